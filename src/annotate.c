@@ -0,0 +1,532 @@
+/**\file    annotate.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A cache of the per-address annotations printed by the
+ *   `dump_countries*()`, `dump_IANA*()`, `dump_ASN*()` and
+ *   `dump_DNSBL*()` functions in dump.c.
+ *
+ * A program receiving many packets from the same peer would otherwise
+ * do a geoip, IP2Location, IANA, ASN and DNSBL lookup of the same address
+ * for each traced `recvfrom()`. Now `annotate_get()` resolves all of these
+ * together on the first call for an address. Later calls within
+ * `g_cfg.annotate_ttl` seconds are a single probe in this table.
+ *
+ * The table is split into `ANNOTATE_SHARDS` shards on the hash of the
+ * address; each with its own lock. A shard is a set-associative array of
+ * `ANNOTATE_SETS` sets with `ANNOTATE_WAYS` entries in each. An address can
+ * only be in one set; when a set is full, the oldest entry is replaced.
+ * Hence the memory used is bounded by `ANNOTATE_MAX_ENTRIES` entries.
+ *
+ * The lookups are done without holding a lock. An entry is copied in or
+ * out while holding the lock; a caller never has a pointer into a shard.
+ *
+ * For the many addresses from e.g. `getaddrinfo()`, `annotate_prefetch()`
+ * looks up the countries of all of them with one `geoip_lookup_many()`.
+ *
+ * annotate.c - Part of Wsock-Trace.
+ */
+#include "common.h"
+#include "init.h"
+#include "geoip.h"
+#include "iana.h"
+#include "asn.h"
+#include "dnsbl.h"
+#include "inet_util.h"
+#include "annotate.h"
+
+#define ANNOTATE_SHARD_BITS   4
+#define ANNOTATE_SHARDS       (1 << ANNOTATE_SHARD_BITS)
+#define ANNOTATE_SET_BITS     5
+#define ANNOTATE_SETS         (1 << ANNOTATE_SET_BITS)
+#define ANNOTATE_WAYS         4
+#define ANNOTATE_MAX_ENTRIES  (ANNOTATE_SHARDS * ANNOTATE_SETS * ANNOTATE_WAYS)
+
+/**\struct annotate_entry
+ * An `annotation` and when it was resolved.
+ */
+struct annotate_entry {
+       DWORD      stamp;       /**< `GetTickCount()` when resolved */
+       annotation ann;
+     };
+
+/**\struct annotate_shard
+ * One shard of the table and the statistics for it.
+ */
+struct annotate_shard {
+       CRITICAL_SECTION       lock;
+       struct annotate_entry *set [ANNOTATE_SETS] [ANNOTATE_WAYS];
+       uint64_t               hits;
+       uint64_t               misses;
+       uint64_t               expired;
+       uint64_t               evicted;
+       DWORD                  entries;
+     };
+
+static struct annotate_shard *annotate_tab;
+static DWORD                  annotate_ttl_msec;
+
+/**
+ * `ASN_libloc_print()` prints to a `str_put_func` without any context.
+ * So the text is collected in this buffer while holding `ASN_capture_lock`.
+ */
+static CRITICAL_SECTION ASN_capture_lock;
+static char            *ASN_capture_buf;
+static size_t           ASN_capture_left;
+static int              ASN_capture_calls;
+
+void annotate_init (void)
+{
+  int i;
+
+  InitializeCriticalSection (&ASN_capture_lock);
+
+  if (g_cfg.annotate_ttl <= 0)
+     return;
+
+  annotate_tab = calloc (ANNOTATE_SHARDS, sizeof(*annotate_tab));
+  if (!annotate_tab)
+     return;
+
+  for (i = 0; i < ANNOTATE_SHARDS; i++)
+      InitializeCriticalSectionAndSpinCount (&annotate_tab[i].lock, 1000);
+  annotate_ttl_msec = 1000 * (DWORD)g_cfg.annotate_ttl;
+}
+
+void annotate_exit (void)
+{
+  int i, j, k;
+
+  if (annotate_tab)
+  {
+    for (i = 0; i < ANNOTATE_SHARDS; i++)
+    {
+      for (j = 0; j < ANNOTATE_SETS; j++)
+          for (k = 0; k < ANNOTATE_WAYS; k++)
+              free (annotate_tab[i].set[j][k]);
+      DeleteCriticalSection (&annotate_tab[i].lock);
+    }
+    free (annotate_tab);
+    annotate_tab = NULL;
+  }
+  DeleteCriticalSection (&ASN_capture_lock);
+}
+
+/**
+ * Print the statistics in `trace_report()`.
+ */
+void annotate_report (void)
+{
+  uint64_t hits = 0, misses = 0, expired = 0, evicted = 0;
+  DWORD    entries = 0;
+  int      i;
+
+  if (!annotate_tab)
+     return;
+
+  for (i = 0; i < ANNOTATE_SHARDS; i++)
+  {
+    struct annotate_shard *sh = annotate_tab + i;
+
+    EnterCriticalSection (&sh->lock);
+    hits    += sh->hits;
+    misses  += sh->misses;
+    expired += sh->expired;
+    evicted += sh->evicted;
+    entries += sh->entries;
+    LeaveCriticalSection (&sh->lock);
+  }
+
+  C_printf ("  Address annotations: %s hits, ", qword_str(hits));
+  C_printf ("%s misses (%.1f%% hits), ", qword_str(misses),
+            (hits + misses) ? 100.0 * (double)hits / (double)(hits + misses) : 0.0);
+  C_printf ("%s expired, ", qword_str(expired));
+  C_printf ("%s evicted.\n", qword_str(evicted));
+  C_printf ("    %lu entries, memory: %s bytes.\n", entries,
+            qword_str(sizeof(*annotate_tab) * ANNOTATE_SHARDS + entries * sizeof(struct annotate_entry)));
+}
+
+static uint64_t annotate_hash (const annotation *ann)
+{
+  uint64_t h;
+
+  if (ann->family == AF_INET)
+     h = ann->addr.ip4.s_addr;
+  else
+  {
+    const uint64_t *q = (const uint64_t*) &ann->addr.ip6;
+
+    h = q[0] ^ (q[1] * 0xC2B2AE3D27D4EB4FULL);
+  }
+  h *= 0x9E3779B97F4A7C15ULL;
+  return (h ^ (h >> 29));
+}
+
+static bool annotate_same_addr (const annotation *a, const annotation *b)
+{
+  if (a->family != b->family)
+     return (false);
+  if (a->family == AF_INET)
+     return (a->addr.ip4.s_addr == b->addr.ip4.s_addr);
+  return (memcmp(&a->addr.ip6, &b->addr.ip6, sizeof(a->addr.ip6)) == 0);
+}
+
+static int ASN_capture (const char *str)
+{
+  size_t len = strlen (str);
+
+  ASN_capture_calls++;
+  if (len >= ASN_capture_left)
+     len = ASN_capture_left - 1;
+  memcpy (ASN_capture_buf, str, len);
+  ASN_capture_buf  += len;
+  ASN_capture_left -= len;
+  *ASN_capture_buf = '\0';
+  return ((int)len);
+}
+
+/**
+ * Do the lookups for the `want` parts of `ann` not yet resolved.
+ */
+static void annotate_resolve (annotation *ann, DWORD want)
+{
+  const struct in_addr  *ia4 = (ann->family == AF_INET)  ? &ann->addr.ip4 : NULL;
+  const struct in6_addr *ia6 = (ann->family == AF_INET6) ? &ann->addr.ip6 : NULL;
+
+  want &= ~ann->have;
+
+  if (want & ANNOTATE_GEOIP)
+  {
+    const char     *cc  = geoip_lookup_country (ann->family, &ann->addr, &ann->country_ip2loc);
+    const char     *loc = ia4 ? geoip_get_location_by_ipv4 (ia4) : geoip_get_location_by_ipv6 (ia6);
+    const position *pos = ia4 ? geoip_get_position_by_ipv4 (ia4) : geoip_get_position_by_ipv6 (ia6);
+
+    ann->has_country  = (cc != NULL);
+    ann->has_location = (loc != NULL);
+    ann->has_position = (pos != NULL);
+    str_ncpy (ann->country, cc ? cc : "", sizeof(ann->country));
+    str_ncpy (ann->location, loc ? loc : "", sizeof(ann->location));
+    if (pos)
+         ann->pos = *pos;
+    else memset (&ann->pos, '\0', sizeof(ann->pos));
+  }
+
+  if (want & ANNOTATE_IANA)
+  {
+    if (ia4)
+         ann->iana = iana_find_by_ip4_address (ia4);
+    else ann->iana = iana_find_by_ip6_address (ia6);
+  }
+
+  if (want & ANNOTATE_ASN)
+  {
+    EnterCriticalSection (&ASN_capture_lock);
+    ann->ASN_text[0]  = '\0';
+    ASN_capture_buf   = ann->ASN_text;
+    ASN_capture_left  = sizeof(ann->ASN_text);
+    ASN_capture_calls = 0;
+    ann->ASN_rc       = ASN_libloc_print ("", ia4, ia6, ASN_capture);
+    ann->ASN_printed  = (ASN_capture_calls > 0);
+    LeaveCriticalSection (&ASN_capture_lock);
+  }
+
+  if (want & ANNOTATE_DNSBL)
+  {
+    const char *refs [DNSBL_MAX_REFS];
+    int         num = DNSBL_get_refs (ia4, ia6, refs, DIM(refs));
+
+    if (num > 0)
+         DNSBL_refs_str (refs, num, ann->DNSBL_refs, sizeof(ann->DNSBL_refs));
+    else ann->DNSBL_refs[0] = '\0';
+  }
+  ann->have |= want;
+}
+
+/**
+ * Find a cached entry for `ann->addr` in `sh` with all the `want` parts.
+ * Copy it to `ann` on success.
+ */
+static bool annotate_find (struct annotate_shard *sh, unsigned set, DWORD now, DWORD want, annotation *ann)
+{
+  struct annotate_entry *e;
+  int    i;
+
+  for (i = 0; i < ANNOTATE_WAYS; i++)
+  {
+    e = sh->set [set][i];
+    if (!e || !annotate_same_addr(&e->ann, ann))
+       continue;
+
+    if (now - e->stamp >= annotate_ttl_msec)
+    {
+      sh->expired++;
+      return (false);
+    }
+    if ((e->ann.have & want) != want)
+    {
+      *ann = e->ann;   /* Resolve only the missing parts */
+      return (false);
+    }
+    *ann = e->ann;
+    return (true);
+  }
+  return (false);
+}
+
+/**
+ * Put `ann` in `set` of `sh`. Replace the entry for the same address,
+ * an unused entry or the oldest entry. In that order.
+ */
+static void annotate_store (struct annotate_shard *sh, unsigned set, DWORD now, const annotation *ann)
+{
+  struct annotate_entry **ways = sh->set [set];
+  int    i, oldest = 0;
+
+  for (i = 0; i < ANNOTATE_WAYS; i++)
+  {
+    if (ways[i] && annotate_same_addr(&ways[i]->ann, ann))
+       break;
+  }
+
+  if (i == ANNOTATE_WAYS)
+  {
+    for (i = 0; i < ANNOTATE_WAYS; i++)
+    {
+      if (!ways[i])
+         break;
+      if (now - ways[i]->stamp > now - ways[oldest]->stamp)
+         oldest = i;
+    }
+  }
+
+  if (i == ANNOTATE_WAYS)
+  {
+    i = oldest;
+    sh->evicted++;
+  }
+  else if (!ways[i])
+  {
+    ways[i] = malloc (sizeof(*ways[i]));
+    if (!ways[i])
+       return;
+    sh->entries++;
+  }
+  ways[i]->stamp = now;
+  ways[i]->ann   = *ann;
+}
+
+/**
+ * Count the country of `ann` in the geoip statistics. Done for each
+ * `annotate_get()` that `want` the country; a cache-hit is an address
+ * seen too. The lookups in `annotate_resolve()` and `annotate_prefetch()`
+ * do not count.
+ */
+static void annotate_count (const annotation *ann, DWORD want)
+{
+  if ((want & ANNOTATE_GEOIP) && (ann->have & ANNOTATE_GEOIP) && ann->has_country)
+     geoip_stats_add (ann->family, ann->country, ann->country_ip2loc);
+}
+
+/**
+ * Set the address of `ann` and clear the flags of it.
+ */
+static void annotate_key (annotation *ann, const struct in_addr *ip4, const struct in6_addr *ip6)
+{
+  memset (ann, '\0', offsetof(annotation, country));
+  if (ip4)
+  {
+    ann->family   = AF_INET;
+    ann->addr.ip4 = *ip4;
+  }
+  else
+  {
+    ann->family   = AF_INET6;
+    ann->addr.ip6 = *ip6;
+  }
+}
+
+/**
+ * Add the parts enabled in the config to `want`.
+ */
+static DWORD annotate_want (DWORD want)
+{
+  if (g_cfg.GEOIP.enable)
+     want |= ANNOTATE_GEOIP;
+  if (g_cfg.IANA.enable)
+     want |= ANNOTATE_IANA;
+  if (g_cfg.ASN.enable)
+     want |= ANNOTATE_ASN;
+  if (g_cfg.DNSBL.enable)
+     want |= ANNOTATE_DNSBL;
+  return (want);
+}
+
+static struct annotate_shard *annotate_shard_of (const annotation *ann, unsigned *set)
+{
+  uint64_t hash = annotate_hash (ann);
+
+  *set = (unsigned) (hash >> ANNOTATE_SHARD_BITS) & (ANNOTATE_SETS - 1);
+  return (annotate_tab + (hash & (ANNOTATE_SHARDS - 1)));
+}
+
+/**
+ * Return the `want` parts of the annotation for `ip4` or `ip6` in `ann`.
+ * Other parts enabled in the config are resolved too on a cache-miss.
+ * So the next `annotate_get()` for this address need no lookups.
+ *
+ * \param[in]  ip4   the IPv4 address; or NULL.
+ * \param[in]  ip6   the IPv6 address if `ip4 == NULL`.
+ * \param[in]  want  the `ANNOTATE_x` bits needed.
+ * \param[out] ann   the result.
+ * \retval     true  if it was found in the cache.
+ */
+bool annotate_get (const struct in_addr *ip4, const struct in6_addr *ip6, DWORD want, annotation *ann)
+{
+  struct annotate_shard *sh;
+  unsigned set;
+  DWORD    now, want_caller = want;
+
+  annotate_key (ann, ip4, ip6);
+
+  if (!annotate_tab)
+  {
+    annotate_resolve (ann, want);
+    annotate_count (ann, want_caller);
+    return (false);
+  }
+
+  want = annotate_want (want);
+  sh   = annotate_shard_of (ann, &set);
+  now  = GetTickCount();
+
+  EnterCriticalSection (&sh->lock);
+  if (annotate_find(sh, set, now, want, ann))
+  {
+    sh->hits++;
+    LeaveCriticalSection (&sh->lock);
+    annotate_count (ann, want_caller);
+    return (true);
+  }
+  sh->misses++;
+  LeaveCriticalSection (&sh->lock);
+
+  annotate_resolve (ann, want);
+
+  EnterCriticalSection (&sh->lock);
+  annotate_store (sh, set, now, ann);
+  LeaveCriticalSection (&sh->lock);
+  annotate_count (ann, want_caller);
+  return (false);
+}
+
+/**
+ * Resolve and cache the annotations of many addresses of the same family.
+ * The countries of those not in the cache are looked up together with
+ * `geoip_lookup_many()`. Unless IP2Location must be used for an address.
+ *
+ * The following `annotate_get()` for these addresses are then cache-hits.
+ * These count the countries in the geoip statistics; it is not done here.
+ * Does nothing if the cache is disabled.
+ *
+ * \param[in] family     `AF_INET` or `AF_INET6`.
+ * \param[in] addresses  `num` pointers to a `struct in_addr` or a `struct in6_addr`.
+ * \param[in] num        the number of addresses.
+ */
+void annotate_prefetch (int family, const void **addresses, int num)
+{
+  struct annotate_shard *sh;
+  annotation  *miss;
+  const void **batch_addr;
+  const char **batch_cc;
+  int         *batch_idx;
+  int          i, num_miss = 0, num_batch = 0;
+  bool         use_ip2loc = false;
+  unsigned     set;
+  DWORD        want, now;
+
+  if (!annotate_tab || num <= 0 || (family != AF_INET && family != AF_INET6))
+     return;
+
+  miss       = malloc (num * sizeof(*miss));
+  batch_addr = malloc (num * sizeof(*batch_addr));
+  batch_cc   = malloc (num * sizeof(*batch_cc));
+  batch_idx  = malloc (num * sizeof(*batch_idx));
+  if (!miss || !batch_addr || !batch_cc || !batch_idx)
+     goto quit;
+
+  want = annotate_want (0);
+  now  = GetTickCount();
+
+  for (i = 0; i < num; i++)
+  {
+    annotation *ann = miss + num_miss;
+
+    if (family == AF_INET)
+         annotate_key (ann, (const struct in_addr*)addresses[i], NULL);
+    else annotate_key (ann, NULL, (const struct in6_addr*)addresses[i]);
+
+    sh = annotate_shard_of (ann, &set);
+    EnterCriticalSection (&sh->lock);
+    if (annotate_find(sh, set, now, want, ann))
+       sh->hits++;
+    else
+    {
+      sh->misses++;
+      num_miss++;
+    }
+    LeaveCriticalSection (&sh->lock);
+  }
+
+  if (want & ANNOTATE_GEOIP)
+  {
+    INIT_DB_NEED (INIT_DB_GEOIP);
+    use_ip2loc = (family == AF_INET ? ip2loc_num_ipv4_entries() : ip2loc_num_ipv6_entries()) > 0;
+  }
+
+  /* Collect those a `geoip_get_country_by_ipv4()` or `geoip_get_country_by_ipv6()`
+   * would not find in IP2Location.
+   */
+  for (i = 0; i < num_miss && (want & ANNOTATE_GEOIP); i++)
+  {
+    const annotation      *ann = miss + i;
+    const struct in_addr  *ia4 = (family == AF_INET)  ? &ann->addr.ip4 : NULL;
+    const struct in6_addr *ia6 = (family == AF_INET6) ? &ann->addr.ip6 : NULL;
+
+    if ((ann->have & ANNOTATE_GEOIP) || (use_ip2loc && INET_util_addr_is_global(ia4, ia6)))
+       continue;
+    batch_addr [num_batch]  = ia4 ? (const void*)ia4 : (const void*)ia6;
+    batch_idx [num_batch++] = i;
+  }
+
+  if (num_batch > 0)
+  {
+    geoip_lookup_many (family, batch_addr, num_batch, batch_cc);
+    for (i = 0; i < num_batch; i++)
+    {
+      annotation *ann = miss + batch_idx[i];
+
+      ann->has_country    = (batch_cc[i] != NULL);
+      ann->has_location   = ann->has_position = false;
+      ann->country_ip2loc = false;
+      str_ncpy (ann->country, batch_cc[i] ? batch_cc[i] : "", sizeof(ann->country));
+      ann->location[0] = '\0';
+      memset (&ann->pos, '\0', sizeof(ann->pos));
+      ann->have |= ANNOTATE_GEOIP;
+    }
+  }
+
+  for (i = 0; i < num_miss; i++)
+  {
+    annotate_resolve (miss + i, want);
+    sh = annotate_shard_of (miss + i, &set);
+    EnterCriticalSection (&sh->lock);
+    annotate_store (sh, set, now, miss + i);
+    LeaveCriticalSection (&sh->lock);
+  }
+
+quit:
+  free (miss);
+  free (batch_addr);
+  free (batch_cc);
+  free (batch_idx);
+}
@@ -0,0 +1,57 @@
+/**\file    annotate.h
+ * \ingroup Main
+ *
+ * \brief
+ *   A cache of the geo-IP, IANA, ASN and DNSBL annotations of an address.
+ */
+#ifndef _ANNOTATE_H
+#define _ANNOTATE_H
+
+#include "geoip.h"
+#include "iana.h"
+#include "dnsbl.h"
+
+/**
+ * The parts of an `annotation` to resolve; see `annotate_get()`.
+ */
+#define ANNOTATE_GEOIP  0x01    /**< country, location and position */
+#define ANNOTATE_IANA   0x02    /**< the IANA record */
+#define ANNOTATE_ASN    0x04    /**< the text from `ASN_libloc_print()` */
+#define ANNOTATE_DNSBL  0x08    /**< the SBL references */
+
+/**\struct annotation
+ * Everything printed about one address by the `dump_countries*()`,
+ * `dump_IANA*()`, `dump_ASN*()` and `dump_DNSBL*()` functions.
+ */
+typedef struct annotation {
+        int         family;            /**< `AF_INET` or `AF_INET6` */
+        union {
+          struct in_addr  ip4;
+          struct in6_addr ip6;
+        } addr;                        /**< the address itself */
+        DWORD       have;              /**< the `ANNOTATE_x` parts resolved */
+
+        bool        has_country;       /**< geoip gave a country-code */
+        bool        has_location;      /**< IP2Location gave a city/region */
+        bool        has_position;      /**< IP2Location gave a position */
+        bool        country_ip2loc;    /**< the country came from IP2Location */
+        char        country [3];       /**< the 2 letter country-code */
+        char        location [100];    /**< the "city/region" */
+        position    pos;               /**< the latitude + longitude */
+
+        const IANA_record *iana;       /**< from `iana_find_by_ip4_address()` or `iana_find_by_ip6_address()`. Or NULL */
+
+        bool        ASN_printed;       /**< `ASN_libloc_print()` printed the intro */
+        int         ASN_rc;            /**< and returned this */
+        char        ASN_text [300];    /**< and printed this after the intro */
+
+        char        DNSBL_refs [DNSBL_MAX_REFS * 15];  /**< from `DNSBL_refs_str()`. Or "" if none */
+      } annotation;
+
+extern void annotate_init     (void);
+extern void annotate_exit     (void);
+extern void annotate_report   (void);
+extern bool annotate_get      (const struct in_addr *ip4, const struct in6_addr *ip6, DWORD want, annotation *ann);
+extern void annotate_prefetch (int family, const void **addresses, int num);
+
+#endif  /* _ANNOTATE_H */
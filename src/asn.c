@@ -70,6 +70,8 @@ struct _loc_network {   /* Scraped from '$(LIBLOC_ROOT)/src/network.c' */
      };
 
 static void ASN_bin_close (void);
+static void ASN_libloc_cache_init (void);
+static void ASN_libloc_cache_exit (void);
 
 static int _IN6_IS_ADDR_TEREDO (const struct in6_addr *ip6)
 {
@@ -220,6 +222,7 @@ static void ASN_bin_close (void)
      fclose (libloc.file);
 
   memset (&libloc, '\0', sizeof(libloc));
+  ASN_libloc_cache_exit();
 }
 
 /**
@@ -432,7 +435,9 @@ static void ASN_print_libloc_version (void)
 }
 
 /**
- * A custom libloc logger function used to log to `g_cfg.trace_stream`.
+ * A custom libloc logger function used to log to the trace-output.
+ * Goes through `debug_printf()` like `TRACE()`; never to `g_cfg.trace_stream`
+ * directly. That could be compressed or reopened by the writer-thread.
  */
 static void ASN_libloc_logger (struct loc_ctx *ctx,
                                int             priority,
@@ -442,15 +447,16 @@ static void ASN_libloc_logger (struct loc_ctx *ctx,
                                const char     *format,
                                va_list         args)
 {
-  if (g_cfg.trace_stream)
-  {
-    WORD col = set_color (NULL);  /* Use default console colour */
+  char buf [1000];
+  int  len;
+
+  buf[0] = '\0';
+  len = snprintf (buf, sizeof(buf), "LIBLOC(%d): %s(%u): ", priority, basename(file), line);
+  if (len > -1 && len < sizeof(buf))
+     vsnprintf (buf + len, sizeof(buf) - len, format, args);
+
+  debug_printf (NULL, 0, "%s", buf);
 
-    fprintf (g_cfg.trace_stream, "LIBLOC(%d): %s(%u): ", priority, basename(file), line);
-    vfprintf (g_cfg.trace_stream, format, args);
-    fflush (g_cfg.trace_stream);
-    set_color (&col);            /* Restore active colour */
-  }
   ARGSUSED (ctx);
   ARGSUSED (function);
 }
@@ -556,6 +562,7 @@ static size_t ASN_load_bin_file (const char *file)
    */
   fclose (libloc.file);
   libloc.file = NULL;
+  ASN_libloc_cache_init();
 
   descr   = loc_database_get_description (libloc.db);
   licence = loc_database_get_license (libloc.db);
@@ -595,26 +602,291 @@ static size_t ASN_load_bin_file (const char *file)
  */
 #define ASN_MAX_NAME 250
 
+/**
+ * \def ASN_NET_CACHE_SIZE
+ *   The number of networks in the `ASN_net_cache`.
+ *
+ * \def ASN_NAME_CACHE_SIZE
+ *   The number of AS-names in the `ASN_name_cache`.
+ */
+#define ASN_NET_CACHE_SIZE   1024
+#define ASN_NAME_CACHE_SIZE  512
+
+/**\struct ASN_cache_entry
+ * An element in a `ASN_cache`.
+ */
+struct ASN_cache_entry {
+       uint64 key;
+       int    next;   /**< next in the same bucket; -1 for the end */
+       bool   ref;    /**< set on a hit; cleared by the CLOCK hand */
+       void  *data;   /**< malloc()'ed data for the key; NULL if the entry is free */
+     };
+
+/**\struct ASN_cache
+ * A fixed size hash-table with CLOCK eviction. <br>
+ * Several entries can have the same key; the `match` function given to
+ * `ASN_cache_find()` picks the right one.
+ */
+struct ASN_cache {
+       struct ASN_cache_entry *entry;     /**< `size` entries */
+       int                    *bucket;    /**< `2*size` heads of the bucket chains; -1 for an empty bucket */
+       unsigned                size;
+       unsigned                used;
+       unsigned                hand;      /**< the CLOCK hand */
+       DWORD                   hits, misses, evictions;
+     };
+
+typedef bool (*ASN_cache_match) (const void *data, const void *arg);
+
+static struct ASN_cache ASN_net_cache, ASN_name_cache;
+
+static unsigned ASN_cache_bucket (const struct ASN_cache *cache, uint64 key)
+{
+  return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32) % (2 * cache->size);
+}
+
+static bool ASN_cache_init (struct ASN_cache *cache, unsigned size)
+{
+  unsigned i;
+
+  cache->used   = cache->hand = 0;
+  cache->entry  = calloc (size, sizeof(*cache->entry));
+  cache->bucket = malloc (2 * size * sizeof(*cache->bucket));
+  if (!cache->entry || !cache->bucket)
+  {
+    free (cache->entry);
+    free (cache->bucket);
+    cache->entry  = NULL;
+    cache->bucket = NULL;
+    return (false);
+  }
+  for (i = 0; i < 2 * size; i++)
+      cache->bucket [i] = -1;
+  cache->size = size;
+  return (true);
+}
+
+static void ASN_cache_free (struct ASN_cache *cache)
+{
+  unsigned i;
+
+  for (i = 0; i < cache->used; i++)
+      free (cache->entry[i].data);
+  free (cache->entry);
+  free (cache->bucket);
+  cache->entry  = NULL;
+  cache->bucket = NULL;
+  cache->size = cache->used = 0;
+}
+
+/**
+ * Return the data for `key` where `(*match)(data, arg)` is true.
+ * Or NULL if not found.
+ */
+static void *ASN_cache_find (struct ASN_cache *cache, uint64 key, ASN_cache_match match, const void *arg)
+{
+  int i;
+
+  if (!cache->entry)
+     return (NULL);
+
+  for (i = cache->bucket [ASN_cache_bucket(cache, key)]; i >= 0; i = cache->entry[i].next)
+  {
+    struct ASN_cache_entry *e = cache->entry + i;
+
+    if (e->key == key && (!match || (*match)(e->data, arg)))
+    {
+      e->ref = true;
+      cache->hits++;
+      return (e->data);
+    }
+  }
+  cache->misses++;
+  return (NULL);
+}
+
+/**
+ * Take entry `idx` out of its bucket-chain and free the data.
+ */
+static void ASN_cache_evict (struct ASN_cache *cache, int idx)
+{
+  struct ASN_cache_entry *e = cache->entry + idx;
+  int                    *link = &cache->bucket [ASN_cache_bucket(cache, e->key)];
+
+  while (*link != idx)
+        link = &cache->entry[*link].next;
+  *link = e->next;
+  free (e->data);
+  e->data = NULL;
+  cache->evictions++;
+}
+
+/**
+ * Add the `malloc()`'ed `data` for `key`. The cache takes ownership of it.
+ * When full, the CLOCK hand moves to the first entry with no hit since
+ * the last round, and that entry is reused.
+ */
+static void ASN_cache_add (struct ASN_cache *cache, uint64 key, void *data)
+{
+  struct ASN_cache_entry *e;
+  unsigned                bucket;
+  int                     idx;
+
+  if (!cache->entry)
+  {
+    free (data);
+    return;
+  }
+
+  if (cache->used < cache->size)
+     idx = cache->used++;
+  else
+  {
+    while (cache->entry[cache->hand].ref)
+    {
+      cache->entry [cache->hand].ref = false;
+      cache->hand = (cache->hand + 1) % cache->size;
+    }
+    idx = cache->hand;
+    cache->hand = (cache->hand + 1) % cache->size;
+    ASN_cache_evict (cache, idx);
+  }
+
+  bucket = ASN_cache_bucket (cache, key);
+  e = cache->entry + idx;
+  e->key  = key;
+  e->data = data;
+  e->ref  = false;
+  e->next = cache->bucket [bucket];
+  cache->bucket [bucket] = idx;
+}
+
+static void ASN_libloc_cache_init (void)
+{
+  if (!ASN_net_cache.entry)
+     ASN_cache_init (&ASN_net_cache, ASN_NET_CACHE_SIZE);
+  if (!ASN_name_cache.entry)
+     ASN_cache_init (&ASN_name_cache, ASN_NAME_CACHE_SIZE);
+}
+
+/**
+ * Called when the libloc database is closed; the cached data is from it.
+ * Keep the counters for `ASN_report()`.
+ */
+static void ASN_libloc_cache_exit (void)
+{
+  ASN_cache_free (&ASN_net_cache);
+  ASN_cache_free (&ASN_name_cache);
+}
+
+/**\struct ASN_net
+ * A network (or the absence of one) returned by `loc_database_lookup()`.
+ * Kept in the `ASN_net_cache`.
+ */
+struct ASN_net {
+       struct in6_addr first;      /**< The first address; IPv4-mapped for an IPv4 network */
+       struct in6_addr last;       /**< The last address */
+       int             prefix;     /**< The IPv6 prefix-length */
+       uint32_t        AS_num;
+       bool            found;      /**< false if no network; then `first` and `last` is the looked up address */
+       bool            is_anycast;
+       bool            is_anon_proxy;
+       bool            is_sat_provider;
+       bool            is_hostile;
+     };
+
+/**
+ * The key for the `ASN_net_cache` is the /24 (IPv4) or /48 (IPv6) of an address.
+ * The networks from libloc are rarely smaller than that. A network larger than
+ * that gets an entry for each /24 or /48 an address was looked up in.
+ */
+static uint64 ASN_net_key (const struct in6_addr *addr, bool is_ip4)
+{
+  const BYTE *b = addr->s6_bytes;
+
+  if (is_ip4)
+     return ((uint64)4 << 56) | ((uint64)b[12] << 16) | ((uint64)b[13] << 8) | b[14];
+  return ((uint64)6 << 56) |
+         ((uint64)b[0] << 40) | ((uint64)b[1] << 32) | ((uint64)b[2] << 24) |
+         ((uint64)b[3] << 16) | ((uint64)b[4] << 8)  | b[5];
+}
+
+/**
+ * `ASN_cache_find()` helper; is the address `arg` in the network `data`?
+ */
+static bool ASN_net_match (const void *data, const void *arg)
+{
+  const struct ASN_net *net = data;
+
+  return (memcmp(&net->first, arg, sizeof(net->first)) <= 0 &&
+          memcmp(arg, &net->last, sizeof(net->last)) <= 0);
+}
+
+/**
+ * Look up the AS-name for `AS_num` in the `ASN_name_cache` or in libloc.
+ * Returns NULL if it has no name.
+ */
+static const char *ASN_libloc_name (uint32_t AS_num)
+{
+  struct loc_as *as = NULL;
+  const char    *name;
+  char          *copy;
+  int            rc;
+
+  name = ASN_cache_find (&ASN_name_cache, AS_num, NULL, NULL);
+  if (name)
+     return (*name ? name : NULL);
+
+  rc = loc_database_get_as (libloc.db, &as, AS_num);
+  if (rc == 0 && as)
+       name = loc_as_get_name (as);
+  else TRACE (2, "No data for AS%u, err: %d/%s.\n", AS_num, -rc, strerror(-rc));
+
+  /* A "" for no name; then there's no need to ask libloc again.
+   */
+  copy = strdup (name ? name : "");
+  if (as)
+     loc_as_unref (as);
+
+  if (!copy)
+     return (NULL);
+  ASN_cache_add (&ASN_name_cache, AS_num, copy);
+  return (*copy ? copy : NULL);
+}
+
+/**
+ * Fill `_net` from a `loc_network`.
+ */
+static void libloc_get_net (struct loc_network *net, struct ASN_net *_net)
+{
+  const struct _loc_network *lnet = (const struct _loc_network*) net;
+
+  memcpy (&_net->first, &lnet->first_address, sizeof(_net->first));
+  memcpy (&_net->last, &lnet->last_address, sizeof(_net->last));
+  _net->prefix          = lnet->prefix;
+  _net->AS_num          = loc_network_get_asn (net);
+  _net->found           = true;
+  _net->is_anycast      = (loc_network_has_flag (net, LOC_NETWORK_FLAG_ANYCAST) != 0);
+  _net->is_anon_proxy   = (loc_network_has_flag (net, LOC_NETWORK_FLAG_ANONYMOUS_PROXY) != 0);
+  _net->is_sat_provider = (loc_network_has_flag (net, LOC_NETWORK_FLAG_SATELLITE_PROVIDER) != 0);
+  _net->is_hostile      = (loc_network_has_flag (net, LOC_NETWORK_FLAG_DROP) != 0);
+}
+
 /**
  * Internal function called from `ASN_libloc_print()`.
  */
-static int libloc_handle_net (struct loc_network    *net,
+static int libloc_handle_net (const struct ASN_net  *net,
                               const struct in_addr  *ip4,
                               const struct in6_addr *ip6,
                               str_put_func           func)
 {
-  struct loc_as       *as = NULL;
-  struct _loc_network *_net = (struct _loc_network*) net;
-  char                 _net_name [MAX_IP6_SZ+1+4];
-  int                  _prefix = _net->prefix;
-  const char          *net_name;
-  const char          *remark;
-  const char          *AS_name;
-  char                 attributes [100] = "";
-  char                 print_buf [1000];
-  int                  rc = 0;
-  uint32_t             AS_num;
-  bool                 is_anycast, is_anon_proxy, is_sat_provider, is_hostile;
+  char        _net_name [MAX_IP6_SZ+1+4];
+  int         _prefix = net->prefix;
+  const char *net_name;
+  const char *remark;
+  const char *AS_name = NULL;
+  char        attributes [100] = "";
+  char        print_buf [1000];
 
 #if 0
   /** \todo: hopefully, some day this could be possible in 'libloc'
@@ -626,47 +898,25 @@ static int libloc_handle_net (struct loc_network    *net,
   if (ip4)
      _prefix -= 96;
 
-  snprintf (_net_name, sizeof(_net_name), "%s/%d", INET_addr_ntop2(AF_INET6, &_net->first_address), _prefix);
+  snprintf (_net_name, sizeof(_net_name), "%s/%d", INET_addr_ntop2(AF_INET6, &net->first), _prefix);
 
   if (ip4)
        net_name = _net_name + strlen("::ffff:");
   else net_name = _net_name;
 
-  AS_num = loc_network_get_asn (net);
-
-  is_anycast      = (loc_network_has_flag (net, LOC_NETWORK_FLAG_ANYCAST) != 0);
-  is_anon_proxy   = (loc_network_has_flag (net, LOC_NETWORK_FLAG_ANONYMOUS_PROXY) != 0);
-  is_sat_provider = (loc_network_has_flag (net, LOC_NETWORK_FLAG_SATELLITE_PROVIDER) != 0);
-  is_hostile      = (loc_network_has_flag (net, LOC_NETWORK_FLAG_DROP) != 0);
-#if 0
-  is_tor_exit     = (loc_network_has_flag (net, LOC_NETWORK_FLAG_TOR_EXIT) != 0);
-  is_bogon        = (loc_network_has_flag (net, LOC_NETWORK_FLAG_BOGON) != 0);
-#endif
-
   /* Since a Teredo address is valid here, maybe other blocks have an AS_num too?
    */
   INET_util_addr_is_special (ip4, ip6, &remark);
 
-  if (AS_num > 0)
+  if (net->AS_num > 0)
   {
     g_num_asn++;   /**< \todo This should be a count of unique ASN */
-    rc = loc_database_get_as (libloc.db, &as, AS_num);
+    AS_name = ASN_libloc_name (net->AS_num);
   }
 
-  if (rc == 0 && as)
-  {
-    AS_name = as ? loc_as_get_name (as) : NULL;
-    if (!AS_name)
-         AS_name = "<Unknown>";
-    else g_num_as_names++;   /**< \todo This should be a count of unique AS-names */
-    rc = 1;
-  }
-  else
-  {
-    TRACE (2, "No data for AS%u, err: %d/%s.\n", AS_num, -rc, strerror(-rc));
-    AS_name = "<unknown>";
-    rc = 1;
-  }
+  if (AS_name)
+       g_num_as_names++;   /**< \todo This should be a count of unique AS-names */
+  else AS_name = "<unknown>";
 
   if (remark)
   {
@@ -674,23 +924,19 @@ static int libloc_handle_net (struct loc_network    *net,
     strcat (attributes, remark);
   }
 
-  if (is_anycast)
+  if (net->is_anycast)
      strcat (attributes, ", Anycast");
-  if (is_anon_proxy)
+  if (net->is_anon_proxy)
      strcat (attributes, ", Anonymous Proxy");
-  if (is_sat_provider)
+  if (net->is_sat_provider)
      strcat (attributes, ", Satellite Provider");
-  if (is_hostile)
+  if (net->is_hostile)
      strcat (attributes, ", Hostile");
 
   snprintf (print_buf, sizeof(print_buf), "%u, name: %.*s, net: %s%s",
-            AS_num, ASN_MAX_NAME-30, AS_name, net_name, attributes);
+            net->AS_num, ASN_MAX_NAME-30, AS_name, net_name, attributes);
   (*func) (print_buf);
-
-  if (as)
-     loc_as_unref (as);
-
-  return (rc);
+  return (1);
 }
 
 /**
@@ -712,9 +958,9 @@ static int libloc_handle_net (struct loc_network    *net,
  * This function does nothing for top-level networks like from IANA, RIPE etc.
  * 'libloc' only have information on RIRs (Regional Internet Registries).
  *
- * \todo
- *  Create a cache for this since calling `loc_database_lookup()` can
- *  sometimes be slow.
+ * Since calling `loc_database_lookup()` can sometimes be slow, the network
+ * found (or not found) is kept in the `ASN_net_cache`. Another address in the
+ * same network and /24 (or /48) does not need libloc.
  */
 static int __ASN_libloc_print (const char            *intro,
                                const struct in_addr  *ip4,
@@ -722,8 +968,10 @@ static int __ASN_libloc_print (const char            *intro,
                                str_put_func           func)
 {
   struct loc_network *net = NULL;
+  struct ASN_net     *cached;
   struct in6_addr     addr;
   const  char        *addr_str = "?";
+  uint64              key;
   int                 rc, save, ip6_teredo;
 
   if (!libloc.db)
@@ -775,51 +1023,47 @@ static int __ASN_libloc_print (const char            *intro,
 
   (*func) (intro);
 
-#if 0
-  /**
-   * \todo Search the cached ASN-list first (sorted on net?)
-   */
-  if (ASN_entries)
+  key = ASN_net_key (&addr, ip4 != NULL);
+  cached = ASN_cache_find (&ASN_net_cache, key, ASN_net_match, &addr);
+  if (!cached)
   {
-    const struct ASN_record *asn;
+    cached = calloc (1, sizeof(*cached));
+    if (!cached)
+    {
+      g_cfg.trace_level = save;
+      return (0);
+    }
 
-    g_num_compares = 0;
-    asn = smartlist_bsearch (ASN_entries, &rec, ASN_compare_on_net);
-    if (asn)
-       rc = libloc_handle_net (NULL, asn, ip4, ip6, func);
+    rc = loc_database_lookup (libloc.db, &addr, &net);
+    if (rc == 0 && net)
+    {
+      libloc_get_net (net, cached);
+      loc_network_unref (net);
+    }
+    else
+    {
+      /* A negative lookup; only for this address.
+       */
+      TRACE (2, "No data for address: %s, err: %d/%s.\n", addr_str, -rc, strerror(-rc));
+      cached->first = cached->last = addr;
+    }
+    ASN_cache_add (&ASN_net_cache, key, cached);
   }
-  else
-#endif
 
-  rc = loc_database_lookup (libloc.db, &addr, &net);
-  if (rc == 0 && net)
-  {
-    rc = libloc_handle_net (net, ip4, ip6, func);
-    loc_network_unref (net);
-  }
+  if (cached->found)
+     rc = libloc_handle_net (cached, ip4, ip6, func);
   else
   {
     (*func) ("<no info>");
-    TRACE (2, "No data for address: %s, err: %d/%s.\n", addr_str, -rc, strerror(-rc));
     rc = 0;
   }
 
 #if 0
-  /**
-   * \todo
-   * Add this to the ASN-list (sorted on net?)
-   * Add negative lookups also; no `net` or `AS_num` found.
-   */
-  if (rc)
-  {
-    smartlist_insert (ASN_entries, at_sorted_pos, asn);
-
   /**
    * \todo
    * Check if the resulting network is a "Bogon".
    * Ref: https://en.wikipedia.org/wiki/Bogon_filtering
    */
-  }
 #endif
 
   /* Restore trace-level
@@ -830,6 +1074,8 @@ static int __ASN_libloc_print (const char            *intro,
 
 int ASN_libloc_print (const char *intro, const struct in_addr *ip4, const struct in6_addr *ip6, str_put_func print_func)
 {
+  INIT_DB_NEED (INIT_DB_ASN);
+
   if (!print_func)
      print_func = C_puts;
 
@@ -848,6 +1094,8 @@ void ASN_print (const char *intro, const struct IANA_record *iana, const struct
 {
   const struct ASN_record *rec;
 
+  INIT_DB_NEED (INIT_DB_ASN);
+
   if (ip6 || !ASN_entries)
      return;
 
@@ -985,6 +1233,10 @@ void ASN_report (void)
 {
   C_printf ("\n  ASN statistics:\n"
             "    Got %lu ASN-numbers, %lu AS-names.\n", g_num_asn, g_num_as_names);
+  C_printf ("    Network cache: %lu hits, %lu misses, %lu evictions.\n",
+            ASN_net_cache.hits, ASN_net_cache.misses, ASN_net_cache.evictions);
+  C_printf ("    AS-name cache: %lu hits, %lu misses, %lu evictions.\n",
+            ASN_name_cache.hits, ASN_name_cache.misses, ASN_name_cache.evictions);
 }
 
 /*
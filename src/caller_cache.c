@@ -0,0 +1,245 @@
+/**\file    caller_cache.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A cache of the callers formatted by `StackWalkShow()`.
+ *
+ * With `trace_caller = 1`, `get_caller()` in wsock_trace.c resolves the
+ * return address of each traced call with the DbgHelp functions and
+ * formats it as e.g. `"foo.c(123) (main+17)"`. A program calling `recv()`
+ * in a loop would do that for the same address again and again.
+ * Now the formatted string is resolved once and kept in this table.
+ *
+ * An open-addressing table with linear probing of `CALLER_CACHE_SLOTS`
+ * slots. A slot is never changed once it is used; the strings are copied
+ * into an arena of `CALLER_ARENA_SIZE` byte blocks. Hence a returned string
+ * stays valid until `caller_cache_exit()`.
+ *
+ * A lookup is done without holding a lock. `caller_cache_add()` holds a lock
+ * and sets the address in a slot last; after the string is set.
+ * When 3/4 of the slots are used, nothing more is added.
+ *
+ * caller_cache.c - Part of Wsock-Trace.
+ */
+#include "common.h"
+#include "init.h"
+#include "caller_cache.h"
+
+#define CALLER_CACHE_BITS   12
+#define CALLER_CACHE_SLOTS  (1 << CALLER_CACHE_BITS)
+#define CALLER_CACHE_MAX    (3 * CALLER_CACHE_SLOTS / 4)
+#define CALLER_ARENA_SIZE   (16*1024)
+
+/*
+ * A volatile read has acquire semantics on x86 and x64 with MSVC.
+ * Not so on ARM; it needs a barrier between reading the address
+ * and reading the string.
+ */
+#if defined(_M_ARM) || defined(_M_ARM64)
+  #define CALLER_ACQUIRE()  MemoryBarrier()
+#else
+  #define CALLER_ACQUIRE()  ((void)0)
+#endif
+
+/**\struct caller_slot
+ * A slot; a free one has `addr == 0`.
+ */
+struct caller_slot {
+       volatile ULONG_PTR addr;
+       const char        *str;
+     };
+
+/**\struct caller_arena
+ * A block of strings; followed by `size` bytes.
+ */
+struct caller_arena {
+       struct caller_arena *next;
+       size_t               size;
+       size_t               used;
+     };
+
+static struct caller_slot  *caller_tab;
+static struct caller_arena *caller_arena;
+static CRITICAL_SECTION     caller_lock;
+static DWORD                caller_entries;
+static uint64               caller_memory;
+static bool                 caller_full;
+static volatile LONG64      caller_hits;
+static volatile LONG64      caller_misses;
+
+static DWORD caller_hash (ULONG_PTR addr)
+{
+  uint64 h = (uint64)addr * U64_SUFFIX(0x9E3779B97F4A7C15);
+
+  return (DWORD) (h >> (64 - CALLER_CACHE_BITS));
+}
+
+/**
+ * Copy `str` into the arena.
+ * A string longer than `CALLER_ARENA_SIZE` gets a block of it's own.
+ */
+static const char *caller_arena_strdup (const char *str)
+{
+  struct caller_arena *a = caller_arena;
+  size_t len = strlen (str) + 1;
+  char  *p;
+
+  if (!a || a->used + len > a->size)
+  {
+    size_t size = max (len, CALLER_ARENA_SIZE);
+
+    a = malloc (sizeof(*a) + size);
+    if (!a)
+       return (NULL);
+    a->size = size;
+    a->used = 0;
+
+    /* Keep a partly used block at the head unless this one is larger.
+     */
+    if (caller_arena && size == len)
+    {
+      a->next = caller_arena->next;
+      caller_arena->next = a;
+    }
+    else
+    {
+      a->next = caller_arena;
+      caller_arena = a;
+    }
+    caller_memory += sizeof(*a) + size;
+  }
+  p = (char*) (a + 1) + a->used;
+  memcpy (p, str, len);
+  a->used += len;
+  return (p);
+}
+
+void caller_cache_init (void)
+{
+  if (caller_tab)
+     return;
+
+  caller_tab = calloc (CALLER_CACHE_SLOTS, sizeof(*caller_tab));
+  if (!caller_tab)
+     return;
+
+  InitializeCriticalSectionAndSpinCount (&caller_lock, 1000);
+  caller_entries = 0;
+  caller_memory  = CALLER_CACHE_SLOTS * sizeof(*caller_tab);
+  caller_full    = false;
+  caller_hits    = caller_misses = 0;
+}
+
+void caller_cache_exit (void)
+{
+  struct caller_arena *a, *next;
+
+  if (!caller_tab)
+     return;
+
+  for (a = caller_arena; a; a = next)
+  {
+    next = a->next;
+    free (a);
+  }
+  caller_arena = NULL;
+  free (caller_tab);
+  caller_tab = NULL;
+  DeleteCriticalSection (&caller_lock);
+}
+
+/**
+ * Return the cached string for the return address `addr`.
+ * Or `NULL` if not found (or the cache is not initialised).
+ */
+const char *caller_cache_get (ULONG_PTR addr)
+{
+  DWORD i, n;
+
+  if (!caller_tab || addr == 0)
+     return (NULL);
+
+  i = caller_hash (addr);
+  for (n = 0; n < CALLER_CACHE_SLOTS; n++)
+  {
+    const struct caller_slot *slot = caller_tab + i;
+    ULONG_PTR a = slot->addr;
+
+    if (a == 0)
+       break;
+    if (a == addr)
+    {
+      CALLER_ACQUIRE();
+      InterlockedIncrement64 (&caller_hits);
+      return (slot->str);
+    }
+    i = (i + 1) & (CALLER_CACHE_SLOTS - 1);
+  }
+  InterlockedIncrement64 (&caller_misses);
+  return (NULL);
+}
+
+/**
+ * Add a copy of `str` for the return address `addr`.
+ * Return the copy. Or `NULL` if the cache is full; then the caller
+ * must use it's own `str`.
+ */
+const char *caller_cache_add (ULONG_PTR addr, const char *str)
+{
+  const char *ret = NULL;
+  DWORD       i;
+
+  if (!caller_tab || addr == 0 || caller_full)
+     return (NULL);
+
+  EnterCriticalSection (&caller_lock);
+
+  i = caller_hash (addr);
+  while (caller_tab[i].addr)
+  {
+    if (caller_tab[i].addr == addr)   /* Added by another thread */
+    {
+      ret = caller_tab[i].str;
+      goto quit;
+    }
+    i = (i + 1) & (CALLER_CACHE_SLOTS - 1);
+  }
+
+  if (caller_entries >= CALLER_CACHE_MAX)
+  {
+    TRACE (2, "caller_cache is full (%lu entries).\n", caller_entries);
+    caller_full = true;
+    goto quit;
+  }
+
+  ret = caller_arena_strdup (str);
+  if (ret)
+  {
+    caller_tab[i].str = ret;
+    InterlockedExchangePointer ((PVOID volatile*)&caller_tab[i].addr, (PVOID)addr);
+    caller_entries++;
+  }
+
+quit:
+  LeaveCriticalSection (&caller_lock);
+  return (ret);
+}
+
+void caller_cache_report (void)
+{
+  uint64 hits, misses;
+
+  if (!caller_tab)
+     return;
+
+  hits   = (uint64) caller_hits;
+  misses = (uint64) caller_misses;
+  if (hits + misses == 0)
+     return;
+
+  C_printf ("  Caller cache: %s hits, ", qword_str(hits));
+  C_printf ("%s misses (%.1f%% hits).\n", qword_str(misses),
+            100.0 * (double)hits / (double)(hits + misses));
+  C_printf ("    %lu entries, memory: %s bytes%s.\n", caller_entries,
+            qword_str(caller_memory), caller_full ? " (full)" : "");
+}
@@ -0,0 +1,16 @@
+/**\file    caller_cache.h
+ * \ingroup Main
+ *
+ * \brief
+ *   A cache of the formatted callers from `StackWalkShow()` keyed on the return address.
+ */
+#ifndef _CALLER_CACHE_H
+#define _CALLER_CACHE_H
+
+extern void        caller_cache_init   (void);
+extern void        caller_cache_exit   (void);
+extern void        caller_cache_report (void);
+extern const char *caller_cache_get    (ULONG_PTR addr);
+extern const char *caller_cache_add    (ULONG_PTR addr, const char *str);
+
+#endif  /* _CALLER_CACHE_H */
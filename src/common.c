@@ -22,6 +22,11 @@
 #include "smartlist.h"
 #include "init.h"
 #include "dump.h"
+#include "trace_ring.h"
+#include "trace_bin.h"
+#include "trace_gz.h"
+#include "sock_table.h"
+#include "path_cache.h"
 
 #ifndef WSA_QOS_EUNKOWNPSOBJ
 #define WSA_QOS_EUNKOWNPSOBJ  (WSABASEERR + 1024)
@@ -46,7 +51,7 @@ char *set_program_name (const char *argv0)
  * Keep a cache of socket-values and their associated data
  * from `socket()` and `accept()`.
  */
-static smartlist_t *sock_list = NULL;
+static sock_table *sock_list = NULL;
 
 /**
  * A mapping table of `"\\device\\harddiskvolume1\\x"` to paths.
@@ -65,107 +70,78 @@ static void device_to_paths_map_remove_all (void)
   device_to_paths_map = NULL;
 }
 
-/**
- * \typedef sock_list_entry
- * The structure for remembering a socket's lifetime.
- *
- * \todo: options from `setsockopt()` should be added here.
- */
-typedef struct sock_list_entry {
-        SOCKET sock;        /**< the socket-value */
-        int    family;      /**< the address family; AF_INET, AF_INET6, AF_UNIX */
-        int    type;        /**< the procotol type; SOCK_STREAM, SOCK_DGRAM, SOCK_RAW, SOCK_RDM, SOCK_SEQPACKET */
-        int    protocol;    /**< the protocol number; IPPROTO_IP, etc. */
-      } sock_list_entry;
-
 void sock_list_add (SOCKET sock, int family, int type, int protocol)
 {
-  struct sock_list_entry *se;
+  sock_info     si;
+  LARGE_INTEGER now;
 
   if (g_cfg.trace_level <= 0 || !sock_list)
      return;
 
-  se = malloc (sizeof(*se));
-  if (!se)
-     return;
-
-  se->sock     = sock;
-  se->family   = family;
-  se->type     = type;
-  se->protocol = protocol;
-  smartlist_add (sock_list, se);
+  QueryPerformanceCounter (&now);
+  memset (&si, '\0', sizeof(si));
+  si.sock     = sock;
+  si.family   = family;
+  si.type     = type;
+  si.protocol = protocol;
+  si.created  = now.QuadPart;
+  sock_table_add (sock_list, &si);
 }
 
-void sock_list_remove (SOCKET sock)
+/**
+ * Remove `sock` from the cache.
+ * Return what was known about it in `info` (if not NULL).
+ */
+bool sock_list_remove (SOCKET sock, sock_info *info)
 {
-  int i, max;
-
   if (g_cfg.trace_level <= 0 || !sock_list)
-     return;
-
-  max = smartlist_len (sock_list);
-  for (i = 0; i < max; i++)
-  {
-    struct sock_list_entry *se = smartlist_get (sock_list, i);
-
-    if (se && sock == se->sock)
-    {
-      free (se);
-      smartlist_del_keeporder (sock_list, i);
-      break;
-    }
-  }
+     return (false);
+  return sock_table_remove (sock_list, sock, info);
 }
 
 static void sock_list_remove_all (void)
 {
-  smartlist_wipe (sock_list, free);
+  sock_table_free (sock_list);
   sock_list = NULL;
 }
 
 int sock_list_type (SOCKET sock, int *family, int *protocol)
 {
-  int i, max;
+  sock_info si;
 
-  if (g_cfg.trace_level <= 0 || !sock_list)
-     return  (-1);
+  if (g_cfg.trace_level <= 0 || !sock_list || !sock_table_get(sock_list, sock, &si))
+     return (-1);
 
-  max = smartlist_len (sock_list);
-  for (i = 0; i < max; i++)
-  {
-    const struct sock_list_entry *se = smartlist_get (sock_list, i);
+  if (family)
+     *family = si.family;
+  if (protocol)
+     *protocol = si.protocol;
+  return (si.type);
+}
 
-    if (se && sock == se->sock)
-    {
-      if (family)
-         *family = se->family;
-      if (protocol)
-         *protocol = se->protocol;
-      return (se->type);
-    }
-  }
-  return (-1);
+/**
+ * Add to the byte-counters of `sock`.
+ */
+void sock_list_count (SOCKET sock, uint64_t recv, uint64_t sent)
+{
+  if (g_cfg.trace_level > 0 && sock_list)
+     sock_table_count (sock_list, sock, recv, sent);
 }
 
 /*
  * A cache of file-names with true casing as returned from
- * 'GetLongPathName()'. Use a 32-bit CRC value to lookup an
- * entry in fname_cache_get().
+ * 'GetLongPathName()'. Keyed on the file-name as given to
+ * `shorten_path()`. The memory for it is bounded by
+ * `FNAME_CACHE_MAX_BYTES`; when that is used, new file-names
+ * are not shortened.
  */
-struct file_name_entry {
-       char  *orig_name;
-       char  *real_name;
-       DWORD  crc32;
-     };
+#define FNAME_CACHE_MAX_BYTES  (4*1024*1024)
 
-static smartlist_t *fname_list = NULL;
-static const char  *fname_cache_get (const char *fname);
+static path_cache  *fname_cache = NULL;
 static const char  *fname_cache_add (const char *fname);
 static void         fname_cache_free (void);
 static void         fname_cache_dump (void);
 
-static DWORD crc_bytes (const char *buf, size_t len);
-
 #define TRACE_BUF_SIZE (2*1024)
 
 /*
@@ -177,12 +153,62 @@ static char  C_buf [TRACE_BUF_SIZE];
 static bool C_tilde_escape = true;
 static bool C_get_color = false;
 
+/*
+ * For `g_cfg.trace_async`:
+ */
+#define C_WRITER_BUF_SIZE   (64*1024)  /* Batch up to this much per write */
+#define C_WRITER_MSEC       20         /* Max time a record waits in a ring */
+#define C_WRITER_WAKE_PCT   50         /* Wake the writer when a ring is this full */
+#define C_WRITER_EXIT_MSEC  1000       /* Max time to wait for the writer at exit */
+
+static bool          C_async = false;
+static trace_rings   C_rings;
+static HANDLE        C_writer_thr;
+static HANDLE        C_writer_wake;     /* Auto-reset event to wake the writer */
+static HANDLE        C_writer_done;     /* Set when the writer is finished */
+static volatile LONG C_writer_stop;
+static char         *C_writer_buf;
+static size_t        C_writer_len;
+
+static void C_async_exit (void);
+
+/*
+ * For `g_cfg.trace_compress`:
+ */
+static trace_gz *C_gz;
+static DWORD     C_gz_synced;    /* `GetTickCount()` at last sync-flush */
+
+static void C_compress_sync (bool force);
+static void C_compress_exit (void);
+
+/*
+ * For `g_cfg.trace_rotate_size` and `g_cfg.trace_rotate_time`:
+ */
+#define C_ROTATE_EXIT_MSEC  10000      /* Max time to wait for a compression at exit */
+
+static bool    C_rotate = false;
+static char   *C_rotate_fname;         /* Full path of the trace-file */
+static time_t  C_rotate_start;         /* When the current trace-file was started */
+static HANDLE  C_rotate_thr;           /* Thread compressing the last old trace-file */
+static HANDLE  C_rotate_done;          /* Set when that thread is finished */
+
+static void C_rotate_check (void);
+static void C_rotate_exit (void);
+
+/*
+ * With `C_gz` or `C_rotate`, the writer-thread and a thread without a ring
+ * can both write to `g_cfg.trace_stream`. And the writer-thread can reopen it.
+ * No `TRACE()` while holding this; `TRACE()` can lock it too.
+ */
+static CRITICAL_SECTION C_file_crit;
+
 void common_init (void)
 {
   C_tilde_escape = true;
   C_ptr = C_buf;
   C_end = C_ptr + TRACE_BUF_SIZE - 1;
-  sock_list = smartlist_new();
+  InitializeCriticalSection (&C_file_crit);
+  sock_list = sock_table_new();
   device_to_paths_map = smartlist_new();
 
   /* Explicitly set UTF-8 locale. Try multiple locale formats
@@ -207,6 +233,10 @@ void common_exit (void)
   fname_cache_free();
   sock_list_remove_all();
   device_to_paths_map_remove_all();
+  C_async_exit();
+  C_rotate_exit();
+  C_compress_exit();
+  DeleteCriticalSection (&C_file_crit);
   C_ptr = C_end = NULL;
 }
 
@@ -1172,7 +1202,7 @@ char *fix_drive (char *path)
  */
 const char *shorten_path (const char *path)
 {
-  const char *real_name = fname_cache_get (path);
+  const char *real_name = fname_cache ? path_cache_get (fname_cache, path) : NULL;
 
   if (!real_name)
   {
@@ -1192,82 +1222,58 @@ const char *shorten_path (const char *path)
   return (real_name);
 }
 
-static const char *fname_cache_get (const char *fname)
-{
-  const struct file_name_entry *fe;
-  DWORD crc32 = crc_bytes (fname, strlen(fname));
-  int   i, max;
-
-  if (!fname_list)
-  {
-    fname_list = smartlist_new();
-    return (NULL);
-  }
-  max = smartlist_len (fname_list);
-  for (i = 0; i < max; i++)
-  {
-    fe = smartlist_get (fname_list, i);
-    if (crc32 == fe->crc32)
-       return (fe->real_name ? fe->real_name : fe->orig_name);
-  }
-  return (NULL);
-}
-
 /**
  * Add a filename to the cache.
+ * The value is the true casing of it with `/` slashes. Or just
+ * the slashes fixed if `GetLongPathName()` fails.
  */
 static const char *fname_cache_add (const char *fname)
 {
-  struct file_name_entry *fn;
-  size_t fn_len = strlen (fname);
-  char   buf [_MAX_PATH];
+  char buf [_MAX_PATH];
 
-  fn = malloc (sizeof(*fn) + fn_len + 1);
-  if (!fn)
+  if (!fname_cache)
+  {
+    fname_cache = path_cache_new (FNAME_CACHE_MAX_BYTES);
+    if (!fname_cache)
+       return (NULL);
+  }
+  if (path_cache_full(fname_cache))
      return (NULL);
 
-  fn->crc32     = crc_bytes (fname, fn_len);
-  fn->orig_name = strcpy ((char*)(fn+1), fname);
-  str_replace ('\\', '/', fn->orig_name);
-
   if (GetLongPathName(fname, buf, sizeof(buf)))
-  {
-    fn->real_name = str_replace ('\\', '/', strdup(buf));
-    fix_drive (fn->real_name);
-  }
+     fix_drive (buf);
   else
-    fn->real_name = NULL;
+     str_ncpy (buf, fname, sizeof(buf));
 
-  smartlist_add (fname_list, fn);
-  return (fn->real_name ? fn->real_name : fn->orig_name);
+  return path_cache_add (fname_cache, fname, str_replace('\\', '/', buf));
 }
 
-static void fname_cache_dump (void)
+static void fname_cache_dump_one (const char *orig_name, const char *real_name, uint64_t hash, void *arg)
 {
-  int i, max = fname_list ? smartlist_len (fname_list) : 0;
-
-  for (i = 0; i < max; i++)
-  {
-    const struct file_name_entry *fn = smartlist_get (fname_list, i);
+  int *i = (int*) arg;
 
-    C_printf ("%2d: orig: '%s'\n"
-              "    real: '%s',   CRC32: 0x%08lX\n",
-              i, fn->orig_name, fn->real_name, fn->crc32);
-  }
+  C_printf ("%2d: orig: '%s'\n"
+            "    real: '%s',   hash: 0x%016llX\n",
+            (*i)++, orig_name, real_name, (unsigned long long)hash);
 }
 
-static void fname_cache_free_one (void *e)
+static void fname_cache_dump (void)
 {
-  struct file_name_entry *fn = (struct file_name_entry*) e;
+  int i = 0;
+
+  if (!fname_cache)
+     return;
 
-  free (fn->real_name);
-  free (fn);
+  path_cache_foreach (fname_cache, fname_cache_dump_one, &i);
+  C_printf ("%d file-names, %s bytes%s.\n", i,
+            dword_str((DWORD)path_cache_bytes(fname_cache)),
+            path_cache_full(fname_cache) ? " (full)" : "");
 }
 
 static void fname_cache_free (void)
 {
-  smartlist_wipe (fname_list, fname_cache_free_one);
-  fname_list = NULL;
+  path_cache_free (fname_cache);
+  fname_cache = NULL;
 }
 
 /**
@@ -1314,22 +1320,47 @@ int C_indent (size_t indent)
 }
 
 /**
- * Write out the trace-buffer.
+ * Write `len` bytes to the compressed or rotated trace-file.
+ * The caller must hold `C_file_crit`; but not necessarily `ws_sema`.
+ * Hence `C_rotate_file()` can use it without taking `ws_sema` after
+ * `C_file_crit`; the opposite order of `C_write()`.
  */
-size_t C_flush (void)
+static size_t C_write_file (const char *buf, size_t len)
 {
-  size_t len = C_ptr - C_buf;
-  size_t written = len;
+  size_t written;
 
-  assert (len <= TRACE_BUF_SIZE);
-  assert (C_ptr && C_end);
+  if (C_gz)
+  {
+    written = trace_gz_write (C_gz, buf, len);
+    C_compress_sync (false);
+  }
+  else if (g_cfg.trace_stream)
+    written = fwrite (buf, 1, len, g_cfg.trace_stream);
+  else
+    written = 0;    /* the trace-file could not be reopened */
+  return (written);
+}
+
+/**
+ * Write `len` bytes of trace-output to `g_cfg.trace_stream` or `OutputDebugStringA()`.
+ * `buf` must have room for a 0-terminator.
+ */
+static size_t C_write (char *buf, size_t len)
+{
+  size_t written = len;
 
   ws_sema_wait();
 
   if (g_cfg.trace_use_ods)
   {
-    *C_ptr = '\0';
-    OutputDebugStringA (C_buf);
+    buf [len] = '\0';
+    OutputDebugStringA (buf);
+  }
+  else if (C_gz || C_rotate)
+  {
+    EnterCriticalSection (&C_file_crit);
+    written = C_write_file (buf, len);
+    LeaveCriticalSection (&C_file_crit);
   }
   else if (g_cfg.trace_stream)
   {
@@ -1337,14 +1368,734 @@ size_t C_flush (void)
      * Use 'fwrite()' (a bit slower than '_write()') so the Lua-output
      * written using 'io.write()' is in sync with our trace-output.
      */
-    written = (int) fwrite (C_buf, 1, (size_t)len, g_cfg.trace_stream);
+    written = fwrite (buf, 1, len, g_cfg.trace_stream);
   }
-  C_ptr = C_buf;   /* restart buffer */
-
   ws_sema_release();
   return (written);
 }
 
+/**
+ * Start compressing the trace-file if `g_cfg.trace_compress` is set.
+ * Called from `wsock_trace_init()` before anything is written to it.
+ *
+ * The compression is done in `C_write()`; with `g_cfg.trace_async`, that
+ * is on the writer-thread. A sync-flush is done every `g_cfg.trace_compress_sync`
+ * msec so a crash leaves a readable file.
+ */
+bool C_compress_init (void)
+{
+  if (g_cfg.trace_compress <= 0 || !g_cfg.trace_file_okay || C_gz)
+     return (false);
+
+  C_gz = trace_gz_open (g_cfg.trace_stream, min(g_cfg.trace_compress, 9));
+  if (!C_gz)
+  {
+    TRACE (1, "Failed to start compressing '%s'.\n", g_cfg.trace_file);
+    return (false);
+  }
+  C_gz_synced = GetTickCount();
+  return (true);
+}
+
+/**
+ * Do a sync-flush if `g_cfg.trace_compress_sync` msec has passed since the last.
+ * Or always if `force == true`.
+ */
+static void C_compress_sync (bool force)
+{
+  DWORD now;
+
+  if (!C_gz)
+     return;
+
+  now = GetTickCount();
+  if (force || now - C_gz_synced >= (DWORD)g_cfg.trace_compress_sync)
+  {
+    EnterCriticalSection (&C_file_crit);
+    trace_gz_sync (C_gz);
+    LeaveCriticalSection (&C_file_crit);
+    C_gz_synced = now;
+  }
+}
+
+/**
+ * Called from `common_exit()` after the last trace-output.
+ * Write the gzip trailer; the file is closed in `wsock_trace_exit()`.
+ */
+static void C_compress_exit (void)
+{
+  if (!C_gz)
+     return;
+
+  EnterCriticalSection (&C_file_crit);
+  trace_gz_close (C_gz);
+  C_gz = NULL;
+  LeaveCriticalSection (&C_file_crit);
+}
+
+/**
+ * Start rotating the trace-file if `g_cfg.trace_rotate_size` or
+ * `g_cfg.trace_rotate_time` is set. Called from `wsock_trace_init()`
+ * after `C_async_init()`.
+ *
+ * The writer-thread checks the size and age of the trace-file after
+ * draining the rings. On a rollover it closes the trace-file, renames it
+ * and opens a new one. A traced thread never waits for that; except a thread
+ * without a ring that waits in `C_write()` for the reopen. The old file is
+ * compressed by another thread (`g_cfg.trace_rotate_compress`).
+ */
+bool C_rotate_init (void)
+{
+  char path [_MAX_PATH];
+
+  if (g_cfg.trace_rotate_size <= 0 && g_cfg.trace_rotate_time <= 0)
+     return (false);
+
+  if (!C_async || !g_cfg.trace_file_okay || g_cfg.trace_file_device ||
+      !_fullpath(path, g_cfg.trace_file, sizeof(path)))
+  {
+    TRACE (1, "The trace-file will not be rotated.\n");
+    return (false);
+  }
+
+  C_rotate_fname = strdup (path);
+  C_rotate_done  = CreateEvent (NULL, TRUE, TRUE, NULL);
+  if (!C_rotate_fname || !C_rotate_done)
+  {
+    if (C_rotate_done)
+       CloseHandle (C_rotate_done);
+    C_rotate_done = NULL;
+    FREE (C_rotate_fname);
+    return (false);
+  }
+
+  if (g_cfg.trace_rotate_keep < 1)
+     g_cfg.trace_rotate_keep = 1;
+
+  C_rotate_start = time (NULL);
+  C_rotate = true;
+  TRACE (2, "Rotating '%s' at %d MB or %d sec; keeping %d old files.\n",
+         C_rotate_fname, g_cfg.trace_rotate_size, g_cfg.trace_rotate_time, g_cfg.trace_rotate_keep);
+  return (true);
+}
+
+/**
+ * Is it time to rotate the trace-file?
+ * Only the writer-thread changes `g_cfg.trace_stream`; no need to lock it here.
+ */
+static bool C_rotate_due (void)
+{
+  LARGE_INTEGER size;
+  HANDLE        hnd;
+
+  if (g_cfg.trace_rotate_time > 0 && time(NULL) - C_rotate_start >= g_cfg.trace_rotate_time)
+     return (true);
+
+  if (g_cfg.trace_rotate_size > 0)
+  {
+    hnd = (HANDLE) _get_osfhandle (_fileno(g_cfg.trace_stream));
+    if (hnd != INVALID_HANDLE_VALUE && GetFileSizeEx(hnd, &size) &&
+        size.QuadPart >= 1024LL * 1024LL * g_cfg.trace_rotate_size)
+       return (true);
+  }
+  return (false);
+}
+
+/**
+ * Shift the numbered old trace-files; `file.1` becomes `file.2` etc.
+ * The oldest (`file.<trace_rotate_keep>`) is deleted.
+ */
+static void C_rotate_shift (void)
+{
+  static const char *suffix[] = { "", ".gz" };
+  char   from [_MAX_PATH];
+  char   to   [_MAX_PATH];
+  int    i, j;
+
+  for (j = 0; j < DIM(suffix); j++)
+  {
+    snprintf (from, sizeof(from), "%s.%d%s", C_rotate_fname, g_cfg.trace_rotate_keep, suffix[j]);
+    DeleteFileA (from);
+
+    for (i = g_cfg.trace_rotate_keep - 1; i >= 1; i--)
+    {
+      snprintf (from, sizeof(from), "%s.%d%s", C_rotate_fname, i, suffix[j]);
+      snprintf (to, sizeof(to), "%s.%d%s", C_rotate_fname, i + 1, suffix[j]);
+      MoveFileExA (from, to, MOVEFILE_REPLACE_EXISTING);
+    }
+  }
+}
+
+/**
+ * Return true if `str` is a time-stamp from `C_rotate_rename()`.
+ * Like `"20240131-235959"` or `"20240131-235959.gz"`.
+ */
+static bool C_rotate_is_stamp (const char *str)
+{
+  int i;
+
+  for (i = 0; i < 15; i++)
+  {
+    if (i == 8 ? (str[i] != '-') : !isdigit((int)str[i]))
+       return (false);
+  }
+  return (str[15] == '\0' || !stricmp(str + 15, ".gz"));
+}
+
+/**
+ * `smartlist_sort()` helper; the oldest time-stamp first.
+ */
+static int C_rotate_compare (const void **_a, const void **_b)
+{
+  return strcmp (*(const char**)_a, *(const char**)_b);
+}
+
+/**
+ * Delete the oldest time-stamped trace-files until
+ * `g_cfg.trace_rotate_keep` are left.
+ */
+static void C_rotate_purge (void)
+{
+  WIN32_FIND_DATAA ff;
+  HANDLE           hnd;
+  smartlist_t     *old;
+  const char      *base = basename (C_rotate_fname);
+  size_t           base_len = strlen (base);
+  char             fname [_MAX_PATH];
+  int              i, num;
+
+  snprintf (fname, sizeof(fname), "%s.*", C_rotate_fname);
+  hnd = FindFirstFileA (fname, &ff);
+  if (hnd == INVALID_HANDLE_VALUE)
+     return;
+
+  old = smartlist_new();
+  do
+  {
+    if (!(ff.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        !strnicmp(ff.cFileName, base, base_len) && ff.cFileName[base_len] == '.' &&
+        C_rotate_is_stamp(ff.cFileName + base_len + 1))
+       smartlist_add (old, strdup(ff.cFileName + base_len + 1));
+  }
+  while (FindNextFileA(hnd, &ff));
+  FindClose (hnd);
+
+  smartlist_sort (old, C_rotate_compare);
+  num = smartlist_len (old) - g_cfg.trace_rotate_keep;
+
+  for (i = 0; i < num; i++)
+  {
+    snprintf (fname, sizeof(fname), "%s.%s", C_rotate_fname, (const char*)smartlist_get(old, i));
+    DeleteFileA (fname);
+  }
+  smartlist_wipe (old, free);
+  smartlist_free (old);
+}
+
+/**
+ * Rename the closed trace-file to `file.1` or `file.<time-stamp>`.
+ */
+static bool C_rotate_rename (char *old_name, size_t size)
+{
+  SYSTEMTIME now;
+
+  if (!g_cfg.trace_rotate_stamp)
+  {
+    C_rotate_shift();
+    snprintf (old_name, size, "%s.1", C_rotate_fname);
+    return MoveFileExA (C_rotate_fname, old_name, MOVEFILE_REPLACE_EXISTING);
+  }
+
+  /* Never replace an existing file; a rename in the same second
+   * fails and the trace-file is rotated later.
+   */
+  GetLocalTime (&now);
+  snprintf (old_name, size, "%s.%04u%02u%02u-%02u%02u%02u", C_rotate_fname,
+            now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond);
+  if (!MoveFileExA(C_rotate_fname, old_name, 0))
+     return (false);
+
+  C_rotate_purge();
+  return (true);
+}
+
+/**
+ * Close, rename and reopen the trace-file.
+ * Called with `C_file_crit` held.
+ */
+static bool C_rotate_file (char *old_name, size_t size, DWORD *err)
+{
+  bool renamed;
+
+  if (C_gz)
+  {
+    trace_gz_close (C_gz);
+    C_gz = NULL;
+  }
+  fclose (g_cfg.trace_stream);
+  g_cfg.trace_stream = NULL;
+
+  renamed = C_rotate_rename (old_name, size);
+  *err = renamed ? 0 : GetLastError();
+
+  /* Without a '+', `fopen_excl()` does not truncate the file.
+   * That is what we want if the rename failed.
+   */
+  g_cfg.trace_stream = fopen_excl (C_rotate_fname, g_cfg.trace_file_commit ? "atc" : "at");
+  if (!g_cfg.trace_stream)
+  {
+    g_cfg.trace_file_okay = false;
+    C_rotate = false;
+    return (renamed);
+  }
+
+  if (g_cfg.no_buffering)
+     setvbuf (g_cfg.trace_stream, NULL, _IONBF, 0);
+
+  if (g_cfg.trace_binmode)
+     _setmode (_fileno(g_cfg.trace_stream), O_BINARY);
+
+  if (g_cfg.trace_compress > 0)
+  {
+    C_gz = trace_gz_open (g_cfg.trace_stream, min(g_cfg.trace_compress, 9));
+    C_gz_synced = GetTickCount();
+  }
+
+  /* Every file needs the header to be decoded on it's own.
+   */
+  if (g_cfg.trace_binary)
+  {
+    trace_bin_hdr hdr;
+
+    trace_bin_head_record (&hdr);
+    C_write_file ((const char*)&hdr, sizeof(hdr));
+  }
+  C_rotate_start = time (NULL);
+  return (renamed);
+}
+
+/**
+ * Compress an old trace-file to `<file>.gz` and delete it.
+ * Keep it if that fails.
+ */
+static bool C_rotate_gzip (const char *fname)
+{
+  char      gz_name [_MAX_PATH];
+  char     *buf = malloc (C_WRITER_BUF_SIZE);
+  FILE     *in, *out;
+  trace_gz *gz = NULL;
+  size_t    len;
+  bool      ok = false;
+
+  snprintf (gz_name, sizeof(gz_name), "%s.gz", fname);
+  in  = fopen (fname, "rb");
+  out = fopen (gz_name, "wb");
+
+  if (buf && in && out)
+     gz = trace_gz_open (out, min(g_cfg.trace_rotate_compress, 9));
+  if (gz)
+  {
+    ok = true;
+    while ((len = fread(buf, 1, C_WRITER_BUF_SIZE, in)) > 0)
+    {
+      if (trace_gz_write(gz, buf, len) != len)
+      {
+        ok = false;
+        break;
+      }
+    }
+    trace_gz_close (gz);
+    if (ferror(in) || ferror(out))
+       ok = false;
+  }
+  if (in)
+     fclose (in);
+  if (out && fclose(out) != 0)
+     ok = false;
+
+  if (ok)
+       DeleteFileA (fname);
+  else if (out)
+       DeleteFileA (gz_name);
+  free (buf);
+  return (ok);
+}
+
+/**
+ * The thread compressing an old trace-file.
+ * It must not `TRACE()`; the rings can be freed before it's done.
+ */
+static DWORD WINAPI C_rotate_thread (void *arg)
+{
+  char *fname = (char*) arg;
+
+  C_rotate_gzip (fname);
+  free (fname);
+  SetEvent (C_rotate_done);
+  return (0);
+}
+
+/**
+ * Called from the writer-thread after draining the rings.
+ * Rotate the trace-file if it's too large or too old.
+ */
+static void C_rotate_check (void)
+{
+  char  old_name [_MAX_PATH];
+  char *arg;
+  DWORD err;
+  bool  renamed;
+
+  if (!C_rotate || !C_rotate_due())
+     return;
+
+  /* Not before the last old file is compressed; it could get renamed.
+   */
+  if (WaitForSingleObject(C_rotate_done, 0) != WAIT_OBJECT_0)
+     return;
+
+  if (C_rotate_thr)
+     CloseHandle (C_rotate_thr);
+  C_rotate_thr = NULL;
+
+  EnterCriticalSection (&C_file_crit);
+  renamed = C_rotate_file (old_name, sizeof(old_name), &err);
+  LeaveCriticalSection (&C_file_crit);
+
+  if (!renamed)
+  {
+    TRACE (1, "Failed to rename '%s' to '%s': %s.\n",
+           C_rotate_fname, old_name, win_strerror(err));
+    return;
+  }
+
+  g_data.counts.trace_rotations++;
+  TRACE (2, "Rotated the trace-file to '%s'.\n", old_name);
+
+  if (g_cfg.trace_rotate_compress <= 0 || C_gz)
+     return;
+
+  arg = strdup (old_name);
+  if (!arg)
+     return;
+
+  ResetEvent (C_rotate_done);
+  C_rotate_thr = CreateThread (NULL, 0, C_rotate_thread, arg, 0, NULL);
+  if (!C_rotate_thr)
+  {
+    TRACE (1, "Failed to start compressing '%s': %s.\n", old_name, win_strerror(GetLastError()));
+    SetEvent (C_rotate_done);
+    free (arg);
+  }
+}
+
+/**
+ * Called from `common_exit()` after the writer-thread is stopped.
+ * Give a compression in progress some time to finish.
+ */
+static void C_rotate_exit (void)
+{
+  if (!C_rotate_fname)
+     return;
+
+  C_rotate = false;
+  if (C_rotate_thr)
+  {
+    WaitForSingleObject (C_rotate_done, C_ROTATE_EXIT_MSEC);
+    CloseHandle (C_rotate_thr);
+  }
+  CloseHandle (C_rotate_done);
+  C_rotate_thr = C_rotate_done = NULL;
+  FREE (C_rotate_fname);
+}
+
+/**
+ * Write out the batch of records collected by `C_writer_add()`.
+ */
+static void C_writer_flush (void)
+{
+  if (C_writer_len > 0)
+     C_write (C_writer_buf, C_writer_len);
+  C_writer_len = 0;
+}
+
+/**
+ * The `trace_ring_func` for `trace_ring_drain()`.
+ * Add one record to the batch.
+ */
+static void C_writer_add (void *arg, uint32_t seq, const char *data, size_t len)
+{
+  if (C_writer_len + len >= C_WRITER_BUF_SIZE)
+     C_writer_flush();
+
+  /* A text-record is never larger than `TRACE_BUF_SIZE`.
+   * But a binary record with a large `g_cfg.max_data` could be.
+   */
+  if (len >= C_WRITER_BUF_SIZE)
+       C_write ((char*)data, len);
+  else
+  {
+    memcpy (C_writer_buf + C_writer_len, data, len);
+    C_writer_len += len;
+  }
+  ARGSUSED (arg);
+  ARGSUSED (seq);
+}
+
+/**
+ * Drain all the per-thread rings in sequence-order and write them out.
+ */
+static void C_writer_drain (void)
+{
+  trace_ring_drain (&C_rings, C_writer_add, NULL);
+  C_writer_flush();
+  g_data.counts.trace_drops = trace_ring_dropped (&C_rings);
+}
+
+/**
+ * The background writer-thread for `g_cfg.trace_async`.
+ *
+ * The event is set before the thread exits; exiting a thread needs the
+ * loader-lock and `C_async_exit()` is called with it held.
+ */
+static DWORD WINAPI C_writer_thread (void *arg)
+{
+  while (!C_writer_stop)
+  {
+    WaitForSingleObject (C_writer_wake, C_WRITER_MSEC);
+    C_writer_drain();
+    C_rotate_check();
+    C_compress_sync (false);
+  }
+  SetEvent (C_writer_done);
+  ARGSUSED (arg);
+  return (0);
+}
+
+/**
+ * Start the asynchronous trace-output if `g_cfg.trace_async` is set.
+ *
+ * Each thread then puts the lines it would have written in `C_flush()`
+ * into its own ring (allocated on first use and kept in the TLS-slot
+ * `g_data.ws_Tls_index`). The writer-thread merges the rings in the order
+ * the lines were committed and writes them to the trace-file or
+ * `OutputDebugStringA()`. A line that does not fit in a full ring is
+ * dropped and counted in `g_data.counts.trace_drops`.
+ *
+ * Not used when tracing to a console since the colours are set
+ * in-between the lines.
+ */
+bool C_async_init (void)
+{
+  if (!g_cfg.trace_async || C_async || g_data.ws_Tls_index == TLS_OUT_OF_INDEXES)
+     return (false);
+
+  if (!g_cfg.trace_use_ods && g_cfg.trace_file_device && !g_data.stdout_redirected)
+  {
+    TRACE (1, "'trace_async' is not used for a console.\n");
+    return (false);
+  }
+
+  C_writer_buf  = malloc (C_WRITER_BUF_SIZE + 1);
+  C_writer_wake = CreateEvent (NULL, FALSE, FALSE, NULL);
+  C_writer_done = CreateEvent (NULL, TRUE, FALSE, NULL);
+  C_writer_stop = 0;
+  C_writer_len  = 0;
+
+  if (C_writer_buf && C_writer_wake && C_writer_done)
+     C_writer_thr = CreateThread (NULL, 0, C_writer_thread, NULL, 0, NULL);
+
+  if (!C_writer_thr)
+  {
+    TRACE (1, "Failed to start the trace writer-thread: %s.\n", win_strerror(GetLastError()));
+    if (C_writer_wake)
+       CloseHandle (C_writer_wake);
+    if (C_writer_done)
+       CloseHandle (C_writer_done);
+    FREE (C_writer_buf);
+    C_writer_wake = C_writer_done = NULL;
+    return (false);
+  }
+  C_async = true;
+  TRACE (2, "Started the trace writer-thread; ring-size: %d kB.\n", g_cfg.trace_ring_size);
+  return (true);
+}
+
+/**
+ * Called from `common_exit()`.
+ *
+ * Stop the writer-thread and write out what is left in the rings.
+ * If the process is exiting, the writer-thread is already killed.
+ * Then `C_writer_done` is never set, but the thread-handle is signalled.
+ */
+static void C_async_exit (void)
+{
+  HANDLE wait [2];
+
+  if (!C_async)
+     return;
+
+  InterlockedExchange (&C_writer_stop, 1);
+  SetEvent (C_writer_wake);
+
+  wait[0] = C_writer_done;
+  wait[1] = C_writer_thr;
+  WaitForMultipleObjects (DIM(wait), wait, FALSE, C_WRITER_EXIT_MSEC);
+
+  C_async = false;
+  C_writer_drain();
+  trace_rings_free (&C_rings);
+
+  if (g_data.counts.trace_drops > 0)
+     C_printf ("%s trace-lines were dropped.\n", qword_str(g_data.counts.trace_drops));
+
+  CloseHandle (C_writer_thr);
+  CloseHandle (C_writer_wake);
+  CloseHandle (C_writer_done);
+  C_writer_thr = C_writer_wake = C_writer_done = NULL;
+  FREE (C_writer_buf);
+}
+
+/**
+ * Called from `DllMain (..., DLL_THREAD_DETACH)`.
+ * This thread will not trace anything more; the writer frees its ring.
+ */
+void C_async_thread_exit (void)
+{
+  trace_ring *ring;
+  DWORD       err;
+
+  if (!C_async)
+     return;
+
+  err  = GetLastError();
+  ring = TlsGetValue (g_data.ws_Tls_index);
+  if (ring)
+  {
+    trace_ring_close (ring);
+    TlsSetValue (g_data.ws_Tls_index, NULL);
+  }
+  SetLastError (err);
+}
+
+/**
+ * Put a trace-record into the ring of this thread.
+ *
+ * \retval false if this thread has no ring (too many threads or no memory).
+ *         Then write it directly.
+ */
+static bool C_async_put (const void *data, size_t len)
+{
+  trace_ring *ring;
+  DWORD       err = GetLastError();   /* 'TlsGetValue()' clears it */
+
+  ring = TlsGetValue (g_data.ws_Tls_index);
+  if (!ring)
+  {
+    ring = trace_ring_new (&C_rings, 1024 * g_cfg.trace_ring_size);
+    if (ring)
+       TlsSetValue (g_data.ws_Tls_index, ring);
+  }
+  if (ring && trace_ring_put(ring, data, len) >= C_WRITER_WAKE_PCT)
+     SetEvent (C_writer_wake);
+
+  SetLastError (err);
+  return (ring != NULL);
+}
+
+/**
+ * Write out a record as-is.
+ * Or with `g_cfg.trace_async`, put it into the ring of this thread.
+ *
+ * Used by trace_bin.c; the caller must call `C_flush()` first to keep
+ * the trace in order.
+ */
+size_t C_write_record (const void *data, size_t len)
+{
+  if (len == 0 || (C_async && C_async_put(data, len)))
+     return (len);
+  return C_write ((char*)data, len);
+}
+
+/**
+ * Write out a block of already formatted trace-output as-is; without
+ * the `~` colour escapes. Anything in the trace-buffer is written first.
+ *
+ * Used by the hex-dumper in dump.c. With `g_cfg.trace_async`, it is put into
+ * the ring of this thread in pieces of at most `TRACE_BUF_SIZE`; like any
+ * other text-record. `buf` must have room for a 0-terminator.
+ */
+size_t C_write_block (char *buf, size_t len)
+{
+  size_t written = 0;
+
+  if (C_ptr && C_ptr > C_buf)
+     C_flush();
+
+  if (len == 0)
+     return (0);
+
+  if (g_cfg.trace_binary)
+     return trace_bin_text (buf, len);
+
+  while (C_async && written < len)
+  {
+    size_t chunk = min (len - written, TRACE_BUF_SIZE);
+
+    if (!C_async_put(buf + written, chunk))
+       break;
+    written += chunk;
+  }
+  if (written < len)
+     written += C_write (buf + written, len - written);
+  return (written);
+}
+
+/**
+ * Send the trace-output to `stream` from now on; e.g. for a log-file in
+ * `ws_tool firewall`. What is in the trace-buffer and the rings is written
+ * out to the old stream first. The writer-thread is stopped since it
+ * could be writing to the old stream.
+ *
+ * \retval false with a compressed or rotated trace-file; they own the stream.
+ */
+bool C_set_stream (FILE *stream)
+{
+  if (C_gz || C_rotate)
+     return (false);
+
+  if (C_ptr && C_ptr > C_buf)
+     C_flush();
+  C_async_exit();
+  if (g_cfg.trace_stream)
+     fflush (g_cfg.trace_stream);
+  g_cfg.trace_stream = stream;
+  return (true);
+}
+
+/**
+ * Write out the trace-buffer.
+ * Or with `g_cfg.trace_async`, put it into the ring of this thread.
+ * Or with `g_cfg.trace_binary`, write it as a text-record.
+ */
+size_t C_flush (void)
+{
+  size_t len = C_ptr - C_buf;
+  size_t written = len;
+
+  assert (len <= TRACE_BUF_SIZE);
+  assert (C_ptr && C_end);
+
+  if (g_cfg.trace_binary && len > 0)
+     written = trace_bin_text (C_buf, len);
+
+  else if (!C_async || len == 0 || !C_async_put(C_buf, len))
+     written = C_write (C_buf, len);
+
+  C_ptr = C_buf;   /* restart buffer */
+  return (written);
+}
+
 int C_printf (const char *fmt, ...)
 {
   char    buf [2000];
@@ -1578,14 +2329,15 @@ FILE *fopen_excl (const char *file, const char *mode)
  * Return nicely formatted string `"xx,xxx,xxx"`
  * with thousand separators (left adjusted).
  *
- * Use 8 buffers in round-robin.
+ * Use 8 buffers in round-robin. The index is taken atomically and masked
+ * before use; the init-threads in init.c call this concurrently.
  */
 const char *qword_str (unsigned __int64 val)
 {
   static char buf [8][30];
-  static int  idx = 0;
+  static volatile LONG idx = 0;
   char   tmp[30];
-  char  *rc = buf [idx++];
+  char  *rc = buf [InterlockedIncrement(&idx) & 7];
 
 #if defined(_MSC_VER)
   if (g_data.use_win_locale)
@@ -1594,10 +2346,7 @@ const char *qword_str (unsigned __int64 val)
 
     if (_ui64toa_s (val, buf2, sizeof(buf2), 10) == 0 &&
         GetNumberFormat (LOCALE_USER_DEFAULT, 0, buf2, NULL, rc, sizeof(buf[0])))
-    {
-      idx &= 7;
-      return str_ltrim (rc);
-    }
+       return str_ltrim (rc);
   }
 #endif
 
@@ -1624,7 +2373,6 @@ const char *qword_str (unsigned __int64 val)
     sprintf (tmp, "%15llu", val);
     sprintf (rc, "%.3s,%.3s,%.3s,%.3s,%.3s", tmp, tmp+3, tmp+6, tmp+9, tmp+12);
   }
-  idx &= 7;
   return str_ltrim (rc);
 }
 
@@ -2012,76 +2760,6 @@ int fnmatch (const char *pattern, const char *string, int flags)
   }   /* while (1) */
 }
 
-/*
- * These CRC functions are derived from code in chapter 19 of the book
- * "C Programmer's Guide to Serial Communications", by Joe Campbell.
- */
-#define CRC_BITS    32
-#define CRC_HIBIT   ((DWORD) (1UL << (CRC_BITS-1)))
-#define CRC_SHIFTS  (CRC_BITS-8)
-
-/* Our PRZ's 24-bit CRC generator polynomial. Ref:
- *   http://en.wikipedia.org/wiki/Cyclic_redundancy_check
- *   Section "Commonly used and standardized CRCs"
- */
-#define CRC_PRZ  0x864CFBL
-
-/* Pre-generated table for speeding up CRC calculations.
- */
-static DWORD crc_table [256 * sizeof(DWORD)] = { '\0' };
-
-/*
- * mk_crctbl() derives a CRC lookup table from the CRC polynomial.
- * The table is used later by crc_bytes() below.
- * mk_crctbl() only needs to be called once at the dawn of time.
- *
- * The theory behind mk_crctbl() is that table[i] is initialized
- * with the CRC of i, and this is related to the CRC of `i >> 1',
- * so the CRC of `i >> 1' (pointed to by p) can be used to derive
- * the CRC of i (pointed to by q).
- */
-static void mk_crctbl (DWORD poly, DWORD *tab)
-{
-  DWORD *p = tab;
-  DWORD *q = tab;
-  int    i;
-
-  *q++ = 0;
-  *q++ = poly;
-  for (i = 1; i < 128; i++)
-  {
-    DWORD t = *(++p);
-
-    if (t & CRC_HIBIT)
-    {
-      t <<= 1;
-      *q++ = t ^ poly;
-      *q++ = t;
-    }
-    else
-    {
-      t <<= 1;
-      *q++ = t;
-      *q++ = t ^ poly;
-    }
-  }
-}
-
-/*
- * Calculate 32-bit CRC on buffer 'buf' with length 'len'.
- */
-static DWORD crc_bytes (const char *buf, size_t len)
-{
-  DWORD accum;
-
-  if (!crc_table[0])
-     mk_crctbl (CRC_PRZ, crc_table);
-
-  for (accum = 0; len > 0; len--)
-      accum = (accum << 8) ^ crc_table[(BYTE)(accum >> CRC_SHIFTS) ^ *buf++];
-  return (accum);
-}
-
 /**
  * Simple check for file-existence.
  */
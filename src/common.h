@@ -86,6 +86,14 @@ extern int    C_indent   (size_t indent);
 extern size_t C_flush    (void);
 extern int    C_level_save_restore (int pop);
 
+extern bool   C_async_init        (void);
+extern void   C_async_thread_exit (void);
+extern size_t C_write_record      (const void *data, size_t len);
+extern size_t C_write_block       (char *buf, size_t len);
+extern bool   C_set_stream        (FILE *stream);
+extern bool   C_compress_init     (void);
+extern bool   C_rotate_init       (void);
+
 /* Init/exit functions for stuff in common.c.
  */
 extern void common_init (void);
@@ -183,9 +191,12 @@ extern const char *get_dll_build_date (void);
 extern const char *get_builder (bool show_dbg_rel);
 extern const char *get_dll_version (void);
 
+struct sock_info;
+
 extern void sock_list_add (SOCKET sock, int family, int type, int protocol);
-extern void sock_list_remove (SOCKET sock);
+extern bool sock_list_remove (SOCKET sock, struct sock_info *info);
 extern int  sock_list_type (SOCKET sock, int *family, int *protocol);
+extern void sock_list_count (SOCKET sock, uint64_t recv, uint64_t sent);
 
 /*
  * fnmatch() stuff:
@@ -244,7 +244,8 @@ static const char *CSV_get_next_field (struct CSV_context *ctx)
 
   /* Update the max size of this field. Includes the 0-termination.
    */
-  sz = ctx->parse_ptr - ret + 1;
+  ctx->value_len = ctx->parse_ptr - ret;
+  sz = ctx->value_len + 1;
   if (ctx->field_sizes [ctx->field_num] < sz)
       ctx->field_sizes [ctx->field_num] = sz;
 
@@ -259,6 +260,304 @@ static const char *CSV_get_next_field (struct CSV_context *ctx)
   return (ret);
 }
 
+/**
+ * The initial size of the block-buffer for `CSV_ENGINE_BLOCK`.
+ * It grows if a single field is larger than this.
+ * `CSV_scan()` may read `CSV_BLOCK_SLACK` bytes past the data.
+ */
+#define CSV_BLOCK_SIZE   (256*1024)
+#define CSV_BLOCK_SLACK  8
+
+/**
+ * Return a pointer to the first occurrence of any of the `num` characters
+ * in `chars` in the range `[p .. end)`. Or `end` if none found.
+ *
+ * Tests 8 bytes at a time; a byte equal to `c` becomes a zero-byte in `w ^ (ones * c)`
+ * and `HAS_ZERO()` sets the high bit of it. The lowest such bit is always a true
+ * match (Windows is little-endian). The last word may read up to 7 bytes past `end`;
+ * `blk_buf` has room for that.
+ */
+static const char *CSV_scan (const char *p, const char *end, const char *chars, int num)
+{
+  const uint64 ones  = U64_SUFFIX (0x0101010101010101);
+  const uint64 highs = U64_SUFFIX (0x8080808080808080);
+  uint64 mask [5];
+  int    i;
+
+  #define HAS_ZERO(v)  (((v) - ones) & ~(v) & highs)
+
+  for (i = 0; i < num; i++)
+      mask[i] = ones * (BYTE)chars[i];
+
+  while (p < end)
+  {
+    uint64 w, hit = 0;
+
+    memcpy (&w, p, sizeof(w));
+    for (i = 0; i < num; i++)
+        hit |= HAS_ZERO (w ^ mask[i]);
+    if (hit)
+    {
+      while (!(hit & 0x80))
+      {
+        hit >>= 8;
+        p++;
+      }
+      return (p < end ? p : end);
+    }
+    p += 8;
+  }
+  return (end);
+  #undef HAS_ZERO
+}
+
+/**
+ * Read the next block of the file into `ctx->blk_buf`.
+ *
+ * Keep the unparsed part of the current field; move it to the start
+ * of the buffer. Grow the buffer if the field fills it completely.
+ *
+ * \retval 0 on end-of-file.
+ */
+static int CSV_block_fill (struct CSV_context *ctx)
+{
+  size_t keep = ctx->blk_end - ctx->blk_field;
+  size_t got;
+
+  if (ctx->blk_eof)
+     return (0);
+
+  if (ctx->blk_field > 0)
+  {
+    memmove (ctx->blk_buf, ctx->blk_buf + ctx->blk_field, keep);
+    ctx->blk_ptr -= ctx->blk_field;
+    ctx->blk_out -= ctx->blk_field;
+    ctx->blk_end  = keep;
+    ctx->blk_field = 0;
+  }
+
+  if (keep >= ctx->blk_size - 1)
+  {
+    char *more = realloc (ctx->blk_buf, 2 * ctx->blk_size + CSV_BLOCK_SLACK);
+
+    if (!more)
+    {
+      TRACE (1, "Failed to grow the block-buffer to %zu bytes.\n", 2 * ctx->blk_size);
+      ctx->blk_eof = 1;
+      return (0);
+    }
+    ctx->blk_buf   = more;
+    ctx->blk_size *= 2;
+  }
+
+  got = fread (ctx->blk_buf + keep, 1, ctx->blk_size - 1 - keep, ctx->file);
+  if (got == 0)
+     ctx->blk_eof = 1;
+
+  ctx->blk_end += got;
+  ctx->blk_buf [ctx->blk_end] = '\0';
+  return (got > 0);
+}
+
+/**
+ * The `CSV_ENGINE_BLOCK` version of `CSV_get_next_field()`.
+ *
+ * Instead of a `fgetc()` and a state-function call for each character, this
+ * scans for the next interesting character with `CSV_scan()`. The field is
+ * returned in-place in `ctx->blk_buf`; it is only moved down when a quote, a
+ * `\r` etc. must be removed from it. The states and rules are exactly as
+ * in `state_normal()`, `state_quoted()`, `state_escaped()` and `state_comment()`.
+ *
+ * If the field continues past the end of the buffer, the next block is
+ * read and the scan resumes where it stopped.
+ */
+static const char *CSV_block_next_field (struct CSV_context *ctx)
+{
+  CSV_STATE state = STATE_NORMAL;
+  char     *buf, *p, *end, *out, *limit, *ret;
+  char      normal_chars [5];
+  unsigned  line;
+  size_t    sz;
+  int       c, num_normal = 4, copied = 0;
+
+  normal_chars[0] = (char) ctx->delimiter;
+  normal_chars[1] = '"';
+  normal_chars[2] = '\r';
+  normal_chars[3] = '\n';
+  if (ctx->field_num == 0)
+     normal_chars [num_normal++] = '#';
+
+  ctx->blk_field = ctx->blk_out = ctx->blk_ptr;
+
+  while (1)
+  {
+    buf   = ctx->blk_buf;
+    p     = buf + ctx->blk_ptr;
+    end   = buf + ctx->blk_end;
+    out   = buf + ctx->blk_out;
+    limit = buf + ctx->blk_field + ctx->line_size;
+
+    while (p < end && state != STATE_STOP && state != STATE_EOF)
+    {
+      const char *q;
+      size_t      len;
+
+      if (state == STATE_NORMAL)
+           q = CSV_scan (p, end, normal_chars, num_normal);
+      else if (state == STATE_QUOTED)
+           q = CSV_scan (p, end, "\"\\\r\n", 4);
+      else if (state == STATE_COMMENT)
+           q = CSV_scan (p, end, "\n", 1);
+      else q = p;   /* STATE_ESCAPED */
+
+      if (state != STATE_COMMENT && state != STATE_ESCAPED)
+      {
+        /* Keep the plain characters in `[p .. q)` (as `PUTC()` would do)
+         */
+        len = min ((size_t)(q - p), (size_t)(limit > out ? limit - out : 0));
+        if (out != p)
+           memmove (out, p, len);
+        out += len;
+      }
+      p = (char*) q;
+      if (p == end)
+         break;
+
+      c = (BYTE) *p++;
+      ctx->c_in = c;
+
+      switch (state)
+      {
+        case STATE_NORMAL:
+             if (c == ctx->delimiter)
+                state = STATE_STOP;
+             else if (c == '"')
+                state = STATE_QUOTED;
+             else if (c == '\n')
+             {
+               ctx->line_num++;
+               if (ctx->field_num > 0)
+                    state = STATE_STOP;
+               else ctx->empty_lines++;
+             }
+             else if (c == '#')
+             {
+               state = STATE_COMMENT;
+               ctx->comment_lines++;
+             }
+             break;              /* A '\r' is ignored */
+
+        case STATE_QUOTED:
+             if (c == '"')
+                state = STATE_NORMAL;
+             else if (c == '\\')
+                state = STATE_ESCAPED;
+             else if (c == '\n')
+             {
+               if (out < limit)
+                  *out++ = ' ';
+               ctx->line_num++;
+             }
+             break;
+
+        case STATE_ESCAPED:
+             if (c == '"')
+             {
+               if (out < limit)
+                  *out++ = '"';
+               state = STATE_QUOTED;
+             }
+             else if (c == '\n')
+               ctx->line_num++;
+             else if (c != '\r')
+               state = STATE_QUOTED;
+             break;
+
+        case STATE_COMMENT:
+             ctx->line_num++;
+             state = STATE_NORMAL;
+             break;
+
+        default:
+             break;
+      }
+    }
+
+    ctx->blk_ptr = p - buf;
+    ctx->blk_out = out - buf;
+
+    if (state == STATE_STOP || state == STATE_EOF)
+       break;
+
+    if (!CSV_block_fill(ctx))
+    {
+      TRACE (3, "%s() reached EOF at rec: %u, line: %u, field: %u.\n",
+             __FUNCTION__, ctx->rec_num, ctx->line_num, ctx->field_num);
+      ctx->c_in = -1;
+      state = STATE_EOF;
+      break;
+    }
+  }
+
+  ctx->state = state;
+  if (state == STATE_EOF)
+     return (NULL);
+
+  /* There is always room for the 0-termination; `out` is before
+   * the delimiter or newline just consumed.
+   */
+  ret  = ctx->blk_buf + ctx->blk_field;
+  out  = ctx->blk_buf + ctx->blk_out;
+  *out = '\0';
+
+  /* Skip blanks and delimiters following this field.
+   * If that needs the next block, copy the field to `parse_buf` first.
+   */
+  if (isspace(ctx->delimiter) || iscntrl(ctx->delimiter))
+  {
+    while (1)
+    {
+      if (ctx->blk_ptr == ctx->blk_end)
+      {
+        if (!copied)
+        {
+          memcpy (ctx->parse_buf, ret, out - ret + 1);
+          out = ctx->parse_buf + (out - ret);
+          ret = ctx->parse_buf;
+          copied = 1;
+        }
+        ctx->blk_field = ctx->blk_out = ctx->blk_ptr;
+        if (!CSV_block_fill(ctx))
+        {
+          ctx->c_in = -1;
+          break;
+        }
+      }
+      ctx->c_in = (BYTE) ctx->blk_buf [ctx->blk_ptr];
+      if (ctx->c_in != ' ' && ctx->c_in != ctx->delimiter)
+         break;
+      ctx->blk_ptr++;
+    }
+  }
+
+#if !defined(CSV_TEST)
+  ret = str_ltrim (ret);
+#endif
+
+  ctx->value_len = out - ret;
+
+  sz = ctx->value_len + 1;
+  if (ctx->field_sizes [ctx->field_num] < sz)
+      ctx->field_sizes [ctx->field_num] = sz;
+
+  line = ctx->line_num;
+  if (ctx->c_in == '\n')
+     line--;
+
+  TRACE (4, "rec: %u, line: %u, field: %u: '%s'.\n", ctx->rec_num, line, ctx->field_num, ret);
+  return (ret);
+}
+
 /**
  * Open and parse CSV file and extract one record by calling the callback for each found field.
  *
@@ -276,7 +575,9 @@ static int CSV_parse_file (struct CSV_context *ctx)
     ctx->state = STATE_NORMAL;
     ctx->state_func = state_normal;
 
-    val  = CSV_get_next_field (ctx);
+    if (ctx->engine == CSV_ENGINE_BLOCK)
+         val = CSV_block_next_field (ctx);
+    else val = CSV_get_next_field (ctx);
     line = ctx->line_num;
     if (!val)
        goto quit;
@@ -296,16 +597,16 @@ static int CSV_parse_file (struct CSV_context *ctx)
   return (ctx->field_num == ctx->num_fields);
 
 quit:
+  if (ctx->state == STATE_EOF)   /* Check this first; an EOF on line 1 would loop forever */
+  {
+    TRACE (4, "  Reached EOF on line %u, field %u.\n", ctx->line_num, ctx->field_num);
+    return (0);
+  }
   if (ctx->line_num == 1)
   {
     TRACE (2, "  Ignoring parse-error on line %u, field %u.\n", ctx->line_num, ctx->field_num);
     return (1);
   }
-  if (ctx->state == STATE_EOF)
-  {
-    TRACE (4, "  Reached EOF on line %u, field %u.\n", ctx->line_num, ctx->field_num);
-    return (0);
-  }
   TRACE (2, "  Unable to parse line %u, field %u.\n", ctx->line_num, ctx->field_num);
   ctx->parse_errors++;
   return (0);
@@ -438,17 +739,38 @@ static int CSV_check_and_fill_ctx (struct CSV_context *ctx)
     return (0);
   }
 
+  if (ctx->engine == CSV_ENGINE_BLOCK)
+  {
+    ctx->blk_size = max (CSV_BLOCK_SIZE, 2*ctx->line_size);
+    ctx->blk_buf  = malloc (ctx->blk_size + CSV_BLOCK_SLACK);
+    if (!ctx->blk_buf)
+    {
+      TRACE (1, "Allocation of 'blk_buf' failed.\n");
+      free (ctx->parse_buf);
+      free (ctx->field_sizes);
+      return (0);
+    }
+    ctx->blk_ptr = ctx->blk_end = ctx->blk_field = ctx->blk_out = 0;
+    ctx->blk_eof = 0;
+  }
+
   TRACE (2, "Opening file \"%s\".\n", ctx->file_name);
 
-  ctx->file = fopen (ctx->file_name, "rt");
+  /* The block-engine does its own buffering and ignores any '\r'.
+   */
+  ctx->file = fopen (ctx->file_name, ctx->engine == CSV_ENGINE_BLOCK ? "rb" : "rt");
   if (!ctx->file)
   {
     TRACE (1, "Failed to open file \"%s\". errno: %d\n", ctx->file_name, errno);
     free (ctx->parse_buf);
+    free (ctx->blk_buf);
+    ctx->blk_buf = NULL;
     return (0);
   }
 
-  if (setvbuf(ctx->file, NULL, _IOFBF, 2*ctx->line_size))
+  if (ctx->engine == CSV_ENGINE_BLOCK)
+     setvbuf (ctx->file, NULL, _IONBF, 0);
+  else if (setvbuf(ctx->file, NULL, _IOFBF, 2*ctx->line_size))
      TRACE (1, "Failed to call 'setvbuf()' on \"%s\", errno: %d\n", ctx->file_name, errno);
 
   ctx->state_func = state_illegal;
@@ -476,6 +798,8 @@ unsigned CSV_open_and_parse_file (struct CSV_context *ctx)
   fclose (ctx->file);
   ctx->file = NULL;
   free (ctx->parse_buf);
+  free (ctx->blk_buf);
+  ctx->blk_buf = NULL;
 
 #ifdef CSV_TEST
   if (CSV_test_verbose >= 2)
@@ -517,29 +841,149 @@ static int csv_callback (struct CSV_context *ctx, const char *value)
   return (1);
 }
 
+/*
+ * The callback for the benchmark.
+ * Count the fields and make a FNV-1a hash of all the values.
+ * This hash should be the same for both engines.
+ */
+static unsigned bench_fields;
+static uint64   bench_hash;
+
+static int csv_bench_callback (struct CSV_context *ctx, const char *value)
+{
+  const BYTE *p = (const BYTE*) value;
+  const BYTE *end = p + ctx->value_len;
+  uint64      h = bench_hash ^ ctx->field_num;
+
+  while (p < end)
+      h = (h ^ *p++) * U64_SUFFIX (0x100000001B3);
+  bench_hash = h * U64_SUFFIX (0x100000001B3);
+  bench_fields++;
+  return (1);
+}
+
+/*
+ * Parse `file` with `engine` and return the throughput in MB/s.
+ */
+static double csv_bench_engine (const struct CSV_context *opt, const char *file, CSV_ENGINE engine,
+                                int64 size, unsigned *records)
+{
+  struct CSV_context ctx = *opt;
+  double start, usec;
+
+  ctx.file_name = file;
+  ctx.callback  = csv_bench_callback;
+  ctx.engine    = engine;
+  bench_fields  = 0;
+  bench_hash    = U64_SUFFIX (0xCBF29CE484222325);
+
+  start = get_timestamp_now();
+  *records = CSV_open_and_parse_file (&ctx);
+  usec = get_timestamp_now() - start;
+  if (usec <= 0.0)
+     usec = 1.0;
+  return ((double)size / usec);   /* bytes/usec == MB/s */
+}
+
+/*
+ * Compare the throughput of the 2 engines on a CSV-file.
+ */
+static int csv_bench_file (const struct CSV_context *opt, const char *file, int loops)
+{
+  struct stat st;
+  unsigned    rec_stdio = 0, rec_block = 0;
+  unsigned    fields_stdio = 0, fields_block = 0;
+  uint64      hash_stdio = 0, hash_block = 0;
+  double      mbs_stdio = 0.0, mbs_block = 0.0;
+  int         i;
+
+  if (!file || !*file)
+     return (0);
+
+  if (stat(file, &st) != 0)
+  {
+    printf ("Cannot benchmark \"%s\": %s.\n", file, strerror(errno));
+    return (0);
+  }
+
+  for (i = 0; i < loops; i++)
+  {
+    mbs_stdio = max (mbs_stdio, csv_bench_engine(opt, file, CSV_ENGINE_STDIO, st.st_size, &rec_stdio));
+    fields_stdio = bench_fields;
+    hash_stdio   = bench_hash;
+
+    mbs_block = max (mbs_block, csv_bench_engine(opt, file, CSV_ENGINE_BLOCK, st.st_size, &rec_block));
+    fields_block = bench_fields;
+    hash_block   = bench_hash;
+  }
+
+  printf ("%s: %s bytes, %s records.\n", file, qword_str(st.st_size), dword_str(rec_block));
+  printf ("  stdio: %8.1f MB/s\n", mbs_stdio);
+  printf ("  block: %8.1f MB/s (%.1fx)\n", mbs_block, mbs_stdio > 0.0 ? mbs_block / mbs_stdio : 0.0);
+
+  if (rec_stdio != rec_block || fields_stdio != fields_block || hash_stdio != hash_block)
+  {
+    printf ("  Engines differ! records: %u/%u, fields: %u/%u.\n",
+            rec_stdio, rec_block, fields_stdio, fields_block);
+    return (1);
+  }
+  return (0);
+}
+
+/*
+ * Benchmark the engines on the files given on the cmd-line.
+ * Or if none given, on the CSV-files from the config-file.
+ */
+static int csv_bench (const struct CSV_context *opt, char **files, int loops)
+{
+  int errors = 0;
+
+  if (*files)
+  {
+    for ( ; *files; files++)
+        errors += csv_bench_file (opt, *files, loops);
+  }
+  else
+  {
+    errors += csv_bench_file (opt, g_cfg.GEOIP.ip4_file, loops);
+    errors += csv_bench_file (opt, g_cfg.GEOIP.ip6_file, loops);
+    errors += csv_bench_file (opt, g_cfg.IANA.ip4_file, loops);
+    errors += csv_bench_file (opt, g_cfg.IANA.ip6_file, loops);
+    errors += csv_bench_file (opt, g_cfg.ASN.asn_csv_file, loops);
+  }
+  return (errors ? 1 : 0);
+}
+
 static int show_help (void)
 {
   printf ("Usage:\n"
           "  %s [-f field-delimiter] [-m records] <-n number-of-fields> <-g c-file> <file.csv>\n"
+          "  %s -b [loops] [-f field-delimiter] [file.csv..]\n"
+          "    -b: benchmark the CSV-engines on the given files or the CSV-files in the config-file.\n"
           "    -f: set field delimiter. Use '\\t' for a <TAB>, '\\s for a <SPACE> or '^|' for '|' (default is ',').\n"
           "    -m: max number of records to handle.\n"
           "    -n: number of fields in CSV-records. Default is found by auto-detection.\n"
           "    -g: generate a .h-file to represent the data (use '-' for stdout).\n",
-          g_data.program_name);
+          g_data.program_name, g_data.program_name);
   return (0);
 }
 
 int csv_main (int argc, char **argv)
 {
   struct CSV_context ctx;
-  int    ch, rc;
+  int    ch, rc, bench = 0;
 
   set_program_name (argv[0]);
   memset (&ctx, '\0', sizeof(ctx));
 
-  while ((ch = getopt(argc, argv, "f:m:n:g:h?")) != EOF)
+  while ((ch = getopt(argc, argv, "b::f:m:n:g:h?")) != EOF)
      switch (ch)
      {
+       case 'b':
+            bench = optarg ? atoi (optarg) : 3;
+            if (bench <= 0)
+               bench = 1;
+            break;
        case 'f':
             if (!strcmp(optarg, "'") || !strcmp(optarg, "\\s"))
             {
@@ -570,6 +1014,9 @@ int csv_main (int argc, char **argv)
   }
 
   argv += optind;
+  if (bench)
+     return csv_bench (&ctx, argv, bench);
+
   if (!*argv)
      return show_help();
 
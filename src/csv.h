@@ -21,6 +21,14 @@ typedef enum CSV_STATE {
         STATE_EOF
       } CSV_STATE;
 
+/**
+ * \enum The CSV-parser engines
+ */
+typedef enum CSV_ENGINE {
+        CSV_ENGINE_BLOCK = 0,   /**< Read large blocks and split fields in place (default) */
+        CSV_ENGINE_STDIO        /**< The original `fgetc()` state-machine */
+      } CSV_ENGINE;
+
 struct CSV_context;
 
 /**
@@ -62,6 +70,15 @@ typedef struct CSV_context {
         int         c_in;
         int         BOM_found;
         CSV_cfile   cfile;
+        CSV_ENGINE  engine;
+        size_t      value_len;     /* The length of the `value` given to `callback` */
+        char       *blk_buf;       /* Block-buffer for `CSV_ENGINE_BLOCK` */
+        size_t      blk_size;
+        size_t      blk_ptr;       /* Offset of next char to parse */
+        size_t      blk_end;       /* Offset of end of valid data */
+        size_t      blk_field;     /* Offset of start of current field */
+        size_t      blk_out;       /* Offset where the next char of the field is stored */
+        int         blk_eof;
       } CSV_context;
 
 extern int CSV_test_errors;
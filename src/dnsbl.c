@@ -8,6 +8,10 @@
  *   Used in dump.c to print the SBL (Spamhaus Block Reference)
  *   if found in the `DNSBL_list` smartlist.
  *
+ *   The blocks are looked up in a multibit trie (`DNSBL_trie4` and
+ *   `DNSBL_trie6`) built by `DNSBL_init()`. All the blocks an address
+ *   is in are found in one lookup.
+ *
  * Ref:
  *   http://www.spamhaus.org/drop/
  *
@@ -61,10 +65,44 @@ struct DNSBL_info {
        int        family;  /* AF_INET or AF_INET6 */
        DNSBL_type type;
        char       SBL_ref [10];
+       const struct DNSBL_info *parent;  /* The next less specific block containing this one */
      };
 
 static smartlist_t *DNSBL_list = NULL;
 
+/**
+ * \def DNSBL_STRIDE
+ *   The number of address-bits used at each level of the `DNSBL_trie`.
+ *   A node has `DNSBL_FANOUT` slots.
+ */
+#define DNSBL_STRIDE  4
+#define DNSBL_FANOUT  (1 << DNSBL_STRIDE)
+
+/**\struct DNSBL_slot
+ * A slot in a `DNSBL_trie` node.
+ */
+struct DNSBL_slot {
+       DWORD child;   /**< The index of the child-node; 0 if none */
+       DWORD match;   /**< 1 + the index in `DNSBL_list` of the most specific block ending at this level; 0 if none */
+     };
+
+/**\struct DNSBL_trie
+ * A multibit trie of the `DNSBL_list` blocks of one address family.
+ * A block of `bits` length is expanded into the slots of the node at
+ * level `(bits-1) / DNSBL_STRIDE`. Since the more specific blocks are added last,
+ * a slot holds the longest match at that level. The other matches for
+ * an address are found via `DNSBL_info::parent`.
+ */
+struct DNSBL_trie {
+       struct DNSBL_slot (*node)[DNSBL_FANOUT];  /**< node 0 is the root */
+       DWORD              num_nodes;
+       DWORD              max_nodes;
+       int                addr_len;              /**< 4 or 16 */
+     };
+
+static struct DNSBL_trie DNSBL_trie4 = { NULL, 0, 0, sizeof(struct in_addr) };
+static struct DNSBL_trie DNSBL_trie6 = { NULL, 0, 0, sizeof(struct in6_addr) };
+
 static void DNSBL_parse_DROP   (smartlist_t *sl, const char *line);
 static void DNSBL_parse_DROPv6 (smartlist_t *sl, const char *line);
 
@@ -107,159 +145,326 @@ static int DNSBL_compare_net (const void **_a, const void **_b)
   {
     const struct in6_addr *a_net = &a->u.ip6.network;
     const struct in6_addr *b_net = &b->u.ip6.network;
+    int   rc = memcmp (a_net, b_net, sizeof(*a_net));
 
-    return memcmp (a_net, b_net, sizeof(*a_net));
+    if (rc)
+       return (rc);
   }
-  return (0);
+
+  /* On the same network, the less specific block first.
+   */
+  return ((int)a->bits - (int)b->bits);
 }
 
 /**
- * `smartlist_bsearch()` helper; compare on IPv4 network range.
- *
- * \note the `mask`, `start_ip` and `end_ip` are all on network order.
+ * Return the network-address of `dnsbl` as bytes.
+ */
+static const BYTE *DNSBL_net_bytes (const struct DNSBL_info *dnsbl)
+{
+  if (dnsbl->family == AF_INET)
+     return (const BYTE*) &dnsbl->u.ip4.network;
+  return (const BYTE*) &dnsbl->u.ip6.network;
+}
+
+/**
+ * Return the `level`'th group of `DNSBL_STRIDE` bits in `addr`.
  */
-static int DNSBL_compare_is_on_net4 (const void *key, const void **member)
+static __inline unsigned DNSBL_nibble (const BYTE *addr, int level)
 {
-  const struct DNSBL_info *dnsbl = *member;
-  const struct in_addr    *ia    = key;
-  int   rc;
+  return (addr [level >> 1] >> ((level & 1) ? 0 : 4)) & (DNSBL_FANOUT - 1);
+}
+
+/**
+ * Return true if the first `bits` of `a1` and `a2` are equal.
+ */
+static bool DNSBL_prefix_equal (const BYTE *a1, const BYTE *a2, unsigned bits)
+{
+  unsigned bytes = bits / 8;
+  unsigned rest  = bits % 8;
+
+  if (memcmp(a1, a2, bytes))
+     return (false);
+  if (rest == 0)
+     return (true);
+  return (((a1[bytes] ^ a2[bytes]) & (0xFF << (8 - rest))) == 0);
+}
+
+/**
+ * Return true if block `outer` contains block `inner`.
+ */
+static bool DNSBL_contains (const struct DNSBL_info *outer, const struct DNSBL_info *inner)
+{
+  return (outer->family == inner->family && outer->bits <= inner->bits &&
+          DNSBL_prefix_equal(DNSBL_net_bytes(outer), DNSBL_net_bytes(inner), outer->bits));
+}
 
-  if (dnsbl->family != AF_INET)
+static DWORD DNSBL_trie_new_node (struct DNSBL_trie *trie)
+{
+  if (trie->num_nodes == trie->max_nodes)
   {
-    /* Since AF_INET6 networks are sorted last in 'DNSBL_list', force
-     * 'smartlist_bsearch_idx()' to look closer to index 0.
-     */
-    TRACE (3, "Wrong family\n");
-    return (-1);
+    DWORD max  = trie->max_nodes ? 2 * trie->max_nodes : 64;
+    void *more = realloc (trie->node, max * sizeof(*trie->node));
+
+    if (!more)
+       return (0);
+    trie->node      = more;
+    trie->max_nodes = max;
   }
+  memset (trie->node [trie->num_nodes], '\0', sizeof(*trie->node));
+  return (trie->num_nodes++);
+}
+
+/**
+ * Add the block `DNSBL_list[idx]` to `trie`.
+ * Must be called in the order of increasing `bits`.
+ */
+static bool DNSBL_trie_add (struct DNSBL_trie *trie, const struct DNSBL_info *dnsbl, int idx)
+{
+  const BYTE *net = DNSBL_net_bytes (dnsbl);
+  DWORD       node = 0;
+  int         level = 0;
+  unsigned    i, first, span;
 
-  rc = INET_util_range4cmp (ia, &dnsbl->u.ip4.network, dnsbl->bits);
+  if (trie->num_nodes == 0)
+  {
+    DNSBL_trie_new_node (trie);  /* the root */
+    if (trie->num_nodes == 0)
+       return (false);
+  }
 
-  if (g_cfg.trace_level >= 3)
+  while ((unsigned)(DNSBL_STRIDE * (level + 1)) < dnsbl->bits)
   {
-    char  net_str     [MAX_IP4_SZ+1];
-    char  mask_str    [MAX_IP4_SZ+1];
-    char  ip_str      [MAX_IP4_SZ+1];
-    char  start_ip_str[MAX_IP4_SZ+1];
-    char  end_ip_str  [MAX_IP4_SZ+1];
-    DWORD mask     = dnsbl->u.ip4.mask.s_addr;
-    DWORD netw     = dnsbl->u.ip4.network.s_addr;
-    DWORD start_ip = netw & mask;
-    DWORD end_ip   = start_ip | ~mask;
+    struct DNSBL_slot *slot = &trie->node [node] [DNSBL_nibble(net, level)];
 
-    INET_addr_ntop (AF_INET, &dnsbl->u.ip4.network, net_str, sizeof(net_str), NULL);
-    INET_addr_ntop (AF_INET, &dnsbl->u.ip4.mask, mask_str, sizeof(mask_str), NULL);
-    INET_addr_ntop (AF_INET, &ia->s_addr, ip_str, sizeof(ip_str), NULL);
-    INET_addr_ntop (AF_INET, &start_ip, start_ip_str, sizeof(start_ip_str), NULL);
-    INET_addr_ntop (AF_INET, &end_ip, end_ip_str, sizeof(end_ip_str), NULL);
+    if (!slot->child)
+    {
+      DWORD child = DNSBL_trie_new_node (trie);
 
-    TRACE (3, "ip: %-15s net: %-15s (%-12s - %-15s) mask: %-15s rc: %d\n",
-           ip_str, net_str, start_ip_str, end_ip_str, mask_str, rc);
+      if (!child)
+         return (false);
+      slot = &trie->node [node] [DNSBL_nibble(net, level)];  /* 'trie->node' could have moved */
+      slot->child = child;
+    }
+    node = slot->child;
+    level++;
   }
-  return (rc);
+
+  span  = 1 << (DNSBL_STRIDE * (level + 1) - dnsbl->bits);
+  first = DNSBL_nibble (net, level) & ~(span - 1);
+  for (i = first; i < first + span; i++)
+      trie->node [node] [i].match = idx + 1;
+  return (true);
+}
+
+static void DNSBL_trie_free (struct DNSBL_trie *trie)
+{
+  free (trie->node);
+  trie->node      = NULL;
+  trie->num_nodes = trie->max_nodes = 0;
 }
 
 /**
- * `smartlist_bsearch()` helper; compare on IPv6 network range.
+ * Return the most specific block in `trie` that `addr` is in; or NULL.
+ */
+static const struct DNSBL_info *DNSBL_trie_lookup (const struct DNSBL_trie *trie, const BYTE *addr)
+{
+  const struct DNSBL_slot *slot;
+  DWORD node  = 0;
+  DWORD match = 0;
+  int   level, levels = 2 * trie->addr_len;
+
+  if (trie->num_nodes == 0)
+     return (NULL);
+
+  for (level = 0; level < levels; level++)
+  {
+    slot = &trie->node [node] [DNSBL_nibble(addr, level)];
+    if (slot->match)
+       match = slot->match;
+    node = slot->child;
+    if (!node)
+       break;
+  }
+  return (match ? smartlist_get(DNSBL_list, match - 1) : NULL);
+}
+
+/**
+ * Build the `DNSBL_trie4` and `DNSBL_trie6` tries from the sorted `DNSBL_list`.
  *
- * \note the `mask`, `start_ip` and `end_ip` are all on network order.
+ * First set the `parent` of each block using a stack of the blocks containing
+ * the previous one. Then add the blocks to the tries in the order of
+ * increasing `bits`; for blocks with equal `bits`, in the order of `DNSBL_list`.
+ * Thus the last of duplicated blocks wins in the trie and its `parent` is
+ * the one before it.
  */
-static int DNSBL_compare_is_on_net6 (const void *key, const void **member)
+static void DNSBL_trie_build (void)
 {
-  const struct DNSBL_info *dnsbl = *member;
-  const struct in6_addr   *ia    = key;
-  int    rc = -1;
+  const struct DNSBL_info **stack;
+  int  *order;
+  int   i, max, top = 0;
+  int   count [IN6ADDRSZ*8 + 2];
+
+  max   = smartlist_len (DNSBL_list);
+  stack = malloc (max * sizeof(*stack));
+  order = malloc (max * sizeof(*order));
+  if (!stack || !order)
+  {
+    free (stack);
+    free ((void*)order);
+    return;
+  }
 
-  if (dnsbl->family != AF_INET6)
+  for (i = 0; i < max; i++)
   {
-    /* Since AF_INET6 networks are sorted last in 'DNSBL_list', force
-     * 'smartlist_bsearch_idx()' to look closer to the end-index.
-     */
-    TRACE (3, "Wrong family (%d)\n", dnsbl->family);
-    return (1);
+    struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, i);
+
+    while (top > 0 && !DNSBL_contains(stack[top-1], dnsbl))
+          top--;
+    dnsbl->parent = top > 0 ? stack [top-1] : NULL;
+    stack [top++] = dnsbl;
+  }
+
+  /* A counting sort on 'bits'; it keeps the list-order for equal 'bits'.
+   */
+  memset (&count, '\0', sizeof(count));
+  for (i = 0; i < max; i++)
+  {
+    const struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, i);
+
+    count [dnsbl->bits + 1]++;
   }
+  for (i = 1; i < DIM(count); i++)
+      count [i] += count [i-1];
+  for (i = 0; i < max; i++)
+  {
+    const struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, i);
 
-  rc = INET_util_range6cmp (ia, &dnsbl->u.ip6.network, dnsbl->bits);
+    order [count[dnsbl->bits]++] = i;
+  }
 
-  if (g_cfg.trace_level >= 3)
+  for (i = 0; i < max; i++)
   {
-    struct in6_addr start_ip, end_ip;
-    char   net_str     [MAX_IP6_SZ+1];
-    char   mask_str    [MAX_IP6_SZ+1];
-    char   ip_str      [MAX_IP6_SZ+1];
-    char   start_ip_str[MAX_IP6_SZ+1];
-    char   end_ip_str  [MAX_IP6_SZ+1];
-    int    i;
+    const struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, order[i]);
 
-    for (i = 0; i < IN6ADDRSZ; i++)
+    if (!DNSBL_trie_add(dnsbl->family == AF_INET ? &DNSBL_trie4 : &DNSBL_trie6, dnsbl, order[i]))
     {
-      start_ip.s6_bytes[i] = dnsbl->u.ip6.network.s6_bytes[i] & dnsbl->u.ip6.mask.s6_bytes[i];
-      end_ip.s6_bytes[i]   = start_ip.s6_bytes[i] | ~dnsbl->u.ip6.mask.s6_bytes[i];
+      TRACE (1, "Failed to build the DNSBL trie.\n");
+      DNSBL_trie_free (&DNSBL_trie4);
+      DNSBL_trie_free (&DNSBL_trie6);
+      break;
     }
-
-    INET_addr_ntop (AF_INET6, &dnsbl->u.ip6.network, net_str, sizeof(net_str), NULL);
-    INET_addr_ntop (AF_INET6, &dnsbl->u.ip6.mask, mask_str, sizeof(mask_str), NULL);
-    INET_addr_ntop (AF_INET6, &ia->s6_addr, ip_str, sizeof(ip_str), NULL);
-    INET_addr_ntop (AF_INET6, &start_ip, start_ip_str, sizeof(start_ip_str), NULL);
-    INET_addr_ntop (AF_INET6, &end_ip, end_ip_str, sizeof(end_ip_str), NULL);
-
-    TRACE (3, "ip: %-20s net: %-20s (%-20s - %-30s)\n"
-              "              mask: 0x%s, rc: %d\n",
-           strupr(ip_str),
-           strupr(net_str),
-           strupr(start_ip_str),
-           strupr(end_ip_str),
-           strupr(mask_str), rc);
   }
-  return (rc);
+
+  TRACE (2, "DNSBL trie: %lu IPv4 nodes, %lu IPv6 nodes (%s bytes).\n",
+         DNSBL_trie4.num_nodes, DNSBL_trie6.num_nodes,
+         dword_str((DNSBL_trie4.num_nodes + DNSBL_trie6.num_nodes) * sizeof(*DNSBL_trie4.node)));
+  free (stack);
+  free (order);
 }
 
 /**
- * Do a binary search in the `DNSBL_list` to figure out if
- * `ip4` or `ip6` address is a member of a **spam group**.
+ * Look up `ip4` or `ip6` address in the `DNSBL_trie4` or `DNSBL_trie6`
+ * to figure out if it is a member of one or more **spam groups**.
+ *
+ * An IPv4/IPv6 address can have more than 1 SBL reference; when it is in
+ * a block which is listed more than once or is inside a larger block.
+ * Up to `max` of these (the most specific first) are returned in `refs`.
  *
- * \note An IPv4/IPv6 address can have more than 1 SBL reference.
- *       This is currently unsupported.
- *       \eg{.}:
- *       Currently (as of January 2025), the IPv4 block `24.233.0.0/19`
- *       is listed in `drop.txt` as:
- *       ```
- *         24.233.0.0/19 ; SBL210084
- *       ```
+ * \retval the number of SBL references found. Can be more than `max`.
  */
-static bool DNSBL_check_common (const struct in_addr *ip4, const struct in6_addr *ip6, const char **sbl_ref)
+static int DNSBL_lookup (const struct in_addr *ip4, const struct in6_addr *ip6, const char **refs, int max)
 {
   const struct DNSBL_info *dnsbl;
-
-  if (sbl_ref)
-     *sbl_ref = NULL;
+  int   num = 0;
 
   if (!DNSBL_list)
-     return (false);
+     return (0);
+
+  if (ip4)
+       dnsbl = DNSBL_trie_lookup (&DNSBL_trie4, (const BYTE*)ip4);
+  else dnsbl = DNSBL_trie_lookup (&DNSBL_trie6, (const BYTE*)ip6);
+
+  for ( ; dnsbl; dnsbl = dnsbl->parent, num++)
+  {
+    if (num < max)
+       refs [num] = dnsbl->SBL_ref;
+  }
+  return (num);
+}
 
-  dnsbl = smartlist_bsearch (DNSBL_list,
-                             ip4 ? (const void*)ip4         : (const void*)ip6,
-                             ip4 ? DNSBL_compare_is_on_net4 : DNSBL_compare_is_on_net6);
-  if (sbl_ref && dnsbl)
-     *sbl_ref = dnsbl->SBL_ref;
+/**
+ * Return true if `ip4` or `ip6` address is a member of a **spam group**.
+ * And the most specific SBL reference in `*sbl_ref`.
+ */
+static bool DNSBL_check_common (const struct in_addr *ip4, const struct in6_addr *ip6, const char **sbl_ref)
+{
+  const char *ref = NULL;
+  int         num = DNSBL_lookup (ip4, ip6, &ref, 1);
 
-  return (dnsbl ? true : false);
+  if (sbl_ref)
+     *sbl_ref = ref;
+  return (num > 0);
 }
 
 bool DNSBL_check_ipv4 (const struct in_addr *ip4, const char **sbl_ref)
 {
+  INIT_DB_NEED (INIT_DB_DNSBL);
   if (!INET_util_addr_is_global(ip4, NULL))
-     return (false);
+  {
+    if (sbl_ref)
+       *sbl_ref = NULL;
+    return (false);
+  }
   return DNSBL_check_common (ip4, NULL, sbl_ref);
 }
 
 bool DNSBL_check_ipv6 (const struct in6_addr *ip6, const char **sbl_ref)
 {
+  INIT_DB_NEED (INIT_DB_DNSBL);
   if (!INET_util_addr_is_global(NULL, ip6))
-     return (false);
+  {
+    if (sbl_ref)
+       *sbl_ref = NULL;
+    return (false);
+  }
   return DNSBL_check_common (NULL, ip6, sbl_ref);
 }
 
+/**
+ * Return all the SBL references for a global `ip4` or `ip6` address.
+ * The most specific block first.
+ *
+ * \retval the number of SBL references found. Can be more than `max`.
+ */
+int DNSBL_get_refs (const struct in_addr *ip4, const struct in6_addr *ip6, const char **refs, int max)
+{
+  INIT_DB_NEED (INIT_DB_DNSBL);
+  if (!INET_util_addr_is_global(ip4, ip6))
+     return (0);
+  return DNSBL_lookup (ip4, ip6, refs, max);
+}
+
+/**
+ * Format the SBL references as `"SBL<ref1>, SBL<ref2>.."` into `buf`.
+ */
+char *DNSBL_refs_str (const char **refs, int num, char *buf, size_t size)
+{
+  char *p = buf;
+  int   i;
+
+  *p = '\0';
+  for (i = 0; i < num && i < DNSBL_MAX_REFS; i++)
+  {
+    int len = snprintf (p, size, "%sSBL%s", i > 0 ? ", " : "", refs[i]);
+
+    if (len < 0 || (size_t)len >= size)
+       break;
+    p    += len;
+    size -= len;
+  }
+  return (buf);
+}
+
 /**
  * Simply prints all the members of the `DNSBL_list` smartlist.
  */
@@ -305,20 +510,21 @@ static int DNSBL_test_single (const char *addr_str)
     struct in_addr  ip4;
     struct in6_addr ip6;
   } addr;
-  const char *sbl_ref = NULL;
+  const char *refs [DNSBL_MAX_REFS];
   const char *remark;
-  int   special, rc;
+  char  refs_buf [DNSBL_MAX_REFS * 15];
+  int   special, num;
 
   snprintf (addr_buf, sizeof(addr_buf), "\"%s\"", addr_str);
   if (INET_addr_pton2(AF_INET, addr_str, &addr.ip4) == 1)
   {
     special = INET_util_addr_is_special (&addr.ip4, NULL, &remark);
-    rc = DNSBL_check_common (&addr.ip4, NULL, &sbl_ref);
+    num = DNSBL_lookup (&addr.ip4, NULL, refs, DIM(refs));
   }
   else if (INET_addr_pton2(AF_INET6, addr_str, &addr.ip6) == 1)
   {
     special = INET_util_addr_is_special (NULL, &addr.ip6, &remark);
-    rc = DNSBL_check_common (NULL, &addr.ip6, &sbl_ref);
+    num = DNSBL_lookup (NULL, &addr.ip6, refs, DIM(refs));
   }
   else
   {
@@ -328,10 +534,110 @@ static int DNSBL_test_single (const char *addr_str)
 
   if (special)
      C_printf ("Address: %s is special; %s.\n", addr_buf, remark);
-  else if (sbl_ref)
-       C_printf ("Address: %s is listed as %s.\n", addr_buf, sbl_ref);
+  else if (num > 0)
+       C_printf ("Address: %s is listed as %s.\n", addr_buf, DNSBL_refs_str(refs, num, refs_buf, sizeof(refs_buf)));
   else C_printf ("Address: %s is not listed in any block-list.\n", addr_buf);
-  return (rc);
+  return (num > 0);
+}
+
+/**
+ * Return the number of blocks in `DNSBL_list` containing `addr`; by a linear search.
+ * And the most specific of these in `*best`.
+ */
+static int DNSBL_linear_lookup (int family, const void *addr, const struct DNSBL_info **best)
+{
+  int i, num = 0, max = smartlist_len (DNSBL_list);
+
+  *best = NULL;
+  for (i = 0; i < max; i++)
+  {
+    const struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, i);
+    int   rc;
+
+    if (dnsbl->family != family)
+       continue;
+    if (family == AF_INET)
+         rc = INET_util_range4cmp (addr, &dnsbl->u.ip4.network, dnsbl->bits);
+    else rc = INET_util_range6cmp (addr, &dnsbl->u.ip6.network, dnsbl->bits);
+    if (rc == 0)
+    {
+      if (!*best || dnsbl->bits > (*best)->bits)
+         *best = dnsbl;
+      num++;
+    }
+  }
+  return (num);
+}
+
+/**
+ * Check the tries against a linear search of `DNSBL_list`.
+ * For each block, look up the first and last address in it and the
+ * addresses just outside it.
+ */
+static int DNSBL_test_trie (void)
+{
+  int    i, j, k, max, errors = 0, lookups = 0;
+  double usec = 0.0;
+
+  max = DNSBL_list ? smartlist_len (DNSBL_list) : 0;
+  for (i = 0; i < max; i++)
+  {
+    const struct DNSBL_info *dnsbl = smartlist_get (DNSBL_list, i);
+    union {
+      struct in_addr  ip4;
+      struct in6_addr ip6;
+      BYTE            bytes [IN6ADDRSZ];
+    } addr [4];
+    int   len = (dnsbl->family == AF_INET) ? 4 : IN6ADDRSZ;
+
+    /* The first and last address in the block. Then one below and above that.
+     */
+    memcpy (&addr[0], DNSBL_net_bytes(dnsbl), len);
+    for (k = 0; k < len; k++)
+    {
+      BYTE mask = (8*k >= (int)dnsbl->bits) ? 0 :
+                  (8*k + 8 <= (int)dnsbl->bits) ? 0xFF : (BYTE) (0xFF << (8 - (dnsbl->bits - 8*k)));
+
+      addr[0].bytes[k] &= mask;
+      addr[1].bytes[k] = addr[0].bytes[k] | (BYTE)~mask;
+    }
+    addr[2] = addr[0];
+    addr[3] = addr[1];
+    for (k = len - 1; k >= 0 && addr[2].bytes[k]-- == 0; k--)
+        ;
+    for (k = len - 1; k >= 0 && ++addr[3].bytes[k] == 0; k--)
+        ;
+
+    for (j = 0; j < DIM(addr); j++)
+    {
+      const struct DNSBL_info *found, *best;
+      const char *refs [1];
+      int         n1, n2;
+      double      start = get_timestamp_now();
+
+      if (dnsbl->family == AF_INET)
+           n1 = DNSBL_lookup (&addr[j].ip4, NULL, refs, 1);
+      else n1 = DNSBL_lookup (NULL, &addr[j].ip6, refs, 1);
+      usec += get_timestamp_now() - start;
+      lookups++;
+
+      /* With duplicated blocks, the most specific can be any of them.
+       */
+      found = DNSBL_trie_lookup (dnsbl->family == AF_INET ? &DNSBL_trie4 : &DNSBL_trie6, addr[j].bytes);
+      n2 = DNSBL_linear_lookup (dnsbl->family, &addr[j], &best);
+      if (n1 != n2 || (found && found->bits != best->bits))
+      {
+        char buf [MAX_IP6_SZ+1];
+
+        INET_addr_ntop (dnsbl->family, &addr[j], buf, sizeof(buf), NULL);
+        if (errors++ < 10)
+           C_printf ("~5trie mismatch~0 for %s: %d vs. %d matches.\n", buf, n1, n2);
+      }
+    }
+  }
+  C_printf ("DNSBL trie: %d lookups, %d errors, %.3f usec/lookup.\n",
+            lookups, errors, lookups ? usec / lookups : 0.0);
+  return (errors);
 }
 
 /*
@@ -428,6 +734,8 @@ static int DNSBL_test (const char *addr_str)
     C_printf ("~1%-15s~0 -> %d, ~1SBL%-7s~0 %s~0  country: %s, location: %s~0\n",
               test->addr, res, sbl_ref, okay, country_code, location);
   }
+  DNSBL_test_trie();
+
   g_cfg.color_trace = save1;
   g_cfg.color_data  = save4;
   g_cfg.color_func  = save5;
@@ -485,11 +793,16 @@ void DNSBL_init (void)
    * But after merging them into one list, we must sort them ourself.
    */
   if (DNSBL_list)
-     smartlist_sort (DNSBL_list, DNSBL_compare_net);
+  {
+    smartlist_sort (DNSBL_list, DNSBL_compare_net);
+    DNSBL_trie_build();
+  }
 }
 
 void DNSBL_exit (void)
 {
+  DNSBL_trie_free (&DNSBL_trie4);
+  DNSBL_trie_free (&DNSBL_trie6);
   smartlist_wipe (DNSBL_list, free);
   DNSBL_list = NULL;
 }
@@ -600,6 +913,7 @@ static void DNSBL_parse_DROP (smartlist_t *sl, const char *line)
 
   INET_addr_pton2 (AF_INET, addr, &dnsbl->u.ip4.network);
   INET_util_get_mask4 (&dnsbl->u.ip4.mask, bits);
+  dnsbl->u.ip4.network.s_addr &= dnsbl->u.ip4.mask.s_addr;  /* the trie needs no host-bits */
 
   dnsbl->bits   = bits;
   dnsbl->type   = DNSBL_DROP;
@@ -615,13 +929,13 @@ static void DNSBL_parse_DROP (smartlist_t *sl, const char *line)
 static void DNSBL_parse_DROPv6 (smartlist_t *sl, const char *line)
 {
   struct DNSBL_info *dnsbl;
-  int                bits = 0;
+  int                i, bits = 0;
   char               addr [MAX_IP6_SZ+1];
 
   if (sscanf(line, "%[a-f0-9:]/%d ; SBL", addr, &bits) != 2)
      return;
 
-  if (bits < 8)   /* Cannot happen */
+  if (bits < 8 || bits > 128)   /* Cannot happen */
      return;
 
   dnsbl = malloc (sizeof(*dnsbl));
@@ -630,6 +944,8 @@ static void DNSBL_parse_DROPv6 (smartlist_t *sl, const char *line)
 
   INET_addr_pton2 (AF_INET6, addr, &dnsbl->u.ip6.network);
   INET_util_get_mask6 (&dnsbl->u.ip6.mask, bits);
+  for (i = 0; i < IN6ADDRSZ; i++)
+      dnsbl->u.ip6.network.s6_bytes[i] &= dnsbl->u.ip6.mask.s6_bytes[i];
 
   dnsbl->bits   = bits;
   dnsbl->type   = DNSBL_DROPv6;
@@ -8,8 +8,15 @@
 
 extern void DNSBL_init (void);
 extern void DNSBL_exit (void);
-extern bool DNSBL_check_ipv4 (const struct in_addr *ip4, const char **sbl_ref);
-extern bool DNSBL_check_ipv6 (const struct in6_addr *ip6, const char **sbl_ref);
+/**
+ * The max number of SBL references `DNSBL_refs_str()` formats.
+ */
+#define DNSBL_MAX_REFS  8
+
+extern bool  DNSBL_check_ipv4 (const struct in_addr *ip4, const char **sbl_ref);
+extern bool  DNSBL_check_ipv6 (const struct in6_addr *ip6, const char **sbl_ref);
+extern int   DNSBL_get_refs   (const struct in_addr *ip4, const struct in6_addr *ip6, const char **refs, int max);
+extern char *DNSBL_refs_str   (const char **refs, int num, char *buf, size_t size);
 extern int  DNSBL_update_files (bool force_update);
 
 #endif
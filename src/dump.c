@@ -25,6 +25,9 @@
 #include "_ipproto.h"
 #include "dnsbl.h"
 #include "dump.h"
+#include "sock_table.h"
+#include "annotate.h"
+#include "hex_dump.h"
 
 #include <mstcpip.h>
 #include <ws2bth.h>
@@ -1797,87 +1800,71 @@ const char *ioctlsocket_cmd_name (long cmd)
  * One dump-line is like:
  * "<prefix> 0000: 47 45 54 20 2F 20 48 54 54 50 2F 31 2E 31 0D 0A  GET / HTTP/1.1..\n"
  *
+ * The lines are formatted by hex_dump.c into a block and written out with
+ * `C_write_block()`. Only used while holding the trace lock; like `C_buf`.
  */
-#define CHECK_MAX_DATA(ofs) \
-        (g_cfg.max_data > 0 && (ofs) >= (unsigned)g_cfg.max_data-1)
+static hex_dump dump_hex;
 
-static UINT dump_data_internal (const void *data_p, unsigned data_len, const char *prefix)
+static void dump_hex_begin (void)
 {
-  const BYTE *data = (const BYTE*) data_p;
-  UINT  i = 0, j, ofs;
-
-  if (data_len == 0)
-     return (0);
-
+  hex_dump_init (&dump_hex, C_write_block, g_cfg.trace_binmode || g_cfg.trace_use_ods);
   C_puts ("~4");
+}
 
-  for (ofs = 0; ofs < data_len; ofs += 16)
-  {
-    C_indent (g_cfg.trace_indent+2);
-
-    if (prefix)
-    {
-      if (ofs == 0)
-           C_puts (prefix);
-      else C_indent (strlen(prefix));
-    }
-    C_puts (str_hex_word(ofs));
-    C_puts (": ");
-
-    for (i = j = 0; i < 16 && i+ofs < data_len; i++)
-    {
-      C_puts (str_hex_byte(data[i+ofs]));
-      C_putc (' ');
-      j = i;
-      if (CHECK_MAX_DATA(ofs+i))
-         break;
-    }
-
-    for ( ; j < 15; j++)     /* pad line to 16 positions */
-        C_puts ("   ");
-    C_putc (' ');
-
-    for (i = 0; i < 16 && i+ofs < data_len; i++)
-    {
-      int ch = data [i+ofs];
+static void dump_hex_end (void)
+{
+  hex_dump_flush (&dump_hex);
+  C_puts ("~0");
+}
 
-      if (ch < ' ' || ch >= 0x7F)    /* non-printable */
-           C_putc ('.');
-      else C_putc_raw (ch);
+/**
+ * Dump at most `g_cfg.max_data` bytes of `data_p` into `dump_hex`.
+ * Return the number of bytes dumped.
+ */
+static UINT dump_data_internal (const void *data_p, unsigned data_len, const char *prefix)
+{
+  unsigned len = data_len;
 
-      if (CHECK_MAX_DATA(ofs+i))
-         break;
-    }
-    C_putc ('\n');
+  if (g_cfg.max_data > 0 && len > (unsigned)g_cfg.max_data)
+     len = g_cfg.max_data;
 
-    if (CHECK_MAX_DATA(ofs+i))
-       break;
-  }
+  hex_dump_data (&dump_hex, data_p, len, g_cfg.trace_indent+2, prefix);
 
-  if (ofs + i < data_len - 1)
+  if (len < data_len)
   {
-    C_indent (g_cfg.trace_indent+2);
-    C_printf ("<%d more bytes...>\n", data_len-1 - ofs - i);
+    char more [100];
+
+    snprintf (more, sizeof(more), "%*s<%u more bytes...>", g_cfg.trace_indent+2, "", data_len - len);
+    hex_dump_line (&dump_hex, more);
   }
-  C_puts ("~0");
-  return (ofs + i);
+  return (len);
 }
 
 void dump_data (const void *data_p, unsigned data_len)
 {
-  if (g_cfg.max_data > 0)
-     dump_data_internal (data_p, data_len, NULL);
+  if (g_cfg.max_data <= 0 || data_len == 0)
+     return;
+
+  dump_hex_begin();
+  dump_data_internal (data_p, data_len, NULL);
+  dump_hex_end();
 }
 
+/**
+ * Dump the buffers of a `WSABUF` array into one block.
+ * The data is formatted directly from each buffer.
+ */
 void dump_wsabuf (const WSABUF *bufs, DWORD num_bufs)
 {
   UINT total = 0;
   int  i;
 
-  if (g_cfg.max_data <= 0)
+  if (g_cfg.max_data <= 0 || !bufs || num_bufs == 0)
      return;
 
-  for (i = 0; i < (int)num_bufs && bufs; i++, bufs++)
+  dump_hex_begin();
+
+  for (i = 0; i < (int)num_bufs; i++, bufs++)
   {
     char prefix [30];
 
@@ -1887,12 +1874,20 @@ void dump_wsabuf (const WSABUF *bufs, DWORD num_bufs)
      * the below 'dump_data_internal()' would crash.
      */
     if (IsBadReadPtr(bufs->buf, sizeof(bufs->buf) + bufs->len))
-         C_printf ("~4%*s%s bad: 0x%p, len: %lu~0\n",
-                   g_cfg.trace_indent+2, "", prefix, bufs->buf, bufs->len);
-    else total += dump_data_internal (bufs->buf, bufs->len, prefix);
+    {
+      char bad [100];
+
+      snprintf (bad, sizeof(bad), "%*s%s bad: 0x%p, len: %lu",
+                g_cfg.trace_indent+2, "", prefix, bufs->buf, bufs->len);
+      hex_dump_line (&dump_hex, bad);
+    }
+    else if (bufs->len > 0)
+      total += dump_data_internal (bufs->buf, bufs->len, prefix);
+
     if (total >= (UINT)g_cfg.max_data)
        break;
   }
+  dump_hex_end();
 }
 
 /**
@@ -1911,7 +1906,9 @@ static void print_control_buf (const WSABUF *buf)
   int save = g_cfg.max_data;
 
   g_cfg.max_data = buf->len;
+  dump_hex_begin();
   dump_data_internal (buf->buf, buf->len, "control: ");
+  dump_hex_end();
   g_cfg.max_data = save;
 }
 
@@ -2003,6 +2000,21 @@ void dump_tcp_info_v1 (const TCP_INFO_v1 *info, int err_code)
   ARGSUSED (err_code);
 }
 
+/**
+ * Called from `closesocket()` with what was known about the socket.
+ */
+void dump_sock_info (const struct sock_info *si)
+{
+  LARGE_INTEGER now;
+  double        msec;
+
+  QueryPerformanceCounter (&now);
+  msec = (double) (now.QuadPart - si->created) / (1000.0 * (double)g_data.clocks_per_usec);
+
+  C_printf ("%*s~4lifetime: %.3f msec, recv: %s bytes, sent: %s bytes.~0\n",
+            g_cfg.trace_indent+2, "", msec, qword_str(si->bytes_recv), qword_str(si->bytes_sent));
+}
+
 static char *maybe_wrap_line (int indent, int trailing_len, const char *start, char *out, int *added_p)
 {
   const char *newline    = strrchr (start, '\n');
@@ -2604,19 +2616,20 @@ static void dump_aliases (char *buf, size_t buf_sz, char **aliases)
  * But all of this happens inside a critical region. So that should
  * hopefully be okay.
  */
-static const char *cc_last   = NULL;    /**< CountryCode of previous address */
-static const char *loc_last  = NULL;    /**< Location of previous address */
-static position    pos_last;            /**< Position of previous address */
-static bool        cc_equal  = false;
-static bool        loc_equal = false;
-static bool        pos_equal = false;
+static char     cc_last  [3];        /**< CountryCode of previous address */
+static char     loc_last [100];      /**< Location of previous address */
+static position pos_last;            /**< Position of previous address */
+static bool     cc_equal  = false;
+static bool     loc_equal = false;
+static bool     pos_equal = false;
 
-static int C_printf_cc (const char            *country_code,
-                        const char            *location,
-                        const struct in_addr  *a4,
-                        const struct in6_addr *a6)
+static int C_printf_cc (const annotation *ann)
 {
-  const char *remark = NULL;
+  const struct in_addr  *a4 = (ann->family == AF_INET)  ? &ann->addr.ip4 : NULL;
+  const struct in6_addr *a6 = (ann->family == AF_INET6) ? &ann->addr.ip6 : NULL;
+  const char            *country_code = ann->has_country  ? ann->country  : NULL;
+  const char            *location     = ann->has_location ? ann->location : NULL;
+  const char            *remark = NULL;
 
   if (country_code && isalpha((int)*country_code))
   {
@@ -2631,18 +2644,17 @@ static int C_printf_cc (const char            *country_code,
      * \note There should be no way to have `location != NULL` and a
      *       `country_code == NULL`.
      */
-    cc_equal = (cc_last && !strcmp(country_code, cc_last));
+    cc_equal = (cc_last[0] && !strcmp(country_code, cc_last));
     if (!cc_equal)
        C_printf ("%s - %s", country_code, geoip_get_long_name_by_A2(country_code));
 
-    loc_equal = (location && loc_last && !strcmp(location, loc_last));
+    loc_equal = (location && loc_last[0] && !strcmp(location, loc_last));
     if (location && !loc_equal)
        C_printf (", %s", location);
 
     if (g_cfg.GEOIP.show_position || g_cfg.GEOIP.show_map_url)
     {
-      const position *pos = a4 ? geoip_get_position_by_ipv4 (a4) :
-                                 geoip_get_position_by_ipv6 (a6);
+      const position *pos = ann->has_position ? &ann->pos : NULL;
 
       if (pos)
            pos_equal = !memcmp(pos, &pos_last, sizeof(*pos));
@@ -2663,8 +2675,8 @@ static int C_printf_cc (const char            *country_code,
       else memset (&pos_last, '\0', sizeof(pos_last));
     }
 
-    cc_last  = country_code;
-    loc_last = location;
+    str_ncpy (cc_last, country_code, sizeof(cc_last));
+    str_ncpy (loc_last, location ? location : "", sizeof(loc_last));
   }
   else if (INET_util_addr_is_special(a4, a6, &remark))
   {
@@ -2691,8 +2703,8 @@ static int C_printf_cc (const char            *country_code,
  */
 static void cc_info_reset (void)
 {
-  cc_last  = loc_last  = NULL;
-  cc_equal = loc_equal = pos_equal = false;
+  cc_last[0] = loc_last[0] = '\0';
+  cc_equal   = loc_equal   = pos_equal = false;
   memset (&pos_last, '\0', sizeof(pos_last));
 }
 
@@ -2714,6 +2726,43 @@ static void check_and_dump_idna (const char *name)
   else C_printf ("failed for %s: %s\n", name, IDNA_strerror(_idna_errno));
 }
 
+/**
+ * Let `annotate_prefetch()` resolve all the addresses in a `hostent::h_addr_list`
+ * together. The following `annotate_get()` calls for them are then cache-hits.
+ */
+static void annotate_addresses (int family, const char **addresses)
+{
+  int num = 0;
+
+  while (addresses && addresses[num])
+        num++;
+  if (num > 1)
+     annotate_prefetch (family, (const void**)addresses, num);
+}
+
+/**
+ * As above, but for the addresses in an `addrinfo` list.
+ * Which can have both `AF_INET` and `AF_INET6` addresses.
+ */
+static void annotate_addrinfo (const struct addrinfo *ai)
+{
+  const void *addr4 [100];
+  const void *addr6 [100];
+  int         num4 = 0, num6 = 0;
+
+  for ( ; ai; ai = ai->ai_next)
+  {
+    if (ai->ai_family == AF_INET && num4 < DIM(addr4))
+       addr4 [num4++] = &((const struct sockaddr_in*)ai->ai_addr)->sin_addr;
+    else if (ai->ai_family == AF_INET6 && num6 < DIM(addr6))
+       addr6 [num6++] = &((const struct sockaddr_in6*)ai->ai_addr)->sin6_addr;
+  }
+  if (num4 > 1)
+     annotate_prefetch (AF_INET, addr4, num4);
+  if (num6 > 1)
+     annotate_prefetch (AF_INET6, addr6, num6);
+}
+
 void dump_countries (int type, const char **addresses)
 {
   int num;
@@ -2721,6 +2770,8 @@ void dump_countries (int type, const char **addresses)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addresses (type, addresses);
+
   WSAERROR_PUSH();
 
   C_indent (g_cfg.trace_indent+2);
@@ -2729,29 +2780,18 @@ void dump_countries (int type, const char **addresses)
 
   for (num = 0; addresses && addresses[num]; num++)
   {
-    const struct in_addr  *ia4 = NULL;
-    const struct in6_addr *ia6 = NULL;
-    const char            *cc  = NULL;
-    const char            *loc = NULL;
+    annotation ann;
 
     if (type == AF_INET)
-    {
-      ia4 = (const struct in_addr*) addresses[num];
-      cc  = geoip_get_country_by_ipv4 (ia4);
-      loc = geoip_get_location_by_ipv4 (ia4);
-    }
+       annotate_get ((const struct in_addr*)addresses[num], NULL, ANNOTATE_GEOIP, &ann);
     else if (type == AF_INET6)
-    {
-      ia6 = (const struct in6_addr*) addresses[num];
-      cc  = geoip_get_country_by_ipv6 (ia6);
-      loc = geoip_get_location_by_ipv6 (ia6);
-    }
+       annotate_get (NULL, (const struct in6_addr*)addresses[num], ANNOTATE_GEOIP, &ann);
     else
     {
       C_printf ("Unknown family: %d", type);
       break;
     }
-    if (C_printf_cc(cc, loc, ia4, ia6) && addresses[num+1])
+    if (C_printf_cc(&ann) && addresses[num+1])
        C_puts (", ");  /** \todo if `ai->ai_next` has a `loc_equal` or `pos_equal` to this `ai`, drop the comma */
   }
   cc_info_reset();
@@ -2803,6 +2843,8 @@ void dump_countries_addrinfo (const struct addrinfo *ai)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addrinfo (ai);
+
   WSAERROR_PUSH();
 
   C_indent (g_cfg.trace_indent+2);
@@ -2811,33 +2853,20 @@ void dump_countries_addrinfo (const struct addrinfo *ai)
 
   for (num = 0; ai; ai = ai->ai_next, num++)
   {
-    const struct sockaddr_in  *sa4 = NULL;
-    const struct sockaddr_in6 *sa6 = NULL;
-    const char                *cc  = NULL;
-    const char                *loc = NULL;
-    const struct in_addr      *ia4 = NULL;
-    const struct in6_addr     *ia6 = NULL;
+    const struct sockaddr_in  *sa4 = (const struct sockaddr_in*) ai->ai_addr;
+    const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6*) ai->ai_addr;
+    annotation                 ann;
 
     if (ai->ai_family == AF_INET)
-    {
-      sa4 = (const struct sockaddr_in*) ai->ai_addr;
-      ia4 = &sa4->sin_addr;
-      cc  = geoip_get_country_by_ipv4 (ia4);
-      loc = geoip_get_location_by_ipv4 (ia4);
-    }
+       annotate_get (&sa4->sin_addr, NULL, ANNOTATE_GEOIP, &ann);
     else if (ai->ai_family == AF_INET6)
-    {
-      sa6 = (const struct sockaddr_in6*) ai->ai_addr;
-      ia6 = &sa6->sin6_addr;
-      cc  = geoip_get_country_by_ipv6 (ia6);
-      loc = geoip_get_location_by_ipv6 (ia6);
-    }
+       annotate_get (NULL, &sa6->sin6_addr, ANNOTATE_GEOIP, &ann);
     else
     {
       C_printf ("Unknown family: %d", ai->ai_family);
       break;
     }
-    if (C_printf_cc(cc, loc, ia4, ia6) && ai->ai_next)
+    if (C_printf_cc(&ann) && ai->ai_next)
        C_puts (", ");  /** \todo if `ai->ai_next` has a `loc_equal` or `pos_equal` to this `ai`, drop the comma */
   }
   cc_info_reset();
@@ -2858,25 +2887,15 @@ static bool        iana_equal = false;
 /*
  * Common dumper of IANA information for a single address.
  */
-static void dump_IANA_info (const struct in_addr *ia4, const struct in6_addr *ia6, bool a_single_addr, int num)
+static void dump_IANA_info (const annotation *ann, bool a_single_addr, int num)
 {
-  struct IANA_record rec;
-  char   IANA_intro [100];
+  char IANA_intro [100];
 
   if (a_single_addr)
        snprintf (IANA_intro, sizeof(IANA_intro), "%*sIANA:   ", g_cfg.trace_indent+2, "");
   else snprintf (IANA_intro, sizeof(IANA_intro), "%*sIANA(%d): ", g_cfg.trace_indent+2, "", num);
 
-  if (ia4)
-  {
-    iana_find_by_ip4_address (ia4, &rec);
-    iana_print_rec (IANA_intro, &rec);
-  }
-  else
-  {
-    iana_find_by_ip6_address (ia6, &rec);
-    iana_print_rec (IANA_intro, &rec);
-  }
+  iana_print_rec (IANA_intro, ann->iana);
 }
 
 /**
@@ -2892,17 +2911,16 @@ static void iana_info_reset (void)
 /*
  * Common dumper of ASN information for a single address.
  */
-static void dump_ASN_info (const struct in_addr *ia4, const struct in6_addr *ia6, bool a_single_addr, int num)
+static void dump_ASN_info (const annotation *ann, bool a_single_addr, int num)
 {
-  char ASN_intro [100];
-  int  rc;
-
-  if (a_single_addr)
-       snprintf (ASN_intro, sizeof(ASN_intro), "%*sASN:    ", g_cfg.trace_indent+2, "");
-  else snprintf (ASN_intro, sizeof(ASN_intro), "%*sASN(%d):  ", g_cfg.trace_indent+2, "", num);
-
-  rc = ASN_libloc_print (ASN_intro, ia4, ia6, NULL);
-  if (rc > 0)
+  if (ann->ASN_printed)
+  {
+    if (a_single_addr)
+         C_printf ("%*sASN:    ", g_cfg.trace_indent+2, "");
+    else C_printf ("%*sASN(%d):  ", g_cfg.trace_indent+2, "", num);
+    C_puts (ann->ASN_text);
+  }
+  if (ann->ASN_rc > 0)
      C_putc ('\n');
 }
 
@@ -2917,18 +2935,22 @@ void dump_IANA_addresses (int family, const char **addresses)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addresses (family, addresses);
+
   C_puts ("~4");
   a_single_addr = (addresses && addresses[1] == NULL);
 
   for (num = 0; addresses && addresses[num]; num++)
   {
-    const struct in_addr  *ia4 = (const struct in_addr*) addresses[num];
-    const struct in6_addr *ia6 = (const struct in6_addr*) addresses[num];
+    annotation ann;
 
     if (family == AF_INET)
-       dump_IANA_info (ia4, NULL, a_single_addr, num);
+       annotate_get ((const struct in_addr*)addresses[num], NULL, ANNOTATE_IANA, &ann);
     else if (family == AF_INET6)
-       dump_IANA_info (NULL, ia6, a_single_addr, num);
+       annotate_get (NULL, (const struct in6_addr*)addresses[num], ANNOTATE_IANA, &ann);
+    else
+       continue;
+    dump_IANA_info (&ann, a_single_addr, num);
   }
   if (num == 0)
      C_puts ("None!?");
@@ -2972,6 +2994,8 @@ void dump_IANA_addrinfo  (const struct addrinfo *ai)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addrinfo (ai);
+
   C_puts ("~4");
   a_single_addr = (ai && !ai->ai_next);
 
@@ -2979,11 +3003,15 @@ void dump_IANA_addrinfo  (const struct addrinfo *ai)
   {
     const struct sockaddr_in  *sa4 = (const struct sockaddr_in*) ai->ai_addr;
     const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6*) ai->ai_addr;
+    annotation                 ann;
 
     if (ai->ai_family == AF_INET)
-       dump_IANA_info (&sa4->sin_addr, NULL, a_single_addr, num);
+       annotate_get (&sa4->sin_addr, NULL, ANNOTATE_IANA, &ann);
     else if (ai->ai_family == AF_INET6)
-       dump_IANA_info (NULL, &sa6->sin6_addr, a_single_addr, num);
+       annotate_get (NULL, &sa6->sin6_addr, ANNOTATE_IANA, &ann);
+    else
+       continue;
+    dump_IANA_info (&ann, a_single_addr, num);
 
 #if 0
     if (ai->ai_next)  /* add a newline if there is another address after this */
@@ -3010,18 +3038,22 @@ void dump_ASN_addresses (int family, const char **addresses)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addresses (family, addresses);
+
   C_puts ("~4");
   a_single_addr = (addresses && addresses[1] == NULL);
 
   for (num = 0; addresses && addresses[num]; num++)
   {
-    const struct in_addr  *ia4 = (const struct in_addr*) addresses[num];
-    const struct in6_addr *ia6 = (const struct in6_addr*) addresses[num];
+    annotation ann;
 
     if (family == AF_INET)
-       dump_ASN_info (ia4, NULL, a_single_addr, num);
+       annotate_get ((const struct in_addr*)addresses[num], NULL, ANNOTATE_ASN, &ann);
     else if (family == AF_INET6)
-       dump_ASN_info (NULL, ia6, a_single_addr, num);
+       annotate_get (NULL, (const struct in6_addr*)addresses[num], ANNOTATE_ASN, &ann);
+    else
+       continue;
+    dump_ASN_info (&ann, a_single_addr, num);
   }
   if (num == 0)
      C_puts ("None!?");
@@ -3061,6 +3093,8 @@ void dump_ASN_addrinfo  (const struct addrinfo *ai)
   if (g_cfg.trace_level <= 0)
      return;
 
+  annotate_addrinfo (ai);
+
   C_puts ("~4");
   a_single_addr = (ai && !ai->ai_next);
 
@@ -3068,12 +3102,15 @@ void dump_ASN_addrinfo  (const struct addrinfo *ai)
   {
     const struct sockaddr_in  *sa4 = (const struct sockaddr_in*) ai->ai_addr;
     const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6*) ai->ai_addr;
+    annotation                 ann;
 
     if (ai->ai_family == AF_INET)
-       dump_ASN_info (&sa4->sin_addr, NULL, a_single_addr, num);
+       annotate_get (&sa4->sin_addr, NULL, ANNOTATE_ASN, &ann);
     else if (ai->ai_family == AF_INET6)
-       dump_ASN_info (NULL, &sa6->sin6_addr, a_single_addr, num);
-
+       annotate_get (NULL, &sa6->sin6_addr, ANNOTATE_ASN, &ann);
+    else
+       continue;
+    dump_ASN_info (&ann, a_single_addr, num);
   }
   if (num == 0)
      C_puts ("None!?");
@@ -3199,22 +3236,35 @@ void dump_events (const WSANETWORKEVENTS *in_events, const WSANETWORKEVENTS *out
   _dump_events (true, out_events);
 }
 
+/**
+ * Print all the SBL references for an IPv4 or IPv6 address.
+ */
+static void dump_DNSBL_refs (const annotation *ann)
+{
+  if (ann->DNSBL_refs[0])
+     C_printf ("%*s~4DNSBL:  %s~0\n", g_cfg.trace_indent+2, "", ann->DNSBL_refs);
+}
+
+static void dump_DNSBL_addr (const struct in_addr *ia4, const struct in6_addr *ia6)
+{
+  annotation ann;
+
+  annotate_get (ia4, ia6, ANNOTATE_DNSBL, &ann);
+  dump_DNSBL_refs (&ann);
+}
+
 void dump_DNSBL (int family, const char **addresses)
 {
   int num;
 
+  annotate_addresses (family, addresses);
+
   for (num = 0; addresses && addresses[num]; num++)
   {
-    const struct in_addr  *ia4 = (const struct in_addr*) addresses[num];
-    const struct in6_addr *ia6 = (const struct in6_addr*) addresses[num];
-    const char            *sbl_ref = NULL;
-
     if (family == AF_INET)
-         DNSBL_check_ipv4 (ia4, &sbl_ref);
+         dump_DNSBL_addr ((const struct in_addr*)addresses[num], NULL);
     else if (family == AF_INET6)
-         DNSBL_check_ipv6 (ia6, &sbl_ref);
-    if (sbl_ref)
-       C_printf ("%*s~4DNSBL:  SBL%s~0\n", g_cfg.trace_indent+2, "", sbl_ref);
+         dump_DNSBL_addr (NULL, (const struct in6_addr*)addresses[num]);
   }
 }
 
@@ -3247,27 +3297,96 @@ void dump_DNSBL_addrinfo (const struct addrinfo *ai)
 {
   int num;
 
+  annotate_addrinfo (ai);
+
   for (num = 0; ai; ai = ai->ai_next, num++)
   {
     const struct sockaddr_in  *sa4;
     const struct sockaddr_in6 *sa6;
-    const char                *sbl_ref = NULL;
 
     if (ai->ai_family == AF_INET)
     {
       sa4 = (const struct sockaddr_in*) ai->ai_addr;
-      DNSBL_check_ipv4 (&sa4->sin_addr, &sbl_ref);
+      dump_DNSBL_addr (&sa4->sin_addr, NULL);
     }
     else if (ai->ai_family == AF_INET6)
     {
       sa6 = (const struct sockaddr_in6*) ai->ai_addr;
-      DNSBL_check_ipv6 (&sa6->sin6_addr, &sbl_ref);
+      dump_DNSBL_addr (NULL, &sa6->sin6_addr);
     }
-    if (sbl_ref)
-       C_printf ("%*s~4DNSBL:  SBL%s~0\n", g_cfg.trace_indent+2, "", sbl_ref);
   }
 }
 
+/**
+ * Does the same as calling `dump_countries_sockaddr()`, `dump_IANA_sockaddr()`,
+ * `dump_ASN_sockaddr()` and `dump_DNSBL_sockaddr()` for the enabled databases.
+ * But with only one `annotate_get()` for the address.
+ */
+void dump_annotations_sockaddr (const struct sockaddr *sa)
+{
+  const struct sockaddr_in  *sa4 = (const struct sockaddr_in*) sa;
+  const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6*) sa;
+  annotation                 ann;
+  DWORD                      want = 0;
+
+  if (!sa || g_cfg.trace_level <= 0)
+     return;
+
+  if (g_cfg.GEOIP.enable)
+     want |= ANNOTATE_GEOIP;
+  if (g_cfg.IANA.enable)
+     want |= ANNOTATE_IANA;
+  if (g_cfg.ASN.enable)
+     want |= ANNOTATE_ASN;
+  if (g_cfg.DNSBL.enable)
+     want |= ANNOTATE_DNSBL;
+
+  if (want == 0)
+     return;
+
+  WSAERROR_PUSH();
+
+  if (sa->sa_family == AF_INET)
+     annotate_get (&sa4->sin_addr, NULL, want, &ann);
+  else if (sa->sa_family == AF_INET6)
+     annotate_get (NULL, &sa6->sin6_addr, want, &ann);
+  else
+  {
+    WSAERROR_POP();
+    return;
+  }
+
+  if (want & ANNOTATE_GEOIP)
+  {
+    C_indent (g_cfg.trace_indent+2);
+    C_printf ("~4geo-IP: ");
+    cc_info_reset();
+    C_printf_cc (&ann);
+    cc_info_reset();
+    C_puts ("~0\n");
+  }
+
+  if (want & ANNOTATE_IANA)
+  {
+    C_puts ("~4");
+    dump_IANA_info (&ann, true, 0);
+    C_puts ("~0");
+    iana_info_reset();
+  }
+
+  if (want & ANNOTATE_ASN)
+  {
+    C_puts ("~4");
+    dump_ASN_info (&ann, true, 0);
+    C_puts ("~0");
+  }
+
+  if (want & ANNOTATE_DNSBL)
+     dump_DNSBL_refs (&ann);
+
+  WSAERROR_POP();
+}
+
 /*
  * Dump the GUIDs and the address of the assosiated extension-function.
  * Called from 'WSAIoctl()' when 'code == SIO_GET_EXTENSION_FUNCTION_POINTER'.
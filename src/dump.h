@@ -16,6 +16,7 @@ extern void dump_wsabuf     (const WSABUF *bufs, DWORD num_bufs);
 extern void dump_wsamsg     (const WSAMSG *msg, int rc);
 extern void dump_tcp_info_v0(const TCP_INFO_v0 *info, int err_code);
 extern void dump_tcp_info_v1(const TCP_INFO_v1 *info, int err_code);
+extern void dump_sock_info  (const struct sock_info *si);
 extern void dump_icmp_error (const ICMP_ERROR_INFO *icmp_error);
 
 extern void dump_hostent   (const char *name, const struct hostent *h);
@@ -51,6 +52,8 @@ extern void dump_DNSBL          (int family, const char **addresses);
 extern void dump_DNSBL_sockaddr (const struct sockaddr *sa);
 extern void dump_DNSBL_addrinfo (const struct addrinfo *ai);
 
+extern void dump_annotations_sockaddr (const struct sockaddr *sa);
+
 extern const char *socket_family (int family);
 extern const char *socket_type (int type);
 extern const char *socket_flags (int flags);
@@ -1751,6 +1751,7 @@ static bool fw_init (void)
   SBL_entries    = smartlist_new();
   rule_orphans   = smartlist_new();
 
+  INIT_DB_NEED (INIT_DB_GEOIP);
   fw_have_ip2loc4 = (ip2loc_num_ipv4_entries() > 0);
   fw_have_ip2loc6 = (ip2loc_num_ipv6_entries() > 0);
 
@@ -3866,29 +3867,35 @@ static void print_ASN_info (const struct in_addr *ia4, const struct in6_addr *ia
  */
 static bool print_DNSBL_info (const struct in_addr *ia4, const struct in6_addr *ia6)
 {
-  const char *sbl_ref = NULL;
-  int         i, max;
-  bool        rc, found = false;
+  const char *refs [DNSBL_MAX_REFS];
+  char        buf [DNSBL_MAX_REFS * 15];
+  int         i, j, max, num;
+  bool        found;
 
   if (!g_cfg.DNSBL.enable || !INET_util_addr_is_global(ia4, ia6))
      return (false);
 
-  rc = ia4 ? DNSBL_check_ipv4 (ia4, &sbl_ref) : DNSBL_check_ipv6 (ia6, &sbl_ref);
-  if (!rc || !sbl_ref)
+  num = DNSBL_get_refs (ia4, ia6, refs, DIM(refs));
+  if (num == 0)
      return (false);
 
-  max = smartlist_len (SBL_entries);
-  for (i = 0; i < max && !found; i++)
-      if (!strcmp(smartlist_get(SBL_entries, i), sbl_ref))
-         found = true;
+  /* Remember each of the SBL references the address is listed in.
+   */
+  for (j = 0; j < num && j < DIM(refs); j++)
+  {
+    max = smartlist_len (SBL_entries);
+    for (i = 0, found = false; i < max && !found; i++)
+        if (!strcmp(smartlist_get(SBL_entries, i), refs[j]))
+           found = true;
 
-  if (!found)
-     smartlist_add (SBL_entries, strdup(sbl_ref));
+    if (!found)
+       smartlist_add (SBL_entries, strdup(refs[j]));
+  }
 
   fw_play_sound (&g_cfg.FIREWALL.sound.beep.event_DNSBL);
 
   num_SBL_hits++;   /* Increment total "SpamHaus Block List" hits */
-  fw_buf_addf ("%-*sSBL-ref: %s\n", fw_indent_sz, "", sbl_ref);
+  fw_buf_addf ("%-*sDNSBL:   %s\n", fw_indent_sz, "", DNSBL_refs_str(refs, num, buf, sizeof(buf)));
   return (true);
 }
 
@@ -3899,11 +3906,12 @@ static bool print_DNSBL_info (const struct in_addr *ia4, const struct in6_addr *
 static void get_port (const _FWPM_NET_EVENT_HEADER3 *header, WORD port, char *port_str)
 {
   const struct servent *se;
+  struct servent        buf;
 
   if (header->ipProtocol == IPPROTO_TCP)
-     se = ws_getservbyport (_byteswap_ushort(port), "tcp", false, false);
+     se = ws_getservbyport (_byteswap_ushort(port), "tcp", false, false, &buf);
   else if (header->ipProtocol == IPPROTO_UDP)
-     se = ws_getservbyport (_byteswap_ushort(port), "udp", false, false);
+     se = ws_getservbyport (_byteswap_ushort(port), "udp", false, false, &buf);
   else
      se = NULL;
 
@@ -4684,6 +4692,7 @@ int firewall_main (int argc, char **argv)
   char   *program  = NULL;
   char   *log_file = NULL;
   FILE   *log_f    = NULL;
+  FILE   *log_old  = NULL;
   WSADATA wsa;
   WORD    ver = MAKEWORD (2, 2);
 
@@ -4777,12 +4786,17 @@ int firewall_main (int argc, char **argv)
   if (log_file)
   {
     log_f = fopen (log_file, "wb+");
-    g_cfg.trace_stream = log_f;
-    if (!g_cfg.trace_stream)
+    if (!log_f)
     {
       fprintf (stderr, "Failed to create log-file %s: %s.\n", log_file, strerror(errno));
       goto quit;
     }
+    log_old = g_cfg.trace_stream;
+    if (!C_set_stream(log_f))
+    {
+      fprintf (stderr, "Can not log to %s with a compressed or rotated trace-file.\n", log_file);
+      goto quit;
+    }
   }
 
   if (program_only)
@@ -4854,7 +4868,11 @@ quit:
   free (program);
   free (log_file);
   if (log_f)
-     fclose (log_f);
+  {
+    if (g_cfg.trace_stream == log_f)
+       C_set_stream (log_old);
+    fclose (log_f);
+  }
 
   return (rc);
 }
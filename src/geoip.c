@@ -73,6 +73,7 @@
 #include "getopt.h"
 #include "dnsbl.h"
 #include "geoip.h"
+#include "miniz.h"
 
 /** Number of calls for `smartlist_bsearch()` to find an IPv4 entry. <br>
  *  Used in `test_addr4()` only.
@@ -94,6 +95,12 @@ static void geoip_make_c_lists (void);
 static void geoip_free_c_lists (void);
 static void geoip_stats_update (const char *country_A2, int flag);
 static int  geoip_get_num_addr (DWORD *num4, DWORD *num6);
+static void geoip4_index_build (void);
+static void geoip6_index_build (void);
+static void geoip_index_free (void);
+static size_t geoip_index_size (int family, DWORD num);
+static DWORD  geoip_snapshot_load (const char *csv_file, int family);
+static void   geoip_snapshot_write (const char *csv_file, const struct stat *st_csv, int family, WORD num_cc);
 
 /**
  * Geoip specific smartlist; list of IPv4 blocks.
@@ -105,18 +112,76 @@ static smartlist_t *geoip_ipv4_entries = NULL;
  */
 static smartlist_t *geoip_ipv6_entries = NULL;
 
+/**\struct geoip_u128
+ *
+ * An IPv6-address as a 128-bit number on host order.
+ * Compares the same way as a `memcmp()` of the `s6_addr[]` bytes.
+ */
+struct geoip_u128 {
+       uint64 hi;       /**< The first 8 bytes of the address */
+       uint64 lo;       /**< The last 8 bytes of the address */
+     };
+
+/**\struct geoip4_index
+ *
+ * A compiled, flat structure-of-arrays version of `geoip_ipv4_entries`.
+ * Built once by `geoip4_index_build()` after the list got sorted.
+ *
+ * The arrays are in *Eytzinger* (BFS) order; element 0 is unused and
+ * the children of node `k` are `2*k` and `2*k+1`. Hence the top levels
+ * of the search share a few cache-lines and there is no pointer chasing.
+ */
+struct geoip4_index {
+       DWORD   num;             /**< The number of ranges */
+       DWORD  *low;             /**< `[num+1]` lowest address of each range */
+       DWORD  *high;            /**< `[num+1]` highest address of each range */
+       WORD   *cc_idx;          /**< `[num+1]` index into `cc_table[]` */
+       char  (*cc_table)[3];    /**< `geoip_cc_table[]` or the one in a snapshot */
+       BYTE   *mem;             /**< The allocated arrays if built from the CSV-file */
+       HANDLE  map_hnd;         /**< The file-mapping if loaded from a snapshot */
+       BYTE   *map_view;        /**< And the view of it */
+     };
+
+/**\struct geoip6_index
+ *
+ * Same as `struct geoip4_index`, but for `geoip_ipv6_entries`.
+ */
+struct geoip6_index {
+       DWORD              num;            /**< The number of ranges */
+       struct geoip_u128 *low;            /**< `[num+1]` lowest address of each range */
+       struct geoip_u128 *high;           /**< `[num+1]` highest address of each range */
+       WORD              *cc_idx;         /**< `[num+1]` index into `cc_table[]` */
+       char             (*cc_table)[3];   /**< `geoip_cc_table[]` or the one in a snapshot */
+       BYTE              *mem;            /**< The allocated arrays if built from the CSV-file */
+       HANDLE             map_hnd;        /**< The file-mapping if loaded from a snapshot */
+       BYTE              *map_view;       /**< And the view of it */
+     };
+
+static struct geoip4_index geoip4_index;
+static struct geoip6_index geoip6_index;
+
+/**
+ * The unique country-codes (or `-X` remarks) referred to by the
+ * `cc_idx[]` arrays above. Slot 0 is the empty string.
+ */
+#define GEOIP_MAX_CC  1024
+
+static char  geoip_cc_table [GEOIP_MAX_CC][3];
+static WORD  geoip_cc_num = 0;
+static WORD *geoip_cc_map = NULL;   /* Only used while building the indices */
+
 /**\struct geoip_stats
  *
  * Structure for counting countries found at run-time.
  */
 struct geoip_stats {
-       uint64  num4;         /**< Total # of times seen in an IPv4-address */
-       uint64  num6;         /**< Total # of times seen in an IPv6-address */
-       char    country [2];  /**< 2 letter ISO-3166 2 letter Country-code */
-       char    flag;         /**< The country was seen in IPv4 or IPv6 address(es). <br>
-                              *   If the address was found by `ip2loc_get_ipv4_entry()` or `ip2loc_get_ipv6_entry()`
-                              *   the flag `GEOIP_VIA_IP2LOC` is also set.
-                              */
+       volatile LONG64 num4;         /**< Total # of times seen in an IPv4-address */
+       volatile LONG64 num6;         /**< Total # of times seen in an IPv6-address */
+       char            country [2];  /**< 2 letter ISO-3166 2 letter Country-code */
+       volatile LONG   flag;         /**< The country was seen in IPv4 or IPv6 address(es). <br>
+                                      *   If the address was found by `ip2loc_lookup_ipv4()` or `ip2loc_lookup_ipv6()`
+                                      *   the flag `GEOIP_VIA_IP2LOC` is also set.
+                                      */
     };
 
 /**
@@ -128,17 +193,50 @@ struct geoip_stats {
  *
  * \def GEOIP_VIA_IP2LOC
  *      The flag for `geoip_stats_update()` if the address was found by
- *      `ip2loc_get_ipv4_entry()` or `ip2loc_get_ipv6_entry()`.
+ *      `ip2loc_lookup_ipv4()` or `ip2loc_lookup_ipv6()`.
  */
 #define GEOIP_STAT_IPV4   0x01
 #define GEOIP_STAT_IPV6   0x02
 #define GEOIP_VIA_IP2LOC  0x04
 
+/*
+ * Internal flags; the country was counted in `geoip_stats_num.ip2loc4` or
+ * `geoip_stats_num.ip2loc6`.
+ */
+#define GEOIP_COUNTED_IP2LOC4  0x10
+#define GEOIP_COUNTED_IP2LOC6  0x20
+
 /**
  * An array of statistics for each country.
  * Updated by `geoip_stats_update()` as countries are discovered from IPv4/IPv6 addresses.
+ *
+ * The counters are updated with `Interlocked*()` functions and do not rely
+ * on the caller holding the trace-lock. Most callers do, but annotate.c
+ * resolves addresses outside it's shard locks and does not assume it.
+ * Per-thread counters would need a TLS slot and a merge at report time;
+ * for little gain since a country counter is rarely contended.
+ *
+ * Set by `geoip_stats_init()` only after `geoip_stats_idx[]` is built.
+ */
+static struct geoip_stats *volatile geoip_stats_buf = NULL;
+
+/**
+ * A direct-mapped index from a 2 letter country-code to `geoip_stats_buf[]`.
+ * Index `26 * (A2[0] - 'A') + A2[1] - 'A'` holds the element-number + 1.
+ * Or 0 for an unknown country-code.
+ */
+#define GEOIP_STATS_IDX_SIZE  (26*26)
+
+static WORD geoip_stats_idx [GEOIP_STATS_IDX_SIZE];
+
+/**
+ * The number of unique countries; as returned by `geoip_num_unique_countries()`.
+ * Counted by `geoip_stats_update()` when a country is seen the first time.
  */
-static struct geoip_stats *geoip_stats_buf = NULL;
+static struct {
+       volatile LONG ip4, ip6;
+       volatile LONG ip2loc4, ip2loc6;
+     } geoip_stats_num;
 
 /**
  * `smartlist_sort()` helper.
@@ -287,24 +385,17 @@ static void geoip_ipv6_add_specials (void)
 }
 
 /**
- * Open and parse a GeoIP file.
+ * Open and parse a GeoIP CSV-file into the `geoip_ipv4_entries` or
+ * `geoip_ipv6_entries` smartlist and sort it.
  *
  * \param[in] file   the file on CVS format to read and parse.
  * \param[in] family the address family of the file; `AF_INET` or `AF_INET6`.
  */
-static DWORD geoip_parse_file (const char *file, int family)
+static DWORD geoip_parse_csv (const char *file, int family)
 {
   struct CSV_context ctx;
   DWORD  num = 0;
 
-  TRACE (4, "address-family: %d, file: %s.\n", family, file);
-
-  if (!file || !file_exists(file))
-  {
-    TRACE (2, "Geoip-file \"%s\" does not exist.\n", file);
-    return (0);
-  }
-
   if (family == AF_INET)
   {
     assert (geoip_ipv4_entries == NULL);
@@ -347,6 +438,61 @@ static DWORD geoip_parse_file (const char *file, int family)
   return (num);
 }
 
+/**
+ * Load a GeoIP file into the `geoip4_index` or `geoip6_index`.
+ *
+ * If `g_cfg.GEOIP.use_snapshot` is set, first try to map an up-to-date
+ * snapshot of it. Otherwise parse the CSV-file, compile the index and
+ * write a new snapshot for the next time.
+ *
+ * \param[in] file   the file on CVS format to read and parse.
+ * \param[in] family the address family of the file; `AF_INET` or `AF_INET6`.
+ */
+static DWORD geoip_parse_file (const char *file, int family)
+{
+  struct stat st_csv;
+  DWORD num;
+  WORD  num_cc;
+
+  TRACE (4, "address-family: %d, file: %s.\n", family, file);
+
+  if (!file || !file_exists(file))
+  {
+    TRACE (2, "Geoip-file \"%s\" does not exist.\n", file);
+    return (0);
+  }
+
+  if (g_cfg.GEOIP.use_snapshot)
+  {
+    num = geoip_snapshot_load (file, family);
+    if (num > 0)
+       return (num);
+  }
+
+  if (stat(file, &st_csv) != 0)
+     return (0);
+
+  num = geoip_parse_csv (file, family);
+  if (num == 0)
+     return (0);
+
+  /* The IPv4 and IPv6 indices shares the `geoip_cc_table[]`.
+   * Lock it in case the other family is loaded in another thread.
+   * The slots below `num_cc` are not changed after that; the snapshot
+   * is written after the lock is released.
+   */
+  ENTER_CRIT();
+  if (family == AF_INET)
+       geoip4_index_build();
+  else geoip6_index_build();
+  num_cc = geoip_cc_num;
+  LEAVE_CRIT (0);
+
+  if (g_cfg.GEOIP.use_snapshot)
+     geoip_snapshot_write (file, &st_csv, family, num_cc);
+  return (num);
+}
+
 /**
  * The main init function for this module.
  * Normally called from `wsock_trace_init()`.
@@ -358,20 +504,51 @@ static DWORD geoip_parse_file (const char *file, int family)
  *                        the `g_cfg.GEOIP.ip6_file` file.
  */
 int geoip_init (DWORD *_num4, DWORD *_num6)
+{
+  geoip_load (AF_INET);
+  geoip_load (AF_INET6);
+  ip2loc_init();
+  return geoip_init_finish (_num4, _num6);
+}
+
+/**
+ * Load the `g_cfg.GEOIP.ip4_file` or `g_cfg.GEOIP.ip6_file`.
+ *
+ * The 2 families are independent and could be loaded by 2 threads.
+ * Called from `geoip_init()` or from the init-jobs in `wsock_trace_init()`.
+ * `geoip_init_finish()` must be called when both are done.
+ *
+ * \param[in] family  `AF_INET` or `AF_INET6`.
+ */
+DWORD geoip_load (int family)
+{
+  if (!g_cfg.GEOIP.enable)
+     return (0);
+  if (family == AF_INET)
+     return geoip_parse_file (g_cfg.GEOIP.ip4_file, AF_INET);
+  return geoip_parse_file (g_cfg.GEOIP.ip6_file, AF_INET6);
+}
+
+/**
+ * Finish the init after `geoip_load()` and `ip2loc_init()` are done.
+ * Disable this module if no addresses were loaded.
+ *
+ * \param[in,out]  _num4  Number of IPv4-addresses loaded.
+ * \param[in,out]  _num6  Number of IPv6-addresses loaded.
+ */
+int geoip_init_finish (DWORD *_num4, DWORD *_num6)
 {
   DWORD num4 = 0, num6 = 0;
 
-  if (g_cfg.GEOIP.enable)
+  geoip_get_num_addr (&num4, &num6);
+  if (num4 == 0 && num6 == 0 && g_cfg.GEOIP.enable)
   {
-    num4 = geoip_parse_file (g_cfg.GEOIP.ip4_file, AF_INET);
-    num6 = geoip_parse_file (g_cfg.GEOIP.ip6_file, AF_INET6);
+    g_cfg.GEOIP.enable = false;
+    ip2loc_exit();
   }
-  if (num4 == 0 && num6 == 0)
-     g_cfg.GEOIP.enable = false;
 
   geoip_make_c_lists();
   geoip_stats_init();
-  ip2loc_init();
 
   return geoip_get_num_addr (_num4, _num6);
 }
@@ -386,6 +563,7 @@ void geoip_exit (void)
   smartlist_wipe (geoip_ipv6_entries, free);
 
   geoip_ipv4_entries = geoip_ipv6_entries = NULL;
+  geoip_index_free();
   geoip_stats_exit();
   geoip_free_c_lists();
   ip2loc_exit();
@@ -466,59 +644,708 @@ static int geoip4_add_entry (DWORD low, DWORD high, const char *country)
   if (!entry)
      return (0);
 
-  entry->low  = low;
-  entry->high = high;
-  memcpy (&entry->country, country, sizeof(entry->country));
-  smartlist_add (geoip_ipv4_entries, entry);
-  return (1);
+  entry->low  = low;
+  entry->high = high;
+  memcpy (&entry->country, country, sizeof(entry->country));
+  smartlist_add (geoip_ipv4_entries, entry);
+  return (1);
+}
+
+/**
+ * Add an IPv6 entry to the `geoip_ipv6_entries` smart-list.
+ *
+ * \param[in] low      The lowest address in the IPv6-block.
+ * \param[in] high     The highest address in the IPv6-block.
+ * \param[in] country  The short country associated with this IPv6-block. <br>
+ *                     Or the `-X` remark if this IPv6-block is a special address.
+ */
+static int geoip6_add_entry (const struct in6_addr *low, const struct in6_addr *high, const char *country)
+{
+  struct ipv6_node *entry = malloc (sizeof(*entry));
+
+  if (!entry)
+     return (0);
+
+  memcpy (&entry->low, low, sizeof(entry->low));
+  memcpy (&entry->high, high, sizeof(entry->high));
+  memcpy (&entry->country, country, sizeof(entry->country));
+  smartlist_add (geoip_ipv6_entries, entry);
+  return (1);
+}
+
+/**
+ * Return the slot in `geoip_cc_table[]` for a country-code.
+ * Add it if not already there.
+ *
+ * \param[in] country  The short country (or `-X` remark) to lookup.
+ */
+static WORD geoip_cc_slot (const char *country)
+{
+  WORD key = (WORD) ((BYTE)country[0] + ((BYTE)country[1] << 8));
+
+  if (key == 0)
+     return (0);
+
+  if (!geoip_cc_map)
+  {
+    geoip_cc_map = calloc (USHRT_MAX+1, sizeof(*geoip_cc_map));
+    if (!geoip_cc_map)
+       return (0);
+  }
+  if (geoip_cc_num == 0)
+     geoip_cc_num = 1;    /* slot 0 == "" */
+
+  if (geoip_cc_map[key] == 0)
+  {
+    WORD i;
+
+    /* The map is freed after each build; check the table first.
+     */
+    for (i = 1; i < geoip_cc_num; i++)
+        if (geoip_cc_table[i][0] == country[0] && geoip_cc_table[i][1] == country[1])
+        {
+          geoip_cc_map [key] = i;
+          return (i);
+        }
+
+    if (geoip_cc_num >= GEOIP_MAX_CC)
+    {
+      TRACE (1, "Too many country-codes; \"%.2s\" ignored.\n", country);
+      return (0);
+    }
+    geoip_cc_table [geoip_cc_num][0] = country[0];
+    geoip_cc_table [geoip_cc_num][1] = country[1];
+    geoip_cc_table [geoip_cc_num][2] = '\0';
+    geoip_cc_map [key] = geoip_cc_num++;
+  }
+  return (geoip_cc_map[key]);
+}
+
+/**
+ * Convert an IPv6-address to a `struct geoip_u128`.
+ */
+static void geoip_in6_to_u128 (const struct in6_addr *addr, struct geoip_u128 *out)
+{
+  const BYTE *b = addr->s6_addr;
+  uint64      hi = 0, lo = 0;
+  int         i;
+
+  for (i = 0; i < 8; i++)
+  {
+    hi = (hi << 8) | b[i];
+    lo = (lo << 8) | b[i+8];
+  }
+  out->hi = hi;
+  out->lo = lo;
+}
+
+/**
+ * Recursively fill the Eytzinger ordered `geoip4_index` from the sorted
+ * `geoip_ipv4_entries`. An in-order walk of the implicit tree rooted at `k`
+ * visits the sorted elements in order.
+ *
+ * \param[in] i  the next element in `geoip_ipv4_entries` to place.
+ * \param[in] k  the current node in the implicit tree.
+ * \retval       the next element in `geoip_ipv4_entries` to place.
+ */
+static DWORD geoip4_index_fill (DWORD i, DWORD k)
+{
+  if (k <= geoip4_index.num)
+  {
+    const struct ipv4_node *entry;
+
+    i = geoip4_index_fill (i, 2*k);
+    entry = smartlist_get (geoip_ipv4_entries, (int)i++);
+    geoip4_index.low [k]   = entry->low;
+    geoip4_index.high [k]  = entry->high;
+    geoip4_index.cc_idx[k] = geoip_cc_slot (entry->country);
+    i = geoip4_index_fill (i, 2*k + 1);
+  }
+  return (i);
+}
+
+/**
+ * As above, but for `geoip6_index`.
+ */
+static DWORD geoip6_index_fill (DWORD i, DWORD k)
+{
+  if (k <= geoip6_index.num)
+  {
+    const struct ipv6_node *entry;
+
+    i = geoip6_index_fill (i, 2*k);
+    entry = smartlist_get (geoip_ipv6_entries, (int)i++);
+    geoip_in6_to_u128 (&entry->low, &geoip6_index.low[k]);
+    geoip_in6_to_u128 (&entry->high, &geoip6_index.high[k]);
+    geoip6_index.cc_idx[k] = geoip_cc_slot (entry->country);
+    i = geoip6_index_fill (i, 2*k + 1);
+  }
+  return (i);
+}
+
+/**
+ * Compile the sorted `geoip_ipv4_entries` into the flat `geoip4_index`.
+ * All arrays are allocated in one block.
+ */
+static void geoip4_index_build (void)
+{
+  DWORD  num = smartlist_len (geoip_ipv4_entries);
+  size_t size = geoip_index_size (AF_INET, num);
+  BYTE  *mem;
+
+  if (num == 0 || (mem = calloc(1, size)) == NULL)
+     return;
+
+  geoip4_index.num      = num;
+  geoip4_index.mem      = mem;
+  geoip4_index.cc_table = geoip_cc_table;
+  geoip4_index.low      = (DWORD*) mem;
+  geoip4_index.high     = geoip4_index.low + num + 1;
+  geoip4_index.cc_idx   = (WORD*) (geoip4_index.high + num + 1);
+  geoip4_index_fill (0, 1);
+
+  FREE (geoip_cc_map);
+  TRACE (2, "Compiled %s IPv4 ranges into %s bytes. %u country-codes.\n",
+         dword_str(num), dword_str((DWORD)size), geoip_cc_num);
+}
+
+/**
+ * Compile the sorted `geoip_ipv6_entries` into the flat `geoip6_index`.
+ */
+static void geoip6_index_build (void)
+{
+  DWORD  num = smartlist_len (geoip_ipv6_entries);
+  size_t size = geoip_index_size (AF_INET6, num);
+  BYTE  *mem;
+
+  if (num == 0 || (mem = calloc(1, size)) == NULL)
+     return;
+
+  geoip6_index.num      = num;
+  geoip6_index.mem      = mem;
+  geoip6_index.cc_table = geoip_cc_table;
+  geoip6_index.low      = (struct geoip_u128*) mem;
+  geoip6_index.high     = geoip6_index.low + num + 1;
+  geoip6_index.cc_idx   = (WORD*) (geoip6_index.high + num + 1);
+  geoip6_index_fill (0, 1);
+
+  FREE (geoip_cc_map);
+  TRACE (2, "Compiled %s IPv6 ranges into %s bytes. %u country-codes.\n",
+         dword_str(num), dword_str((DWORD)size), geoip_cc_num);
+}
+
+/**
+ * Free the memory of both compiled indices.
+ * Or unmap them if they came from a snapshot.
+ */
+static void geoip_index_free (void)
+{
+  if (geoip4_index.map_view)
+  {
+    UnmapViewOfFile (geoip4_index.map_view);
+    CloseHandle (geoip4_index.map_hnd);
+  }
+  if (geoip6_index.map_view)
+  {
+    UnmapViewOfFile (geoip6_index.map_view);
+    CloseHandle (geoip6_index.map_hnd);
+  }
+  FREE (geoip4_index.mem);
+  FREE (geoip6_index.mem);
+  memset (&geoip4_index, '\0', sizeof(geoip4_index));
+  memset (&geoip6_index, '\0', sizeof(geoip6_index));
+  FREE (geoip_cc_map);
+  geoip_cc_num = 0;
+}
+
+/**
+ * \def GEOIP_SNAP_MAGIC
+ *      The magic marker at the start of a snapshot-file.
+ *
+ * \def GEOIP_SNAP_VERSION
+ *      The version of the snapshot-file layout. Bump this when
+ *      `struct geoip4_index`, `struct geoip6_index` or
+ *      `struct geoip_snap_header` changes.
+ */
+#define GEOIP_SNAP_MAGIC    "WSGEOIP"
+#define GEOIP_SNAP_VERSION  2
+
+/**\struct geoip_snap_header
+ *
+ * The header of a binary snapshot of a `geoip4_index` or `geoip6_index`.
+ * Following the header are:
+ *  \li the `num_cc` country-codes of `geoip_cc_table[]` padded to 16 bytes.
+ *  \li the `low[]`, `high[]` and `cc_idx[]` arrays of `num+1` elements each.
+ *      These are in Eytzinger order exactly as they are in memory.
+ */
+struct geoip_snap_header {
+       char   magic [8];   /**< `GEOIP_SNAP_MAGIC` */
+       DWORD  version;     /**< `GEOIP_SNAP_VERSION` */
+       DWORD  family;      /**< `AF_INET` or `AF_INET6` */
+       DWORD  num;         /**< Number of ranges */
+       DWORD  num_cc;      /**< Number of country-codes */
+       DWORD  data_size;   /**< Number of bytes following this header */
+       DWORD  crc32;       /**< The `mz_crc32()` of these bytes */
+       uint64 csv_size;    /**< The size of the CSV-file it was made from */
+       uint64 csv_mtime;   /**< The modification time of the CSV-file */
+     };
+
+#define GEOIP_SNAP_CC_SIZE(num_cc)  (((num_cc) * 3 + 15) & ~15)
+
+/**
+ * Return the size of the index arrays for `num` ranges of `family`.
+ * This is also the size of the `mem` block allocated by `geoip4_index_build()`
+ * or `geoip6_index_build()`.
+ */
+static size_t geoip_index_size (int family, DWORD num)
+{
+  if (family == AF_INET)
+     return (num + 1) * (2*sizeof(DWORD) + sizeof(WORD));
+  return (num + 1) * (2*sizeof(struct geoip_u128) + sizeof(WORD));
+}
+
+/**
+ * Return the name of the snapshot-file for a geoip CSV-file;
+ * the same name with a `.bin` extension added.
+ * Not using a static buffer since the IPv4 and IPv6 files could be loaded
+ * concurrently.
+ */
+static const char *geoip_snapshot_name (const char *csv_file, char *fname, size_t size)
+{
+  snprintf (fname, size, "%s.bin", csv_file);
+  return (fname);
+}
+
+/**
+ * Try to map a snapshot of `csv_file` read-only and point the
+ * `geoip4_index` or `geoip6_index` arrays into this mapping.
+ *
+ * The snapshot is ignored if the size and modification time of `csv_file`
+ * are not the ones it was made from, or if the header or sizes do not match.
+ * The checksum of the data is only checked with `g_cfg.GEOIP.verify_snapshot`;
+ * that would touch every page of the mapping. But every `cc_idx[]` is checked
+ * to be inside the `cc_table[]`; a lookup would otherwise read past the view.
+ *
+ * \param[in] csv_file  the source CSV-file of the snapshot.
+ * \param[in] family    `AF_INET` or `AF_INET6`.
+ * \retval    the number of ranges mapped. 0 on any failure.
+ */
+static DWORD geoip_snapshot_load (const char *csv_file, int family)
+{
+  const struct geoip_snap_header *hdr;
+  char        name_buf [_MAX_PATH];
+  const char *fname = geoip_snapshot_name (csv_file, name_buf, sizeof(name_buf));
+  struct stat st_csv, st_snap;
+  HANDLE      file, map;
+  BYTE       *view, *data;
+  const WORD *cc_idx;
+  size_t      cc_size;
+  DWORD       i;
+
+  if (stat(csv_file, &st_csv) != 0 || stat(fname, &st_snap) != 0)
+     return (0);
+
+  if ((size_t)st_snap.st_size < sizeof(*hdr))
+     return (0);
+
+  file = CreateFile (fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                     FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+     return (0);
+
+  map = CreateFileMapping (file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle (file);   /* The mapping keeps the file open */
+  if (!map)
+  {
+    TRACE (2, "CreateFileMapping() failed: %s\n", win_strerror(GetLastError()));
+    return (0);
+  }
+
+  view = MapViewOfFile (map, FILE_MAP_READ, 0, 0, 0);
+  if (!view)
+  {
+    TRACE (2, "MapViewOfFile() failed: %s\n", win_strerror(GetLastError()));
+    CloseHandle (map);
+    return (0);
+  }
+
+  hdr     = (const struct geoip_snap_header*) view;
+  data    = view + sizeof(*hdr);
+  cc_size = GEOIP_SNAP_CC_SIZE (hdr->num_cc);
+
+  if (memcmp(hdr->magic, GEOIP_SNAP_MAGIC, sizeof(hdr->magic)) ||
+      hdr->version != GEOIP_SNAP_VERSION ||
+      hdr->family != (DWORD)family ||
+      hdr->num == 0 || hdr->num_cc == 0 || hdr->num_cc > GEOIP_MAX_CC ||
+      hdr->data_size != cc_size + geoip_index_size(family, hdr->num) ||
+      (size_t)st_snap.st_size != sizeof(*hdr) + hdr->data_size ||
+      (g_cfg.GEOIP.verify_snapshot &&
+       hdr->crc32 != (DWORD) mz_crc32(MZ_CRC32_INIT, data, hdr->data_size)))
+  {
+    TRACE (1, "Snapshot \"%s\" is corrupt or of wrong version; ignored.\n", fname);
+    goto fail;
+  }
+
+  if (hdr->csv_size != (uint64)st_csv.st_size || hdr->csv_mtime != (uint64)st_csv.st_mtime)
+  {
+    TRACE (2, "Snapshot \"%s\" is not made from this \"%s\".\n", fname, csv_file);
+    goto fail;
+  }
+
+  /* The `cc_idx[]` array is last.
+   */
+  cc_idx = (const WORD*) (data + hdr->data_size) - (hdr->num + 1);
+  for (i = 0; i <= hdr->num; i++)
+      if (cc_idx[i] >= hdr->num_cc)
+      {
+        TRACE (1, "Snapshot \"%s\" has a bad country-index at %lu; ignored.\n", fname, i);
+        goto fail;
+      }
+
+  if (family == AF_INET)
+  {
+    geoip4_index.num      = hdr->num;
+    geoip4_index.cc_table = (char (*)[3]) data;
+    geoip4_index.low      = (DWORD*) (data + cc_size);
+    geoip4_index.high     = geoip4_index.low + hdr->num + 1;
+    geoip4_index.cc_idx   = (WORD*) (geoip4_index.high + hdr->num + 1);
+    geoip4_index.map_hnd  = map;
+    geoip4_index.map_view = view;
+  }
+  else
+  {
+    geoip6_index.num      = hdr->num;
+    geoip6_index.cc_table = (char (*)[3]) data;
+    geoip6_index.low      = (struct geoip_u128*) (data + cc_size);
+    geoip6_index.high     = geoip6_index.low + hdr->num + 1;
+    geoip6_index.cc_idx   = (WORD*) (geoip6_index.high + hdr->num + 1);
+    geoip6_index.map_hnd  = map;
+    geoip6_index.map_view = view;
+  }
+  TRACE (2, "Mapped %s IPv%c ranges from snapshot \"%s\".\n",
+         dword_str(hdr->num), family == AF_INET ? '4' : '6', fname);
+  return (hdr->num);
+
+fail:
+  UnmapViewOfFile (view);
+  CloseHandle (map);
+  return (0);
+}
+
+/**
+ * Write a snapshot of the just compiled `geoip4_index` or `geoip6_index`.
+ * Written to a temporary file first and then renamed; a reader never sees a
+ * partial file. Failing to write is not an error; the CSV-file is simply
+ * parsed again the next time.
+ *
+ * \param[in] csv_file  the source CSV-file of the index.
+ * \param[in] st_csv    the `stat()` of `csv_file` from before it was parsed.
+ * \param[in] family    `AF_INET` or `AF_INET6`.
+ * \param[in] num_cc    the number of used `geoip_cc_table[]` slots after the
+ *                      index was built. The other family could add more.
+ */
+static void geoip_snapshot_write (const char *csv_file, const struct stat *st_csv, int family, WORD num_cc)
+{
+  static const BYTE pad [16] = { 0 };
+  struct geoip_snap_header hdr;
+  char        name_buf [_MAX_PATH];
+  const char *fname = geoip_snapshot_name (csv_file, name_buf, sizeof(name_buf));
+  const BYTE *mem;
+  char        tmp_file [_MAX_PATH];
+  size_t      cc_len, cc_size, mem_size;
+  mz_ulong    crc;
+  FILE       *f;
+  bool        okay;
+
+  memset (&hdr, '\0', sizeof(hdr));
+  memcpy (&hdr.magic, GEOIP_SNAP_MAGIC, sizeof(GEOIP_SNAP_MAGIC));
+  hdr.version   = GEOIP_SNAP_VERSION;
+  hdr.family    = family;
+  hdr.num       = (family == AF_INET) ? geoip4_index.num : geoip6_index.num;
+  hdr.num_cc    = num_cc;
+  hdr.csv_size  = (uint64) st_csv->st_size;
+  hdr.csv_mtime = (uint64) st_csv->st_mtime;
+  mem           = (family == AF_INET) ? geoip4_index.mem : geoip6_index.mem;
+
+  if (hdr.num == 0 || hdr.num_cc == 0 || !mem)
+     return;
+
+  cc_len   = 3 * hdr.num_cc;
+  cc_size  = GEOIP_SNAP_CC_SIZE (hdr.num_cc);
+  mem_size = geoip_index_size (family, hdr.num);
+
+  crc = mz_crc32 (MZ_CRC32_INIT, (const BYTE*)geoip_cc_table, cc_len);
+  crc = mz_crc32 (crc, pad, cc_size - cc_len);
+  crc = mz_crc32 (crc, mem, mem_size);
+
+  hdr.data_size = (DWORD) (cc_size + mem_size);
+  hdr.crc32     = (DWORD) crc;
+
+  snprintf (tmp_file, sizeof(tmp_file), "%s.tmp", fname);
+  f = fopen (tmp_file, "wb");
+  if (!f)
+  {
+    TRACE (2, "Failed to create \"%s\": %s.\n", tmp_file, strerror(errno));
+    return;
+  }
+
+  okay = (fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+          fwrite(geoip_cc_table, 1, cc_len, f) == cc_len &&
+          fwrite(pad, 1, cc_size - cc_len, f) == cc_size - cc_len &&
+          fwrite(mem, 1, mem_size, f) == mem_size);
+  okay = (fclose(f) == 0) && okay;
+
+  if (okay && MoveFileEx(tmp_file, fname, MOVEFILE_REPLACE_EXISTING))
+     TRACE (2, "Wrote snapshot \"%s\"; %s bytes.\n",
+            fname, dword_str((DWORD)(sizeof(hdr) + hdr.data_size)));
+  else
+  {
+    TRACE (2, "Failed to write snapshot \"%s\": %s.\n", fname, win_strerror(GetLastError()));
+    DeleteFile (tmp_file);
+  }
+}
+
+/**
+ * Prefetch the cache-line with the descendants of a node a few levels down. <br>
+ * With 16 `DWORD`s in a 64 byte cache-line, `&low[16*k]` holds all the 4th level
+ * descendants of node `k` in `geoip4_index.low[]`. For the 16 byte elements in
+ * `geoip6_index.low[]`, `&low[4*k]` holds the 2nd level descendants.
+ * A prefetch past the end of the array is harmless.
+ */
+#define GEOIP_PREFETCH(addr)  PreFetchCacheLine (PF_TEMPORAL_LEVEL_1, (const void*)(addr))
+
+/**
+ * Search the `geoip4_index` for an IPv4-address on host order.
+ *
+ * Walk down the implicit tree and remember the last node with a
+ * `low <= ip_num`; that is the range with the largest `low` not above
+ * `ip_num`. The loop body has no data-dependent branches.
+ *
+ * \param[in] ip_num  the IPv4-address on host order.
+ * \retval 0 if not found. Otherwise the node in `geoip4_index`.
+ */
+static DWORD geoip4_index_lookup (DWORD ip_num)
+{
+  const DWORD *low = geoip4_index.low;
+  DWORD k = 1, node = 0;
+
+  while (k <= geoip4_index.num)
+  {
+    DWORD go_right = (low[k] <= ip_num);
+
+    GEOIP_PREFETCH (low + 16*k);
+    node = go_right ? k : node;
+    k = 2*k + go_right;
+    num_4_compare++;
+  }
+  if (node && ip_num <= geoip4_index.high[node])
+     return (node);
+  return (0);
+}
+
+/**
+ * Search the `geoip6_index` for an IPv6-address.
+ *
+ * \param[in] addr  the IPv6-address to search for.
+ * \retval 0 if not found. Otherwise the node in `geoip6_index`.
+ */
+static DWORD geoip6_index_lookup (const struct in6_addr *addr)
+{
+  const struct geoip_u128 *low = geoip6_index.low;
+  const struct geoip_u128 *high;
+  struct geoip_u128 key;
+  DWORD  k = 1, node = 0;
+
+  geoip_in6_to_u128 (addr, &key);
+
+  while (k <= geoip6_index.num)
+  {
+    DWORD go_right = (low[k].hi < key.hi || (low[k].hi == key.hi && low[k].lo <= key.lo));
+
+    GEOIP_PREFETCH (low + 4*k);
+    node = go_right ? k : node;
+    k = 2*k + go_right;
+    num_6_compare++;
+  }
+  if (!node)
+     return (0);
+
+  high = geoip6_index.high + node;
+  if (key.hi < high->hi || (key.hi == high->hi && key.lo <= high->lo))
+     return (node);
+  return (0);
+}
+
+/**
+ * The number of searches `geoip4_index_lookup_many()` and
+ * `geoip6_index_lookup_many()` run interleaved.
+ */
+#define GEOIP_BATCH  8
+
+/**
+ * As `geoip4_index_lookup()`, but for `num <= GEOIP_BATCH` addresses at once.
+ *
+ * Each round moves all the searches one level down the tree. While one
+ * search waits for its prefetched cache-line, the others can proceed.
+ * So the memory latencies overlap instead of adding up.
+ *
+ * \param[in]  ip_num  the IPv4-addresses on host order.
+ * \param[out] node    the node in `geoip4_index` for each; or 0 if not found.
+ * \param[in]  num     the number of addresses.
+ */
+static void geoip4_index_lookup_many (const DWORD *ip_num, DWORD *node, int num)
+{
+  const DWORD *low = geoip4_index.low;
+  DWORD k [GEOIP_BATCH];
+  int   i, active;
+
+  for (i = 0; i < num; i++)
+  {
+    k[i] = 1;
+    node[i] = 0;
+  }
+
+  do
+  {
+    active = 0;
+    for (i = 0; i < num; i++)
+    {
+      DWORD go_right;
+
+      if (k[i] > geoip4_index.num)
+         continue;
+      go_right = (low[k[i]] <= ip_num[i]);
+      GEOIP_PREFETCH (low + 16*k[i]);
+      node[i] = go_right ? k[i] : node[i];
+      k[i] = 2*k[i] + go_right;
+      active++;
+    }
+    num_4_compare += active;
+  }
+  while (active > 0);
+
+  for (i = 0; i < num; i++)
+  {
+    if (node[i] && ip_num[i] > geoip4_index.high[node[i]])
+       node[i] = 0;
+  }
 }
 
 /**
- * Add an IPv6 entry to the `geoip_ipv6_entries` smart-list.
- *
- * \param[in] low      The lowest address in the IPv6-block.
- * \param[in] high     The highest address in the IPv6-block.
- * \param[in] country  The short country associated with this IPv6-block. <br>
- *                     Or the `-X` remark if this IPv6-block is a special address.
+ * As above, but for the `geoip6_index`.
  */
-static int geoip6_add_entry (const struct in6_addr *low, const struct in6_addr *high, const char *country)
+static void geoip6_index_lookup_many (const struct in6_addr **addr, DWORD *node, int num)
 {
-  struct ipv6_node *entry = malloc (sizeof(*entry));
+  const struct geoip_u128 *low = geoip6_index.low;
+  const struct geoip_u128 *high;
+  struct geoip_u128 key [GEOIP_BATCH];
+  DWORD  k [GEOIP_BATCH];
+  int    i, active;
 
-  if (!entry)
-     return (0);
+  for (i = 0; i < num; i++)
+  {
+    geoip_in6_to_u128 (addr[i], &key[i]);
+    k[i] = 1;
+    node[i] = 0;
+  }
 
-  memcpy (&entry->low, low, sizeof(entry->low));
-  memcpy (&entry->high, high, sizeof(entry->high));
-  memcpy (&entry->country, country, sizeof(entry->country));
-  smartlist_add (geoip_ipv6_entries, entry);
-  return (1);
+  do
+  {
+    active = 0;
+    for (i = 0; i < num; i++)
+    {
+      DWORD go_right;
+
+      if (k[i] > geoip6_index.num)
+         continue;
+      go_right = (low[k[i]].hi < key[i].hi || (low[k[i]].hi == key[i].hi && low[k[i]].lo <= key[i].lo));
+      GEOIP_PREFETCH (low + 4*k[i]);
+      node[i] = go_right ? k[i] : node[i];
+      k[i] = 2*k[i] + go_right;
+      active++;
+    }
+    num_6_compare += active;
+  }
+  while (active > 0);
+
+  for (i = 0; i < num; i++)
+  {
+    if (!node[i])
+       continue;
+    high = geoip6_index.high + node[i];
+    if (key[i].hi > high->hi || (key[i].hi == high->hi && key[i].lo > high->lo))
+       node[i] = 0;
+  }
 }
 
 /**
  * This is global here to get the location (city, region and optionally latitude/longitude) later on.
+ *
+ * `geoip_get_country_by_ipv4()` and `geoip_get_country_by_ipv6()` only looks up
+ * the country. The other fields are looked up for `g_ip2loc_addr` when first
+ * needed; see `ip2loc_last_result()`.
  */
-static struct ip2loc_entry g_ip2loc_entry;
+static struct ip2loc_result g_ip2loc_result;
 
-#define IP2LOC_IS_GOOD()  (g_ip2loc_entry.country_short[0] >= 'A' && \
-                           g_ip2loc_entry.country_short[0] <= 'Z')
-#define IP2LOC_SET_BAD()  g_ip2loc_entry.country_short[0] = '\0'
+/**
+ * The address for `g_ip2loc_result`.
+ */
+static int g_ip2loc_family;
+static union {
+       struct in_addr  ip4;
+       struct in6_addr ip6;
+     } g_ip2loc_addr;
+
+#define IP2LOC_IS_GOOD()  (g_ip2loc_result.country_short &&             \
+                           g_ip2loc_result.country_short[0] >= 'A' &&   \
+                           g_ip2loc_result.country_short[0] <= 'Z')
+
+#define IP2LOC_SET_BAD()  do {                                          \
+                            g_ip2loc_result.fields = 0;                 \
+                            g_ip2loc_result.country_short = NULL;       \
+                            g_ip2loc_result.city = "";                  \
+                            g_ip2loc_result.region = "";                \
+                            g_ip2loc_result.latitude = 0.0F;            \
+                            g_ip2loc_result.longitude = 0.0F;           \
+                          } while (0)
 
 /**
- * Given an IPv4 address on network order, return an ISO-3166 2 letter
- * country-code representing the country to which that address
- * belongs, or NULL for `No geoip information available`.
- *
- * To decode it, call `geoip_get_long_name_by_A2()`.
+ * Return the result of the last successful IP2Location lookup in
+ * `geoip_get_country_by_ipv4()` or `geoip_get_country_by_ipv6()`.
+ * With the `fields` looked up if not already done.
  *
- * \param[in] addr  The IPv4 address to get the country for.
+ * \retval NULL if the last lookup did not use IP2Location.
  */
-const char *geoip_get_country_by_ipv4 (const struct in_addr *addr)
+static const struct ip2loc_result *ip2loc_last_result (DWORD fields)
+{
+  DWORD missing;
+
+  if (!IP2LOC_IS_GOOD())
+     return (NULL);
+
+  missing = fields & ~g_ip2loc_result.fields;
+  if (missing)
+  {
+    if (g_ip2loc_family == AF_INET)
+         ip2loc_lookup_ipv4 (&g_ip2loc_addr.ip4, missing, &g_ip2loc_result);
+    else ip2loc_lookup_ipv6 (&g_ip2loc_addr.ip6, missing, &g_ip2loc_result);
+  }
+  return (&g_ip2loc_result);
+}
+
+/**
+ * The lookup of `geoip_get_country_by_ipv4()` without updating the statistics.
+ * Sets `*via_ip2loc` if the country came from IP2Location.
+ */
+static const char *geoip_country_ipv4 (const struct in_addr *addr, bool *via_ip2loc)
 {
   struct ipv4_node *entry = NULL;
+  const char       *country = NULL;
   char     buf [25];
   unsigned num;
 
+  INIT_DB_NEED (INIT_DB_GEOIP);
+  *via_ip2loc = false;
   IP2LOC_SET_BAD();
   num_4_compare = 0;
 
@@ -527,43 +1354,69 @@ const char *geoip_get_country_by_ipv4 (const struct in_addr *addr)
   num = ip2loc_num_ipv4_entries();
   TRACE (4, "Looking for %s in %u elements.\n", buf, num);
 
-  if (num > 0 && INET_util_addr_is_global(addr, NULL) && ip2loc_get_ipv4_entry(addr, &g_ip2loc_entry))
+  if (num > 0 && INET_util_addr_is_global(addr, NULL) &&
+      ip2loc_lookup_ipv4(addr, IP2LOC_COUNTRY, &g_ip2loc_result))
   {
-    if (g_cfg.trace_report)
-       geoip_stats_update (g_ip2loc_entry.country_short, GEOIP_STAT_IPV4 | GEOIP_VIA_IP2LOC);
-    return (g_ip2loc_entry.country_short);
+    g_ip2loc_family   = AF_INET;
+    g_ip2loc_addr.ip4 = *addr;
+    *via_ip2loc = true;
+    return (g_ip2loc_result.country_short);
   }
 
   /* IP2LOCATION lookup failed. Fallback to a geoip lookup below.
    */
-  if (geoip_ipv4_entries)
+  if (geoip4_index.num > 0)
+  {
+    DWORD node = geoip4_index_lookup (swap32(addr->s_addr));
+
+    if (node)
+       country = geoip4_index.cc_table [geoip4_index.cc_idx[node]];
+  }
+  else if (geoip_ipv4_entries)
   {
     DWORD ip_num = swap32 (addr->s_addr);
 
     entry = smartlist_bsearch (geoip_ipv4_entries, &ip_num,
                                geoip_ipv4_compare_key_to_entry);
-
-    if (g_cfg.trace_report && entry && entry->country[0])
-       geoip_stats_update (entry->country, GEOIP_STAT_IPV4);
+    if (entry)
+       country = entry->country;
   }
-  return (entry ? entry->country : NULL);
+
+  return (country);
 }
 
 /**
- * Given an IPv6 address,  return an ISO-3166 2 letter country-code
- * representing the country to which that address belongs, or NULL for
- * `No geoip information available`.
+ * Given an IPv4 address on network order, return an ISO-3166 2 letter
+ * country-code representing the country to which that address
+ * belongs, or NULL for `No geoip information available`.
  *
  * To decode it, call `geoip_get_long_name_by_A2()`.
  *
- * \param[in] addr  The IPv6 address to get the country for.
+ * \param[in] addr  The IPv4 address to get the country for.
  */
-const char *geoip_get_country_by_ipv6 (const struct in6_addr *addr)
+const char *geoip_get_country_by_ipv4 (const struct in_addr *addr)
+{
+  bool        via_ip2loc;
+  const char *country = geoip_country_ipv4 (addr, &via_ip2loc);
+
+  if (g_cfg.trace_report && country && (via_ip2loc || country[0]))
+     geoip_stats_update (country, GEOIP_STAT_IPV4 | (via_ip2loc ? GEOIP_VIA_IP2LOC : 0));
+  return (country);
+}
+
+/**
+ * The lookup of `geoip_get_country_by_ipv6()` without updating the statistics.
+ * Sets `*via_ip2loc` if the country came from IP2Location.
+ */
+static const char *geoip_country_ipv6 (const struct in6_addr *addr, bool *via_ip2loc)
 {
   struct ipv6_node *entry = NULL;
+  const char       *country = NULL;
   char     buf [MAX_IP6_SZ+1];
   unsigned num;
 
+  INIT_DB_NEED (INIT_DB_GEOIP);
+  *via_ip2loc = false;
   IP2LOC_SET_BAD();
   num_6_compare = 0;
 
@@ -572,22 +1425,150 @@ const char *geoip_get_country_by_ipv6 (const struct in6_addr *addr)
   num = ip2loc_num_ipv6_entries();
   TRACE (4, "Looking for %s in %u elements.\n", buf, num);
 
-  if (num > 0 && INET_util_addr_is_global(NULL, addr) && ip2loc_get_ipv6_entry(addr, &g_ip2loc_entry))
+  if (num > 0 && INET_util_addr_is_global(NULL, addr) &&
+      ip2loc_lookup_ipv6(addr, IP2LOC_COUNTRY, &g_ip2loc_result))
   {
-    if (g_cfg.trace_report)
-       geoip_stats_update (g_ip2loc_entry.country_short, GEOIP_STAT_IPV6 | GEOIP_VIA_IP2LOC);
-    return (g_ip2loc_entry.country_short);
+    g_ip2loc_family   = AF_INET6;
+    g_ip2loc_addr.ip6 = *addr;
+    *via_ip2loc = true;
+    return (g_ip2loc_result.country_short);
   }
 
-  if (geoip_ipv6_entries)
+  if (geoip6_index.num > 0)
+  {
+    DWORD node = geoip6_index_lookup (addr);
+
+    if (node)
+       country = geoip6_index.cc_table [geoip6_index.cc_idx[node]];
+  }
+  else if (geoip_ipv6_entries)
   {
     entry = smartlist_bsearch (geoip_ipv6_entries, addr,
                                geoip_ipv6_compare_key_to_entry);
+    if (entry)
+       country = entry->country;
+  }
+
+  return (country);
+}
+
+/**
+ * Given an IPv6 address,  return an ISO-3166 2 letter country-code
+ * representing the country to which that address belongs, or NULL for
+ * `No geoip information available`.
+ *
+ * To decode it, call `geoip_get_long_name_by_A2()`.
+ *
+ * \param[in] addr  The IPv6 address to get the country for.
+ */
+const char *geoip_get_country_by_ipv6 (const struct in6_addr *addr)
+{
+  bool        via_ip2loc;
+  const char *country = geoip_country_ipv6 (addr, &via_ip2loc);
+
+  if (g_cfg.trace_report && country && (via_ip2loc || country[0]))
+     geoip_stats_update (country, GEOIP_STAT_IPV6 | (via_ip2loc ? GEOIP_VIA_IP2LOC : 0));
+  return (country);
+}
+
+/**
+ * As `geoip_get_country_by_ipv4()` or `geoip_get_country_by_ipv6()`, but
+ * the statistics are not updated. For annotate.c; it counts each address
+ * seen with `geoip_stats_add()`, also when the country came from it's cache.
+ *
+ * \param[in]  family      `AF_INET` or `AF_INET6`.
+ * \param[in]  addr        a `struct in_addr` or a `struct in6_addr`.
+ * \param[out] via_ip2loc  set if the country came from IP2Location.
+ */
+const char *geoip_lookup_country (int family, const void *addr, bool *via_ip2loc)
+{
+  if (family == AF_INET)
+     return geoip_country_ipv4 ((const struct in_addr*)addr, via_ip2loc);
+  return geoip_country_ipv6 ((const struct in6_addr*)addr, via_ip2loc);
+}
+
+/**
+ * Count `country_A2` in the statistics for an address of `family`.
+ * The same as `geoip_get_country_by_ipv4()` or `geoip_get_country_by_ipv6()`
+ * does after a lookup.
+ */
+void geoip_stats_add (int family, const char *country_A2, bool via_ip2loc)
+{
+  int flag = (family == AF_INET) ? GEOIP_STAT_IPV4 : GEOIP_STAT_IPV6;
+
+  if (g_cfg.trace_report && country_A2 && (via_ip2loc || country_A2[0]))
+     geoip_stats_update (country_A2, flag | (via_ip2loc ? GEOIP_VIA_IP2LOC : 0));
+}
+
+/**
+ * Look up the country of many addresses of the same family at once.
+ *
+ * The compiled `geoip4_index` or `geoip6_index` is searched `GEOIP_BATCH`
+ * addresses at a time with interleaved searches. Hence this is faster than
+ * calling `geoip_get_country_by_ipv4()` or `geoip_get_country_by_ipv6()`
+ * for each address. E.g. for the many addresses of a CDN host-name.
+ *
+ * Unlike those, this does not use the IP2Location database; the caller
+ * must do that for a global address if `ip2loc_num_ipv4_entries()` or
+ * `ip2loc_num_ipv6_entries()` is non-zero. Nor does it update the statistics;
+ * see `geoip_stats_add()`.
+ *
+ * \param[in]  family     `AF_INET` or `AF_INET6`.
+ * \param[in]  addresses  `num` pointers to a `struct in_addr` or a `struct in6_addr`.
+ * \param[in]  num        the number of addresses.
+ * \param[out] countries  the country-code for each address; or NULL if not found.
+ * \retval    the number of addresses found.
+ */
+int geoip_lookup_many (int family, const void **addresses, int num, const char **countries)
+{
+  DWORD node [GEOIP_BATCH];
+  DWORD ip_num [GEOIP_BATCH];
+  int   i, j, chunk, found = 0;
+
+  INIT_DB_NEED (INIT_DB_GEOIP);
+
+  for (i = 0; i < num; i += chunk)
+  {
+    chunk = min (num - i, GEOIP_BATCH);
+
+    if (family == AF_INET && geoip4_index.num > 0)
+    {
+      for (j = 0; j < chunk; j++)
+          ip_num[j] = swap32 (((const struct in_addr*)addresses[i+j])->s_addr);
+      geoip4_index_lookup_many (ip_num, node, chunk);
+      for (j = 0; j < chunk; j++)
+          countries[i+j] = node[j] ? geoip4_index.cc_table [geoip4_index.cc_idx[node[j]]] : NULL;
+    }
+    else if (family == AF_INET6 && geoip6_index.num > 0)
+    {
+      geoip6_index_lookup_many ((const struct in6_addr**)(addresses + i), node, chunk);
+      for (j = 0; j < chunk; j++)
+          countries[i+j] = node[j] ? geoip6_index.cc_table [geoip6_index.cc_idx[node[j]]] : NULL;
+    }
+    else
+    {
+      for (j = 0; j < chunk; j++)
+      {
+        const struct ipv4_node *entry4 = NULL;
+        const struct ipv6_node *entry6 = NULL;
+
+        if (family == AF_INET && geoip_ipv4_entries)
+        {
+          ip_num[0] = swap32 (((const struct in_addr*)addresses[i+j])->s_addr);
+          entry4 = smartlist_bsearch (geoip_ipv4_entries, &ip_num[0], geoip_ipv4_compare_key_to_entry);
+        }
+        else if (family == AF_INET6 && geoip_ipv6_entries)
+          entry6 = smartlist_bsearch (geoip_ipv6_entries, addresses[i+j], geoip_ipv6_compare_key_to_entry);
+
+        countries[i+j] = entry4 ? entry4->country : entry6 ? entry6->country : NULL;
+      }
+    }
 
-    if (g_cfg.trace_report && entry && entry->country[0])
-       geoip_stats_update (entry->country, GEOIP_STAT_IPV6);
+    for (j = 0; j < chunk; j++)
+        if (countries[i+j])
+           found++;
   }
-  return (entry ? entry->country : NULL);
+  return (found);
 }
 
 /**
@@ -601,10 +1582,11 @@ const char *geoip_get_country_by_ipv6 (const struct in6_addr *addr)
 const char *geoip_get_location_by_ipv4 (const struct in_addr *ip4)
 {
   static char buf [100];
+  const struct ip2loc_result *res = ip2loc_last_result (IP2LOC_CITY | IP2LOC_REGION);
 
-  if (IP2LOC_IS_GOOD())
+  if (res)
   {
-    snprintf (buf, sizeof(buf), "%s/%s", g_ip2loc_entry.city, g_ip2loc_entry.region);
+    snprintf (buf, sizeof(buf), "%s/%s", res->city, res->region);
     return (buf);
   }
   ARGSUSED (ip4);
@@ -622,10 +1604,11 @@ const char *geoip_get_location_by_ipv4 (const struct in_addr *ip4)
 const char *geoip_get_location_by_ipv6 (const struct in6_addr *ip6)
 {
   static char buf [100];
+  const struct ip2loc_result *res = ip2loc_last_result (IP2LOC_CITY | IP2LOC_REGION);
 
-  if (IP2LOC_IS_GOOD())
+  if (res)
   {
-    snprintf (buf, sizeof(buf), "%s/%s", g_ip2loc_entry.city, g_ip2loc_entry.region);
+    snprintf (buf, sizeof(buf), "%s/%s", res->city, res->region);
     return (buf);
   }
   ARGSUSED (ip6);
@@ -647,11 +1630,12 @@ const char *geoip_get_location_by_ipv6 (const struct in6_addr *ip6)
 const position *geoip_get_position_by_ipv4 (const struct in_addr *ip4)
 {
   static struct position ret;
+  const struct ip2loc_result *res = ip2loc_last_result (IP2LOC_POSITION);
 
-  if (IP2LOC_IS_GOOD())
+  if (res)
   {
-    ret.latitude  = g_ip2loc_entry.latitude;   /* Both of these could be 0.0 depending on the IP2location file used. */
-    ret.longitude = g_ip2loc_entry.longitude;
+    ret.latitude  = res->latitude;   /* Both of these could be 0.0 depending on the IP2location file used. */
+    ret.longitude = res->longitude;
     return (&ret);
   }
   ARGSUSED (ip4);
@@ -673,11 +1657,12 @@ const position *geoip_get_position_by_ipv4 (const struct in_addr *ip4)
 const position *geoip_get_position_by_ipv6 (const struct in6_addr *ip6)
 {
   static struct position ret;
+  const struct ip2loc_result *res = ip2loc_last_result (IP2LOC_POSITION);
 
-  if (IP2LOC_IS_GOOD())
+  if (res)
   {
-    ret.latitude  = g_ip2loc_entry.latitude;   /* Both of these could be 0.0 depending on the IP2location file used. */
-    ret.longitude = g_ip2loc_entry.longitude;
+    ret.latitude  = res->latitude;   /* Both of these could be 0.0 depending on the IP2location file used. */
+    ret.longitude = res->longitude;
     return (&ret);
   }
   ARGSUSED (ip6);
@@ -692,13 +1677,18 @@ const position *geoip_get_position_by_ipv6 (const struct in6_addr *ip6)
  */
 static int geoip_get_num_addr (DWORD *num4, DWORD *num6)
 {
-  if (num4 && geoip_ipv4_entries)
+  if (num4 && geoip4_index.num > 0)
+     *num4 = geoip4_index.num;
+  else if (num4 && geoip_ipv4_entries)
      *num4 = smartlist_len (geoip_ipv4_entries);
 
-  if (num6 && geoip_ipv6_entries)
+  if (num6 && geoip6_index.num > 0)
+     *num6 = geoip6_index.num;
+  else if (num6 && geoip_ipv6_entries)
      *num6 = smartlist_len (geoip_ipv6_entries);
 
-  if (!geoip_ipv4_entries && !geoip_ipv6_entries)
+  if (!geoip_ipv4_entries && !geoip_ipv6_entries &&
+      geoip4_index.num == 0 && geoip6_index.num == 0)
      return (0);
 
   return (1);
@@ -1188,30 +2178,77 @@ const char *geoip_get_long_name_by_id (int number)
   return (NULL);
 }
 
+/**
+ * Return the `geoip_stats_idx[]` slot for `country_A2`; or -1 if it's not 2 letters.
+ * Either case is accepted.
+ */
+static int geoip_stats_slot (const char *country_A2)
+{
+  int c0 = TOUPPER (country_A2[0]) - 'A';
+  int c1;
+
+  if (c0 < 0 || c0 >= 26)
+     return (-1);
+  c1 = TOUPPER (country_A2[1]) - 'A';
+  if (c1 < 0 || c1 >= 26)
+     return (-1);
+  return (26 * c0 + c1);
+}
+
+/**
+ * Return the `geoip_stats_buf[]` element for `country_A2`; or NULL.
+ */
+static struct geoip_stats *geoip_stats_lookup (const char *country_A2)
+{
+  struct geoip_stats *buf = geoip_stats_buf;
+  int    slot;
+
+  if (!buf)
+     return (NULL);
+
+  slot = geoip_stats_slot (country_A2);
+  if (slot < 0 || geoip_stats_idx[slot] == 0)
+     return (NULL);
+  return (buf + geoip_stats_idx[slot] - 1);
+}
+
 /**
  * Allocate memory for the geoip statistics array.
  * Keep a zero-element at the end.
+ * And build the index for it.
  */
 static void geoip_stats_init (void)
 {
+  struct geoip_stats *buf;
   size_t i, num, size;
 
   assert (geoip_stats_buf == NULL);
 
   num  = geoip_num_countries();
-  size = sizeof(*geoip_stats_buf) * (num + 1);
+  size = sizeof(*buf) * (num + 1);
 
-  geoip_stats_buf = calloc (1, size);
-  if (!geoip_stats_buf)
+  buf = calloc (1, size);
+  if (!buf)
      size = 0;
 
+  memset (&geoip_stats_idx, '\0', sizeof(geoip_stats_idx));
+  memset ((void*)&geoip_stats_num, '\0', sizeof(geoip_stats_num));
+
   for (i = 0; size && i < num; i++)
   {
     const char *c_A2 = geoip_get_short_name_by_idx ((int)i);
+    int         slot = geoip_stats_slot (c_A2);
 
-    geoip_stats_buf[i].country[0] = TOUPPER (c_A2[0]);
-    geoip_stats_buf[i].country[1] = TOUPPER (c_A2[1]);
+    buf[i].country[0] = TOUPPER (c_A2[0]);
+    buf[i].country[1] = TOUPPER (c_A2[1]);
+    if (slot >= 0 && geoip_stats_idx[slot] == 0)
+       geoip_stats_idx [slot] = (WORD) (i + 1);
   }
+
+  /* Publish it after the index and the elements are set. Not relying
+   * on the trace-lock for this; `geoip_stats_lookup()` checks it first.
+   */
+  InterlockedExchangePointer ((PVOID volatile*)&geoip_stats_buf, buf);
   TRACE (2, "Allocated %u bytes for geoip_stats_buf needed for %u countries.\n",
          (unsigned)size, (unsigned)num);
 }
@@ -1221,42 +2258,65 @@ static void geoip_stats_init (void)
  */
 static void geoip_stats_exit (void)
 {
-  if (geoip_stats_buf)
-     free (geoip_stats_buf);
-  geoip_stats_buf = NULL;
+  struct geoip_stats *buf = InterlockedExchangePointer ((PVOID volatile*)&geoip_stats_buf, NULL);
+
+  free (buf);
+  memset (&geoip_stats_idx, '\0', sizeof(geoip_stats_idx));
+}
+
+/**
+ * Count `stats` in `*counter` if an address of the type in `*num` was seen
+ * and an address was found by ip2loc.c. The `counted` flag makes sure this
+ * is done once; whichever of these happened last.
+ */
+static void geoip_stats_count_ip2loc (struct geoip_stats *stats, volatile LONG64 *num,
+                                      LONG counted, volatile LONG *counter)
+{
+  if ((stats->flag & GEOIP_VIA_IP2LOC) && *num > 0 &&
+      !(InterlockedOr(&stats->flag, counted) & counted))
+     InterlockedIncrement (counter);
 }
 
 /**
  * Update the country statistics for an IPv4 or IPv6-address.
  * `country_A2` should already be in upper case.
  *
+ * The counters are updated with atomic operations and the number of
+ * unique countries is counted here. So `geoip_num_unique_countries()`
+ * need not scan all countries.
+ *
  * \param[in] country_A2  The 2-letter country to update the statistics for.
  * \param[in] flag        A flag describing what counter should be incremented.
  */
 static void geoip_stats_update (const char *country_A2, int flag)
 {
-  struct geoip_stats *stats;
-  int    c1, c2 = (int)country_A2[0] + ((int)country_A2[1] << 8);
-  size_t i;
+  struct geoip_stats *stats = geoip_stats_lookup (country_A2);
 
-  for (i = 0, stats = geoip_stats_buf;
-       stats && i < geoip_num_countries();
-       stats++, i++)
+  if (!stats)
   {
-    c1 = (int)stats->country[0] + ((int)stats->country[1] << 8);
-    if (c1 == c2)
-    {
-      if (flag & GEOIP_STAT_IPV4)
-           stats->num4++;
-      else if (flag & GEOIP_STAT_IPV6)
-           stats->num6++;
-      stats->flag |= flag;
-      break;
-    }
+    TRACE (2, "Found unknown country \"%.2s\" not in 'c_list[]'!.\n", country_A2);
+    return;
   }
-  if (!stats)
-       TRACE (2, "Found unknown country \"%.2s\" not in 'c_list[]'!.\n", country_A2);
-  else TRACE (3, "geoip_stats_update() for \"%.2s\" at index: %d.\n", country_A2, (int)i);
+
+  InterlockedOr (&stats->flag, flag);
+
+  if (flag & GEOIP_STAT_IPV4)
+  {
+    if (InterlockedIncrement64(&stats->num4) == 1)
+       InterlockedIncrement (&geoip_stats_num.ip4);
+  }
+  else if (flag & GEOIP_STAT_IPV6)
+  {
+    if (InterlockedIncrement64(&stats->num6) == 1)
+       InterlockedIncrement (&geoip_stats_num.ip6);
+  }
+
+  /* As before, the `GEOIP_VIA_IP2LOC` flag is for the country; not per address type.
+   */
+  geoip_stats_count_ip2loc (stats, &stats->num4, GEOIP_COUNTED_IP2LOC4, &geoip_stats_num.ip2loc4);
+  geoip_stats_count_ip2loc (stats, &stats->num6, GEOIP_COUNTED_IP2LOC6, &geoip_stats_num.ip2loc6);
+
+  TRACE (3, "geoip_stats_update() for \"%.2s\" at index: %d.\n", country_A2, (int)(stats - geoip_stats_buf));
 }
 
 /**
@@ -1269,30 +2329,19 @@ static void geoip_stats_update (const char *country_A2, int flag)
  */
 int geoip_stats_is_unique (const char *country_A2, int flag)
 {
-  const struct geoip_stats *stats;
-  int    c1, c2 = (int)country_A2[0] + ((int)country_A2[1] << 8);
-  size_t i;
+  const struct geoip_stats *stats = geoip_stats_lookup (country_A2);
 
-  for (i = 0, stats = geoip_stats_buf;
-       stats && i <= geoip_num_countries();
-       stats++, i++)
-  {
-    c1 = (int)stats->country[0] + ((int)stats->country[1] << 8);
-    if (c1 == c2 && (stats->flag & flag))
-       break;
-  }
+  if (!stats || !(stats->flag & flag))
+     return (0);
 
-  if (stats)
-  {
-    if (flag & GEOIP_STAT_IPV4)
-       return  (stats->num4 == 1);
-    return (stats->num6 == 1);
-  }
-  return (0);
+  if (flag & GEOIP_STAT_IPV4)
+     return (stats->num4 == 1);
+  return (stats->num6 == 1);
 }
 
 /**
- * Using `geoip_stats_buf`, count the number of unique countries found in addresses at run-time.
+ * Return the number of unique countries found in addresses at run-time.
+ * These are counted in `geoip_stats_update()`.
  * Normally called from `trace_report()` to print final accumulated statistics.
  *
  * \param[in] num_ip4      The total count of IPv4-addresses found for countries.
@@ -1302,29 +2351,11 @@ int geoip_stats_is_unique (const char *country_A2, int flag)
  */
 void geoip_num_unique_countries (DWORD *num_ip4, DWORD *num_ip6, DWORD *num_ip2loc4, DWORD *num_ip2loc6)
 {
-  const struct geoip_stats *stats;
-  DWORD  n4 = 0, n6 = 0;
-  DWORD  ip2loc_n4 = 0;
-  DWORD  ip2loc_n6 = 0;
-  size_t i;
+  DWORD n4        = (DWORD) geoip_stats_num.ip4;
+  DWORD n6        = (DWORD) geoip_stats_num.ip6;
+  DWORD ip2loc_n4 = (DWORD) geoip_stats_num.ip2loc4;
+  DWORD ip2loc_n6 = (DWORD) geoip_stats_num.ip2loc6;
 
-  for (i = 0, stats = geoip_stats_buf;
-       stats && i < geoip_num_countries();
-       stats++, i++)
-  {
-    if (stats->num4 > 0)
-    {
-      n4++;
-      if (stats->flag & GEOIP_VIA_IP2LOC)
-         ip2loc_n4++;
-    }
-    if (stats->num6 > 0)
-    {
-      n6++;
-      if (stats->flag & GEOIP_VIA_IP2LOC)
-         ip2loc_n6++;
-    }
-  }
   if (num_ip4)
      *num_ip4 = n4;
   if (num_ip6)
@@ -1755,9 +2786,10 @@ static void dump_num_ip_blocks_by_country (void)
 static const char *get_location (void)
 {
   static char buf[110];
+  const struct ip2loc_result *res = ip2loc_last_result (IP2LOC_CITY | IP2LOC_REGION);
 
-  if (IP2LOC_IS_GOOD())
-       snprintf (buf, sizeof(buf), "loc: %s/%s", g_ip2loc_entry.city, g_ip2loc_entry.region);
+  if (res)
+       snprintf (buf, sizeof(buf), "loc: %s/%s", res->city, res->region);
   else strcpy (buf, "loc: <unknown>");
   return (buf);
 }
@@ -1814,6 +2846,7 @@ static void test_addr_common (const char            *addr_str,
   int    save, flag, ip_width;
   bool   excluded;
   double ts_now;
+  static exclude_cache ex_cache;
   char   buf1 [200];
   char   buf2 [200];
 
@@ -1884,9 +2917,9 @@ static void test_addr_common (const char            *addr_str,
     else
       snprintf (buf1, sizeof(buf1), "%s", comment);
 
-    if (a4 && geoip_ipv4_entries)
+    if (a4 && (geoip4_index.num || geoip_ipv4_entries))
          snprintf (buf2, sizeof(buf2), "%lu compares", num_4_compare);
-    else if (a6 && geoip_ipv6_entries)
+    else if (a6 && (geoip6_index.num || geoip_ipv6_entries))
          snprintf (buf2, sizeof(buf2), "%lu compares", num_6_compare);
     else strcpy (buf2, "??");
   }
@@ -1911,55 +2944,38 @@ static void test_addr_common (const char            *addr_str,
   /* If this wasn't already done in dump.c for the trace of `getaddrinfo()`,
    * print the `IANA` and `ASN` information here.
    */
-  excluded = (g_cfg.trace_level == 0 || exclude_list_get("getaddrinfo", EXCL_FUNCTION));
+  excluded = (g_cfg.trace_level == 0 || exclude_list_get_cached(&ex_cache, "getaddrinfo", EXCL_FUNCTION));
 
   if (excluded && (g_cfg.IANA.enable || g_cfg.ASN.enable))
   {
-    struct IANA_record rec;
+    const struct IANA_record *rec;
 
-    if (a4 && iana_find_by_ip4_address(a4, &rec))
+    if (a4 && (rec = iana_find_by_ip4_address(a4)) != NULL)
     {
-      iana_print_rec ("  IANA: ", &rec);
-      ASN_print ("  ASN:  ", &rec, a4, NULL);
+      iana_print_rec ("  IANA: ", rec);
+      ASN_print ("  ASN:  ", rec, a4, NULL);
     }
-    else if (a6 && iana_find_by_ip6_address(a6, &rec))
+    else if (a6 && (rec = iana_find_by_ip6_address(a6)) != NULL)
     {
-      iana_find_by_ip6_address (a6, &rec);
-      iana_print_rec ("  IANA: ", &rec);
-      ASN_print ("  ASN:  ", &rec, NULL, a6);
+      iana_print_rec ("  IANA: ", rec);
+      ASN_print ("  ASN:  ", rec, NULL, a6);
     }
     ASN_libloc_print ("  ASN:  ", a4, a6, NULL);
   }
 
   /** Check the global IPv4 / IPv6 address for membership in a SpamHaus `DROP` / `EDROP` list
    */
-  if (INET_util_addr_is_global(a4, NULL))
-  {
-    const char *sbl_ref = NULL;
-    bool        rc = DNSBL_check_ipv4 (a4, &sbl_ref);
-    char        addr [MAX_IP4_SZ+1];
-
-    if (!sbl_ref)
-       sbl_ref = " <none>";
-    if (rc)
-    {
-      INET_addr_ntop (AF_INET, a4, addr, sizeof(addr), NULL);
-      C_printf ("  Listed as SpamHaus SBL%s\n", sbl_ref);
-    }
-  }
-  else if (INET_util_addr_is_global(NULL, a6))
+  if (INET_util_addr_is_global(a4, NULL) || INET_util_addr_is_global(NULL, a6))
   {
-    const char *sbl_ref = NULL;
-    bool        rc = DNSBL_check_ipv6 (a6, &sbl_ref);
-    char        addr [MAX_IP6_SZ+1];
+    const char *refs [DNSBL_MAX_REFS];
+    char        buf [DNSBL_MAX_REFS * 15];
+    int         num;
 
-    if (!sbl_ref)
-       sbl_ref = " <none>";
-    if (rc)
-    {
-      INET_addr_ntop (AF_INET6, a6, addr, sizeof(addr), NULL);
-      C_printf ("  Listed as SpamHaus SBL%s\n", sbl_ref);
-    }
+    if (INET_util_addr_is_global(a4, NULL))
+         num = DNSBL_get_refs (a4, NULL, refs, DIM(refs));
+    else num = DNSBL_get_refs (NULL, a6, refs, DIM(refs));
+    if (num > 0)
+       C_printf ("  Listed as SpamHaus %s\n", DNSBL_refs_str(refs, num, buf, sizeof(buf)));
   }
   C_printf ("  %.0f usec\n", get_timestamp_now() - ts_now);
 }
@@ -2041,7 +3057,8 @@ static void make_random_addr (struct in_addr *addr4, struct in6_addr *addr6)
 
 static int show_help (void)
 {
-  printf ("Usage: %s [-cDfinruh] <-4|-6> address(es)\n"
+  printf ("Usage: %s [-bcDfinruh] <-4|-6> address(es)\n"
+          "       -b:     benchmark the lookup methods on '-n' random addresses.\n"
           "       -c:     dump addresses on CIDR form.\n"
           "       -D:     dump address entries for countries and count of blocks.\n"
           "       -f:     force an update with the '-u' option.\n"
@@ -2122,6 +3139,162 @@ static void rand_test_addr6 (int loops, bool use_ip2loc)
   C_printf ("# of unique IPv6 countries: %lu\n", num_ip6);
 }
 
+/**
+ * Print the result of one benchmark run.
+ */
+static void bench_report (const char *what, int loops, DWORD found, double usec)
+{
+  double per_sec = usec > 0.0 ? (1E6 * loops) / usec : 0.0;
+
+  C_printf ("  %-12s %12.0f lookups/sec, %.3f usec/lookup, found: %s.\n",
+            what, per_sec, usec / loops, dword_str(found));
+}
+
+/**
+ * Compare the lookup-speed of the compiled `geoip4_index` against a
+ * `smartlist_bsearch()` of `geoip_ipv4_entries`. Both on the same
+ * random addresses from `make_random_addr()`.
+ */
+static void bench_addr4 (int loops)
+{
+  struct in_addr *addr    = malloc (loops * sizeof(*addr));
+  const void    **ptr     = malloc (loops * sizeof(*ptr));
+  const char    **country = malloc (loops * sizeof(*country));
+  DWORD  found, mismatch = 0;
+  double start;
+  int    i;
+
+  if (!addr || !ptr || !country || !geoip_ipv4_entries || geoip4_index.num == 0)
+  {
+    C_printf ("No IPv4 entries or no memory.\n");
+    free (addr);
+    free (ptr);
+    free (country);
+    return;
+  }
+
+  srand ((unsigned int)time(NULL));
+  for (i = 0; i < loops; i++)
+  {
+    make_random_addr (&addr[i], NULL);
+    ptr[i] = &addr[i];
+  }
+
+  C_printf ("IPv4 benchmark; %s random addresses, %s ranges:\n",
+            dword_str(loops), dword_str(geoip4_index.num));
+
+  start = get_timestamp_now();
+  for (i = found = 0; i < loops; i++)
+  {
+    DWORD ip_num = swap32 (addr[i].s_addr);
+
+    if (smartlist_bsearch(geoip_ipv4_entries, &ip_num, geoip_ipv4_compare_key_to_entry))
+       found++;
+  }
+  bench_report ("smartlist:", loops, found, get_timestamp_now() - start);
+
+  start = get_timestamp_now();
+  for (i = found = 0; i < loops; i++)
+  {
+    if (geoip4_index_lookup(swap32(addr[i].s_addr)))
+       found++;
+  }
+  bench_report ("flat index:", loops, found, get_timestamp_now() - start);
+
+  start = get_timestamp_now();
+  found = geoip_lookup_many (AF_INET, ptr, loops, country);
+  bench_report ("batched:", loops, found, get_timestamp_now() - start);
+
+  for (i = 0; i < loops; i++)
+  {
+    DWORD ip_num = swap32 (addr[i].s_addr);
+    DWORD node   = geoip4_index_lookup (ip_num);
+    const struct ipv4_node *entry = smartlist_bsearch (geoip_ipv4_entries, &ip_num,
+                                                       geoip_ipv4_compare_key_to_entry);
+    if ((entry == NULL) != (node == 0) ||
+        (entry && strcmp(entry->country, geoip4_index.cc_table[geoip4_index.cc_idx[node]])))
+       mismatch++;
+    else if ((entry == NULL) != (country[i] == NULL) ||
+             (entry && strcmp(entry->country, country[i])))
+       mismatch++;
+  }
+  C_printf ("  %s mismatches.\n", dword_str(mismatch));
+  ip2loc_bench (AF_INET, ptr, loops);
+  free (addr);
+  free (ptr);
+  free (country);
+}
+
+/**
+ * As above, but for the `geoip6_index` and `geoip_ipv6_entries`.
+ */
+static void bench_addr6 (int loops)
+{
+  struct in6_addr *addr    = malloc (loops * sizeof(*addr));
+  const void     **ptr     = malloc (loops * sizeof(*ptr));
+  const char     **country = malloc (loops * sizeof(*country));
+  DWORD  found, mismatch = 0;
+  double start;
+  int    i;
+
+  if (!addr || !ptr || !country || !geoip_ipv6_entries || geoip6_index.num == 0)
+  {
+    C_printf ("No IPv6 entries or no memory.\n");
+    free (addr);
+    free (ptr);
+    free (country);
+    return;
+  }
+
+  srand ((unsigned int)time(NULL));
+  for (i = 0; i < loops; i++)
+  {
+    make_random_addr (NULL, &addr[i]);
+    ptr[i] = &addr[i];
+  }
+
+  C_printf ("IPv6 benchmark; %s random addresses, %s ranges:\n",
+            dword_str(loops), dword_str(geoip6_index.num));
+
+  start = get_timestamp_now();
+  for (i = found = 0; i < loops; i++)
+  {
+    if (smartlist_bsearch(geoip_ipv6_entries, &addr[i], geoip_ipv6_compare_key_to_entry))
+       found++;
+  }
+  bench_report ("smartlist:", loops, found, get_timestamp_now() - start);
+
+  start = get_timestamp_now();
+  for (i = found = 0; i < loops; i++)
+  {
+    if (geoip6_index_lookup(&addr[i]))
+       found++;
+  }
+  bench_report ("flat index:", loops, found, get_timestamp_now() - start);
+
+  start = get_timestamp_now();
+  found = geoip_lookup_many (AF_INET6, ptr, loops, country);
+  bench_report ("batched:", loops, found, get_timestamp_now() - start);
+
+  for (i = 0; i < loops; i++)
+  {
+    DWORD node = geoip6_index_lookup (&addr[i]);
+    const struct ipv6_node *entry = smartlist_bsearch (geoip_ipv6_entries, &addr[i],
+                                                       geoip_ipv6_compare_key_to_entry);
+    if ((entry == NULL) != (node == 0) ||
+        (entry && strcmp(entry->country, geoip6_index.cc_table[geoip6_index.cc_idx[node]])))
+       mismatch++;
+    else if ((entry == NULL) != (country[i] == NULL) ||
+             (entry && strcmp(entry->country, country[i])))
+       mismatch++;
+  }
+  C_printf ("  %s mismatches.\n", dword_str(mismatch));
+  ip2loc_bench (AF_INET6, ptr, loops);
+  free (addr);
+  free (ptr);
+  free (country);
+}
+
 /**
  * This accepts only one address per line.
  * Trailing `# comments` with or without a starting `<TAB>` are stripped off.
@@ -2178,6 +3351,18 @@ static smartlist_t *make_argv_list (int _argc, char **_argv)
   return (list);
 }
 
+/**
+ * The `-D` and `-b` options needs the `geoip_ipv4_entries` and `geoip_ipv6_entries`
+ * lists. These are not loaded when the index was mapped from a snapshot.
+ */
+static void load_csv_lists (bool do_4, bool do_6)
+{
+  if (do_4 && !geoip_ipv4_entries && file_exists(g_cfg.GEOIP.ip4_file))
+     geoip_parse_csv (g_cfg.GEOIP.ip4_file, AF_INET);
+  if (do_6 && !geoip_ipv6_entries && file_exists(g_cfg.GEOIP.ip6_file))
+     geoip_parse_csv (g_cfg.GEOIP.ip6_file, AF_INET6);
+}
+
 static int check_requirements (void)
 {
   if (!g_cfg.GEOIP.ip4_file || !file_exists(g_cfg.GEOIP.ip4_file))
@@ -2201,19 +3386,22 @@ static int check_requirements (void)
 int geoip_main (int argc, char **argv)
 {
   int     c, do_cidr = 0,  do_4 = 0, do_6 = 0, do_force = 0;
-  int     do_update = 0, do_dump = 0, do_rand = 0;
+  int     do_update = 0, do_dump = 0, do_rand = 0, do_bench = 0;
   int     use_ip2loc = 1;
   int     loops = 10;
   WSADATA wsa;
 
   set_program_name (argv[0]);
 
-  while ((c = getopt (argc, argv, "h?cDfin:ru46")) != EOF)
+  while ((c = getopt (argc, argv, "h?bcDfin:ru46")) != EOF)
     switch (c)
     {
       case '?':
       case 'h':
            return show_help();
+      case 'b':
+           do_bench = 1;
+           break;
       case 'c':
            do_cidr = 1;
            break;
@@ -2272,6 +3460,9 @@ int geoip_main (int argc, char **argv)
   argc -= optind;
   argv += optind;
 
+  if (do_dump || do_bench)
+     load_csv_lists (do_4, do_6);
+
   if (do_dump)
   {
     if (do_4)
@@ -2283,7 +3474,14 @@ int geoip_main (int argc, char **argv)
   }
 
   WSAStartup (MAKEWORD(1,1), &wsa);
-  if (do_rand)
+  if (do_bench)
+  {
+    if (do_4)
+       bench_addr4 (loops);
+    if (do_6)
+       bench_addr6 (loops);
+  }
+  else if (do_rand)
   {
     if (do_4)
        rand_test_addr4 (loops, use_ip2loc);
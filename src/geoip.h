@@ -26,16 +26,25 @@ struct ipv6_node {
        char            country [3];  /**< The short country name of this node */
      };
 
-/**\struct ip2loc_entry
+/**
+ * The fields to look up with `ip2loc_lookup_ipv4()` or `ip2loc_lookup_ipv6()`.
+ */
+#define IP2LOC_COUNTRY   0x0001    /**< `struct ip2loc_result::country_short` */
+#define IP2LOC_REGION    0x0002    /**< `struct ip2loc_result::region` */
+#define IP2LOC_CITY      0x0004    /**< `struct ip2loc_result::city` */
+#define IP2LOC_POSITION  0x0008    /**< `struct ip2loc_result::latitude` and `longitude` */
+
+/**\struct ip2loc_result
  * A structure as returned from functions in ip2loc.c.
+ * The strings are owned by ip2loc.c and valid until `ip2loc_exit()`.
  */
-struct ip2loc_entry {
-       char   country_short [3];    /**< The short country name of this entry */
-       char   country_long  [30];   /**< The full country name of this entry */
-       char   city [40];            /**< The city name of this entry (if any) */
-       char   region [40];          /**< The region name of this entry (if any) */
-       float  latitude;             /**< The latitude of this entry (if any) */
-       float  longitude;            /**< The longitude of this entry (if any) */
+struct ip2loc_result {
+       DWORD       fields;          /**< The `IP2LOC_x` fields set below */
+       const char *country_short;   /**< The short country name of this entry */
+       const char *city;            /**< The city name of this entry. Or "" */
+       const char *region;          /**< The region name of this entry. Or "" */
+       float       latitude;        /**< The latitude of this entry (if any) */
+       float       longitude;       /**< The longitude of this entry (if any) */
      };
 
 /**\typedef position
@@ -47,9 +56,14 @@ typedef struct position {
       } position;
 
 extern int         geoip_init (DWORD *_num4, DWORD *_num6);
+extern DWORD       geoip_load (int family);
+extern int         geoip_init_finish (DWORD *_num4, DWORD *_num6);
 extern void        geoip_exit (void);
 extern const char *geoip_get_country_by_ipv4 (const struct in_addr *addr);
 extern const char *geoip_get_country_by_ipv6 (const struct in6_addr *addr);
+extern int         geoip_lookup_many (int family, const void **addresses, int num, const char **countries);
+extern const char *geoip_lookup_country (int family, const void *addr, bool *via_ip2loc);
+extern void        geoip_stats_add (int family, const char *country_A2, bool via_ip2loc);
 extern const char *geoip_get_long_name_by_id (int number);
 extern const char *geoip_get_long_name_by_A2 (const char *short_name);
 extern const char *geoip_get_location_by_ipv4 (const struct in_addr *ip4);
@@ -70,11 +84,12 @@ extern void geoip_num_unique_countries (DWORD *num_ip4,     DWORD *num_ip6,
  */
 extern bool  ip2loc_init (void);
 extern void  ip2loc_exit (void);
-extern bool  ip2loc_get_ipv4_entry (const struct in_addr *addr, struct ip2loc_entry *out);
-extern bool  ip2loc_get_ipv6_entry (const struct in6_addr *addr, struct ip2loc_entry *out);
+extern bool  ip2loc_lookup_ipv4 (const struct in_addr *addr, DWORD fields, struct ip2loc_result *res);
+extern bool  ip2loc_lookup_ipv6 (const struct in6_addr *addr, DWORD fields, struct ip2loc_result *res);
 extern DWORD ip2loc_num_ipv4_entries (void);
 extern DWORD ip2loc_num_ipv6_entries (void);
 extern DWORD ip2loc_index_errors (void);
+extern void  ip2loc_bench (int family, const void **addresses, int num);
 
 #endif
 
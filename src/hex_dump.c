@@ -0,0 +1,585 @@
+/**\file    hex_dump.c
+ * \ingroup Main
+ *
+ * \brief
+ *   Formatting of data as hex and ASCII rows into a large block of output.
+ *
+ * Used by `dump_data()` and `dump_wsabuf()` in dump.c. A row is like:
+ * ```
+ *  <indent><prefix>0000: 47 45 54 20 2F 20 48 54 54 50 2F 31 2E 31 0D 0A  GET / HTTP/1.1..
+ * ```
+ *
+ * Previously each character of a row was put with a `C_putc()` and each
+ * row was written out on it's own. Now the rows are formatted into a block
+ * of `HEX_DUMP_BLOCK_SIZE` bytes that is written out when full. Several
+ * buffers (e.g. a `WSABUF` array) can be formatted into the same block
+ * directly from where the data is.
+ *
+ * A full row of 16 bytes is done with SSSE3 table lookups (`pshufb`)
+ * when the CPU has it. Otherwise (or for the last short row) a 256
+ * entry table of the hex digits and one of the printable characters
+ * are used.
+ *
+ * This file has no Windows specific code. Build and run the benchmark
+ * against the old `C_putc()` style dumper on e.g. Linux with:
+ * ```
+ *   gcc -O2 -DHEX_DUMP_TEST -o hex_dump_test hex_dump.c
+ *   ./hex_dump_test [kBytes]
+ * ```
+ *
+ * hex_dump.c - Part of Wsock-Trace.
+ */
+#if defined(HEX_DUMP_TEST)
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <stdint.h>
+  #if defined(_WIN32)
+    #include <windows.h>
+  #else
+    #include <time.h>
+  #endif
+#else
+  #include "common.h"
+#endif
+
+#include "hex_dump.h"
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1500) && (defined(_M_IX86) || defined(_M_X64)) && !defined(_M_ARM64EC)
+  #include <intrin.h>
+  #include <tmmintrin.h>
+  #define HEX_DUMP_SSSE3 1
+
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+  #include <tmmintrin.h>
+  #include <cpuid.h>
+  #define HEX_DUMP_SSSE3 1
+#endif
+
+/*
+ * With clang-cl and gcc, the SSSE3 intrinsics must be in
+ * a function compiled for it.
+ */
+#if defined(__clang__) || defined(__GNUC__)
+  #define HEX_DUMP_SSSE3_FUNC  __attribute__((target("ssse3")))
+#else
+  #define HEX_DUMP_SSSE3_FUNC
+#endif
+
+/**
+ * The max length of a row after the indent and prefix: <br>
+ * `"0000: "` + 16 * `"XX "` + `" "` + 16 characters + `"\r\n"`.
+ */
+#define HEX_DUMP_ROW_SIZE  (6 + 3*16 + 1 + 16 + 2)
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static char hex_triplet [256][4];   /* "XX " + 1 byte written over by the next */
+static char hex_printable [256];    /* The byte or a '.' */
+static int  hex_use_ssse3 = -1;     /* Not yet checked */
+
+static bool hex_have_ssse3 (void)
+{
+#if defined(HEX_DUMP_SSSE3) && defined(_MSC_VER)
+  int info [4];
+
+  __cpuid (info, 1);
+  return ((info[2] & (1 << 9)) != 0);
+
+#elif defined(HEX_DUMP_SSSE3)
+  unsigned eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+     return (false);
+  return ((ecx & bit_SSSE3) != 0);
+
+#else
+  return (false);
+#endif
+}
+
+/**
+ * Build the tables once. Several threads doing it at the same time
+ * is harmless; they all write the same values.
+ */
+static void hex_tables_init (void)
+{
+  int i;
+
+  if (hex_use_ssse3 >= 0)
+     return;
+
+  for (i = 0; i < 256; i++)
+  {
+    hex_triplet [i][0] = hex_digits [i >> 4];
+    hex_triplet [i][1] = hex_digits [i & 15];
+    hex_triplet [i][2] = ' ';
+    hex_triplet [i][3] = ' ';
+    hex_printable [i]  = (i < ' ' || i >= 0x7F) ? '.' : (char)i;
+  }
+  hex_use_ssse3 = hex_have_ssse3() ? 1 : 0;
+}
+
+static char *hex_row_offset (char *p, size_t ofs)
+{
+  p[0] = hex_digits [(ofs >> 12) & 15];
+  p[1] = hex_digits [(ofs >> 8) & 15];
+  p[2] = hex_digits [(ofs >> 4) & 15];
+  p[3] = hex_digits [ofs & 15];
+  p[4] = ':';
+  p[5] = ' ';
+  return (p + 6);
+}
+
+/**
+ * Format a row of `n <= 16` bytes using the tables.
+ */
+static char *hex_row_scalar (char *p, const uint8_t *data, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++, p += 3)
+      memcpy (p, hex_triplet[data[i]], 4);
+
+  for ( ; i < 16; i++, p += 3)    /* pad row to 16 positions */
+      memcpy (p, "   ", 3);
+  *p++ = ' ';
+
+  for (i = 0; i < n; i++)
+      *p++ = hex_printable [data[i]];
+  return (p);
+}
+
+#if defined(HEX_DUMP_SSSE3)
+/**
+ * Format a full row of 16 bytes.
+ *
+ * The hex digits of the high and low nibbles are looked up with `pshufb`
+ * and interleaved into 2 vectors of 8 * `"XX"`. The 48 characters of the
+ * `"XX "` triplets are shuffled out of these and the spaces or'ed in
+ * (`pshufb` gives a 0 for an index with the high bit set).
+ */
+HEX_DUMP_SSSE3_FUNC
+static char *hex_row_ssse3 (char *p, const uint8_t *data)
+{
+  #define X  -128
+  #define S  ' '
+  const __m128i digits = _mm_setr_epi8 ('0', '1', '2', '3', '4', '5', '6', '7',
+                                        '8', '9', 'A', 'B', 'C', 'D', 'E', 'F');
+  const __m128i shuf0  = _mm_setr_epi8 (0, 1, X, 2, 3, X, 4, 5, X, 6, 7, X, 8, 9, X, 10);
+  const __m128i shuf1a = _mm_setr_epi8 (11, X, 12, 13, X, 14, 15, X, X, X, X, X, X, X, X, X);
+  const __m128i shuf1b = _mm_setr_epi8 (X, X, X, X, X, X, X, X, 0, 1, X, 2, 3, X, 4, 5);
+  const __m128i shuf2  = _mm_setr_epi8 (X, 6, 7, X, 8, 9, X, 10, 11, X, 12, 13, X, 14, 15, X);
+  const __m128i space0 = _mm_setr_epi8 (0, 0, S, 0, 0, S, 0, 0, S, 0, 0, S, 0, 0, S, 0);
+  const __m128i space1 = _mm_setr_epi8 (0, S, 0, 0, S, 0, 0, S, 0, 0, S, 0, 0, S, 0, 0);
+  const __m128i space2 = _mm_setr_epi8 (S, 0, 0, S, 0, 0, S, 0, 0, S, 0, 0, S, 0, 0, S);
+  const __m128i nibble = _mm_set1_epi8 (0x0F);
+  #undef X
+  #undef S
+
+  __m128i v  = _mm_loadu_si128 ((const __m128i*)data);
+  __m128i hi = _mm_shuffle_epi8 (digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+  __m128i lo = _mm_shuffle_epi8 (digits, _mm_and_si128(v, nibble));
+  __m128i a  = _mm_unpacklo_epi8 (hi, lo);   /* bytes 0 - 7 */
+  __m128i b  = _mm_unpackhi_epi8 (hi, lo);   /* bytes 8 - 15 */
+  __m128i printable;
+
+  _mm_storeu_si128 ((__m128i*)p, _mm_or_si128(_mm_shuffle_epi8(a, shuf0), space0));
+  _mm_storeu_si128 ((__m128i*)(p + 16),
+                    _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, shuf1a), _mm_shuffle_epi8(b, shuf1b)),
+                                 space1));
+  _mm_storeu_si128 ((__m128i*)(p + 32), _mm_or_si128(_mm_shuffle_epi8(b, shuf2), space2));
+  p[48] = ' ';
+
+  /* A signed compare; the bytes >= 0x80 are negative and non-printable.
+   */
+  printable = _mm_and_si128 (_mm_cmpgt_epi8(v, _mm_set1_epi8(' ' - 1)),
+                             _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+  _mm_storeu_si128 ((__m128i*)(p + 49),
+                    _mm_or_si128(_mm_and_si128(printable, v),
+                                 _mm_andnot_si128(printable, _mm_set1_epi8('.'))));
+  return (p + 49 + 16);
+}
+#endif  /* HEX_DUMP_SSSE3 */
+
+void hex_dump_init (hex_dump *hd, hex_dump_writer write, bool crlf)
+{
+  hex_tables_init();
+  hd->write = write;
+  hd->crlf  = crlf;
+  hd->len   = 0;
+}
+
+/**
+ * Format `len` bytes of `data` as rows of 16 bytes.
+ *
+ * Each row is indented by `indent` spaces. The first row is followed by
+ * the `prefix` (if any); the other rows by as many spaces. The offsets
+ * start at 0 for each call.
+ */
+void hex_dump_data (hex_dump *hd, const void *data, size_t len, size_t indent, const char *prefix)
+{
+  const uint8_t *bytes = (const uint8_t*) data;
+  char           lead [HEX_DUMP_MAX_LEAD];
+  size_t         prefix_len = prefix ? strlen (prefix) : 0;
+  size_t         lead_len, ofs;
+
+  if (indent > sizeof(lead))
+     indent = sizeof(lead);
+  if (prefix_len > sizeof(lead) - indent)
+     prefix_len = sizeof(lead) - indent;
+  lead_len = indent + prefix_len;
+
+  memset (lead, ' ', lead_len);
+  if (prefix_len > 0)
+     memcpy (lead + indent, prefix, prefix_len);
+
+  for (ofs = 0; ofs < len; ofs += 16)
+  {
+    size_t n = (len - ofs < 16) ? len - ofs : 16;
+    char  *p;
+
+    if (hd->len + lead_len + HEX_DUMP_ROW_SIZE > HEX_DUMP_BLOCK_SIZE)
+       hex_dump_flush (hd);
+
+    p = hd->buf + hd->len;
+    memcpy (p, lead, lead_len);
+    p = hex_row_offset (p + lead_len, ofs);
+
+#if defined(HEX_DUMP_SSSE3)
+    if (n == 16 && hex_use_ssse3 > 0)
+         p = hex_row_ssse3 (p, bytes + ofs);
+    else p = hex_row_scalar (p, bytes + ofs, n);
+#else
+    p = hex_row_scalar (p, bytes + ofs, n);
+#endif
+
+    if (hd->crlf)
+       *p++ = '\r';
+    *p++ = '\n';
+    hd->len = p - hd->buf;
+
+    if (ofs == 0 && prefix_len > 0)
+       memset (lead + indent, ' ', prefix_len);
+  }
+}
+
+/**
+ * Add a line of text (without a newline) to the block.
+ */
+void hex_dump_line (hex_dump *hd, const char *line)
+{
+  size_t len = strlen (line);
+
+  if (hd->len + len + 2 > HEX_DUMP_BLOCK_SIZE)
+  {
+    hex_dump_flush (hd);
+    if (len + 2 > HEX_DUMP_BLOCK_SIZE)
+       len = HEX_DUMP_BLOCK_SIZE - 2;
+  }
+  memcpy (hd->buf + hd->len, line, len);
+  hd->len += len;
+  if (hd->crlf)
+     hd->buf [hd->len++] = '\r';
+  hd->buf [hd->len++] = '\n';
+}
+
+/**
+ * Write out what is in the block.
+ */
+void hex_dump_flush (hex_dump *hd)
+{
+  if (hd->len > 0)
+     (*hd->write) (hd->buf, hd->len);
+  hd->len = 0;
+}
+
+#if defined(HEX_DUMP_TEST)
+/*
+ * A check and a benchmark of the above.
+ *
+ * 1) Check that the rows are the same as those of the old dumper in
+ *    dump.c for all lengths up to 100 bytes; with and without a prefix.
+ *    With the tables only and with SSSE3 (if the CPU has it).
+ *
+ * 2) Dump `test_kbytes` of random data in 1460 byte (a TCP segment) pieces.
+ *    Write out to the null-device like `C_write()` does. Report the MB/s
+ *    of data dumped for the old dumper and the new.
+ */
+#define TEST_PIECE   1460
+#define TEST_ROUNDS  5
+
+#if defined(_WIN32)
+  #define TEST_NULL_DEVICE  "NUL"
+#else
+  #define TEST_NULL_DEVICE  "/dev/null"
+#endif
+
+static unsigned      test_kbytes = 64*1024;
+static volatile long test_errors;
+static FILE         *test_null;
+static char         *test_capture;    /* != NULL: capture the output here */
+static size_t        test_captured;
+
+static void test_error (const char *what, size_t len, const char *prefix)
+{
+  if (++test_errors <= 10)
+     printf ("Error: %s for len: %u, prefix: '%s'.\n", what, (unsigned)len, prefix ? prefix : "<none>");
+}
+
+static uint32_t test_rand (uint32_t *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 8);
+}
+
+static size_t test_write (char *buf, size_t len)
+{
+  if (test_capture)
+  {
+    memcpy (test_capture + test_captured, buf, len);
+    test_captured += len;
+    return (len);
+  }
+  return fwrite (buf, 1, len, test_null);
+}
+
+/*
+ * The old dumper; like `C_putc()` into a 2 kB trace-buffer that is
+ * written out for each newline.
+ */
+static char  old_buf [2*1024];
+static char *old_ptr = old_buf;
+
+static void old_flush (void)
+{
+  test_write (old_buf, old_ptr - old_buf);
+  old_ptr = old_buf;
+}
+
+static void old_putc (int ch)
+{
+  *old_ptr++ = (char) ch;
+  if (ch == '\n' || old_ptr >= old_buf + sizeof(old_buf) - 1)
+     old_flush();
+}
+
+static void old_puts (const char *str)
+{
+  while (*str)
+     old_putc (*str++);
+}
+
+static void old_indent (size_t indent)
+{
+  while (indent--)
+     old_putc (' ');
+}
+
+static const char *old_hex (unsigned val, int digits)
+{
+  static char buf [5];
+  int i;
+
+  for (i = digits-1; i >= 0; i--, val >>= 4)
+      buf[i] = hex_digits [val & 15];
+  buf [digits] = '\0';
+  return (buf);
+}
+
+static void old_dump (const uint8_t *data, unsigned data_len, size_t indent, const char *prefix)
+{
+  unsigned i = 0, j, ofs;
+
+  for (ofs = 0; ofs < data_len; ofs += 16)
+  {
+    old_indent (indent);
+
+    if (prefix)
+    {
+      if (ofs == 0)
+           old_puts (prefix);
+      else old_indent (strlen(prefix));
+    }
+    old_puts (old_hex(ofs & 0xFFFF, 4));
+    old_puts (": ");
+
+    for (i = j = 0; i < 16 && i+ofs < data_len; i++)
+    {
+      old_puts (old_hex(data[i+ofs], 2));
+      old_putc (' ');
+      j = i;
+    }
+
+    for ( ; j < 15; j++)
+        old_puts ("   ");
+    old_putc (' ');
+
+    for (i = 0; i < 16 && i+ofs < data_len; i++)
+    {
+      int ch = data [i+ofs];
+
+      if (ch < ' ' || ch >= 0x7F)
+           old_putc ('.');
+      else old_putc (ch);
+    }
+    old_putc ('\n');
+  }
+}
+
+#if defined(_WIN32)
+  static double test_now (void)
+  {
+    LARGE_INTEGER now, freq;
+
+    QueryPerformanceCounter (&now);
+    QueryPerformanceFrequency (&freq);
+    return (double) now.QuadPart / (double) freq.QuadPart;
+  }
+#else
+  static double test_now (void)
+  {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1E9;
+  }
+#endif
+
+static hex_dump test_hd;
+
+/*
+ * Part 1.
+ */
+static void test_compare (const uint8_t *data)
+{
+  static const char *prefixes[] = { NULL, "iov 0: ", "control: " };
+  size_t  len, p, size = 200 * 100;
+  char   *old_out = malloc (size);
+  char   *new_out = malloc (size);
+
+  if (!old_out || !new_out)
+  {
+    test_error ("alloc", 0, NULL);
+    goto quit;
+  }
+
+  for (p = 0; p < sizeof(prefixes)/sizeof(prefixes[0]); p++)
+  {
+    for (len = 0; len <= 100; len++)
+    {
+      size_t old_len;
+
+      test_capture  = old_out;
+      test_captured = 0;
+      old_dump (data + len, (unsigned)len, 7, prefixes[p]);
+      old_len = test_captured;
+
+      test_capture  = new_out;
+      test_captured = 0;
+      hex_dump_init (&test_hd, test_write, false);
+      hex_dump_data (&test_hd, data + len, len, 7, prefixes[p]);
+      hex_dump_flush (&test_hd);
+
+      if (old_len != test_captured || memcmp(old_out, new_out, old_len))
+         test_error ("different rows", len, prefixes[p]);
+    }
+  }
+
+quit:
+  test_capture = NULL;
+  free (old_out);
+  free (new_out);
+}
+
+static void test_report (const char *what, size_t bytes, double sec)
+{
+  printf ("  %-22s %8.1f MB/s\n", what, sec > 0.0 ? (double)bytes / (1024.0 * 1024.0 * sec) : 0.0);
+}
+
+/*
+ * Part 2.
+ */
+static double test_bench (const uint8_t *data, size_t size, bool old)
+{
+  double best = 0.0;
+  int    round;
+
+  for (round = 0; round < TEST_ROUNDS; round++)
+  {
+    double start = test_now();
+    double sec;
+    size_t ofs;
+
+    if (!old)
+       hex_dump_init (&test_hd, test_write, false);
+
+    for (ofs = 0; ofs < size; ofs += TEST_PIECE)
+    {
+      size_t len = (size - ofs < TEST_PIECE) ? size - ofs : TEST_PIECE;
+
+      if (old)
+           old_dump (data + ofs, (unsigned)len, 4, NULL);
+      else hex_dump_data (&test_hd, data + ofs, len, 4, NULL);
+    }
+    if (!old)
+       hex_dump_flush (&test_hd);
+
+    sec = test_now() - start;
+    if (round == 0 || sec < best)
+       best = sec;
+  }
+  return (best);
+}
+
+int main (int argc, char **argv)
+{
+  size_t   i, size;
+  uint32_t seed = 1;
+  uint8_t *data;
+  int      have_ssse3;
+
+  if (argc > 1)
+     test_kbytes = (unsigned) atol (argv[1]);
+  if (test_kbytes < 1)
+  {
+    printf ("Use at least 1 kByte.\n");
+    return (1);
+  }
+
+  size = 1024 * (size_t)test_kbytes;
+  data = malloc (size);
+  test_null = fopen (TEST_NULL_DEVICE, "wb");
+  if (!data || !test_null)
+  {
+    printf ("Out of memory or no '%s'.\n", TEST_NULL_DEVICE);
+    return (1);
+  }
+  for (i = 0; i < size; i++)
+      data[i] = (uint8_t) test_rand (&seed);
+
+  hex_tables_init();
+  have_ssse3 = hex_use_ssse3;
+
+  printf ("Dumping %u kB in %u byte pieces (SSSE3: %s):\n",
+          test_kbytes, TEST_PIECE, have_ssse3 ? "yes" : "no");
+
+  hex_use_ssse3 = 0;
+  test_compare (data);
+  test_report ("old C_putc() style:", size, test_bench(data, size, true));
+  test_report ("new, tables:", size, test_bench(data, size, false));
+
+  if (have_ssse3)
+  {
+    hex_use_ssse3 = 1;
+    test_compare (data);
+    test_report ("new, SSSE3:", size, test_bench(data, size, false));
+  }
+
+  fclose (test_null);
+  free (data);
+
+  printf ("%s: %ld errors.\n", test_errors ? "FAILED" : "OKAY", test_errors);
+  return (test_errors ? 1 : 0);
+}
+#endif  /* HEX_DUMP_TEST */
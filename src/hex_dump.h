@@ -0,0 +1,39 @@
+/**\file    hex_dump.h
+ * \ingroup Main
+ *
+ * \brief
+ *   Formatting of data as hex and ASCII rows into a large block of output.
+ */
+#ifndef _HEX_DUMP_H
+#define _HEX_DUMP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/** The size of the output block. */
+#define HEX_DUMP_BLOCK_SIZE  (16*1024)
+
+/** The max length of the indent and prefix of a row. */
+#define HEX_DUMP_MAX_LEAD    256
+
+/**
+ * The function writing out a full block; `buf [len]` may be set to 0.
+ */
+typedef size_t (*hex_dump_writer) (char *buf, size_t len);
+
+/**\struct hex_dump
+ * The state of a dump; `buf` is written out when full and in `hex_dump_flush()`.
+ */
+typedef struct hex_dump {
+        hex_dump_writer write;
+        bool            crlf;                           /**< End the rows with `"\r\n"` */
+        size_t          len;                            /**< Bytes used in `buf` */
+        char            buf [HEX_DUMP_BLOCK_SIZE + 1];  /**< + 1 for a 0-terminator */
+      } hex_dump;
+
+extern void hex_dump_init  (hex_dump *hd, hex_dump_writer write, bool crlf);
+extern void hex_dump_data  (hex_dump *hd, const void *data, size_t len, size_t indent, const char *prefix);
+extern void hex_dump_line  (hex_dump *hd, const char *line);
+extern void hex_dump_flush (hex_dump *hd);
+
+#endif  /* _HEX_DUMP_H */
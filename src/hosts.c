@@ -4,91 +4,439 @@
  * \brief
  *   `/etc/hosts` parsing for wsock_trace.
  *
+ * The entries are kept in a registry built in one pass over the files:
+ *  \li Every host-name is stored once in a string arena and indexed by
+ *      a case-insensitive hash-table.
+ *  \li All the addresses of a name are kept in one contiguous vector.
+ *  \li Every (name, address) pair is indexed by a 2nd hash-table.
+ *
+ * Hence checking a resolved address against all the addresses of a
+ * name is an O(1) operation. Even for blocking hosts-files with 100k+ lines.
+ *
  * By Gisle Vanem <gvanem@yahoo.no> August 2017.
  */
 #include "common.h"
 #include "init.h"
-#include "smartlist.h"
 #include "inet_addr.h"
 #include "csv.h"
+#include "getopt.h"
 #include "hosts.h"
 
 /**
- * \struct host_entry
- * The structure for host-entries we read from a file.
+ * The size of each block in the string arena.
+ */
+#define HOSTS_ARENA_BLOCK  (64*1024)
+
+/**
+ * The initial size of the hash-tables.
+ */
+#define HOSTS_TABLE_SIZE   1024
+
+/**
+ * The default number of lines in the file generated by `hosts_file_bench()`.
  */
-struct host_entry {
-       char        host_name [MAX_HOST_LEN];  /**< name of `/etc/hosts` entry */
-       int         addr_type;                 /**< type `AF_INET` or `AF_INET6` */
-       char        addr [IN6ADDRSZ];          /**< the address; 16 bytes to hold an IPv6 address */
-       const char *file;                      /**< which `g_cfg.hosts_file[]` is this entry from? */
+#define HOSTS_BENCH_LINES  500000
+
+/**
+ * \struct host_name
+ * A unique host-name from the hosts-files.
+ */
+struct host_name {
+       const char *name;     /**< the name; allocated in the string arena */
+       DWORD       hash;     /**< the case-insensitive hash of `name` */
+       DWORD       first;    /**< index of the first address in `hosts.addr[]` */
+       DWORD       count;    /**< number of addresses for this name */
      };
 
-static smartlist_t *hosts_list;
-static int          current_hosts_file;
-static unsigned     num_af_inet;
-static unsigned     num_af_inet6;
+/**
+ * \struct host_addr
+ * An address of a `host_name`.
+ */
+struct host_addr {
+       DWORD  name;               /**< index into `hosts.names[]` */
+       DWORD  hash;               /**< the hash of the (`name`, `family`, `addr`) triple */
+       WORD   family;             /**< `AF_INET` or `AF_INET6` */
+       WORD   file;               /**< which `g_cfg.hosts_file[]` is this entry from? */
+       BYTE   addr [IN6ADDRSZ];   /**< the address; 16 bytes to hold an IPv6 address */
+     };
 
 /**
- * Add an entry to the given `smartlist_t` that becomes `hosts_list`.
+ * \struct hosts_table
+ * An open-addressed hash-table of indices (+1) into `hosts.names[]` or `hosts.addr[]`.
  */
-static void add_entry (const void *addr, const char *name, int af_type)
+struct hosts_table {
+       DWORD *slots;     /**< 0 means an empty slot */
+       DWORD  mask;      /**< the number of slots - 1 */
+     };
+
+/**
+ * \struct hosts_arena
+ * One block of the string arena. Never moves once allocated.
+ */
+struct hosts_arena {
+       struct hosts_arena *next;
+       size_t              used;
+       char                data [HOSTS_ARENA_BLOCK];
+     };
+
+/**
+ * \struct hosts_registry
+ * All the data loaded from the hosts-files.
+ */
+struct hosts_registry {
+       struct host_name   *names;         /**< the unique names */
+       DWORD               num_names;
+       DWORD               max_names;
+       struct host_addr   *addr;          /**< the addresses; grouped on name after `hosts_make_vectors()` */
+       DWORD               num_addr;
+       DWORD               max_addr;
+       struct hosts_table  name_tab;      /**< hash-table on `names[]` */
+       struct hosts_table  addr_tab;      /**< hash-table on `addr[]` */
+       struct hosts_arena *arena;         /**< the string arena; newest block first */
+       DWORD               duplicates;    /**< number of duplicated (name, address) pairs */
+       DWORD               num_af_inet;
+       DWORD               num_af_inet6;
+       DWORD               rec_num;       /**< the sum of `CSV_context::rec_num` for all files */
+       DWORD               line_num;      /**< ditto for `CSV_context::line_num` */
+       DWORD               parse_errors;  /**< ditto for `CSV_context::parse_errors` */
+       DWORD               comment_lines; /**< ditto for `CSV_context::comment_lines` */
+     };
+
+static struct hosts_registry hosts;
+static int                   current_hosts_file;
+static bool                  hosts_loaded;
+
+/**
+ * The case-insensitive FNV-1a hash of a host-name.
+ */
+static DWORD hosts_hash_name (const char *name)
 {
-  struct host_entry *he;
-  int    asize = 0;
+  DWORD hash = 2166136261U;
 
-  switch (af_type)
+  while (*name)
   {
-    case AF_INET:
-         asize = sizeof (struct in_addr);
-         break;
-    case AF_INET6:
-         asize = sizeof (struct in6_addr);
-         break;
-    default:
-         assert (0);
+    hash ^= (BYTE) tolower (*(const BYTE*)name);
+    hash *= 16777619U;
+    name++;
   }
+  return (hash);
+}
+
+/**
+ * The FNV-1a hash of a (name-index, family, address) triple.
+ */
+static DWORD hosts_hash_addr (DWORD name, int family, const void *addr, int asize)
+{
+  const BYTE *p = (const BYTE*) addr;
+  DWORD hash = 2166136261U;
+  int   i;
 
-  he = calloc (1, sizeof(*he));
-  if (he && asize)
+  for (i = 0; i < 4; i++)
+  {
+    hash ^= (BYTE) (name >> (8*i));
+    hash *= 16777619U;
+  }
+  hash ^= (BYTE) family;
+  hash *= 16777619U;
+  for (i = 0; i < asize; i++)
   {
-    he->addr_type = af_type;
-    str_ncpy (he->host_name, name, sizeof(he->host_name));
-    memcpy (&he->addr, addr, asize);
-    he->file = g_cfg.hosts_file [current_hosts_file];
-    smartlist_add (hosts_list, he);
+    hash ^= p[i];
+    hash *= 16777619U;
   }
+  return (hash);
+}
+
+static int hosts_addr_size (int family)
+{
+  if (family == AF_INET)
+     return sizeof (struct in_addr);
+  if (family == AF_INET6)
+     return sizeof (struct in6_addr);
+  return (0);
+}
+
+static DWORD hosts_name_hash_of (DWORD idx)
+{
+  return (hosts.names[idx].hash);
+}
+
+static DWORD hosts_addr_hash_of (DWORD idx)
+{
+  return (hosts.addr[idx].hash);
 }
 
 /**
- * `smartlist_sort()` and `smartlist_make_uniq()` helper;
- * compare on address-types, then on names.
+ * Make room for `need` entries in the hash-table `tab`.
+ * Keep the load-factor below 50%. Rehash the old entries using `hash_of()`.
  */
-static int hosts_compare_name (const void **_a, const void **_b)
+static bool hosts_table_reserve (struct hosts_table *tab, DWORD need, DWORD (*hash_of)(DWORD))
 {
-  const struct host_entry *a = *_a;
-  const struct host_entry *b = *_b;
+  DWORD *slots, size, i, j;
+
+  size = tab->slots ? tab->mask + 1 : 0;
+  if (2 * need <= size)
+     return (true);
+
+  if (size == 0)
+     size = HOSTS_TABLE_SIZE;
+  while (size < 2 * need)
+     size *= 2;
 
-  if (a->addr_type == b->addr_type)
-     return stricmp (a->host_name, b->host_name);
+  slots = calloc (size, sizeof(*slots));
+  if (!slots)
+     return (false);
+
+  for (i = 0; tab->slots && i <= tab->mask; i++)
+  {
+    if (!tab->slots[i])
+       continue;
+    j = (*hash_of) (tab->slots[i] - 1) & (size - 1);
+    while (slots[j])
+       j = (j + 1) & (size - 1);
+    slots[j] = tab->slots[i];
+  }
+  free (tab->slots);
+  tab->slots = slots;
+  tab->mask  = size - 1;
+  return (true);
+}
+
+static void hosts_table_insert (struct hosts_table *tab, DWORD hash, DWORD idx)
+{
+  DWORD j = hash & tab->mask;
+
+  while (tab->slots[j])
+     j = (j + 1) & tab->mask;
+  tab->slots[j] = idx + 1;
+}
+
+static void hosts_table_free (struct hosts_table *tab)
+{
+  free (tab->slots);
+  tab->slots = NULL;
+  tab->mask  = 0;
+}
 
-  /* This will cause AF_INET6 addresses to come last.
+/**
+ * Copy a string into the string arena.
+ */
+static const char *hosts_arena_strdup (const char *str)
+{
+  struct hosts_arena *blk = hosts.arena;
+  size_t len = strlen (str) + 1;
+  char  *ret;
+
+  assert (len <= HOSTS_ARENA_BLOCK);
+
+  if (!blk || blk->used + len > sizeof(blk->data))
+  {
+    blk = malloc (sizeof(*blk));
+    if (!blk)
+       return (NULL);
+    blk->used   = 0;
+    blk->next   = hosts.arena;
+    hosts.arena = blk;
+  }
+  ret = blk->data + blk->used;
+  memcpy (ret, str, len);
+  blk->used += len;
+  return (ret);
+}
+
+/**
+ * Return the index + 1 of `name` in `hosts.names[]`. Or 0 if not found.
+ */
+static DWORD hosts_name_find (const char *name, DWORD hash)
+{
+  DWORD j, slot;
+
+  if (!hosts.name_tab.slots)
+     return (0);
+
+  for (j = hash & hosts.name_tab.mask; (slot = hosts.name_tab.slots[j]) != 0;
+       j = (j + 1) & hosts.name_tab.mask)
+  {
+    const struct host_name *hn = hosts.names + slot - 1;
+
+    if (hn->hash == hash && !stricmp(hn->name, name))
+       return (slot);
+  }
+  return (0);
+}
+
+/**
+ * Return the `host_addr` matching the triple. Or NULL if not found.
+ */
+static const struct host_addr *hosts_addr_find (DWORD name, int family, const void *addr, int asize, DWORD hash)
+{
+  DWORD j, slot;
+
+  if (!hosts.addr_tab.slots)
+     return (NULL);
+
+  for (j = hash & hosts.addr_tab.mask; (slot = hosts.addr_tab.slots[j]) != 0;
+       j = (j + 1) & hosts.addr_tab.mask)
+  {
+    const struct host_addr *ha = hosts.addr + slot - 1;
+
+    if (ha->hash == hash && ha->name == name && ha->family == family &&
+        !memcmp(ha->addr, addr, asize))
+       return (ha);
+  }
+  return (NULL);
+}
+
+/**
+ * Return the index of `name` in `hosts.names[]`; add it if new.
+ * Or `(DWORD)-1` if out of memory.
+ */
+static DWORD hosts_name_add (const char *name)
+{
+  struct host_name *hn;
+  DWORD  hash = hosts_hash_name (name);
+  DWORD  slot = hosts_name_find (name, hash);
+
+  if (slot)
+     return (slot - 1);
+
+  if (hosts.num_names == hosts.max_names)
+  {
+    DWORD max = hosts.max_names ? 2 * hosts.max_names : HOSTS_TABLE_SIZE;
+
+    hn = realloc (hosts.names, max * sizeof(*hn));
+    if (!hn)
+       return ((DWORD)-1);
+    hosts.names     = hn;
+    hosts.max_names = max;
+  }
+  if (!hosts_table_reserve(&hosts.name_tab, hosts.num_names + 1, hosts_name_hash_of))
+     return ((DWORD)-1);
+
+  hn = hosts.names + hosts.num_names;
+  hn->name  = hosts_arena_strdup (name);
+  hn->hash  = hash;
+  hn->first = 0;
+  hn->count = 0;
+  if (!hn->name)
+     return ((DWORD)-1);
+
+  hosts_table_insert (&hosts.name_tab, hash, hosts.num_names);
+  return (hosts.num_names++);
+}
+
+/**
+ * Add an address for `name` to the registry; unless it's a duplicate.
+ */
+static void add_entry (const void *addr, const char *name, int af_type)
+{
+  struct host_addr *ha;
+  char   host_name [MAX_HOST_LEN];
+  int    asize = hosts_addr_size (af_type);
+  DWORD  idx, hash;
+
+  assert (asize > 0);
+
+  /* Truncate very long names as before.
    */
-  return (a->addr_type - b->addr_type);
+  str_ncpy (host_name, name, sizeof(host_name));
+  idx = hosts_name_add (host_name);
+  if (idx == (DWORD)-1)
+     return;
+
+  hash = hosts_hash_addr (idx, af_type, addr, asize);
+  if (hosts_addr_find(idx, af_type, addr, asize, hash))
+  {
+    hosts.duplicates++;
+    return;
+  }
+
+  if (hosts.num_addr == hosts.max_addr)
+  {
+    DWORD max = hosts.max_addr ? 2 * hosts.max_addr : HOSTS_TABLE_SIZE;
+
+    ha = realloc (hosts.addr, max * sizeof(*ha));
+    if (!ha)
+       return;
+    hosts.addr     = ha;
+    hosts.max_addr = max;
+  }
+  if (!hosts_table_reserve(&hosts.addr_tab, hosts.num_addr + 1, hosts_addr_hash_of))
+     return;
+
+  ha = hosts.addr + hosts.num_addr;
+  memset (ha, '\0', sizeof(*ha));
+  ha->name   = idx;
+  ha->hash   = hash;
+  ha->family = (WORD) af_type;
+  ha->file   = (WORD) current_hosts_file;
+  memcpy (ha->addr, addr, asize);
+  hosts_table_insert (&hosts.addr_tab, hash, hosts.num_addr);
+  hosts.names[idx].count++;
+  hosts.num_addr++;
+
+  if (af_type == AF_INET)
+       hosts.num_af_inet++;
+  else hosts.num_af_inet6++;
 }
 
 /**
- * `smartlist_bsearch()` helper; compare on names.
+ * Make the addresses of each name a contiguous vector in `hosts.addr[]`.
+ *
+ * A stable counting-sort on the name-index. The order of the addresses
+ * of one name is the order they were in the hosts-file(s).
+ * Since the indices changes, the `hosts.addr_tab` must be rebuilt.
  */
-static int hosts_bsearch_name (const void *key, const void **member)
+static void hosts_make_vectors (void)
 {
-  const struct host_entry *he = *member;
-  const char              *name = key;
-  int   rc = stricmp (name, he->host_name);
+  struct host_addr *sorted;
+  DWORD  i, pos;
 
-  TRACE (3, "key: %-30s he->host_name: %-30s he->addr_type: %d, rc: %d\n",
-         name, he->host_name, he->addr_type, rc);
-  return (rc);
+  if (hosts.num_addr == 0)
+     return;
+
+  sorted = malloc (hosts.num_addr * sizeof(*sorted));
+  if (!sorted)
+     return;
+
+  /* Let `first` be the end of each vector; then fill them from the back.
+   */
+  for (i = pos = 0; i < hosts.num_names; i++)
+  {
+    pos += hosts.names[i].count;
+    hosts.names[i].first = pos;
+  }
+  for (i = hosts.num_addr; i > 0; i--)
+  {
+    const struct host_addr *ha = hosts.addr + i - 1;
+
+    sorted [--hosts.names[ha->name].first] = *ha;
+  }
+
+  free (hosts.addr);
+  hosts.addr     = sorted;
+  hosts.max_addr = hosts.num_addr;
+
+  memset (hosts.addr_tab.slots, '\0', (hosts.addr_tab.mask + 1) * sizeof(DWORD));
+  for (i = 0; i < hosts.num_addr; i++)
+      hosts_table_insert (&hosts.addr_tab, hosts.addr[i].hash, i);
+}
+
+/**
+ * Return the number of bytes allocated for the registry.
+ */
+static size_t hosts_bytes (void)
+{
+  const struct hosts_arena *blk;
+  size_t size = hosts.max_names * sizeof(*hosts.names) +
+                hosts.max_addr  * sizeof(*hosts.addr);
+
+  if (hosts.name_tab.slots)
+     size += (hosts.name_tab.mask + 1) * sizeof(DWORD);
+  if (hosts.addr_tab.slots)
+     size += (hosts.addr_tab.mask + 1) * sizeof(DWORD);
+  for (blk = hosts.arena; blk; blk = blk->next)
+      size += sizeof(*blk);
+  return (size);
 }
 
 /**
@@ -134,15 +482,9 @@ static int hosts_CSV_add (struct CSV_context *ctx, const char *value)
          break;
     case 1:
          if (family == AF_INET)
-         {
-           add_entry (&ip4, value, family);
-           num_af_inet++;
-         }
+            add_entry (&ip4, value, family);
          else if (family == AF_INET6)
-         {
-           add_entry (&ip6, value, family);
-           num_af_inet6++;
-         }
+            add_entry (&ip6, value, family);
          family = -1;
          memset (&ip4, '\0', sizeof(ip4));
          memset (&ip6, '\0', sizeof(ip6));
@@ -152,50 +494,86 @@ static int hosts_CSV_add (struct CSV_context *ctx, const char *value)
 }
 
 /**
- * Print the details of the `hosts_list` and some additional statistics.
+ * `qsort()` helper for `hosts_file_dump()`; compare on names.
  */
-static void hosts_file_dump (int max, int duplicates, const struct CSV_context *ctx)
+static int hosts_compare_name (const void *_a, const void *_b)
 {
-  int i;
+  const struct host_name *a = hosts.names + *(const DWORD*) _a;
+  const struct host_name *b = hosts.names + *(const DWORD*) _b;
+
+  return stricmp (a->name, b->name);
+}
 
-  C_printf ("\nA total of %d entries in these files:\n", max);
+/**
+ * Print the details of the registry and some additional statistics.
+ */
+static void hosts_file_dump (void)
+{
+  DWORD *order, i, j;
+  int    num = 0;
+
+  C_printf ("\nA total of %s names and %s addresses in these files:\n",
+            dword_str(hosts.num_names), dword_str(hosts.num_addr));
   for (i = 0; g_cfg.hosts_file[i]; i++)
-      C_printf ("  %d: \"%s\"\n", i, g_cfg.hosts_file[i]);
+      C_printf ("  %lu: \"%s\"\n", (u_long)i, g_cfg.hosts_file[i]);
 
-  C_printf ("  duplicates: %d, num_af_inet: %u, num_af_inet6: %u.\n"
-            "  ctx->rec_num: %u, ctx->line_num: %u, ctx->parse_errors: %u, ctx->comment_lines: %u.\n\n",
-            duplicates, num_af_inet, num_af_inet6, ctx->rec_num, ctx->line_num,
-            ctx->parse_errors, ctx->comment_lines);
+  C_printf ("  duplicates: %lu, num_af_inet: %lu, num_af_inet6: %lu, memory: %s bytes.\n"
+            "  rec_num: %lu, line_num: %lu, parse_errors: %lu, comment_lines: %lu.\n\n",
+            (u_long)hosts.duplicates, (u_long)hosts.num_af_inet, (u_long)hosts.num_af_inet6,
+            qword_str(hosts_bytes()), (u_long)hosts.rec_num, (u_long)hosts.line_num,
+            (u_long)hosts.parse_errors, (u_long)hosts.comment_lines);
+
+  if (hosts.num_names == 0)
+     return;
+
+  order = malloc (hosts.num_names * sizeof(*order));
+  if (!order)
+     return;
+
+  for (i = 0; i < hosts.num_names; i++)
+      order[i] = i;
+  qsort (order, hosts.num_names, sizeof(*order), hosts_compare_name);
 
   C_puts ("Entries sorted on name:\n");
-  for (i = 0; i < max; i++)
+  for (i = 0; i < hosts.num_names; i++)
   {
-    const struct host_entry *he = smartlist_get (hosts_list, i);
-    char  buf [MAX_IP6_SZ+1];
-    int   file_idx;
+    const struct host_name *hn = hosts.names + order[i];
 
-    for (file_idx = 0; g_cfg.hosts_file [file_idx]; file_idx++)
+    for (j = 0; j < hn->count; j++)
     {
-      if (he->file == g_cfg.hosts_file [file_idx])
-         break;
+      const struct host_addr *ha = hosts.addr + hn->first + j;
+      char  buf [MAX_IP6_SZ+1];
+
+      INET_addr_ntop (ha->family, ha->addr, buf, sizeof(buf), NULL);
+      C_printf ("%3d: %-70s %-20s (hosts-file: %d)\n",
+                num++, j == 0 ? hn->name : "", buf, ha->file);
     }
-    INET_addr_ntop (he->addr_type, he->addr, buf, sizeof(buf), NULL);
-    C_printf ("%3d: %-70s %-20s (hosts-file: %d)\n",
-              i, he->host_name, buf, file_idx);
   }
+  free (order);
 }
 
 /**
- * Free the memory in `hosts_list` and free the list itself.
+ * Free the memory in the registry.
  */
 void hosts_file_exit (void)
 {
-  smartlist_wipe (hosts_list, free);
-  hosts_list = NULL;
+  struct hosts_arena *blk, *next;
+
+  for (blk = hosts.arena; blk; blk = next)
+  {
+    next = blk->next;
+    free (blk);
+  }
+  hosts_table_free (&hosts.name_tab);
+  hosts_table_free (&hosts.addr_tab);
+  free (hosts.names);
+  free (hosts.addr);
+  memset (&hosts, '\0', sizeof(hosts));
+  hosts_loaded = false;
 }
 
 /**
- * Build the `hosts_file` smartlist.
+ * Build the registry from the hosts-files.
  *
  * We support loading multiple `/etc/hosts` files;
  * Currently max 3.
@@ -203,12 +581,8 @@ void hosts_file_exit (void)
 void hosts_file_init (void)
 {
   struct CSV_context ctx;
-  int    dups, max;
 
-  assert (hosts_list == NULL);
-  hosts_list = smartlist_new();
-  if (!hosts_list)
-     return;
+  assert (!hosts_loaded);
 
   for (current_hosts_file = 0; g_cfg.hosts_file[current_hosts_file]; current_hosts_file++)
   {
@@ -218,57 +592,64 @@ void hosts_file_init (void)
     ctx.num_fields = 2;
     ctx.callback   = hosts_CSV_add;
     CSV_open_and_parse_file (&ctx);
+
+    hosts.rec_num       += ctx.rec_num;
+    hosts.line_num      += ctx.line_num;
+    hosts.parse_errors  += ctx.parse_errors;
+    hosts.comment_lines += ctx.comment_lines;
   }
 
-  smartlist_sort (hosts_list, hosts_compare_name);
-  dups = smartlist_make_uniq (hosts_list, hosts_compare_name, free);
+  hosts_make_vectors();
+  hosts_loaded = true;
 
-  /* The new length after the duplicates were removed.
-   */
-  max = smartlist_len (hosts_list);
   if (g_cfg.trace_level >= 3)
-     hosts_file_dump (max, dups, &ctx);
+  {
+    ENTER_CRIT();     /* Other databases could be loading in other threads */
+    hosts_file_dump();
+    LEAVE_CRIT (0);
+  }
 }
 
-/*
- * Check if one of the addresses for `name` is from a hosts-file.
+/**
+ * Return the number of addresses in `addresses[]` (of type `family`)
+ * that are also in a hosts-file for `name`.
  */
-int hosts_file_check_hostent (const char *name, const struct hostent *host)
+static int hosts_check_addresses (const char *name, int family, const char **addresses)
 {
-  const char              **addresses;
-  const struct host_entry  *he;
-  int                       i, asize;
-  int                       num = 0;
-
-  addresses = (const char**) host->h_addr_list;
+  int   i, num, asize = hosts_addr_size (family);
+  DWORD idx;
 
-  if (!name || !hosts_list || !addresses)
+  if (!hosts_loaded || asize == 0)
      return (0);
 
-  /** Do a binary search in the `hosts_list`.
-   */
-  he = smartlist_bsearch (hosts_list, name, hosts_bsearch_name);
+  idx = hosts_name_find (name, hosts_hash_name(name));
+  if (idx-- == 0)
+     return (0);
 
-  for (i = num = 0; he && addresses[i]; i++)
+  for (i = num = 0; addresses[i]; i++)
   {
-    switch (he->addr_type)
-    {
-      case AF_INET:
-           asize = sizeof(struct in_addr);
-           break;
-      case AF_INET6:
-           asize = sizeof(struct in6_addr);
-           break;
-      default:
-           return (num);
-    }
-    if (he->addr_type == host->h_addrtype &&
-        !memcmp(addresses[i], &he->addr, asize))
+    DWORD hash = hosts_hash_addr (idx, family, addresses[i], asize);
+
+    if (hosts_addr_find(idx, family, addresses[i], asize, hash))
        num++;
   }
   return (num);
 }
 
+/*
+ * Check if one of the addresses for `name` is from a hosts-file.
+ */
+int hosts_file_check_hostent (const char *name, const struct hostent *host)
+{
+  const char **addresses;
+
+  addresses = (const char**) host->h_addr_list;
+
+  if (!name || !addresses)
+     return (0);
+  return hosts_check_addresses (name, host->h_addrtype, addresses);
+}
+
 /**
  * As above, but for an `struct addrinfo *`.
  */
@@ -318,3 +699,200 @@ int hosts_file_check_addrinfoW (const wchar_t *name, const struct addrinfoW *aiW
   ai.ai_addr   = aiW->ai_addr;
   return hosts_file_check_addrinfo (a_name, &ai);
 }
+
+/**
+ * Replace the configured hosts-files with `file` and reload the registry.
+ */
+static void hosts_file_reload (const char *file)
+{
+  int i;
+
+  hosts_file_exit();
+  for (i = 0; i < DIM(g_cfg.hosts_file); i++)
+  {
+    free (g_cfg.hosts_file[i]);
+    g_cfg.hosts_file[i] = NULL;
+  }
+  g_cfg.hosts_file[0]   = strdup (file);
+  g_cfg.num_hosts_files = 1;
+  hosts_file_init();
+}
+
+/**
+ * The addresses of block `b` written by `hosts_file_bench()`:
+ *  \li 2 IPv4 addresses and 1 IPv6 address for `hostb-a.example.com`.
+ *  \li 1 IPv4 address for `hostb-b.example.com`.
+ */
+static void hosts_bench_addr (DWORD b, struct in_addr *ip4, struct in6_addr *ip6)
+{
+  ip4[0].s_addr = htonl (0x0A000000 + 3*b);
+  ip4[1].s_addr = htonl (0x0A000000 + 3*b + 1);
+  ip4[2].s_addr = htonl (0x0A000000 + 3*b + 2);
+  memset (ip6, '\0', sizeof(*ip6));
+  ip6->s6_addr[0]  = 0xFD;
+  ip6->s6_addr[12] = (BYTE) (b >> 24);
+  ip6->s6_addr[13] = (BYTE) (b >> 16);
+  ip6->s6_addr[14] = (BYTE) (b >> 8);
+  ip6->s6_addr[15] = (BYTE) b;
+}
+
+/**
+ * Generate a hosts-file with `lines` lines in `g_data.ws_tmp_dir`.
+ * Load it and time the lookups of all the names and addresses in it.
+ *
+ * Every 100th block has a duplicated line.
+ */
+static void hosts_file_bench (DWORD lines)
+{
+  struct in_addr  ip4 [3];
+  struct in6_addr ip6;
+  struct hostent  he;
+  char           *addr_list [3];
+  char            file [_MAX_PATH];
+  char            name [50], buf [MAX_IP6_SZ+1];
+  char          (*names)[3][32];
+  FILE           *f;
+  DWORD           b, blocks = lines / 4;
+  DWORD           found = 0, expect = 0, bogus = 0;
+  double          start, usec;
+
+  if (blocks == 0)
+     blocks = 1;
+
+  snprintf (file, sizeof(file), "%s\\hosts-bench.txt", g_data.ws_tmp_dir);
+  f = fopen (file, "w+t");
+  if (!f)
+  {
+    C_printf ("Failed to create \"%s\".\n", file);
+    return;
+  }
+
+  fputs ("# Generated by 'hosts_file_bench()'\n", f);
+  for (b = 0; b < blocks; b++)
+  {
+    hosts_bench_addr (b, ip4, &ip6);
+    snprintf (name, sizeof(name), "host%lu-a.example.com", (u_long)b);
+    fprintf (f, "%s %s\n", INET_addr_ntop(AF_INET, &ip4[0], buf, sizeof(buf), NULL), name);
+    fprintf (f, "%s %s\n", INET_addr_ntop(AF_INET, &ip4[1], buf, sizeof(buf), NULL), name);
+    fprintf (f, "%s %s\n", INET_addr_ntop(AF_INET6, &ip6, buf, sizeof(buf), NULL), name);
+    if (b % 100 == 0)
+       fprintf (f, "%s %s\n", INET_addr_ntop(AF_INET, &ip4[0], buf, sizeof(buf), NULL), name);
+    fprintf (f, "%s host%lu-b.example.com\n",
+             INET_addr_ntop(AF_INET, &ip4[2], buf, sizeof(buf), NULL), (u_long)b);
+  }
+  fclose (f);
+
+  C_printf ("Loading \"%s\" with %s lines.\n", file, dword_str(4*blocks + (blocks+99)/100));
+
+  start = get_timestamp_now();
+  hosts_file_reload (file);
+  usec = get_timestamp_now() - start;
+
+  C_printf ("  load:     %.3f msec, %s names, %s addresses, %s duplicates, %s bytes.\n",
+            usec / 1E3, dword_str(hosts.num_names), dword_str(hosts.num_addr),
+            dword_str(hosts.duplicates), qword_str(hosts_bytes()));
+
+  /* Format the names up-front to time only the lookups.
+   * Use upper-case to test the case-insensitive lookup.
+   */
+  names = malloc (blocks * sizeof(*names));
+  if (!names)
+  {
+    remove (file);
+    return;
+  }
+  for (b = 0; b < blocks; b++)
+  {
+    snprintf (names[b][0], sizeof(names[b][0]), "HOST%lu-A.example.COM", (u_long)b);
+    snprintf (names[b][1], sizeof(names[b][1]), "host%lu-b.example.com", (u_long)b);
+    snprintf (names[b][2], sizeof(names[b][2]), "host%lu-c.example.com", (u_long)b);
+  }
+
+  addr_list[2]   = NULL;
+  he.h_aliases   = NULL;
+  he.h_addr_list = addr_list;
+
+  start = get_timestamp_now();
+  for (b = 0; b < blocks; b++)
+  {
+    hosts_bench_addr (b, ip4, &ip6);
+
+    he.h_addrtype = AF_INET;
+    addr_list[0]  = (char*) &ip4[1];   /* Not the 1st address for this name */
+    addr_list[1]  = (char*) &ip4[0];
+    found += hosts_file_check_hostent (names[b][0], &he);
+
+    he.h_addrtype = AF_INET6;
+    addr_list[0]  = (char*) &ip6;
+    addr_list[1]  = NULL;
+    found += hosts_file_check_hostent (names[b][0], &he);
+
+    /* This address belongs to the other name.
+     */
+    he.h_addrtype = AF_INET;
+    addr_list[0]  = (char*) &ip4[2];
+    bogus += hosts_file_check_hostent (names[b][0], &he);
+    found += hosts_file_check_hostent (names[b][1], &he);
+    bogus += hosts_file_check_hostent (names[b][2], &he);
+    expect += 4;
+  }
+  usec = get_timestamp_now() - start;
+
+  C_printf ("  lookups:  %.3f msec, %.3f usec/lookup, found: %s (expected %s), bogus: %s.\n",
+            usec / 1E3, usec / (5.0 * blocks), dword_str(found), dword_str(expect), dword_str(bogus));
+  free (names);
+  remove (file);
+}
+
+static int show_help (void)
+{
+  printf ("Usage: %s [-Dbn:h] [hosts-file]\n"
+          "       -D:    run 'hosts_file_dump()' to dump the hosts registry.\n"
+          "       -b:    benchmark loading and lookups of a generated hosts-file.\n"
+          "       -n #:  number of lines in the generated hosts-file (default %d).\n"
+          "       -h:    this help.\n"
+          " If a [hosts-file] is specified, use this instead of the configured one(s).\n",
+          g_data.program_name, HOSTS_BENCH_LINES);
+  return (0);
+}
+
+int hosts_file_main (int argc, char **argv)
+{
+  int   ch, do_dump = 0, do_bench = 0;
+  DWORD lines = HOSTS_BENCH_LINES;
+
+  set_program_name (argv[0]);
+
+  while ((ch = getopt(argc, argv, "Dbn:h?")) != EOF)
+     switch (ch)
+     {
+       case 'D':
+            do_dump = 1;
+            break;
+       case 'b':
+            do_bench = 1;
+            break;
+       case 'n':
+            lines = (DWORD) atoi (optarg);
+            break;
+       case '?':
+       case 'h':
+       default:
+            return show_help();
+  }
+
+  if (do_dump + do_bench == 0)
+     return show_help();
+
+  argv += optind;
+  if (*argv)
+     hosts_file_reload (argv[0]);
+
+  if (do_dump)
+     hosts_file_dump();
+
+  if (do_bench)
+     hosts_file_bench (lines);
+
+  return (0);
+}
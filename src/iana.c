@@ -26,14 +26,65 @@
 #include "init.h"
 #include "iana.h"
 
-static smartlist_t *iana_entries_ip4;
-static smartlist_t *iana_entries_ip6;
-static DWORD        g_num_ipv4, g_num_ipv6;
-static char         print_buf [500];
-static unsigned     rec_max = UINT_MAX;
-static unsigned     rec_illegal;
+/**
+ * The size of each block in the string-pool.
+ */
+#define IANA_POOL_BLOCK  4096
+
+/**
+ * \struct IANA_u128
+ * An IPv4 or IPv6 address as a 128-bit host-order number. <br>
+ * For an IPv4 address, `hi == 0` and the address is in the lower 32 bits of `lo`.
+ */
+struct IANA_u128 {
+       uint64 hi, lo;
+     };
+
+/**
+ * \struct IANA_range
+ * An element of the prefix-match index.
+ *
+ * The index is a sorted array of disjoint ranges that covers all the
+ * network blocks of one family. Each range ends where the next one starts.
+ * And it refers to the longest prefix (if any) containing it.
+ */
+struct IANA_range {
+       struct IANA_u128 start;  /**< the first address of this range */
+       int              rec;    /**< index into `IANA_table::recs` or -1 for no record */
+     };
+
+/**
+ * \struct IANA_table
+ * The records and the prefix-match index for one family.
+ */
+struct IANA_table {
+       IANA_record       *recs;        /**< the records; sorted on net-number and mask */
+       int                num_recs;
+       int                max_recs;
+       struct IANA_range *ranges;      /**< the prefix-match index built by `iana_build_index()` */
+       int                num_ranges;
+     };
+
+/**
+ * \struct IANA_pool
+ * One block of the string-pool. Never moves once allocated.
+ */
+struct IANA_pool {
+       struct IANA_pool *next;
+       size_t            used;
+       char              data [IANA_POOL_BLOCK];
+     };
+
+static struct IANA_table iana_table4, iana_table6;
+static struct IANA_pool *iana_pool;
+static smartlist_t      *iana_strings;    /**< the unique strings in `iana_pool` */
+static DWORD             g_num_ipv4, g_num_ipv6;
+static char              print_buf [500];
+static unsigned          rec_max = UINT_MAX;
+static unsigned          rec_illegal;
 
 static void iana_sort_lists (void);
+static void iana_build_index (struct IANA_table *tab, int family);
 static void iana_load_and_parse (int family, const char *file, const char *cfg_setting);
 static int  iana_add_entry (const struct IANA_record *rec);
 static int  iana_CSV_add4 (struct CSV_context *ctx, const char *value);
@@ -54,13 +105,23 @@ void iana_init (void)
   iana_load_and_parse (AF_INET6, g_cfg.IANA.ip6_file, "g_cfg.IANA.ip6_file");
 
   iana_sort_lists();
+  iana_build_index (&iana_table4, AF_INET);
+  iana_build_index (&iana_table6, AF_INET6);
 
-  if ((!iana_entries_ip4 || smartlist_len(iana_entries_ip4) == 0) &&
-      (!iana_entries_ip6 || smartlist_len(iana_entries_ip6) == 0))
+  /* The strings are not needed for de-duplication anymore.
+   */
+  smartlist_free (iana_strings);
+  iana_strings = NULL;
+
+  if (iana_table4.num_recs == 0 && iana_table6.num_recs == 0)
      g_cfg.IANA.enable = false;
 
   if (g_cfg.trace_level >= 2)
-     iana_dump();
+  {
+    ENTER_CRIT();     /* Other databases could be loading in other threads */
+    iana_dump();
+    LEAVE_CRIT (0);
+  }
 }
 
 /**
@@ -109,7 +170,7 @@ static const char *iana_format_rec6 (const IANA_record *rec, bool aligned)
 }
 
 /**
- * With a positive result (`rec->family != -1`) from `iana_find_by_ip4_address()`,
+ * With a result from `iana_find_by_ip4_address()` or `iana_find_by_ip6_address()`,
  * print an IANA record in `dump.c` to show it like this:
  *
  * ```
@@ -120,10 +181,12 @@ static const char *iana_format_rec6 (const IANA_record *rec, bool aligned)
  *   geo-IP: US - United States, Mountain View/California
  *   IANA:   Administered by ARIN, 1992-12, LEGACY
  * ```
+ *
+ * A `rec == NULL` means no record was found.
  */
 void iana_print_rec (const char *intro, const IANA_record *rec)
 {
-  switch (rec->family)
+  switch (rec ? rec->family : -1)
   {
     case AF_INET:
          C_printf ("%s%s\n", intro, iana_format_rec4(rec, false));
@@ -141,14 +204,14 @@ void iana_print_rec (const char *intro, const IANA_record *rec)
 }
 
 /**
- * Dump the IANA smartlists of IPv4/IPv6 records.
+ * Dump the IANA tables of IPv4/IPv6 records.
  */
 void iana_dump (void)
 {
   const IANA_record *rec;
   int   i, max4, max6;
 
-  max4 = iana_entries_ip4 ? smartlist_len (iana_entries_ip4) : 0;
+  max4 = iana_table4.num_recs;
   for (i = 0; i < max4; i++)
   {
     if (i == 0)
@@ -156,11 +219,11 @@ void iana_dump (void)
                  "   #  Net/mask misc                 date     whois                url"
                  "                     status\n", max4);
 
-    rec = smartlist_get (iana_entries_ip4, i);
+    rec = iana_table4.recs + i;
     C_printf (" %3d: %s\n", i, iana_format_rec4(rec, true));
   }
 
-  max6 = iana_entries_ip6 ? smartlist_len (iana_entries_ip6) : 0;
+  max6 = iana_table6.num_recs;
   for (i = 0; i < max6; i++)
   {
     if (i == 0)
@@ -169,9 +232,13 @@ void iana_dump (void)
                  "                url                   status\n",
                  max4 > 0 ? "\n" : "", max6);
 
-    rec = smartlist_get (iana_entries_ip6, i);
+    rec = iana_table6.recs + i;
     C_printf (" %3d: %s\n", i, iana_format_rec6(rec, true));
   }
+
+  if (max4 + max6 > 0)
+     C_printf ("\nPrefix-match index: %d IPv4 ranges, %d IPv6 ranges.\n",
+               iana_table4.num_ranges, iana_table6.num_ranges);
 }
 
 /**
@@ -180,9 +247,23 @@ void iana_dump (void)
  */
 void iana_exit (void)
 {
-  smartlist_wipe (iana_entries_ip4, free);
-  smartlist_wipe (iana_entries_ip6, free);
-  iana_entries_ip4 = iana_entries_ip6 = NULL;
+  struct IANA_pool *blk, *next;
+
+  free (iana_table4.recs);
+  free (iana_table4.ranges);
+  free (iana_table6.recs);
+  free (iana_table6.ranges);
+  memset (&iana_table4, '\0', sizeof(iana_table4));
+  memset (&iana_table6, '\0', sizeof(iana_table6));
+
+  for (blk = iana_pool; blk; blk = next)
+  {
+    next = blk->next;
+    free (blk);
+  }
+  iana_pool = NULL;
+  smartlist_free (iana_strings);
+  iana_strings = NULL;
 
   free (g_cfg.IANA.ip4_file);
   free (g_cfg.IANA.ip6_file);
@@ -214,19 +295,12 @@ static void iana_load_and_parse (int family, const char *file, const char *cfg_s
   struct CSV_context ctx;
 
   assert (family == AF_INET || family == AF_INET6);
+  assert ((family == AF_INET ? iana_table4.recs : iana_table6.recs) == NULL);
 
-  if (family == AF_INET)
-  {
-    assert (iana_entries_ip4 == NULL);
-    iana_entries_ip4 = smartlist_new();
-    if (!iana_entries_ip4)
-       return;
-  }
-  else
+  if (!iana_strings)
   {
-    assert (iana_entries_ip6 == NULL);
-    iana_entries_ip6 = smartlist_new();
-    if (!iana_entries_ip6)
+    iana_strings = smartlist_new();
+    if (!iana_strings)
        return;
   }
 
@@ -246,7 +320,68 @@ static void iana_load_and_parse (int family, const char *file, const char *cfg_s
 }
 
 /**
- * The CSV callback to add a record to the `iana_entries_ip4` smart-list.
+ * Add a string to the string-pool. Return an already pooled string if
+ * one matches. Called while parsing; `iana_strings` is NULL afterwards.
+ */
+static const char *iana_pool_add (const char *str)
+{
+  struct IANA_pool *blk = iana_pool;
+  size_t len;
+  char  *ret;
+  int    i, max;
+
+  if (!*str)
+     return ("");
+
+  max = iana_strings ? smartlist_len (iana_strings) : 0;
+  for (i = 0; i < max; i++)
+  {
+    ret = smartlist_get (iana_strings, i);
+    if (!strcmp(ret, str))
+       return (ret);
+  }
+
+  len = strlen (str) + 1;
+  assert (len <= IANA_POOL_BLOCK);
+
+  if (!blk || blk->used + len > sizeof(blk->data))
+  {
+    blk = malloc (sizeof(*blk));
+    if (!blk)
+       return ("");
+    blk->used = 0;
+    blk->next = iana_pool;
+    iana_pool = blk;
+  }
+  ret = blk->data + blk->used;
+  memcpy (ret, str, len);
+  blk->used += len;
+  if (iana_strings)
+     smartlist_add (iana_strings, ret);
+  return (ret);
+}
+
+/**
+ * Pool a CSV field value; truncated to `max - 1` characters.
+ * For a `first_word == true`, only pool the part up to the first space or newline.
+ */
+static const char *iana_pool_field (const char *value, size_t max, bool first_word)
+{
+  char  buf [100];
+  char *space;
+
+  str_ncpy (buf, value, min(max, sizeof(buf)));
+  if (first_word)
+  {
+    space = strpbrk (buf, " \r\n");
+    if (space)
+       *space = '\0';
+  }
+  return iana_pool_add (buf);
+}
+
+/**
+ * The CSV callback to add a record to the `iana_table4` records.
  *
  * \param[in]  ctx   the CSV context structure.
  * \param[in]  value the value for this CSV field in record `ctx->rec_num`.
@@ -266,8 +401,7 @@ static void iana_load_and_parse (int family, const char *file, const char *cfg_s
  */
 static int iana_CSV_add4 (struct CSV_context *ctx, const char *value)
 {
-  static struct IANA_record rec = { -1 };
-  char  *space;
+  static struct IANA_record rec = { -1, -1 };
   int    rc = 1;
 
   switch (ctx->field_num)
@@ -276,22 +410,19 @@ static int iana_CSV_add4 (struct CSV_context *ctx, const char *value)
          sscanf (value, "%lu/%d", (unsigned long*)&rec.net_num.ip4.s_addr, &rec.mask);
          break;
     case 1:
-         str_ncpy (rec.misc, value, sizeof(rec.misc));
+         rec.misc = iana_pool_field (value, 100, false);
          break;
     case 2:
-         str_ncpy (rec.date, value, sizeof(rec.date));
+         rec.date = iana_pool_field (value, 30, false);
          break;
     case 3:
-         str_ncpy (rec.whois, value, sizeof(rec.whois));
+         rec.whois = iana_pool_field (value, 100, false);
          break;
     case 4:
-         str_ncpy (rec.url, value, sizeof(rec.url));
-         space = strchr (rec.url, ' ');
-         if (space)
-            *space = '\0';
+         rec.url = iana_pool_field (value, 100, true);
          break;
     case 5:
-         str_ncpy (rec.status, value, sizeof(rec.status));
+         rec.status = iana_pool_field (value, 100, false);
          break;
     case 6:   /* The value in this 'NOTE' field is ignored */
          rec.family = AF_INET;
@@ -305,7 +436,7 @@ static int iana_CSV_add4 (struct CSV_context *ctx, const char *value)
 }
 
 /**
- * The CSV callback to add a record to the `iana_entries_ip6` smart-list.
+ * The CSV callback to add a record to the `iana_table6` records.
  *
  * \param[in]  ctx   the CSV context structure.
  * \param[in]  value the value for this CSV field in record `ctx->rec_num`.
@@ -328,9 +459,8 @@ static int iana_CSV_add4 (struct CSV_context *ctx, const char *value)
  */
 static int iana_CSV_add6 (struct CSV_context *ctx, const char *value)
 {
-  static struct IANA_record rec = { -1 };
+  static struct IANA_record rec = { -1, -1 };
   static char   ip6_addr [MAX_IP6_SZ+1];
-  char  *space;
   int    rc = 1;
 
   switch (ctx->field_num)
@@ -340,22 +470,19 @@ static int iana_CSV_add6 (struct CSV_context *ctx, const char *value)
          INET_addr_pton2 (AF_INET6, ip6_addr, &rec.net_num.ip6);
          break;
     case 1:
-         str_ncpy (rec.misc, value, sizeof(rec.misc));
+         rec.misc = iana_pool_field (value, 100, false);
          break;
     case 2:
-         str_ncpy (rec.date, value, sizeof(rec.date));
+         rec.date = iana_pool_field (value, 30, false);
          break;
     case 3:
-         str_ncpy (rec.whois, value, sizeof(rec.whois));
+         rec.whois = iana_pool_field (value, 100, false);
          break;
     case 4:
-         str_ncpy (rec.url, value, sizeof(rec.url));
-         space = strchr (rec.url, ' ');
-         if (space)
-            *space = '\0';
+         rec.url = iana_pool_field (value, 100, true);
          break;
     case 5:
-         str_ncpy (rec.status, value, sizeof(rec.status));
+         rec.status = iana_pool_field (value, 100, false);
          break;
     case 6:                                   /* The value in this 'NOTE' field is ignored */
          rec.family = AF_INET6;
@@ -369,39 +496,59 @@ static int iana_CSV_add6 (struct CSV_context *ctx, const char *value)
 }
 
 /**
- * Add an IANA record to the `iana_entries_ip4` ir `iana_entries_ip6` smart-list.
+ * Add an IANA record to the `iana_table4` or `iana_table6` records.
  */
 static int iana_add_entry (const struct IANA_record *rec)
 {
-  struct IANA_record *copy = malloc (sizeof(*copy));
+  struct IANA_table  *tab = (rec->family == AF_INET ? &iana_table4 : &iana_table6);
+  struct IANA_record *copy;
 
-  if (!copy)
-     return (0);
+  if (tab->num_recs == tab->max_recs)
+  {
+    int max = tab->max_recs ? 2 * tab->max_recs : 256;
 
-   if (rec->family == AF_INET && rec->mask == -1)
-      rec_illegal++;
-   else if (rec->family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&rec->net_num.ip6))
-      rec_illegal++;
+    copy = realloc (tab->recs, max * sizeof(*copy));
+    if (!copy)
+       return (0);
+    tab->recs     = copy;
+    tab->max_recs = max;
+  }
 
-  memcpy (copy, rec, sizeof(*copy));
-  if (rec->family == AF_INET)
-       smartlist_add (iana_entries_ip4, copy);
-  else smartlist_add (iana_entries_ip6, copy);
+  if (rec->family == AF_INET && rec->mask == -1)
+     rec_illegal++;
+  else if (rec->family == AF_INET6 && IN6_IS_ADDR_UNSPECIFIED(&rec->net_num.ip6))
+     rec_illegal++;
+
+  copy = tab->recs + tab->num_recs++;
+  *copy = *rec;
+
+  /* Fields missing in the CSV-record are never NULL.
+   */
+  if (!copy->misc)
+     copy->misc = "";
+  if (!copy->date)
+     copy->date = "";
+  if (!copy->whois)
+     copy->whois = "";
+  if (!copy->url)
+     copy->url = "";
+  if (!copy->status)
+     copy->status = "";
   return (1);
 }
 
 /**
- * `smartlist_sort()` helper for `iana_entries_ip4`:
+ * `qsort()` helper for `iana_table4`:
  *   return -1, 1, or 0 based on comparison of two `struct IANA_record`.
  *
  * Sort on network-number, mask and then finally status.
  */
 static DWORD g_num_compares;
 
-static int compare_on_netnum_ip4 (const void **_a, const void **_b)
+static int compare_on_netnum_ip4 (const void *_a, const void *_b)
 {
-  const struct IANA_record *a = *_a;
-  const struct IANA_record *b = *_b;
+  const struct IANA_record *a = _a;
+  const struct IANA_record *b = _b;
 
   assert (a->family == AF_INET && b->family == AF_INET);
 
@@ -415,20 +562,20 @@ static int compare_on_netnum_ip4 (const void **_a, const void **_b)
   if (a->mask < b->mask)
      return (-1);
   if (a->mask > b->mask)
-     return (-1);
+     return (1);
   return stricmp (a->status, b->status);
 }
 
 /**
- * `smartlist_sort()` helper for `iana_entries_ip6`:
+ * `qsort()` helper for `iana_table6`:
  *   return -1, 1, or 0 based on comparison of two `struct IANA_record`.
  *
  * Sort on network-number, mask and then finally status.
  */
-static int compare_on_netnum_ip6 (const void **_a, const void **_b)
+static int compare_on_netnum_ip6 (const void *_a, const void *_b)
 {
-  const struct IANA_record *a = *_a;
-  const struct IANA_record *b = *_b;
+  const struct IANA_record *a = _a;
+  const struct IANA_record *b = _b;
   int   rc;
 
   assert (a->family == AF_INET6 && b->family == AF_INET6);
@@ -444,108 +591,229 @@ static int compare_on_netnum_ip6 (const void **_a, const void **_b)
   if (a->mask < b->mask)
      return (-1);
   if (a->mask > b->mask)
-     return (-1);
+     return (1);
 
   return stricmp (a->status, b->status);
 }
 
 /**
- * `smartlist_bsearch()` helper; compare on IPv4 range.
+ * Sort both `iana_table4` and `iana_table6` records on
+ * net-number, mask and finally on status.
  */
-static int iana_compare_on_netnum_prefix_ip4 (const void *key, const void **member)
+static void iana_sort_lists (void)
 {
-  const struct IANA_record *rec = *member;
-  const struct in_addr     *ip4 = key;
-  char  ip4_buf [MAX_IP4_SZ+1];
-  int   rc;
+  if (iana_table4.num_recs > 0)
+  {
+    g_num_compares = 0;
+    qsort (iana_table4.recs, iana_table4.num_recs, sizeof(*iana_table4.recs), compare_on_netnum_ip4);
+    TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
+    g_num_compares = 0;
+  }
+  if (iana_table6.num_recs > 0)
+  {
+    g_num_compares = 0;
+    qsort (iana_table6.recs, iana_table6.num_recs, sizeof(*iana_table6.recs), compare_on_netnum_ip6);
+    TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
+    g_num_compares = 0;
+  }
+}
 
-  g_num_compares++;
+/**
+ * Convert an IPv4 or IPv6 address to an `IANA_u128`.
+ */
+static void iana_addr_to_u128 (int family, const void *addr, struct IANA_u128 *val)
+{
+  const BYTE *bytes = (const BYTE*) addr;
+  int   i;
 
-  rc = INET_util_range4cmp (ip4, &rec->net_num.ip4, rec->mask);
-  INET_addr_ntop (AF_INET, ip4, ip4_buf, sizeof(ip4_buf), NULL);
+  val->hi = val->lo = 0;
+  if (family == AF_INET)
+  {
+    val->lo = swap32 (*(const DWORD*)addr);
+    return;
+  }
+  for (i = 0; i < 8; i++)
+  {
+    val->hi = (val->hi << 8) | bytes[i];
+    val->lo = (val->lo << 8) | bytes[i+8];
+  }
+}
 
-  TRACE (2, "key: %s, net_num: %lu, mask: %d, rc: %d\n",
-         ip4_buf, (unsigned long)rec->net_num.ip4.s_addr, rec->mask, rc);
-  return (rc);
+static int iana_u128_cmp (const struct IANA_u128 *a, const struct IANA_u128 *b)
+{
+  if (a->hi != b->hi)
+     return (a->hi < b->hi ? -1 : 1);
+  if (a->lo != b->lo)
+     return (a->lo < b->lo ? -1 : 1);
+  return (0);
+}
+
+static int iana_u128_compare (const void *a, const void *b)
+{
+  return iana_u128_cmp (a, b);
 }
 
 /**
- * `smartlist_bsearch()` helper; compare on IPv6 range.
+ * Get the first and last address of the network block in `rec`.
+ * Returns false for an illegal prefix-length.
  */
-static int iana_compare_on_netnum_prefix_ip6 (const void *key, const void **member)
+static bool iana_rec_range (const IANA_record *rec, struct IANA_u128 *first, struct IANA_u128 *last)
 {
-  const struct IANA_record *rec = *member;
-  const struct in6_addr    *ip6 = key;
-  struct in6_addr mask;
-  char  ip6_buf [MAX_IP6_SZ+1];
-  char  net6_buf[MAX_IP6_SZ+1];
-  int   rc;
-
-  g_num_compares++;
+  int    bits = (rec->family == AF_INET ? 32 : 128);
+  int    prefix;
+  uint64 mask_hi, mask_lo;
 
-  INET_util_get_mask6 (&mask, rec->mask);
+  if (rec->mask < 0 || rec->mask > bits)
+     return (false);
 
-  rc = INET_util_range6cmp (ip6, &rec->net_num.ip6, rec->mask);
+  iana_addr_to_u128 (rec->family, &rec->net_num, first);
 
-  INET_addr_ntop (AF_INET6, &rec->net_num.ip6, net6_buf, sizeof(net6_buf), NULL);
-  INET_addr_ntop (AF_INET6, ip6, ip6_buf, sizeof(ip6_buf), NULL);
+  /* An IPv4 address is in the lower 32 bits.
+   */
+  prefix = rec->mask + (128 - bits);
+  if (prefix <= 64)
+  {
+    mask_hi = prefix == 0 ? 0 : (~U64_SUFFIX(0) << (64 - prefix));
+    mask_lo = 0;
+  }
+  else
+  {
+    mask_hi = ~U64_SUFFIX(0);
+    mask_lo = prefix == 128 ? mask_hi : (~U64_SUFFIX(0) << (128 - prefix));
+  }
+  if (rec->family == AF_INET)
+     mask_hi = 0;
 
-  TRACE (2, "key: %s, net_num: %-12s prefix: %2d mask: %-12s rc: %d\n",
-         ip6_buf, net6_buf, rec->mask, INET_util_in6_mask_str(&mask), rc);
-  return (rc);
+  first->hi &= mask_hi;
+  first->lo &= mask_lo;
+  last->hi = first->hi | (rec->family == AF_INET ? 0 : ~mask_hi);
+  last->lo = first->lo | (rec->family == AF_INET ? (~mask_lo & 0xFFFFFFFF) : ~mask_lo);
+  return (true);
 }
 
 /**
- * Sort both `iana_entries_ip4` and  `iana_entries_ip6` smart-lists on
- * net-number, mask and finally on status.
+ * Build the prefix-match index for the records in `tab`.
+ *
+ * The start and the end + 1 of every network block are the boundaries
+ * of the disjoint ranges. Each range refers to the longest prefix containing
+ * it; the records are few, so this is an O(n^2) job done once.
+ * Adjacent ranges referring to the same record are merged.
  */
-static void iana_sort_lists (void)
+static void iana_build_index (struct IANA_table *tab, int family)
 {
-  if (iana_entries_ip4)
+  struct IANA_u128 *bounds, first, last, max;
+  int    i, j, num_bounds = 0;
+
+  if (tab->num_recs == 0)
+     return;
+
+  bounds = malloc (2 * tab->num_recs * sizeof(*bounds));
+  tab->ranges = malloc (2 * tab->num_recs * sizeof(*tab->ranges));
+  if (!bounds || !tab->ranges)
   {
-    g_num_compares = 0;
-    smartlist_sort (iana_entries_ip4, compare_on_netnum_ip4);
-    TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
-    g_num_compares = 0;
+    free (bounds);
+    free (tab->ranges);
+    tab->ranges = NULL;
+    return;
+  }
+
+  max.hi = (family == AF_INET ? 0 : ~U64_SUFFIX(0));
+  max.lo = (family == AF_INET ? 0xFFFFFFFF : ~U64_SUFFIX(0));
+
+  for (i = 0; i < tab->num_recs; i++)
+  {
+    if (!iana_rec_range(tab->recs + i, &first, &last))
+       continue;
+    bounds [num_bounds++] = first;
+    if (iana_u128_cmp(&last, &max))
+    {
+      if (++last.lo == 0)
+         last.hi++;
+      bounds [num_bounds++] = last;
+    }
   }
-  if (iana_entries_ip6)
+  qsort (bounds, num_bounds, sizeof(*bounds), iana_u128_compare);
+
+  for (i = 0; i < num_bounds; i++)
   {
-    g_num_compares = 0;
-    smartlist_sort (iana_entries_ip6, compare_on_netnum_ip6);
-    TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
-    g_num_compares = 0;
+    int best = -1;
+
+    if (i > 0 && !iana_u128_cmp(&bounds[i], &bounds[i-1]))
+       continue;
+
+    for (j = 0; j < tab->num_recs; j++)
+    {
+      if (!iana_rec_range(tab->recs + j, &first, &last) ||
+          iana_u128_cmp(&bounds[i], &first) < 0 || iana_u128_cmp(&bounds[i], &last) > 0)
+         continue;
+      if (best == -1 || tab->recs[j].mask > tab->recs[best].mask)
+         best = j;
+    }
+    if (tab->num_ranges > 0 && tab->ranges[tab->num_ranges-1].rec == best)
+       continue;
+
+    tab->ranges [tab->num_ranges].start = bounds[i];
+    tab->ranges [tab->num_ranges].rec   = best;
+    tab->num_ranges++;
+  }
+  free (bounds);
+  TRACE (2, "%d IPv%c records gave %d ranges.\n",
+         tab->num_recs, family == AF_INET ? '4' : '6', tab->num_ranges);
+}
+
+/**
+ * Look up an address in the prefix-match index of `tab`.
+ * A binary search for the last range starting at or below `addr`.
+ */
+static const IANA_record *iana_lookup (const struct IANA_table *tab, int family, const void *addr)
+{
+  struct IANA_u128 key;
+  int    lo = 0, hi = tab->num_ranges - 1, found = -1;
+
+  iana_addr_to_u128 (family, addr, &key);
+
+  while (lo <= hi)
+  {
+    int mid = (lo + hi) / 2;
+
+    g_num_compares++;
+    if (iana_u128_cmp(&tab->ranges[mid].start, &key) <= 0)
+    {
+      found = mid;
+      lo = mid + 1;
+    }
+    else
+      hi = mid - 1;
   }
+  if (found < 0 || tab->ranges[found].rec < 0)
+     return (NULL);
+  return (tab->recs + tab->ranges[found].rec);
 }
 
 /**
  * Find an IANA record based on an IPv4 address.
  *
- * \param[in]     ip4      The address to search for.
- * \param[in,out] out_rec  The filled record if the address was found.
+ * \param[in] ip4  The address to search for.
+ * \retval    The record with the longest prefix matching `ip4`. Or NULL if none.
  */
-int iana_find_by_ip4_address (const struct in_addr *ip4, struct IANA_record *out_rec)
+const IANA_record *iana_find_by_ip4_address (const struct in_addr *ip4)
 {
   const struct IANA_record *rec;
 
-  out_rec->family = -1;  /* Signal an invalid record */
-  out_rec->rir_list = NULL;
+  INIT_DB_NEED (INIT_DB_IANA);
 
-  if (!iana_entries_ip4)
-     return (0);
+  if (iana_table4.num_ranges == 0)
+     return (NULL);
 
   g_num_compares = 0;
-  rec = smartlist_bsearch (iana_entries_ip4, ip4, iana_compare_on_netnum_prefix_ip4);
+  rec = iana_lookup (&iana_table4, AF_INET, ip4);
 
   TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
   g_num_compares = 0;
 
   if (rec)
-  {
-    *out_rec = *rec;
-    g_num_ipv4++;
-    return (1);
-  }
-  return (0);
+     g_num_ipv4++;
+  return (rec);
 }
 
 _PRAGMA (clang diagnostic ignored  "-Wmissing-braces")
@@ -553,49 +821,44 @@ _PRAGMA (clang diagnostic ignored  "-Wmissing-braces")
 /**
  * Find an IANA record based on an IPv6 address.
  *
- * \param[in]     ip6      The address to search for.
- * \param[in,out] out_rec  The filled record if the address was found.
+ * \param[in] ip6  The address to search for.
+ * \retval    The record with the longest prefix matching `ip6`. Or NULL if none.
  */
-int iana_find_by_ip6_address (const struct in6_addr *ip6, struct IANA_record *out_rec)
+const IANA_record *iana_find_by_ip6_address (const struct in6_addr *ip6)
 {
+  static IANA_record loop_rec = { 0, 128, { 0 },
+                                  "IPv6 Loopback", "No idea", "No WHOIS", "No RDAP", "Fixed status"
+                                };
   const struct IANA_record *rec;
 
-  out_rec->family = -1;  /* Signal an invalid record */
-  out_rec->rir_list = NULL;
+  INIT_DB_NEED (INIT_DB_IANA);
 
-  if (!iana_entries_ip6)
-     return (0);
+  if (iana_table6.num_ranges == 0)
+     return (NULL);
 
   if (IN6_IS_ADDR_LOOPBACK(ip6))
   {
-    const struct in6_addr loop = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1 }; /* IN6ADDR_LOOPBACK_INIT */
+    if (loop_rec.family == 0)
+    {
+      const struct in6_addr loop = { 0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1 }; /* IN6ADDR_LOOPBACK_INIT */
 
+      memcpy (&loop_rec.net_num.ip6, &loop, sizeof(loop_rec.net_num.ip6));
+      loop_rec.family = AF_INET6;
+    }
     TRACE (2, "Returning fixed 'in6addr_loopback'.\n");
-    out_rec->family = AF_INET6;
-    out_rec->mask   = 128;
-    memcpy (&out_rec->net_num.ip6, &loop, sizeof(out_rec->net_num.ip6));
-    strcpy (out_rec->misc, "IPv6 Loopback");
-    strcpy (out_rec->date, "No idea");
-    strcpy (out_rec->whois, "No WHOIS");
-    strcpy (out_rec->url, "No RDAP");
-    strcpy (out_rec->status, "Fixed status");
     g_num_ipv6++;
-    return (1);
+    return (&loop_rec);
   }
 
   g_num_compares = 0;
-  rec = smartlist_bsearch (iana_entries_ip6, ip6, iana_compare_on_netnum_prefix_ip6);
+  rec = iana_lookup (&iana_table6, AF_INET6, ip6);
 
   TRACE (2, "g_num_compares: %lu.\n", g_num_compares);
   g_num_compares = 0;
 
   if (rec)
-  {
-    *out_rec = *rec;
-    g_num_ipv6++;
-    return (1);
-  }
-  return (0);
+     g_num_ipv6++;
+  return (rec);
 }
 
 /*
@@ -627,7 +890,7 @@ typedef struct TEST_ADDR {
 
 int iana_main (int argc, char **argv)
 {
-  struct IANA_record rec;
+  const struct IANA_record *rec;
   static const TEST_ADDR test_addr[] = {
              { AF_INET, { 224,   0,  0,  1 } },
              { AF_INET, { 181,  10, 20, 30 } },
@@ -652,8 +915,12 @@ int iana_main (int argc, char **argv)
              /* This address is part of the block:
               *   2c00:0000::/12,AFRINIC,2006-10-03,whois.afrinic.net,"https://rdap.afrinic.net/rdap/
               */
-             { AF_INET6, { 0 }, { 0x2C, 0xF0, 0xA0, 0x08 } },
-             { AF_INET6, { 0 }, { 0x2C, 0xF1, 0xA0, 0x08 } }  /* 1 address above */
+             { AF_INET6, { 0 }, { 0x2C, 0x0F, 0xA0, 0x08 } },
+
+             /* Just above 2c00::/12 and below 2d00::/8; in no block.
+              * The lookup must return NULL.
+              */
+             { AF_INET6, { 0 }, { 0x2C, 0x10, 0xA0, 0x08 } }
 
            };
   int i, ch, do_ip6 = 0;
@@ -715,10 +982,11 @@ int iana_main (int argc, char **argv)
     {
       INET_addr_ntop (AF_INET, &test_addr[i].ip4, ip4_buf, sizeof(ip4_buf), NULL);
       printf ("\ntest_ip4_address (\"%s\"):\n", ip4_buf);
-      if (iana_find_by_ip4_address(&test_addr[i].ip4, &rec))
+      rec = iana_find_by_ip4_address (&test_addr[i].ip4);
+      if (rec)
       {
-        iana_print_rec ("  IANA: ", &rec);
-        ASN_print ("  ASN:  ", &rec, &test_addr[i].ip4, NULL);
+        iana_print_rec ("  IANA: ", rec);
+        ASN_print ("  ASN:  ", rec, &test_addr[i].ip4, NULL);
       }
       ASN_libloc_print ("  ASN:  ", &test_addr[i].ip4, NULL, NULL);
     }
@@ -726,10 +994,11 @@ int iana_main (int argc, char **argv)
     {
       INET_addr_ntop (AF_INET6, &test_addr[i].ip6, ip6_buf, sizeof(ip6_buf), NULL);
       printf ("\ntest_ip6_address (\"%s\"):\n", ip6_buf);
-      if (iana_find_by_ip6_address(&test_addr[i].ip6, &rec))
+      rec = iana_find_by_ip6_address (&test_addr[i].ip6);
+      if (rec)
       {
-        iana_print_rec ("  IANA: ", &rec);
-        ASN_print ("  ASN:  ", &rec, NULL, &test_addr[i].ip6);
+        iana_print_rec ("  IANA: ", rec);
+        ASN_print ("  ASN:  ", rec, NULL, &test_addr[i].ip6);
       }
       ASN_libloc_print ("  ASN: ", NULL, &test_addr[i].ip6, NULL);
     }
@@ -7,6 +7,9 @@
 #include "wsock_defs.h"
 
 /** \typedef struct IANA_record
+ *
+ * The strings are allocated in a string-pool in `iana.c`.
+ * They are never NULL and are valid until `iana_exit()` is called.
  */
 typedef struct IANA_record {
         /**
@@ -29,36 +32,31 @@ typedef struct IANA_record {
         /** RIR (Regional Internet Registry) like IANA, APNIC, ARIN, AFRINIC and RIPE.
          *  and things like "Administered by ..."
          */
-        char misc [100];
+        const char *misc;
 
         /** The date this network block was added.
          */
-        char date [30];
+        const char *date;
 
         /** The WHOIS address for this network block.
          */
-        char whois [100];
+        const char *whois;
 
         /** The RDAP address for this network block.
          */
-        char url [100];
+        const char *url;
 
         /** The status for this network block.
          */
-        char status[100];
-
-        /**
-         * \todo The smartlist for a `delegated` RIR array.
-         */
-        void *rir_list;
+        const char *status;
       } IANA_record;
 
 extern void iana_init (void);
 extern void iana_exit (void);
 extern void iana_dump (void);
 extern void iana_report (void);
-extern int  iana_find_by_ip4_address (const struct in_addr *ip4, struct IANA_record *rec);
-extern int  iana_find_by_ip6_address (const struct in6_addr *ip6, struct IANA_record *rec);
+extern const IANA_record *iana_find_by_ip4_address (const struct in_addr *ip4);
+extern const IANA_record *iana_find_by_ip6_address (const struct in6_addr *ip6);
 extern void iana_print_rec (const char *intro, const IANA_record *rec);
 
 #endif
@@ -32,8 +32,11 @@
 #include "asn.h"
 #include "iana.h"
 #include "dnsbl.h"
+#include "annotate.h"
+#include "caller_cache.h"
 #include "inet_addr.h"
 #include "init.h"
+#include "trace_bin.h"
 
 struct config_table g_cfg;
 struct global_data  g_data;
@@ -46,16 +49,37 @@ struct global_data  g_data;
  * programs ("addId") and addresses in firewall.c.
  */
 typedef struct exclude {
-        char        *name;          /**< The `name` to exclude from trace */
-        char        *only_if_prog;  /**< But only if `EXCL_FUNCTION == only_if_prog` (optional) */
-        uint64       num_excludes;  /**< Number of times this `name` was excluded */
-        exclude_type which;         /**< A single `exclude_type` of the above `name` */
+        char           *name;          /**< The `name` to exclude from trace */
+        char           *only_if_prog;  /**< But only if `EXCL_FUNCTION == only_if_prog` (optional) */
+        uint64          num_excludes;  /**< Number of times this `name` was excluded */
+        exclude_type    which;         /**< A single `exclude_type` of the above `name` */
+        int             order;         /**< The index in `exclude_list` */
+        struct exclude *next_same;     /**< The next (later) entry with the same `name` */
       } exclude;
 
+/**
+ * \typedef exclude_node
+ *
+ * A node in the case-insensitive prefix-trie of all the `exclude::name`s.
+ * Each node has the children in a list of siblings.
+ */
+typedef struct exclude_node {
+        int                  ch;       /**< The lower-case character leading to this node */
+        struct exclude_node *child;    /**< The first child */
+        struct exclude_node *sibling;  /**< The next child of the parent */
+        struct exclude      *ex;       /**< The first entry with the name ending here; or NULL */
+      } exclude_node;
+
 /* Dynamic array of above exclude structure.
  */
 static smartlist_t *exclude_list = NULL;
 
+/* The trie of the names in `exclude_list`. And a generation-number
+ * incremented when it changes; a `exclude_cache` is then out of date.
+ */
+static exclude_node exclude_trie;
+static DWORD        exclude_gen = 1;
+
 /* Set and restore the "Invalid Parameter Handler".
  */
 static void set_invalid_handler (void);
@@ -133,13 +157,25 @@ static void set_time_format (TS_TYPE *ret, const char *val)
 /**
  * Return the preferred time-stamp string.
  *
- * \todo the below `buf[]` should be a "Thread Local Storage" variable.
+ * \todo the `buf[]` in `get_timestamp_str()` should be a "Thread Local Storage" variable.
  * \sa https://docs.microsoft.com/en-us/windows/win32/dlls/using-thread-local-storage-in-a-dynamic-link-library
  */
 const char *get_timestamp (void)
+{
+  return get_timestamp_str (get_timestamp_raw());
+}
+
+/**
+ * Return the raw value of the preferred time-stamp:
+ *  \li the `QueryPerformanceCounter()` clocks for `TS_RELATIVE` and `TS_DELTA`.
+ *  \li the local time in msec since midnight for `TS_ABSOLUTE`.
+ *
+ * A binary trace-record stores this value and `ws_tool decode` formats it
+ * using `get_timestamp_str()`.
+ */
+int64 get_timestamp_raw (void)
 {
   static LARGE_INTEGER last = {{ S64_SUFFIX(0) }};
-  static char          buf [40];
   SYSTEMTIME           now;
   LARGE_INTEGER        ticks;
   int64                clocks;
@@ -158,7 +194,32 @@ const char *get_timestamp (void)
          else clocks = (int64) (ticks.QuadPart - last.QuadPart);
 
          last = ticks;
+         return (clocks);
+
+    case TS_ABSOLUTE:
+         GetLocalTime (&now);
+         return (1000 * (3600 * now.wHour + 60 * now.wMinute + now.wSecond) + now.wMilliseconds);
+
+    case TS_NONE:
+         return (0);
+  }
+  return (0);
+}
 
+/**
+ * Format a raw time-stamp from `get_timestamp_raw()`.
+ */
+const char *get_timestamp_str (int64 raw)
+{
+  static char buf [40];
+  int64       clocks = raw;
+  unsigned    day_msec = (unsigned) raw;
+
+  switch (g_cfg.trace_time_format)
+  {
+//  case TS_ELAPSED:
+    case TS_RELATIVE:
+    case TS_DELTA:
          if (g_cfg.trace_time_usec)
          {
            double      usec = (double)clocks / (double)g_data.clocks_per_usec;
@@ -194,10 +255,9 @@ const char *get_timestamp (void)
          return (buf);
 
     case TS_ABSOLUTE:
-         GetLocalTime (&now);
          if (g_cfg.trace_time_usec)
-              sprintf (buf, "%02u:%02u:%02u.%06u: ", now.wHour, now.wMinute, now.wSecond, now.wMilliseconds * 1000);
-         else sprintf (buf, "%02u:%02u:%02u.%03u: ", now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+              sprintf (buf, "%02u:%02u:%02u.%06u: ", day_msec / 3600000, (day_msec / 60000) % 60, (day_msec / 1000) % 60, (day_msec % 1000) * 1000);
+         else sprintf (buf, "%02u:%02u:%02u.%03u: ", day_msec / 3600000, (day_msec / 60000) % 60, (day_msec / 1000) % 60, day_msec % 1000);
          return (buf);
 
     case TS_NONE:
@@ -337,40 +397,143 @@ static int config_get_line (FILE        *fil,
   return (1);
 }
 
+/**
+ * Add `ex` to the trie. The entries ending at the same node are
+ * kept in the `exclude_list` order.
+ */
+static bool exclude_trie_add (struct exclude *ex)
+{
+  exclude_node   *node = &exclude_trie;
+  struct exclude **pp;
+  const char      *s;
+
+  for (s = ex->name; *s; s++)
+  {
+    exclude_node *child;
+    int           ch = tolower ((int)*(const u_char*)s);
+
+    for (child = node->child; child; child = child->sibling)
+        if (child->ch == ch)
+           break;
+
+    if (!child)
+    {
+      child = calloc (1, sizeof(*child));
+      if (!child)
+         return (false);
+      child->ch      = ch;
+      child->sibling = node->child;
+      node->child    = child;
+    }
+    node = child;
+  }
+
+  for (pp = &node->ex; *pp; pp = &(*pp)->next_same)
+      ;
+  *pp = ex;
+  ex->next_same = NULL;
+  exclude_gen++;
+  return (true);
+}
+
+static void exclude_trie_free (exclude_node *node)
+{
+  exclude_node *child, *next;
+
+  for (child = node->child; child; child = next)
+  {
+    next = child->sibling;
+    exclude_trie_free (child);
+    free (child);
+  }
+  node->child = NULL;
+  node->ex    = NULL;
+}
+
+/**
+ * Find the first entry in `exclude_list` of type `exclude_which` that
+ * has a `name` which is a case-insensitive prefix of `str`.
+ * I.e. the same as a `strnicmp (str, ex->name, strlen(ex->name))` on each
+ * entry in order. But each character of `str` is looked at only once.
+ */
+static struct exclude *exclude_find (const char *str, unsigned exclude_which)
+{
+  const exclude_node *node = &exclude_trie;
+  struct exclude     *best = NULL;
+  struct exclude     *ex;
+  int                 ch;
+
+  while (node)
+  {
+    for (ex = node->ex; ex; ex = ex->next_same)
+    {
+      if (ex->which & exclude_which)
+      {
+        if (!best || ex->order < best->order)
+           best = ex;
+        break;
+      }
+    }
+    if (!*str)
+       break;
+
+    ch = tolower ((int)*(const u_char*)str++);
+    for (node = node->child; node; node = node->sibling)
+        if (node->ch == ch)
+           break;
+  }
+  return (best);
+}
+
+/**
+ * Count an exclusion on the matching `ex`.
+ * Unless it is only for another program than the caller of this function.
+ */
+static bool exclude_hit (struct exclude *ex, unsigned exclude_which)
+{
+  if (ex->only_if_prog && exclude_which == EXCL_FUNCTION && !StackWalkOurModule(ex->only_if_prog))
+     return (false);
+
+  ex->num_excludes++;
+  return (true);
+}
+
 /**
  * Given a C-format, extract the 1st word from it and check
  * if the function / program should be excluded from tracing.
  *
  * We always assume that `fmt` starts with a valid name.
- * Using `strnicmp()` avoids copying `fmt` into a local
- * buffer first.
+ * The name in the `exclude_list` only has to match the start of `fmt`.
  */
 bool exclude_list_get (const char *fmt, unsigned exclude_which)
 {
-  size_t len;
-  int    i, max;
+  struct exclude *ex;
 
   /* If no tracing of any callers, that should exclude everything.
    */
   if (exclude_which == EXCL_FUNCTION && g_cfg.trace_caller <= 0)
      return (true);
 
-  max = exclude_list ? smartlist_len (exclude_list) : 0;
-  for (i = 0; i < max; i++)
-  {
-    struct exclude *ex = smartlist_get (exclude_list, i);
+  ex = exclude_find (fmt, exclude_which);
+  return (ex ? exclude_hit(ex, exclude_which) : false);
+}
 
-    len = strlen (ex->name);
-    if ((ex->which & exclude_which) && !strnicmp(fmt, ex->name, len))
-    {
-      if (ex->only_if_prog && exclude_which == EXCL_FUNCTION && !StackWalkOurModule(ex->only_if_prog))
-         return (false);
+/**
+ * As `exclude_list_get()`, but the lookup is done only once for each `cache`.
+ * A call-site with a constant `fmt` can then keep the result in a
+ * static `exclude_cache`.
+ */
+bool exclude_list_get_cached (exclude_cache *cache, const char *fmt, unsigned exclude_which)
+{
+  if (exclude_which == EXCL_FUNCTION && g_cfg.trace_caller <= 0)
+     return (true);
 
-      ex->num_excludes++;
-      return (true);
-    }
+  if (cache->gen != exclude_gen)
+  {
+    cache->ex  = exclude_find (fmt, exclude_which);
+    cache->gen = exclude_gen;
   }
-  return (false);
+  return (cache->ex ? exclude_hit(cache->ex, exclude_which) : false);
 }
 
 /**
@@ -390,6 +553,8 @@ static void exclude_list_free_one (void *_ex)
  */
 bool exclude_list_free (void)
 {
+  exclude_trie_free (&exclude_trie);
+  exclude_gen++;
   smartlist_wipe (exclude_list, exclude_list_free_one);
   exclude_list = NULL;
   return (true);
@@ -484,7 +649,9 @@ static bool _exclude_list_add (char *name, unsigned exclude_which)
       ex->which        = which;
       ex->name         = strdup (prog);
       ex->only_if_prog = only ? strdup(only) : NULL;
+      ex->order        = smartlist_len (exclude_list);
       smartlist_add (exclude_list, ex);
+      exclude_trie_add (ex);
     }
   }
 
@@ -593,6 +760,36 @@ static void parse_core_settings (const char *key, const char *val, unsigned line
   else if (!stricmp(key, "trace_binmode"))
      g_cfg.trace_binmode = atoi (val);
 
+  else if (!stricmp(key, "trace_async"))
+     g_cfg.trace_async = atoi (val);
+
+  else if (!stricmp(key, "trace_ring_size"))
+     g_cfg.trace_ring_size = atoi (val);
+
+  else if (!stricmp(key, "trace_binary"))
+     g_cfg.trace_binary = atoi (val);
+
+  else if (!stricmp(key, "trace_compress"))
+     g_cfg.trace_compress = atoi (val);
+
+  else if (!stricmp(key, "trace_compress_sync"))
+     g_cfg.trace_compress_sync = atoi (val);
+
+  else if (!stricmp(key, "trace_rotate_size"))
+     g_cfg.trace_rotate_size = atoi (val);
+
+  else if (!stricmp(key, "trace_rotate_time"))
+     g_cfg.trace_rotate_time = atoi (val);
+
+  else if (!stricmp(key, "trace_rotate_keep"))
+     g_cfg.trace_rotate_keep = atoi (val);
+
+  else if (!stricmp(key, "trace_rotate_stamp"))
+     g_cfg.trace_rotate_stamp = atoi (val);
+
+  else if (!stricmp(key, "trace_rotate_compress"))
+     g_cfg.trace_rotate_compress = atoi (val);
+
   else if (!stricmp(key, "trace_file_commit"))
      g_cfg.trace_file_commit = atoi (val);
 
@@ -761,6 +958,15 @@ static void parse_core_settings (const char *key, const char *val, unsigned line
   else if (!stricmp(key, "no_inv_handler"))
      g_cfg.no_inv_handler = atoi (val);
 
+  else if (!stricmp(key, "init_threads"))
+     g_cfg.init_threads = atoi (val);
+
+  else if (!stricmp(key, "lazy_init"))
+     g_cfg.lazy_init = atoi (val);
+
+  else if (!stricmp(key, "annotate_ttl"))
+     g_cfg.annotate_ttl = atoi (val);
+
   else if (!stricmp(key, "use_winhttp"))
      ;   /* dropped WinHTTP.dll in favour of WinInet.dll */
 
@@ -830,6 +1036,12 @@ static void parse_geoip_settings (const char *key, const char *val, unsigned lin
   else if (!stricmp(key, "map_zoom"))
        g_cfg.GEOIP.map_zoom = atoi (val);
 
+  else if (!stricmp(key, "use_snapshot"))
+       g_cfg.GEOIP.use_snapshot = atoi (val);
+
+  else if (!stricmp(key, "verify_snapshot"))
+       g_cfg.GEOIP.verify_snapshot = atoi (val);
+
   else if (!stricmp(key, "ip4_file"))
        g_cfg.GEOIP.ip4_file = strdup (val);
 
@@ -858,6 +1070,9 @@ static void parse_geoip_settings (const char *key, const char *val, unsigned lin
     g_cfg.GEOIP.ip2location_bin_file = strdup (val);
   }
 
+  else if (!stricmp(key, "ip2location_decode"))
+       g_cfg.GEOIP.ip2location_decode = atoi (val);
+
   else TRACE (1, "%s (%u):\n   Unknown keyword '%s' = '%s'\n",
               g_data.cfg_fname, line, key, val);
 }
@@ -1155,6 +1370,368 @@ static int parse_config_file (FILE *file)
   return (lines);
 }
 
+/**\struct init_job
+ *
+ * One of the independent databases loaded at init.
+ * These are loaded concurrently by a small pool of threads when
+ * `g_cfg.init_threads > 1`. See `init_jobs_start()`.
+ *
+ * Jobs with a `db >= 0` are skipped in lazy mode; they are
+ * loaded by `init_db_load_all()` on the first traced call instead.
+ */
+struct init_job {
+       const char *name;           /**< Short name for `trace_report()` */
+       void      (*func) (void);   /**< The function loading it */
+       int         db;             /**< The `init_db` it belongs to or -1 */
+       bool        done;           /**< It was run */
+       double      usec;           /**< The time it took */
+     };
+
+static void init_geoip4 (void)
+{
+  geoip_load (AF_INET);
+}
+
+static void init_geoip6 (void)
+{
+  geoip_load (AF_INET6);
+}
+
+static void init_ip2loc (void)
+{
+  ip2loc_init();
+}
+
+/*
+ * The largest files first; a free thread then picks the smaller ones.
+ */
+static struct init_job init_jobs[] = {
+                     { "geoip4",   init_geoip4,        INIT_DB_GEOIP },
+                     { "geoip6",   init_geoip6,        INIT_DB_GEOIP },
+                     { "ASN",      ASN_init,           INIT_DB_ASN   },
+                     { "ip2loc",   init_ip2loc,        INIT_DB_GEOIP },
+                     { "IANA",     iana_init,          INIT_DB_IANA  },
+                     { "DNSBL",    DNSBL_init,         INIT_DB_DNSBL },
+                     { "hosts",    hosts_file_init,    -1            },
+                     { "services", services_file_init, -1            }
+                   };
+
+#define INIT_JOBS_MAX_THREADS  DIM(init_jobs)
+
+static volatile LONG init_jobs_next;       /* The next job in `init_jobs[]` to run */
+static volatile LONG init_jobs_completed;  /* Number of jobs finished (or skipped) */
+static volatile LONG init_jobs_pending;    /* Started but not joined */
+static HANDLE        init_jobs_done;       /* Set when all jobs are finished */
+static HANDLE        init_jobs_thr [INIT_JOBS_MAX_THREADS];
+static int           init_jobs_num_thr;
+static double        init_jobs_start_time;
+static double        init_jobs_usec;       /* The wall-time of all the jobs */
+static bool          init_jobs_lazy;       /* Load the `init_db` jobs on first use */
+static volatile LONG init_db_all_loaded;   /* All `init_db` are loaded in lazy mode */
+
+/**
+ * The state of each `init_db`; `INIT_DB_UNLOADED`, `INIT_DB_LOADING`
+ * or `INIT_DB_LOADED`. Checked by the `INIT_DB_NEED()` macro.
+ */
+volatile LONG init_db_state [INIT_DB_MAX];
+
+/**
+ * The once-guard of each `init_db` in lazy mode. See `init_db_load()`.
+ */
+static CRITICAL_SECTION init_db_crit [INIT_DB_MAX];
+
+/**
+ * Run one job and record the time it took.
+ */
+static void init_job_run (struct init_job *job)
+{
+  double start = get_timestamp_now();
+
+  (*job->func)();
+  job->usec = get_timestamp_now() - start;
+  job->done = true;
+  TRACE (2, "Loading %s took %.3f msec.\n", job->name, job->usec / 1E3);
+}
+
+/**
+ * Done when all the jobs are finished; the parts of the init that
+ * depends on more than one job.
+ */
+static void init_jobs_finish (void)
+{
+  if (!init_jobs_lazy)
+     geoip_init_finish (NULL, NULL);
+  init_jobs_usec = get_timestamp_now() - init_jobs_start_time;
+}
+
+/**
+ * Take the next job until none is left.
+ * The thread finishing the last job calls `init_jobs_finish()` and
+ * signals the `init_jobs_done` event.
+ */
+static void init_jobs_run_next (void)
+{
+  LONG i;
+
+  while ((i = InterlockedIncrement(&init_jobs_next) - 1) < DIM(init_jobs))
+  {
+    if (!init_jobs_lazy || init_jobs[i].db < 0)
+       init_job_run (init_jobs + i);
+
+    if (InterlockedIncrement(&init_jobs_completed) == DIM(init_jobs))
+    {
+      init_jobs_finish();
+      SetEvent (init_jobs_done);
+    }
+  }
+}
+
+/**
+ * The worker-thread of the pool.
+ *
+ * The event is set before the thread exits; exiting a thread needs the
+ * loader-lock and the waiter in `init_jobs_join()` could hold it.
+ */
+static DWORD WINAPI init_jobs_worker (void *arg)
+{
+  ARGSUSED (arg);
+  init_jobs_run_next();
+  return (0);
+}
+
+/**
+ * Start loading all databases in `init_jobs[]`.
+ *
+ * Called from `wsock_trace_init()`. When called from `DllMain()`, the
+ * threads do not run until the loader-lock is released. Hence the join is
+ * done in `check_ptr()` before the first traced function needs any of
+ * these databases.
+ *
+ * If `g_cfg.init_threads <= 1` or no threads could be started, load
+ * them one after another in this thread.
+ *
+ * With `g_cfg.lazy_init`, only the hosts and services files are loaded
+ * here. The others are loaded by `init_db_load_all()` in the first traced
+ * call. This is only done when called from `DllMain()`; `ws_tool` always
+ * loads everything up-front. And not with `USE_MHOOK`; then no
+ * `check_ptr()` is done before a hook takes the trace-lock.
+ */
+static void init_jobs_start (void)
+{
+  int i, num_thr = min (g_cfg.init_threads, (int)INIT_JOBS_MAX_THREADS);
+
+#if defined(USE_MHOOK)
+  init_jobs_lazy = false;
+#else
+  init_jobs_lazy = (g_cfg.lazy_init && g_data.ws_from_dll_main);
+#endif
+  init_db_all_loaded = 0;
+  if (init_jobs_lazy)
+  {
+    for (i = 0; i < INIT_DB_MAX; i++)
+        InitializeCriticalSection (&init_db_crit[i]);
+  }
+  else
+  {
+    /* The `INIT_DB_NEED()` checks are then no-ops; `check_ptr()`
+     * does the wait.
+     */
+    for (i = 0; i < INIT_DB_MAX; i++)
+        init_db_state[i] = INIT_DB_LOADED;
+  }
+
+  init_jobs_start_time = get_timestamp_now();
+  init_jobs_next      = 0;
+  init_jobs_completed = 0;
+
+  if (num_thr > 1)
+     init_jobs_done = CreateEvent (NULL, TRUE, FALSE, NULL);
+
+  for (i = 0; init_jobs_done && i < num_thr; i++)
+  {
+    init_jobs_thr[i] = CreateThread (NULL, 0, init_jobs_worker, NULL, 0, NULL);
+    if (!init_jobs_thr[i])
+    {
+      TRACE (1, "CreateThread() failed: %s.\n", win_strerror(GetLastError()));
+      break;
+    }
+  }
+  init_jobs_num_thr = i;
+
+  if (init_jobs_num_thr == 0)
+  {
+    if (init_jobs_done)
+       CloseHandle (init_jobs_done);
+    init_jobs_done = NULL;
+    for (i = 0; i < DIM(init_jobs); i++)
+    {
+      if (!init_jobs_lazy || init_jobs[i].db < 0)
+         init_job_run (init_jobs + i);
+    }
+    init_jobs_finish();
+    return;
+  }
+
+  init_jobs_pending = 1;
+  TRACE (2, "Started %d threads to load %d databases.\n", init_jobs_num_thr, DIM(init_jobs));
+}
+
+/**
+ * Wait for all jobs started by `init_jobs_start()` to finish.
+ * Several threads could get here at the same time; all wait on the
+ * same event, but only one closes the thread handles. The event is
+ * closed in `init_jobs_exit()`.
+ *
+ * The jobs no worker has taken yet are run here first. A thread created
+ * from `DllMain()` can not start before the loader-lock is released. And the
+ * first traced call could come while it is held; e.g. from the `DllMain()`
+ * of another DLL. Then nothing is left for the workers and the wait is only
+ * for jobs a running worker has taken.
+ */
+static void init_jobs_join (void)
+{
+  int i;
+
+  if (!init_jobs_pending)
+     return;
+
+  init_jobs_run_next();
+  WaitForSingleObject (init_jobs_done, INFINITE);
+
+  if (InterlockedExchange(&init_jobs_pending, 0) == 0)
+     return;
+
+  for (i = 0; i < init_jobs_num_thr; i++)
+  {
+    CloseHandle (init_jobs_thr[i]);
+    init_jobs_thr[i] = NULL;
+  }
+  TRACE (2, "All databases loaded in %.3f msec.\n", init_jobs_usec / 1E3);
+}
+
+/**
+ * Called from `wsock_trace_exit()`.
+ *
+ * If the process exits before the jobs got joined, the threads could
+ * have been killed half-way. Then do not touch any of the databases.
+ *
+ * The same if a thread got killed while in `init_db_load()`.
+ *
+ * \retval true if it's safe to use and free the databases.
+ */
+static bool init_jobs_exit (void)
+{
+  int i;
+
+  if (init_jobs_pending && WaitForSingleObject(init_jobs_done, 0) != WAIT_OBJECT_0)
+  {
+    TRACE (1, "The databases were not loaded at exit.\n");
+    return (false);
+  }
+  for (i = 0; i < INIT_DB_MAX; i++)
+  {
+    if (init_db_state[i] == INIT_DB_LOADING)
+    {
+      TRACE (1, "Database %d was being loaded at exit.\n", i);
+      return (false);
+    }
+  }
+  init_jobs_join();
+  if (init_jobs_done)
+     CloseHandle (init_jobs_done);
+  init_jobs_done = NULL;
+
+  if (init_jobs_lazy)
+  {
+    for (i = 0; i < INIT_DB_MAX; i++)
+        DeleteCriticalSection (&init_db_crit[i]);
+    init_jobs_lazy = false;
+  }
+  return (true);
+}
+
+/**
+ * Print the load-times of the databases in `trace_report()`.
+ */
+static void init_jobs_report (void)
+{
+  int i;
+
+  C_printf ("\n  Database load times (%d threads):\n", init_jobs_num_thr > 0 ? init_jobs_num_thr : 1);
+  for (i = 0; i < DIM(init_jobs); i++)
+  {
+    if (init_jobs[i].done)
+         C_printf ("    %-10s %10.3f msec\n", init_jobs[i].name, init_jobs[i].usec / 1E3);
+    else C_printf ("    %-10s %10s\n", init_jobs[i].name, "not loaded");
+  }
+  C_printf ("    %-10s %10.3f msec%s\n", "total:", init_jobs_usec / 1E3,
+            init_jobs_lazy ? " (at startup)" : "");
+}
+
+/**
+ * Load the database `db` on first use.
+ *
+ * `init_db_crit[db]` is the once-guard. A second thread needing the same
+ * database blocks until the first is done; other threads are not held up.
+ * A recursive call from the same thread (while `INIT_DB_LOADING`) simply
+ * returns.
+ *
+ * Must not be called holding the trace-lock (`ENTER_CRIT()`); the loaders
+ * `TRACE()` and a thread waiting here for another loading thread would
+ * dead-lock. In a traced function, `check_ptr()` has already loaded all
+ * of them before the trace-lock is taken. Hence the `INIT_DB_NEED()` in
+ * the lookup functions only loads for callers outside a traced function.
+ *
+ * Does nothing unless in lazy mode; otherwise `check_ptr()` waits for
+ * all the databases.
+ */
+void init_db_load (init_db db)
+{
+  int i;
+
+  if (!init_jobs_lazy || db < 0 || db >= INIT_DB_MAX)
+     return;
+
+  if (init_db_state[db] == INIT_DB_LOADED)
+     return;
+
+  EnterCriticalSection (&init_db_crit[db]);
+  if (init_db_state[db] == INIT_DB_UNLOADED)
+  {
+    init_db_state[db] = INIT_DB_LOADING;
+    for (i = 0; i < DIM(init_jobs); i++)
+    {
+      if (init_jobs[i].db == (int)db)
+         init_job_run (init_jobs + i);
+    }
+    if (db == INIT_DB_GEOIP)
+       geoip_init_finish (NULL, NULL);
+    InterlockedExchange (&init_db_state[db], INIT_DB_LOADED);
+  }
+  LeaveCriticalSection (&init_db_crit[db]);
+}
+
+/**
+ * Called from `check_ptr()` in lazy mode; before a traced function takes
+ * the trace-lock. Load all the databases not yet loaded.
+ *
+ * `init_db_all_loaded` is not set while a database is still loading in
+ * this thread; i.e. a traced call from a loader.
+ */
+static void init_db_load_all (void)
+{
+  int i, loaded = 0;
+
+  for (i = 0; i < INIT_DB_MAX; i++)
+  {
+    init_db_load (i);
+    if (init_db_state[i] == INIT_DB_LOADED)
+       loaded++;
+  }
+  if (loaded == INIT_DB_MAX)
+     InterlockedExchange (&init_db_all_loaded, 1);
+}
+
 static void trace_report (void)
 {
   const struct exclude *ex;
@@ -1243,7 +1820,16 @@ static void trace_report (void)
   if (g_cfg.use_sema)
      C_printf ("    Semaphore wait: %13s\n",        qword_str(g_data.counts.sema_waits));
 
-  if (g_cfg.GEOIP.enable)
+  if (g_cfg.trace_async)
+     C_printf ("    Dropped lines:  %13s\n",        qword_str(g_data.counts.trace_drops));
+
+  if (g_cfg.trace_rotate_size > 0 || g_cfg.trace_rotate_time > 0)
+     C_printf ("    File rotations: %13s\n",        qword_str(g_data.counts.trace_rotations));
+
+  overlap_report();
+  init_jobs_report();
+
+  if (g_cfg.GEOIP.enable && init_db_state[INIT_DB_GEOIP] == INIT_DB_LOADED)
   {
     DWORD num_ip4, num_ip6, num_ip2loc4, num_ip2loc6;
 
@@ -1252,10 +1838,13 @@ static void trace_report (void)
     C_printf ("  # of unique countries (IPv6): %3lu, by ip2loc: %3lu.\n", num_ip6, num_ip2loc6);
   }
 
-  if (g_cfg.IANA.enable)
+  annotate_report();
+  caller_cache_report();
+
+  if (g_cfg.IANA.enable && init_db_state[INIT_DB_IANA] == INIT_DB_LOADED)
      iana_report();
 
-  if (g_cfg.ASN.enable)
+  if (g_cfg.ASN.enable && init_db_state[INIT_DB_ASN] == INIT_DB_LOADED)
      ASN_report();
 
   if (g_cfg.FIREWALL.enable)
@@ -1268,11 +1857,13 @@ static void trace_report (void)
 void wsock_trace_exit (void)
 {
   int  i;
-  bool rc;
+  bool rc, db_okay;
 
   set_color (NULL);
 
-  if (g_data.fatal_error)
+  db_okay = init_jobs_exit();
+
+  if (g_data.fatal_error || !db_okay)
      g_cfg.trace_report = false;
 
 #if 0
@@ -1286,8 +1877,13 @@ void wsock_trace_exit (void)
   exclude_list_free();
   StackWalkExit();
   overlap_exit();
-  hosts_file_exit();
-  services_file_exit();
+  annotate_exit();
+  caller_cache_exit();
+  if (db_okay)
+  {
+    hosts_file_exit();
+    services_file_exit();
+  }
 
 #if 0
   if (g_cfg.trace_level >= 3)
@@ -1343,10 +1939,13 @@ void wsock_trace_exit (void)
   FREE (g_cfg.DNSBL.dropv6_url);
   FREE (g_cfg.DNSBL.edrop_url);
 
-  DNSBL_exit();
-  geoip_exit();
-  iana_exit();
-  ASN_exit();
+  if (db_okay)
+  {
+    DNSBL_exit();
+    geoip_exit();
+    iana_exit();
+    ASN_exit();
+  }
   IDNA_exit();
 
   reset_invalid_handler();
@@ -1416,7 +2015,7 @@ void wsock_trace_init (void)
   FILE       *file;
   char       *end, *env = getenv ("WSOCK_TRACE_LEVEL");
   const char *now;
-  bool        okay;
+  bool        okay, trace_binary;
   HMODULE     mod;
 
   /* Set default values.
@@ -1437,6 +2036,13 @@ void wsock_trace_init (void)
   g_cfg.trace_max_len = 9999;      /* Infinite */
   g_cfg.trace_stream  = stdout;
   g_cfg.trace_file_device = true;
+  g_cfg.GEOIP.use_snapshot = true;
+  g_cfg.init_threads = 4;
+  g_cfg.lazy_init = true;
+  g_cfg.annotate_ttl = 60;
+  g_cfg.trace_ring_size = 256;
+  g_cfg.trace_compress_sync = 1000;
+  g_cfg.trace_rotate_keep = 5;
 
   tzset();
   common_init();
@@ -1464,6 +2070,9 @@ void wsock_trace_init (void)
   if (g_cfg.compact)
      g_cfg.dump_data = false;
 
+  trace_binary = g_cfg.trace_binary;
+  g_cfg.trace_binary = false;
+
   if (g_cfg.use_sema)
   {
     /* Check if we've already got an instance of ourself.
@@ -1517,6 +2126,33 @@ void wsock_trace_init (void)
     }
   }
 
+  /* A binary trace needs a real trace-file. The text-records in it
+   * gets the same "\r\n" line-endings as a normal trace-file.
+   */
+  if (trace_binary && g_cfg.trace_file_okay)
+     g_cfg.trace_binmode = true;
+  else trace_binary = false;
+
+  /* So does a compressed trace. Let the writer-thread do the compression.
+   */
+  if (g_cfg.trace_compress > 0 && g_cfg.trace_file_okay)
+  {
+    g_cfg.trace_binmode = true;
+    g_cfg.trace_async   = true;
+  }
+  else
+    g_cfg.trace_compress = 0;
+
+  /* Rotating the trace-file is also done by the writer-thread.
+   */
+  if ((g_cfg.trace_rotate_size > 0 || g_cfg.trace_rotate_time > 0) && g_cfg.trace_file_okay)
+     g_cfg.trace_async = true;
+  else
+  {
+    g_cfg.trace_rotate_size = 0;
+    g_cfg.trace_rotate_time = 0;
+  }
+
   if (g_cfg.trace_stream)
   {
     if (g_cfg.no_buffering)
@@ -1526,6 +2162,15 @@ void wsock_trace_init (void)
        _setmode (_fileno(g_cfg.trace_stream), O_BINARY);
   }
 
+  if (g_cfg.trace_compress > 0 && !C_compress_init())
+     g_cfg.trace_compress = 0;
+
+  /* Write the header first. From now on, all output to
+   * the trace-file is written as binary records.
+   */
+  if (trace_binary)
+     g_cfg.trace_binary = trace_bin_init();
+
   if (g_cfg.PCAP.enable)
   {
     errno = 0;
@@ -1540,6 +2185,11 @@ void wsock_trace_init (void)
     IDNA_exit();
   }
 
+  annotate_init();
+
+  if (g_cfg.trace_caller)
+     caller_cache_init();
+
   if (image_opt_header_is_gui_app(mod))
   {
     TRACE (2, "Disabling sound in a GUI-program.\n");
@@ -1612,6 +2262,9 @@ void wsock_trace_init (void)
        TRACE (1, "TlsAlloc() -> TLS_OUT_OF_INDEXES! GetLastError(): %lu.\n", GetLastError());
   else TRACE (2, "TlsAlloc() -> %lu.\n", g_data.ws_Tls_index);
 
+  C_async_init();
+  C_rotate_init();
+
   if (!g_data.stdout_redirected)
   {
     if (!g_cfg.color_file)
@@ -1661,21 +2314,24 @@ void wsock_trace_init (void)
             "                get_dll_build_date(): %s\n",
          g_data.curr_prog, g_data.curr_dir, g_data.prog_dir, get_dll_short_name(), get_dll_build_date());
 
-  geoip_init (NULL, NULL);
-
-  DNSBL_init();
+  /* Load geoip, DNSBL, hosts, services, IANA and ASN databases.
+   * Or with `lazy_init = 1`, some of these in the first traced call.
+   */
+  init_jobs_start();
 
   if (g_cfg.trace_level >= 3)
      check_all_search_lists();
 
   load_ws2_funcs();
-  hosts_file_init();
-  services_file_init();
 
   StackWalkInit();
   overlap_init();
-  iana_init();
-  ASN_init();
+
+  /* Not called from `DllMain()`; e.g. from `ws_tool`. No reason to wait for
+   * the first call to `check_ptr()`.
+   */
+  if (!g_data.ws_from_dll_main)
+     init_jobs_join();
 
 #if defined(USE_LWIP)
   ws_lwip_init();
@@ -1693,11 +2349,20 @@ void wsock_trace_init (void)
  * ```
  *
  * Hence `func_name` should be equal to `ptr_name + 2`.
+ *
+ * Since this is called first in all traced functions, this is also where
+ * we wait for the databases loaded by `init_jobs_start()`.
  */
 void check_ptr (const void **ptr, const char *ptr_name)
 {
   const char *func_name = ptr_name + 2;
 
+  if (init_jobs_pending)
+     init_jobs_join();
+
+  if (init_jobs_lazy && !init_db_all_loaded)
+     init_db_load_all();
+
   if (*ptr == NULL)
   {
     const struct LoadTable *f = find_ws2_func_by_name (func_name);
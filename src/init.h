@@ -21,6 +21,8 @@ struct statistics {
        uint64  dll_attach;
        uint64  dll_detach;
        uint64  sema_waits;
+       uint64  trace_drops;
+       uint64  trace_rotations;
      };
 
 typedef enum TS_TYPE {  /* Time-Stamp enum type */
@@ -89,6 +91,8 @@ struct GEOIP_cfg {
        bool    show_position;
        bool    show_map_url;
        bool    openstreetmap;
+       bool    use_snapshot;
+       bool    verify_snapshot;
        UINT    map_zoom;
        int     max_days;
        char   *ip4_file;
@@ -96,6 +100,7 @@ struct GEOIP_cfg {
        char   *ip4_url;
        char   *ip6_url;
        char   *ip2location_bin_file;
+       bool    ip2location_decode;
        char   *proxy;
      };
 
@@ -140,6 +145,16 @@ struct config_table {
        bool    trace_file_device;
        bool    trace_file_commit;
        bool    trace_use_ods;
+       bool    trace_async;
+       int     trace_ring_size;
+       bool    trace_binary;
+       int     trace_compress;
+       int     trace_compress_sync;
+       int     trace_rotate_size;
+       int     trace_rotate_time;
+       int     trace_rotate_keep;
+       bool    trace_rotate_stamp;
+       int     trace_rotate_compress;
        int     trace_level;
        int     trace_overlap;
        int     trace_indent;
@@ -193,6 +208,9 @@ struct config_table {
        bool    cygwin_only;
        bool    no_buffering;
        bool    no_inv_handler;
+       int     init_threads;
+       bool    lazy_init;
+       int     annotate_ttl;
        TS_TYPE trace_time_format;
        bool    trace_time_usec;
 
@@ -263,6 +281,35 @@ extern int  get_column (void);
 
 extern void check_ptr (const void **ptr, const char *ptr_name);
 
+/**
+ * The databases that can be loaded on first use.
+ * See `init_db_load()` in init.c.
+ */
+typedef enum init_db {
+        INIT_DB_GEOIP = 0,   /* geoip4, geoip6 and ip2loc */
+        INIT_DB_ASN,
+        INIT_DB_IANA,
+        INIT_DB_DNSBL,
+        INIT_DB_MAX
+      } init_db;
+
+#define INIT_DB_UNLOADED  0
+#define INIT_DB_LOADING   1
+#define INIT_DB_LOADED    2
+
+extern volatile LONG init_db_state [INIT_DB_MAX];
+extern void          init_db_load (init_db db);
+
+/**
+ * Put this first in a function that needs the database `db`.
+ * Cheap once it is loaded. It must not need to load it while holding
+ * the trace-lock; see `init_db_load()`.
+ */
+#define INIT_DB_NEED(db)  do {                                       \
+                            if (init_db_state[db] != INIT_DB_LOADED) \
+                               init_db_load (db);                    \
+                          } while (0)
+
 typedef enum exclude_type {
         EXCL_NONE     = 0x00,
         EXCL_FUNCTION = 0x01,
@@ -270,11 +317,23 @@ typedef enum exclude_type {
         EXCL_ADDRESS  = 0x04,
       } exclude_type;
 
+/**\struct exclude_cache
+ * The result of a lookup in the `exclude_list` kept at a call-site.
+ * Must be zeroed (static) before the first `exclude_list_get_cached()`.
+ */
+typedef struct exclude_cache {
+        struct exclude *ex;   /**< The matching entry; or NULL */
+        DWORD           gen;  /**< The generation of the `exclude_list` it was found in; 0 if none */
+      } exclude_cache;
+
 extern bool exclude_list_add (const char *name, unsigned exclude_which);
 extern bool exclude_list_get (const char *fmt, unsigned exclude_which);
+extern bool exclude_list_get_cached (exclude_cache *cache, const char *fmt, unsigned exclude_which);
 extern bool exclude_list_free (void);
 
 extern const char *get_timestamp (void);
+extern int64       get_timestamp_raw (void);
+extern const char *get_timestamp_str (int64 raw);
 extern double      get_timestamp_now (void);
 extern const char *get_date_str (const SYSTEMTIME *st);
 extern const char *get_time_now (void);
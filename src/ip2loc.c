@@ -14,6 +14,10 @@
  * This module uses a binary file specified in the `[geoip]` section and
  * the keyword `ip2location_bin_file` of `wsock_trace`.
  *
+ * With `ip2location_decode = 1`, the rows of this file are decoded once into
+ * flat arrays and a string-pool. Lookups are then a plain binary search on
+ * these arrays instead of bounds-checked reads of the shared-memory.
+ *
  * \note There is no separate keyword for IPv4 and IPv6 addresses as this
  *       binary file should contain both address-families
  *       (and additional information).
@@ -46,8 +50,8 @@ _PRAGMA (clang diagnostic ignored "-Wstrict-prototypes")
  * below, patched heavily and removed stuff not needed.
  *
  * Most importantly, it uses only shared-memory access without calling `calloc()`
- * and `strdup()` to return any results. Just copy to a `ip2loc_entry` entry as
- * needed.
+ * and `strdup()` to return any results. The strings in a `ip2loc_result` point
+ * into `ip2loc_pool`; only the fields asked for are looked up.
  *
  * IP2Location C library is distributed under MIT license
  * Copyright (c) 2013-2015 IP2Location.com. support at ip2location dot com
@@ -70,61 +74,6 @@ _PRAGMA (clang diagnostic ignored "-Wstrict-prototypes")
 #define API_VERSION_MINOR   0
 #define API_VERSION_MICRO   8
 
-/**
- * Flags used to determine what to look for in `IP2Location_read_record()`.
- *
- * \def FLG_COUNTRY_SHORT
- *  Look up the 2 letter ISO-3166 country code.
- * \ref geoip_get_long_name_by_A2() and c_list[].
- *
- * \def FLG_COUNTRY_LONG
- *  Look up the complete country name.
- *
- * \def FLG_REGION
- *  Look up the region in the country.
- *
- * \def FLG_CITY
- *  Look up the city in the country.
- */
-#define FLG_COUNTRY_SHORT   0x00001
-#define FLG_COUNTRY_LONG    0x00002
-#define FLG_REGION          0x00004
-#define FLG_CITY            0x00008
-#define FLG_ISP             0x00010   /* never used */
-#define FLG_LATITUDE        0x00020
-#define FLG_LONGITUDE       0x00040
-
-/**
- * \def IP2LOC_FLAGS
- *
- * The default flags used to look up an database-entry for an IPv4/IPv6-address
- * with these members:
- *
- *  \li `struct ip2loc_entry::country_short`,
- *  \li `struct ip2loc_entry::country_long`,
- *  \li `struct ip2loc_entry::city`,
- *  \li `struct ip2loc_entry::region`.
- *
- * And optionally:
- *  \li `struct ip2loc_entry::latitude`.
- *  \li `struct ip2loc_entry::longitude`.
- *
- * if `g_cfg.GEOIP.show_position` or `g_cfg.GEOIP.show_map_url` is true.
- */
-
-#if 0
-  #define IP2LOC_FLAGS  (FLG_COUNTRY_SHORT | FLG_COUNTRY_LONG | FLG_REGION | FLG_CITY)
-#else
-  /**
-   * A bit faster to skip looking for the full country-name.
-   * The returned `struct ip2loc_entry::country_short` is instead passed to
-   * `geoip_get_long_name_by_A2()` to get the full country-name.
-   */
-  #define IP2LOC_FLAGS  (FLG_COUNTRY_SHORT | FLG_REGION | FLG_CITY)
-#endif
-
-static uint32_t lookup_flags = IP2LOC_FLAGS;
-
 #define MAX_IPV4_RANGE      4294967295U /* ULONG_MAX */
 #define IPV4                0
 #define IPV6                1
@@ -186,6 +135,63 @@ static uint8_t CITY_POSITION[25]      = { 0, 0, 0, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
 static uint8_t LATITUDE_POSITION[25]  = { 0, 0, 0, 0, 0, 5, 5, 0, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5 };
 static uint8_t LONGITUDE_POSITION[25] = { 0, 0, 0, 0, 0, 6, 6, 0, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6 };
 
+/**\struct ip2loc_u128
+ * An IPv6-address as a 128-bit number on host order.
+ */
+struct ip2loc_u128 {
+       uint64 hi;
+       uint64 lo;
+     };
+
+/**\struct ip2loc_decoded
+ * The rows of one address-family decoded from the .BIN-file into
+ * flat typed arrays by `ip2loc_decode()`.
+ *
+ * The strings are ids into `ip2loc_pool.strings`. Id 0 is "".
+ * Row `i` covers the addresses `[from[i] .. from[i+1]>`.
+ */
+struct ip2loc_decoded {
+       uint32_t            num;        /**< Number of rows */
+       uint32_t           *from4;      /**< `[num+1]` the first IPv4-address of each row */
+       struct ip2loc_u128 *from6;      /**< `[num+1]` the first IPv6-address of each row */
+       uint32_t           *index;      /**< `[2*65536]` low/high row for the 16 MSB of an address. Or NULL */
+       uint32_t           *country;    /**< `[num]` */
+       uint32_t           *region;     /**< `[num]` */
+       uint32_t           *city;       /**< `[num]` */
+       float              *latitude;   /**< `[num]`. Or NULL if not in the database */
+       float              *longitude;  /**< `[num]`. Or NULL if not in the database */
+     };
+
+static struct ip2loc_decoded ip2loc_dec4, ip2loc_dec6;
+
+/**
+ * The size of each block in the string-pool.
+ * A Pascal-type string is at most 255 characters.
+ */
+#define IP2LOC_POOL_BLOCK  (64 * 1024)
+
+/**
+ * The string-pool for the decoded rows and the strings returned in a `ip2loc_result`.
+ *
+ * Each string from the .BIN-file is stored only once and never moves until
+ * `ip2loc_exit()`. The hash-table maps it's file-position to the id in `strings`.
+ *
+ * Like `g_ip2loc_result` in geoip.c, this is not thread-safe; the callers
+ * are serialised by `g_data.crit_sect`.
+ */
+static struct {
+       char        *block;        /**< the current block; the first `sizeof(char*)` bytes links to the previous */
+       uint32_t     block_used;   /**< bytes used in `block` */
+       uint32_t     bytes;        /**< total bytes in all blocks */
+       const char **strings;      /**< id -> string */
+       uint32_t     num;          /**< number of ids in use */
+       uint32_t     max;          /**< number of ids allocated */
+       uint32_t    *hash_pos;     /**< the file-position + 1 of a string. 0 is an empty slot */
+       uint32_t    *hash_id;      /**< the string's id in `strings` */
+       uint32_t     hash_size;    /**< a power of 2 */
+       uint32_t     hash_used;
+     } ip2loc_pool;
+
 static void        IP2Location_initialize (IP2Location *loc);
 static void        IP2Location_read_ipv6_addr (IP2Location *loc, uint32_t position, struct in6_addr *addr);
 static uint32_t    IP2Location_read32 (IP2Location *loc, uint32_t position);
@@ -194,6 +200,10 @@ static float       IP2Location_read_float (IP2Location *loc, uint32_t position);
 static int32_t     IP2Location_DB_set_shared_memory (IP2Location *loc);
 static void        IP2Location_close (IP2Location *loc);
 static const char *IP2Location_api_version_str (void);
+static bool        ip2loc_decode (IP2Location *loc);
+static void        ip2loc_decode_exit (void);
+static uint32_t    ip2loc_pool_add (IP2Location *loc, uint32_t position);
+static void        ip2loc_pool_free (void);
 
 /**
  * Open and initialise access to the IP2Location library and binary data-file.
@@ -306,8 +316,8 @@ bool ip2loc_init (void)
   if (!ip2loc_handle)
      ip2loc_handle = open_file (g_cfg.GEOIP.ip2location_bin_file);
 
-  if (g_cfg.GEOIP.show_position || g_cfg.GEOIP.show_map_url)
-     lookup_flags |= (FLG_LATITUDE + FLG_LONGITUDE);
+  if (ip2loc_handle && g_cfg.GEOIP.ip2location_decode && ip2loc_dec4.num + ip2loc_dec6.num == 0)
+     ip2loc_decode (ip2loc_handle);
 
   return (ip2loc_handle != NULL);
 }
@@ -318,6 +328,8 @@ bool ip2loc_init (void)
  */
 void ip2loc_exit (void)
 {
+  ip2loc_decode_exit();
+  ip2loc_pool_free();
   IP2Location_close (ip2loc_handle);
   ip2loc_handle = NULL;
 }
@@ -427,74 +439,52 @@ static int ipv6_compare (const struct in6_addr *addr1, const struct in6_addr *ad
 }
 
 /**
- * Read a Pascal-type string; `size + byte-characters` at `position`.
- */
-static void IP2Location_read_str (IP2Location *loc, uint32_t position, char *ret, size_t max_sz)
-{
-  uint8_t size;
-
-  if ((uint64)loc->sh_mem_ptr + position >= loc->sh_mem_max)
-  {
-    loc->sh_mem_index_errors++;
-    *ret = '\0';
-    return;
-  }
-  size = loc->sh_mem_ptr [position];
-  size = min (size, (uint8_t)max_sz);
-  memcpy (ret, &loc->sh_mem_ptr[position+1], size);
-}
-
-/**
- * Read the record data into `*out`.
- *
- * \param[in] loc      the current database structure; equals `ip2loc_handle`.
- * \param[in] rowaddr  the database row.
- * \param[in] mode     the flags used for lookup; equals `lookup_flags`.
- * \param[out] out     the entry to return.
+ * Read the `fields` of the record at `rowaddr` into `*res`.
+ * The strings are added to `ip2loc_pool` if not already there.
  *
- * \note
- *  The `*out` record is empty on entry of this function.
+ * \param[in]  loc      the current database structure; equals `ip2loc_handle`.
+ * \param[in]  rowaddr  the database row.
+ * \param[in]  fields   the `IP2LOC_x` fields to look up.
+ * \param[out] res      the result to fill.
  */
-static void IP2Location_read_record (IP2Location *loc, uint32_t rowaddr, uint32_t mode, struct ip2loc_entry *out)
+static void IP2Location_read_result (IP2Location *loc, uint32_t rowaddr, DWORD fields, struct ip2loc_result *res)
 {
-  uint32_t val;
   uint8_t  dbtype = loc->db_type;
+  uint32_t id;
 
-  if ((mode & FLG_COUNTRY_SHORT) && COUNTRY_POSITION[dbtype])
+  /* Note: `ip2loc_pool_add()` can move `ip2loc_pool.strings`;
+   *       hence get the `id` first.
+   */
+  if (fields & IP2LOC_COUNTRY)
   {
-    val = IP2Location_read32 (loc, rowaddr + 4 * (COUNTRY_POSITION[dbtype]-1));
-    IP2Location_read_str (loc, val, out->country_short, sizeof(out->country_short));
+    id = COUNTRY_POSITION[dbtype] ? ip2loc_pool_add (loc, IP2Location_read32 (loc, rowaddr + 4 * (COUNTRY_POSITION[dbtype]-1))) : 0;
+    res->country_short = ip2loc_pool.strings ? ip2loc_pool.strings [id] : "";
   }
 
-  if ((mode & FLG_COUNTRY_LONG) && COUNTRY_POSITION[dbtype])  /* No need to call this. Remove? */
+  if (fields & IP2LOC_REGION)
   {
-    val = IP2Location_read32 (loc, rowaddr + 4 * (COUNTRY_POSITION[dbtype]-1));
-    IP2Location_read_str (loc, val+3, out->country_long, sizeof(out->country_long));
+    id = REGION_POSITION[dbtype] ? ip2loc_pool_add (loc, IP2Location_read32 (loc, rowaddr + 4 * (REGION_POSITION[dbtype]-1))) : 0;
+    res->region = ip2loc_pool.strings ? ip2loc_pool.strings [id] : "";
   }
 
-  if ((mode & FLG_REGION) && REGION_POSITION[dbtype])
+  if (fields & IP2LOC_CITY)
   {
-    val = IP2Location_read32 (loc, rowaddr + 4 * (REGION_POSITION[dbtype]-1));
-    IP2Location_read_str (loc, val, out->region, sizeof(out->region));
+    id = CITY_POSITION[dbtype] ? ip2loc_pool_add (loc, IP2Location_read32 (loc, rowaddr + 4 * (CITY_POSITION[dbtype]-1))) : 0;
+    res->city = ip2loc_pool.strings ? ip2loc_pool.strings [id] : "";
   }
 
-  if ((mode & FLG_CITY) && CITY_POSITION[dbtype])
+  if (fields & IP2LOC_POSITION)
   {
-    val = IP2Location_read32 (loc, rowaddr + 4 * (CITY_POSITION[dbtype]-1));
-    IP2Location_read_str (loc, val, out->city, sizeof(out->city));
+    res->latitude  = LATITUDE_POSITION[dbtype]  ? IP2Location_read_float (loc, rowaddr + 4 * (LATITUDE_POSITION[dbtype]-1))  : 0.0F;
+    res->longitude = LONGITUDE_POSITION[dbtype] ? IP2Location_read_float (loc, rowaddr + 4 * (LONGITUDE_POSITION[dbtype]-1)) : 0.0F;
   }
-
-  if ((mode & FLG_LATITUDE) && (LATITUDE_POSITION[dbtype]))
-     out->latitude = IP2Location_read_float (loc, rowaddr + 4 * (LATITUDE_POSITION[dbtype] - 1));
-
-  if ((mode & FLG_LONGITUDE) && (LONGITUDE_POSITION[dbtype]))
-     out->longitude = IP2Location_read_float (loc, rowaddr + 4 * (LONGITUDE_POSITION[dbtype]-1));
+  res->fields |= fields;
 }
 
 /**
  * Get record for a IPv4 from database
  */
-static bool IP2Location_get_ipv4_record (IP2Location *loc, uint32_t mode, ipv_t parsed_ipv, struct ip2loc_entry *out)
+static bool IP2Location_get_ipv4_record (IP2Location *loc, DWORD fields, ipv_t parsed_ipv, struct ip2loc_result *res)
 {
   uint32_t baseaddr  = loc->ipv4_db_addr;
   uint32_t dbcolumn  = loc->db_column;
@@ -533,7 +523,7 @@ static bool IP2Location_get_ipv4_record (IP2Location *loc, uint32_t mode, ipv_t
 
     if (ipno >= ipfrom && ipno < ipto)
     {
-      IP2Location_read_record (loc, baseaddr + (mid * column), mode, out);
+      IP2Location_read_result (loc, baseaddr + (mid * column), fields, res);
       return (true);
     }
 
@@ -547,7 +537,7 @@ static bool IP2Location_get_ipv4_record (IP2Location *loc, uint32_t mode, ipv_t
 /**
  * Get record for a IPv6 from database
  */
-static bool IP2Location_get_ipv6_record (IP2Location *loc, uint32_t mode, ipv_t parsed_ipv, struct ip2loc_entry *out)
+static bool IP2Location_get_ipv6_record (IP2Location *loc, DWORD fields, ipv_t parsed_ipv, struct ip2loc_result *res)
 {
   uint32_t baseaddr  = loc->ipv6_db_addr;
   uint32_t dbcolumn  = loc->db_column;
@@ -586,7 +576,7 @@ static bool IP2Location_get_ipv6_record (IP2Location *loc, uint32_t mode, ipv_t
 
     if ((ipv6_compare(&ipno, &ipfrom) >= 0) && ipv6_compare(&ipno, &ipto) < 0)
     {
-      IP2Location_read_record (loc, baseaddr + mid * column + 12, mode, out);
+      IP2Location_read_result (loc, baseaddr + mid * column + 12, fields, res);
       return (true);
     }
 
@@ -753,52 +743,640 @@ static float IP2Location_read_float (IP2Location *loc, uint32_t position)
 
 
 /**
- * This avoids the call to `inet_pton()` since the passed `addr`
- * should be a valid IPv4-address.
+ * Append the Pascal-type string at file `position` to the string-pool.
+ * Return it's id or 0 ("") on error.
+ */
+static uint32_t ip2loc_pool_append (IP2Location *loc, uint32_t position)
+{
+  uint8_t size = 0;
+  char   *str;
+
+  if ((uint64)loc->sh_mem_ptr + position < loc->sh_mem_max)
+     size = loc->sh_mem_ptr [position];
+
+  if ((uint64)loc->sh_mem_ptr + position + 1 + size > loc->sh_mem_max)
+  {
+    loc->sh_mem_index_errors++;
+    return (0);
+  }
+
+  if (ip2loc_pool.num == ip2loc_pool.max)
+  {
+    uint32_t     new_max = 2 * ip2loc_pool.max;
+    const char **strings = realloc ((void*)ip2loc_pool.strings, new_max * sizeof(*strings));
+
+    if (!strings)
+       return (0);
+    ip2loc_pool.strings = strings;
+    ip2loc_pool.max     = new_max;
+  }
+
+  if (!ip2loc_pool.block || ip2loc_pool.block_used + size + 1 > IP2LOC_POOL_BLOCK)
+  {
+    char *block = malloc (IP2LOC_POOL_BLOCK);
+
+    if (!block)
+       return (0);
+    *(char**) block = ip2loc_pool.block;
+    ip2loc_pool.block      = block;
+    ip2loc_pool.block_used = sizeof(char*);
+    ip2loc_pool.bytes     += IP2LOC_POOL_BLOCK;
+  }
+
+  str = ip2loc_pool.block + ip2loc_pool.block_used;
+  memcpy (str, &loc->sh_mem_ptr[position+1], size);
+  str [size] = '\0';
+  ip2loc_pool.block_used += size + 1;
+  ip2loc_pool.strings [ip2loc_pool.num] = str;
+  return (ip2loc_pool.num++);
+}
+
+/**
+ * Grow the string-pool hash-table to `size` slots and rehash into it.
+ */
+static bool ip2loc_pool_rehash (uint32_t size)
+{
+  uint32_t *pos = calloc (size, sizeof(*pos));
+  uint32_t *id  = calloc (size, sizeof(*id));
+  uint32_t  i, j;
+
+  if (!pos || !id)
+  {
+    free (pos);
+    free (id);
+    return (false);
+  }
+
+  for (i = 0; i < ip2loc_pool.hash_size; i++)
+  {
+    if (!ip2loc_pool.hash_pos[i])
+       continue;
+    j = (ip2loc_pool.hash_pos[i] * 2654435761U) & (size - 1);
+    while (pos[j])
+       j = (j + 1) & (size - 1);
+    pos[j] = ip2loc_pool.hash_pos[i];
+    id[j]  = ip2loc_pool.hash_id[i];
+  }
+  free (ip2loc_pool.hash_pos);
+  free (ip2loc_pool.hash_id);
+  ip2loc_pool.hash_pos  = pos;
+  ip2loc_pool.hash_id   = id;
+  ip2loc_pool.hash_size = size;
+  return (true);
+}
+
+/**
+ * Return the id in `ip2loc_pool.strings` for the string at file `position`.
+ * Adding it if not already there.
  */
-bool ip2loc_get_ipv4_entry (const struct in_addr *addr, struct ip2loc_entry *out)
+static uint32_t ip2loc_pool_add (IP2Location *loc, uint32_t position)
+{
+  uint32_t key = position + 1;
+  uint32_t i, id;
+
+  if (ip2loc_pool.num == 0)
+  {
+    /* Id 0 is "". Used for any error too.
+     */
+    ip2loc_pool.strings = malloc (1024 * sizeof(*ip2loc_pool.strings));
+    if (!ip2loc_pool.strings)
+       return (0);
+    ip2loc_pool.strings[0] = "";
+    ip2loc_pool.max = 1024;
+    ip2loc_pool.num = 1;
+  }
+
+  if (2 * (ip2loc_pool.hash_used + 1) > ip2loc_pool.hash_size &&
+      !ip2loc_pool_rehash(ip2loc_pool.hash_size ? 2 * ip2loc_pool.hash_size : 4096))
+     return (0);
+
+  i = (key * 2654435761U) & (ip2loc_pool.hash_size - 1);
+  while (ip2loc_pool.hash_pos[i])
+  {
+    if (ip2loc_pool.hash_pos[i] == key)
+       return (ip2loc_pool.hash_id[i]);
+    i = (i + 1) & (ip2loc_pool.hash_size - 1);
+  }
+
+  id = ip2loc_pool_append (loc, position);
+  if (id == 0)
+     return (0);
+
+  ip2loc_pool.hash_pos[i] = key;
+  ip2loc_pool.hash_id[i]  = id;
+  ip2loc_pool.hash_used++;
+  return (id);
+}
+
+/**
+ * Free the hash-table of the string-pool.
+ */
+static void ip2loc_pool_hash_free (void)
+{
+  free (ip2loc_pool.hash_pos);
+  free (ip2loc_pool.hash_id);
+  ip2loc_pool.hash_pos  = ip2loc_pool.hash_id = NULL;
+  ip2loc_pool.hash_size = ip2loc_pool.hash_used = 0;
+}
+
+/**
+ * Free the string-pool and all it's blocks.
+ */
+static void ip2loc_pool_free (void)
+{
+  char *block, *prev;
+
+  for (block = ip2loc_pool.block; block; block = prev)
+  {
+    prev = *(char**) block;
+    free (block);
+  }
+  ip2loc_pool_hash_free();
+  free ((void*)ip2loc_pool.strings);
+  memset (&ip2loc_pool, '\0', sizeof(ip2loc_pool));
+}
+
+/**
+ * Return the number of bytes used by the string-pool.
+ */
+static size_t ip2loc_pool_bytes (void)
+{
+  return (ip2loc_pool.bytes + ip2loc_pool.max * sizeof(char*) +
+          ip2loc_pool.hash_size * 2 * sizeof(uint32_t));
+}
+
+/**
+ * Convert an IPv6-address on network order to a `ip2loc_u128`.
+ */
+static void ip2loc_u128_set (struct ip2loc_u128 *u, const struct in6_addr *addr)
+{
+  int i;
+
+  u->hi = u->lo = 0;
+  for (i = 0; i < 8; i++)
+  {
+    u->hi = (u->hi << 8) | addr->u.Byte[i];
+    u->lo = (u->lo << 8) | addr->u.Byte[i+8];
+  }
+}
+
+static bool ip2loc_u128_less_eq (const struct ip2loc_u128 *a, const struct ip2loc_u128 *b)
+{
+  return (a->hi < b->hi || (a->hi == b->hi && a->lo <= b->lo));
+}
+
+/**
+ * Free the decoded rows of one address-family.
+ */
+static void ip2loc_decode_free (struct ip2loc_decoded *dec)
+{
+  free (dec->from4);
+  free (dec->from6);
+  free (dec->index);
+  free (dec->country);
+  free (dec->region);
+  free (dec->city);
+  free (dec->latitude);
+  free (dec->longitude);
+  memset (dec, '\0', sizeof(*dec));
+}
+
+/**
+ * Free all decoded rows. The strings in `ip2loc_pool` are kept.
+ */
+static void ip2loc_decode_exit (void)
+{
+  ip2loc_decode_free (&ip2loc_dec4);
+  ip2loc_decode_free (&ip2loc_dec6);
+}
+
+/**
+ * Return the number of bytes used by the decoded rows of one address-family.
+ */
+static size_t ip2loc_decode_bytes (const struct ip2loc_decoded *dec)
+{
+  size_t size;
+
+  if (dec->num == 0)
+     return (0);
+
+  size = (dec->num + 1) * (dec->from4 ? sizeof(*dec->from4) : sizeof(*dec->from6));
+  size += 3 * dec->num * sizeof(uint32_t);
+  if (dec->index)
+     size += 2 * 65536 * sizeof(*dec->index);
+  if (dec->latitude)
+     size += 2 * dec->num * sizeof(float);
+  return (size);
+}
+
+/**
+ * Decode the rows of one address-family from the shared-memory into `*dec`.
+ * Every field is read with the bounds-checked `IP2Location_read*()` functions
+ * here; but never again in `ip2loc_decoded_find4()` or `ip2loc_decoded_find6()`.
+ */
+static bool ip2loc_decode_family (IP2Location *loc, int family, struct ip2loc_decoded *dec)
+{
+  uint8_t  dbtype   = loc->db_type;
+  uint32_t baseaddr = (family == AF_INET) ? loc->ipv4_db_addr       : loc->ipv6_db_addr;
+  uint32_t num      = (family == AF_INET) ? loc->ipv4_db_count      : loc->ipv6_db_count;
+  uint32_t index    = (family == AF_INET) ? loc->ipv4_index_db_addr : loc->ipv6_index_db_addr;
+  uint32_t column   = loc->db_column * 4 + (family == AF_INET6 ? 12 : 0);
+  uint32_t skip     = (family == AF_INET6 ? 12 : 0);
+  bool     has_pos  = (LATITUDE_POSITION[dbtype] && LONGITUDE_POSITION[dbtype]);
+  uint32_t i;
+
+  memset (dec, '\0', sizeof(*dec));
+  if (num == 0)
+     return (true);
+
+  if (family == AF_INET)
+       dec->from4 = malloc ((num + 1) * sizeof(*dec->from4));
+  else dec->from6 = malloc ((num + 1) * sizeof(*dec->from6));
+
+  dec->country = calloc (num, sizeof(*dec->country));
+  dec->region  = calloc (num, sizeof(*dec->region));
+  dec->city    = calloc (num, sizeof(*dec->city));
+  if (index > 0)
+     dec->index = malloc (2 * 65536 * sizeof(*dec->index));
+  if (has_pos)
+  {
+    dec->latitude  = malloc (num * sizeof(*dec->latitude));
+    dec->longitude = malloc (num * sizeof(*dec->longitude));
+  }
+
+  if ((!dec->from4 && !dec->from6) || !dec->country || !dec->region || !dec->city ||
+      (index > 0 && !dec->index) || (has_pos && (!dec->latitude || !dec->longitude)))
+  {
+    ip2loc_decode_free (dec);
+    return (false);
+  }
+
+  /* Row `num` is only used for the `ipto` of the last row.
+   * Use the top of the address-space if it's not there.
+   */
+  for (i = 0; i <= num; i++)
+  {
+    if (family == AF_INET)
+    {
+      dec->from4[i] = IP2Location_read32 (loc, baseaddr + i * column);
+      if (i == num && dec->from4[i] <= dec->from4[i-1])
+         dec->from4[i] = (uint32_t) MAX_IPV4_RANGE;
+    }
+    else
+    {
+      struct in6_addr addr;
+
+      IP2Location_read_ipv6_addr (loc, baseaddr + i * column, &addr);
+      ip2loc_u128_set (&dec->from6[i], &addr);
+      if (i == num && ip2loc_u128_less_eq(&dec->from6[i], &dec->from6[i-1]))
+         dec->from6[i].hi = dec->from6[i].lo = ~(uint64)0;
+    }
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    uint32_t row = baseaddr + i * column + skip;
+
+    if (COUNTRY_POSITION[dbtype])
+       dec->country[i] = ip2loc_pool_add (loc, IP2Location_read32 (loc, row + 4 * (COUNTRY_POSITION[dbtype]-1)));
+    if (REGION_POSITION[dbtype])
+       dec->region[i] = ip2loc_pool_add (loc, IP2Location_read32 (loc, row + 4 * (REGION_POSITION[dbtype]-1)));
+    if (CITY_POSITION[dbtype])
+       dec->city[i] = ip2loc_pool_add (loc, IP2Location_read32 (loc, row + 4 * (CITY_POSITION[dbtype]-1)));
+    if (has_pos)
+    {
+      dec->latitude[i]  = IP2Location_read_float (loc, row + 4 * (LATITUDE_POSITION[dbtype]-1));
+      dec->longitude[i] = IP2Location_read_float (loc, row + 4 * (LONGITUDE_POSITION[dbtype]-1));
+    }
+  }
+
+  for (i = 0; index > 0 && i < 65536; i++)
+  {
+    dec->index [2*i]   = IP2Location_read32 (loc, index + (i << 3));
+    dec->index [2*i+1] = IP2Location_read32 (loc, index + (i << 3) + 4);
+  }
+  dec->num = num;
+  return (true);
+}
+
+/**
+ * Decode the whole .BIN-file into `ip2loc_dec4`, `ip2loc_dec6` and `ip2loc_pool`.
+ * Called from `ip2loc_init()` if `g_cfg.GEOIP.ip2location_decode` is set,
+ * or from `ip2loc_bench()`.
+ */
+static bool ip2loc_decode (IP2Location *loc)
+{
+  double start = get_timestamp_now();
+
+  if (loc->db_type >= DIM(COUNTRY_POSITION))
+  {
+    TRACE (1, "Unsupported IP2Location db_type: %u.\n", loc->db_type);
+    return (false);
+  }
+
+  if (!ip2loc_decode_family(loc, AF_INET, &ip2loc_dec4) ||
+      !ip2loc_decode_family(loc, AF_INET6, &ip2loc_dec6))
+  {
+    TRACE (1, "Failed to allocate memory for the decoded IP2Location rows.\n");
+    ip2loc_decode_exit();
+    return (false);
+  }
+
+  /* The hash-table is not needed if the shared-memory is never used again
+   */
+  if (g_cfg.GEOIP.ip2location_decode)
+     ip2loc_pool_hash_free();
+
+  TRACE (2, "Decoded %s IPv4 and %s IPv6 rows in %.3f msec. Memory: %s + %s bytes strings.\n",
+         dword_str(ip2loc_dec4.num), dword_str(ip2loc_dec6.num),
+         (get_timestamp_now() - start) / 1E3,
+         qword_str(ip2loc_decode_bytes(&ip2loc_dec4) + ip2loc_decode_bytes(&ip2loc_dec6)),
+         qword_str(ip2loc_pool_bytes()));
+  return (true);
+}
+
+/**
+ * Return the decoded row + 1 for the IPv4-number `ipno` (on host order).
+ * Or 0 if not found.
+ */
+static uint32_t ip2loc_decoded_find4 (const struct ip2loc_decoded *dec, uint32_t ipno)
+{
+  uint32_t low = 0, high = dec->num - 1;
+
+  if (dec->num == 0)
+     return (0);
+
+  if (ipno == (uint32_t)MAX_IPV4_RANGE)
+     ipno -= 1;
+
+  if (dec->index)
+  {
+    low  = dec->index [2*(ipno >> 16)];
+    high = min (dec->index [2*(ipno >> 16) + 1], dec->num - 1);
+    if (low > high)
+       return (0);
+  }
+
+  /* Find the last row in [low..high] starting at or below `ipno`.
+   */
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low + 1) / 2;
+
+    num_4_loops++;
+    if (dec->from4[mid] <= ipno)
+         low  = mid;
+    else high = mid - 1;
+  }
+  if (dec->from4[low] <= ipno && ipno < dec->from4[low+1])
+     return (low + 1);
+  return (0);
+}
+
+/**
+ * As above, but for the IPv6-number `ipno`.
+ */
+static uint32_t ip2loc_decoded_find6 (const struct ip2loc_decoded *dec, const struct in6_addr *addr)
+{
+  struct ip2loc_u128 ipno;
+  uint32_t low = 0, high = dec->num - 1;
+
+  if (dec->num == 0)
+     return (0);
+
+  ip2loc_u128_set (&ipno, addr);
+
+  if (dec->index)
+  {
+    uint32_t ipnum1 = (uint32_t) (ipno.hi >> 48);
+
+    low  = dec->index [2*ipnum1];
+    high = min (dec->index [2*ipnum1 + 1], dec->num - 1);
+    if (low > high)
+       return (0);
+  }
+
+  while (low < high)
+  {
+    uint32_t mid = low + (high - low + 1) / 2;
+
+    num_6_loops++;
+    if (ip2loc_u128_less_eq(&dec->from6[mid], &ipno))
+         low  = mid;
+    else high = mid - 1;
+  }
+  if (ip2loc_u128_less_eq(&dec->from6[low], &ipno) &&
+      !ip2loc_u128_less_eq(&dec->from6[low+1], &ipno))
+     return (low + 1);
+  return (0);
+}
+
+/**
+ * Set the `fields` of the decoded `row` in `*res` like `IP2Location_read_result()` does.
+ */
+static void ip2loc_decoded_result (const struct ip2loc_decoded *dec, uint32_t row, DWORD fields, struct ip2loc_result *res)
+{
+  if (fields & IP2LOC_COUNTRY)
+     res->country_short = ip2loc_pool.strings [dec->country[row]];
+
+  if (fields & IP2LOC_REGION)
+     res->region = ip2loc_pool.strings [dec->region[row]];
+
+  if (fields & IP2LOC_CITY)
+     res->city = ip2loc_pool.strings [dec->city[row]];
+
+  if (fields & IP2LOC_POSITION)
+  {
+    res->latitude  = dec->latitude  ? dec->latitude [row]  : 0.0F;
+    res->longitude = dec->longitude ? dec->longitude [row] : 0.0F;
+  }
+  res->fields |= fields;
+}
+
+/**
+ * Look up an IPv4-number (on host order) in the decoded rows or the shared-memory.
+ */
+static bool ip2loc_lookup4 (uint32_t ipno, bool decoded, DWORD fields, struct ip2loc_result *res)
 {
   ipv_t parsed_ipv;
 
-  parsed_ipv.ip_ver = 4;
-  parsed_ipv.ipv4   = _byteswap_ulong (addr->s_addr);
+  num_4_loops = 0;
 
-  memset (out, '\0', sizeof(*out));
-  if (!IP2Location_get_ipv4_record(ip2loc_handle, lookup_flags, parsed_ipv, out))
-     return (false);
+  if (decoded)
+  {
+    uint32_t row = ip2loc_decoded_find4 (&ip2loc_dec4, ipno);
 
-  TRACE (3, "Record for IPv4-number %s; country_short: \"%.2s\", num_4_loops: %lu.\n",
-         INET_util_get_ip_num(addr, NULL), out->country_short, num_4_loops);
-  return (out->country_short[0] != '\0' && out->country_short[1] != '\0');
+    if (row == 0)
+       return (false);
+    ip2loc_decoded_result (&ip2loc_dec4, row - 1, fields, res);
+    return (true);
+  }
+  parsed_ipv.ip_ver = 4;
+  parsed_ipv.ipv4   = ipno;
+  return IP2Location_get_ipv4_record (ip2loc_handle, fields, parsed_ipv, res);
 }
 
 /**
- * This avoids the call to `inet_pton()` since the passed
- * `addr` should be a valid IPv6-address.
+ * As above, but for an IPv6-address.
  */
-bool ip2loc_get_ipv6_entry (const struct in6_addr *addr, struct ip2loc_entry *out)
+static bool ip2loc_lookup6 (const struct in6_addr *addr, bool decoded, DWORD fields, struct ip2loc_result *res)
 {
   ipv_t parsed_ipv;
 
-  if (IN6_IS_ADDR_V4MAPPED(addr))
+  num_6_loops = 0;
+
+  if (decoded)
   {
-    parsed_ipv.ip_ver = 4;
-    parsed_ipv.ipv4   = *(const uint32_t*) addr;
+    uint32_t row = ip2loc_decoded_find6 (&ip2loc_dec6, addr);
+
+    if (row == 0)
+       return (false);
+    ip2loc_decoded_result (&ip2loc_dec6, row - 1, fields, res);
+    return (true);
   }
-  else
+  parsed_ipv.ip_ver = 6;
+  memcpy (&parsed_ipv.ipv6, addr, sizeof(parsed_ipv.ipv6));
+  return IP2Location_get_ipv6_record (ip2loc_handle, fields, parsed_ipv, res);
+}
+
+/**
+ * Look up the `fields` of an IPv4-address.
+ *
+ * Only the `IP2LOC_x` fields asked for are set in `*res`; the others are left
+ * untouched. The strings point into the string-pool and are valid until
+ * `ip2loc_exit()`. So nothing is copied.
+ *
+ * This avoids the call to `inet_pton()` since the passed `addr`
+ * should be a valid IPv4-address.
+ *
+ * \retval true  if found. And with `IP2LOC_COUNTRY`, if the country-code has 2 letters.
+ */
+bool ip2loc_lookup_ipv4 (const struct in_addr *addr, DWORD fields, struct ip2loc_result *res)
+{
+  if (!ip2loc_handle || !ip2loc_lookup4(_byteswap_ulong(addr->s_addr), ip2loc_dec4.num > 0, fields, res))
+     return (false);
+
+  if (!(fields & IP2LOC_COUNTRY))
+     return (true);
+
+  TRACE (3, "Record for IPv4-number %s; country_short: \"%.2s\", num_4_loops: %lu.\n",
+         INET_util_get_ip_num(addr, NULL), res->country_short, num_4_loops);
+  return (res->country_short[0] != '\0' && res->country_short[1] != '\0');
+}
+
+/**
+ * As above, but for an IPv6-address.
+ *
+ * An IPv4-mapped address is looked up as the IPv4-address in it's last 4 bytes.
+ */
+bool ip2loc_lookup_ipv6 (const struct in6_addr *addr, DWORD fields, struct ip2loc_result *res)
+{
+  if (IN6_IS_ADDR_V4MAPPED(addr))
   {
-    parsed_ipv.ip_ver = 6;
-    memcpy (&parsed_ipv.ipv6, addr, sizeof(parsed_ipv.ipv6));
+    struct in_addr ip4;
+
+    memcpy (&ip4, &addr->u.Byte[12], sizeof(ip4));
+    return ip2loc_lookup_ipv4 (&ip4, fields, res);
   }
 
-  memset (out, '\0', sizeof(*out));
-  if (!IP2Location_get_ipv6_record(ip2loc_handle, lookup_flags, parsed_ipv, out))
+  if (!ip2loc_handle || !ip2loc_lookup6(addr, ip2loc_dec6.num > 0, fields, res))
      return (false);
 
+  if (!(fields & IP2LOC_COUNTRY))
+     return (true);
+
   TRACE (3, "Record for IPv6-number %s; country_short: \"%.2s\", num_6_loops: %lu.\n",
-         INET_util_get_ip_num(NULL, (const struct in6_addr*)&parsed_ipv.ipv6),
-         out->country_short, num_6_loops);
-  return (out->country_short[0] != '\0' && out->country_short[1] != '\0');
+         INET_util_get_ip_num(NULL, addr), res->country_short, num_6_loops);
+  return (res->country_short[0] != '\0' && res->country_short[1] != '\0');
+}
+
+/**
+ * Compare the lookup-speed of the shared-memory rows against the decoded rows
+ * on `num` addresses of `family`. Called from the `bench_addr4()` and
+ * `bench_addr6()` functions in geoip.c.
+ *
+ * If `g_cfg.GEOIP.ip2location_decode` is not set, the rows are decoded here
+ * and freed again afterwards.
+ */
+void ip2loc_bench (int family, const void **addresses, int num)
+{
+  const struct ip2loc_decoded *dec = (family == AF_INET) ? &ip2loc_dec4 : &ip2loc_dec6;
+  const DWORD fields = IP2LOC_COUNTRY | IP2LOC_REGION | IP2LOC_CITY | IP2LOC_POSITION;
+  struct ip2loc_result r1, r2;
+  bool   temp_decode = false;
+  DWORD  found, mismatch = 0;
+  double start, usec;
+  int    pass, i;
+
+  if (!ip2loc_handle || (family == AF_INET ? ip2loc_handle->ipv4_db_count : ip2loc_handle->ipv6_db_count) == 0)
+     return;
+
+  if (ip2loc_dec4.num == 0 && ip2loc_dec6.num == 0)
+  {
+    start = get_timestamp_now();
+    if (!ip2loc_decode(ip2loc_handle))
+    {
+      C_printf ("Failed to decode the IP2Location rows.\n");
+      return;
+    }
+    C_printf ("IP2Location rows decoded in %.3f msec.\n", (get_timestamp_now() - start) / 1E3);
+    temp_decode = true;
+  }
+
+  C_printf ("IP2Location %s benchmark; %s rows:\n",
+            family == AF_INET ? "IPv4" : "IPv6", dword_str(dec->num));
+
+  for (pass = 0; pass < 2; pass++)
+  {
+    start = get_timestamp_now();
+    for (i = found = 0; i < num; i++)
+    {
+      bool ok;
+
+      if (family == AF_INET)
+           ok = ip2loc_lookup4 (_byteswap_ulong(((const struct in_addr*)addresses[i])->s_addr), pass, fields, &r1);
+      else ok = ip2loc_lookup6 (addresses[i], pass, fields, &r1);
+      if (ok)
+         found++;
+    }
+    usec = get_timestamp_now() - start;
+    C_printf ("  %-12s %12.0f lookups/sec, %.3f usec/lookup, found: %s.\n",
+              pass ? "decoded:" : "shared-mem:", usec > 0.0 ? (1E6 * num) / usec : 0.0,
+              usec / num, dword_str(found));
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    bool ok1, ok2;
+
+    memset (&r1, '\0', sizeof(r1));
+    memset (&r2, '\0', sizeof(r2));
+    if (family == AF_INET)
+    {
+      uint32_t ipno = _byteswap_ulong (((const struct in_addr*)addresses[i])->s_addr);
+
+      ok1 = ip2loc_lookup4 (ipno, false, fields, &r1);
+      ok2 = ip2loc_lookup4 (ipno, true, fields, &r2);
+    }
+    else
+    {
+      ok1 = ip2loc_lookup6 (addresses[i], false, fields, &r1);
+      ok2 = ip2loc_lookup6 (addresses[i], true, fields, &r2);
+    }
+    if (ok1 != ok2)
+       mismatch++;
+    else if (ok1 &&
+             (strcmp(r1.country_short, r2.country_short) || strcmp(r1.city, r2.city) ||
+              strcmp(r1.region, r2.region) ||
+              r1.latitude != r2.latitude || r1.longitude != r2.longitude))
+       mismatch++;
+  }
+
+  C_printf ("  %s mismatches. Decoded memory: %s bytes rows + %s bytes strings.\n",
+            dword_str(mismatch), qword_str(ip2loc_decode_bytes(dec)), qword_str(ip2loc_pool_bytes()));
+
+  if (temp_decode)
+     ip2loc_decode_exit();
 }
 
 /**
@@ -16,7 +16,6 @@
 
 #include "common.h"
 #include "init.h"
-#include "smartlist.h"
 #include "overlap.h"
 
 #undef  TRACE
@@ -31,10 +30,27 @@
           }                                             \
         } while (0)
 
+#define OV_TRACE_ON()  (g_cfg.trace_overlap >= 1 && g_cfg.trace_level >= g_cfg.trace_overlap)
+
 func_WSAGetOverlappedResult  p_WSAGetOverlappedResult = NULL;
 
 static char ov_trace_buf [200];
 
+/**
+ * \enum ov_index
+ * The hash-indices a `struct overlapped` is linked into.
+ */
+enum ov_index {
+     OV_BY_KEY = 0,    /**< On the socket and `WSAOVERLAPPED*`; for `overlap_recall()` */
+     OV_BY_EVENT,      /**< On the event; for `overlap_recall_all()` */
+     OV_BY_SOCK,       /**< On the socket; for `overlap_remove()` */
+     OV_INDICES
+   };
+
+#define OV_CHUNK        256   /**< Number of `struct overlapped` in each pool-chunk */
+#define OV_MIN_BUCKETS  64    /**< Initial number of buckets in each index */
+#define OV_HIST_BINS    24    /**< Latency bins; `< 1 usec`, `< 2 usec`, ... `>= 2^22 usec` */
+
 /** \struct overlapped
  *
  * Structure for remembering a socket and an overlapped structure.
@@ -60,34 +76,230 @@ struct overlapped {
        SOCKET         sock;
        WSAEVENT       event;
        WSAOVERLAPPED *ov;
+
+       /**
+        * `QueryPerformanceCounter()` when it was stored.
+        */
+       int64 start;
+
+       /**
+        * The chains of each `ov_index`. A free entry is
+        * on the `ov_free` list using `next [OV_BY_KEY]`.
+        */
+       struct overlapped *next [OV_INDICES];
+       struct overlapped *prev [OV_INDICES];
      };
 
-static smartlist_t *ov_list;       /**< The dynamic list of `struct overlapped` */
-static DWORD        num_overlaps;  /**< Number of overlapped operations pending */
+/** \struct ov_chunk
+ * The pool of `struct overlapped` is allocated in chunks and
+ * never freed before `overlap_exit()`.
+ */
+struct ov_chunk {
+       struct ov_chunk  *next;
+       struct overlapped entry [OV_CHUNK];
+     };
+
+static struct ov_chunk    *ov_chunks;                /**< All allocated chunks */
+static struct overlapped  *ov_free;                  /**< The free entries */
+static struct overlapped **ov_bucket [OV_INDICES];   /**< The bucket-heads of each index */
+static DWORD               ov_buckets;               /**< Number of buckets in each index; a power of 2 */
+static DWORD               ov_pending;               /**< Number of overlapped operations pending */
+static DWORD               num_overlaps;             /**< Number of overlapped operations stored */
+static uint64              ov_hist [2][OV_HIST_BINS];/**< Completion latencies; `[0]` for send, `[1]` for recv */
+
+static DWORD ov_hash (uint64 a, uint64 b)
+{
+  uint64 h = ((a * 0x9E3779B97F4A7C15ULL) ^ b) * 0x9E3779B97F4A7C15ULL;
+
+  return (DWORD) (h >> 32) & (ov_buckets - 1);
+}
+
+static DWORD ov_hash_of (const struct overlapped *ov, int idx)
+{
+  switch (idx)
+  {
+    case OV_BY_KEY:
+         return ov_hash (ov->sock, (uintptr_t)ov->ov);
+    case OV_BY_EVENT:
+         return ov_hash ((uintptr_t)ov->event, 0);
+    default:
+         return ov_hash (ov->sock, 0);
+  }
+}
+
+static void ov_link (struct overlapped *ov)
+{
+  int idx;
+
+  for (idx = 0; idx < OV_INDICES; idx++)
+  {
+    struct overlapped **head = ov_bucket[idx] + ov_hash_of (ov, idx);
+
+    ov->prev [idx] = NULL;
+    ov->next [idx] = *head;
+    if (*head)
+       (*head)->prev [idx] = ov;
+    *head = ov;
+  }
+}
+
+static void ov_unlink (struct overlapped *ov)
+{
+  int idx;
+
+  for (idx = 0; idx < OV_INDICES; idx++)
+  {
+    if (ov->prev[idx])
+         ov->prev[idx]->next [idx] = ov->next [idx];
+    else ov_bucket[idx] [ov_hash_of(ov, idx)] = ov->next [idx];
+
+    if (ov->next[idx])
+       ov->next[idx]->prev [idx] = ov->prev [idx];
+  }
+}
+
+/**
+ * Allocate the bucket-heads of all indices with `size` buckets
+ * and re-link the entries in the old ones.
+ */
+static bool ov_rehash (DWORD size)
+{
+  struct overlapped **old = ov_bucket [OV_BY_KEY];
+  struct overlapped **new_bucket [OV_INDICES];
+  struct overlapped  *ov, *next;
+  DWORD  i, old_size = ov_buckets;
+  int    idx;
+
+  for (idx = 0; idx < OV_INDICES; idx++)
+  {
+    new_bucket [idx] = calloc (size, sizeof(*new_bucket[idx]));
+    if (!new_bucket[idx])
+    {
+      while (--idx >= 0)
+         free (new_bucket[idx]);
+      return (false);
+    }
+  }
+
+  for (idx = 1; idx < OV_INDICES; idx++)
+  {
+    free (ov_bucket[idx]);
+    ov_bucket [idx] = new_bucket [idx];
+  }
+  ov_bucket [OV_BY_KEY] = new_bucket [OV_BY_KEY];
+  ov_buckets = size;
+
+  for (i = 0; i < old_size; i++)
+  {
+    for (ov = old[i]; ov; ov = next)
+    {
+      next = ov->next [OV_BY_KEY];
+      ov_link (ov);
+    }
+  }
+  free (old);
+  return (true);
+}
+
+/**
+ * Get a `struct overlapped` from the pool; add a chunk if it's empty.
+ */
+static struct overlapped *ov_alloc (void)
+{
+  struct overlapped *ov;
+
+  if (!ov_free)
+  {
+    struct ov_chunk *chunk = malloc (sizeof(*chunk));
+    int    i;
+
+    if (!chunk)
+       return (NULL);
+
+    chunk->next = ov_chunks;
+    ov_chunks = chunk;
+    for (i = OV_CHUNK - 1; i >= 0; i--)
+    {
+      chunk->entry[i].next [OV_BY_KEY] = ov_free;
+      ov_free = chunk->entry + i;
+    }
+  }
+  ov = ov_free;
+  ov_free = ov->next [OV_BY_KEY];
+  return (ov);
+}
+
+/**
+ * Unlink `ov` from all indices and put it back in the pool.
+ */
+static void ov_release (struct overlapped *ov)
+{
+  ov_unlink (ov);
+  ov->next [OV_BY_KEY] = ov_free;
+  ov_free = ov;
+  ov_pending--;
+}
+
+/**
+ * Find the operation for socket `s` and overlapped pointer `o`.
+ * If `is_recv >= 0`, it must also match that.
+ */
+static struct overlapped *ov_find (SOCKET s, const WSAOVERLAPPED *o, int is_recv)
+{
+  struct overlapped *ov;
+
+  if (ov_buckets == 0)
+     return (NULL);
+
+  for (ov = ov_bucket[OV_BY_KEY] [ov_hash(s, (uintptr_t)o)]; ov; ov = ov->next[OV_BY_KEY])
+  {
+    if (ov->ov == o && ov->sock == s && (is_recv < 0 || ov->is_recv == is_recv))
+       return (ov);
+  }
+  return (NULL);
+}
+
+/**
+ * Add the completion latency of `ov` to the histogram.
+ */
+static void ov_hist_add (const struct overlapped *ov)
+{
+  LARGE_INTEGER now;
+  uint64        usec;
+  int           bin = 0;
+
+  QueryPerformanceCounter (&now);
+  usec = (uint64) (now.QuadPart - ov->start) / (g_data.clocks_per_usec ? g_data.clocks_per_usec : 1);
+
+  while (usec > 0 && bin < OV_HIST_BINS - 1)
+  {
+    usec >>= 1;
+    bin++;
+  }
+  ov_hist [ov->is_recv] [bin]++;
+}
 
 /**
  * \li Report any non-completed overlapped operations.
- * \li Free the memory allocated for the overlapped list.
+ * \li Free the memory allocated for the overlapped pool and indices.
  * \li Called from `wsock_trace_exit()`.
  */
 void overlap_exit (void)
 {
   struct overlapped *ov;
-  int    i, max;
+  DWORD  i;
+  int    idx;
 
-  if (!ov_list)
+  if (!ov_bucket[OV_BY_KEY])
      return;
 
-  max = smartlist_len (ov_list);
-  if (max >= 1)
+  if (ov_pending >= 1)
   {
-    TRACE ("%d overlapped transfers not completed:\n", max);
-    for (i = 0; i < max; i++)
-    {
-      ov = smartlist_get (ov_list, i);
-      TRACE ("  o: 0x%p, event: 0x%p, sock: %u, is_recv: %d, bytes: %lu\n",
-             ov->ov, ov->event, SOCKET_CAST(ov->sock), ov->is_recv, ov->bytes);
-    }
+    TRACE ("%lu overlapped transfers not completed:\n", ov_pending);
+    for (i = 0; i < ov_buckets; i++)
+       for (ov = ov_bucket[OV_BY_KEY][i]; ov; ov = ov->next[OV_BY_KEY])
+           TRACE ("  o: 0x%p, event: 0x%p, sock: %u, is_recv: %d, bytes: %lu\n",
+                  ov->ov, ov->event, SOCKET_CAST(ov->sock), ov->is_recv, ov->bytes);
   }
   else if (num_overlaps)
   {
@@ -95,41 +307,58 @@ void overlap_exit (void)
      */
     TRACE ("All overlapped transfers completed.\n");
   }
-  num_overlaps = 0;
-  smartlist_wipe (ov_list, free);
-  ov_list = NULL;
+  num_overlaps = ov_pending = 0;
+
+  for (idx = 0; idx < OV_INDICES; idx++)
+  {
+    free (ov_bucket[idx]);
+    ov_bucket [idx] = NULL;
+  }
+  ov_buckets = 0;
+
+  while (ov_chunks)
+  {
+    struct ov_chunk *next = ov_chunks->next;
+
+    free (ov_chunks);
+    ov_chunks = next;
+  }
+  ov_free = NULL;
 }
 
 /**
  * Initialiser for overlapped operations.
- * Just create the dynamic list.
+ * Just create the indices; the pool is allocated on first use.
  */
 void overlap_init (void)
 {
-  ov_list = smartlist_new();
+  memset (&ov_hist, '\0', sizeof(ov_hist));
+  num_overlaps = ov_pending = 0;
+  ov_rehash (OV_MIN_BUCKETS);
 }
 
 /**
  * Trace an overlapped operation:
- * \li if `i == -1`, trace all elements in the list.
- * \li if `i != -1`, trace the element with index `i`.
+ * \li if `ov == NULL`, trace all pending operations.
+ * \li if `ov != NULL`, trace this operation.
  */
-static void overlap_trace (int i, const struct overlapped *ov)
+static void overlap_trace (const struct overlapped *ov)
 {
-  if (i == -1)
-  {
-    int max = smartlist_len (ov_list);
+  DWORD i;
 
-    for (i = 0; i < max; i++)
-    {
-      ov = smartlist_get (ov_list, i);
-      TRACE ("ov_list[%d]: is_recv: %d, event: 0x%p, sock: %u\n",
-             i, ov->is_recv, ov->event, (unsigned)ov->sock);
-    }
+  if (!OV_TRACE_ON())
+     return;
+
+  if (ov)
+  {
+    TRACE ("ov: 0x%p, is_recv: %d, event: 0x%p, sock: %u\n",
+           ov->ov, ov->is_recv, ov->event, SOCKET_CAST(ov->sock));
+    return;
   }
-  else
-    TRACE ("ov_list[%d]: is_recv: %d, event: 0x%p, sock: %u\n",
-           i, ov->is_recv, ov->event, SOCKET_CAST(ov->sock));
+  for (i = 0; i < ov_buckets; i++)
+     for (ov = ov_bucket[OV_BY_KEY][i]; ov; ov = ov->next[OV_BY_KEY])
+         TRACE ("ov: 0x%p, is_recv: %d, event: 0x%p, sock: %u\n",
+                ov->ov, ov->is_recv, ov->event, SOCKET_CAST(ov->sock));
 }
 
 /**
@@ -143,71 +372,74 @@ static void overlap_trace (int i, const struct overlapped *ov)
  */
 void overlap_store (SOCKET s, WSAOVERLAPPED *o, DWORD num_bytes, bool is_recv)
 {
-  struct overlapped *ov = NULL;
-  int    i, max = smartlist_len (ov_list);
-  bool   modify = false;
+  struct overlapped *ov;
+  LARGE_INTEGER      now;
 
   TRACE ("o: 0x%p,  event: 0x%p, sock: %u\n",
          o, o ? o->hEvent : NULL, SOCKET_CAST(s));
 
-  for (i = 0; i < max; i++)
-  {
-    ov = smartlist_get (ov_list, i);
-    if (ov->ov == o && ov->sock == s && ov->is_recv == is_recv)
-    {
-      modify = true;
-      break;
-    }
-  }
+  if (ov_buckets == 0)
+     return;
 
-  if (!modify)
+  ov = ov_find (s, o, is_recv);
+  if (ov)
+     ov_unlink (ov);   /* the event could be another */
+  else
   {
-    ov = malloc (sizeof(*ov));
+    if (ov_pending >= ov_buckets)
+       ov_rehash (2 * ov_buckets);
+
+    ov = ov_alloc();
     if (!ov)
        return;
     ov->is_recv = is_recv;
     ov->sock    = s;
     ov->ov      = o;
-    smartlist_add (ov_list, ov);
     num_overlaps++;
+    ov_pending++;
   }
 
+  QueryPerformanceCounter (&now);
+  ov->start = now.QuadPart;
   ov->event = o ? o->hEvent : NULL;
   ov->bytes = num_bytes;
-  overlap_trace (-1, NULL);
+  ov_link (ov);
+  overlap_trace (NULL);
 }
 
 /**
  * Try to update all overlapped operations matching this event.
+ * Only the operations on this event are looked at, and only those
+ * completed are asked for the result.
  */
-void overlap_recall_all (const WSAEVENT *event)
+void overlap_recall_all (WSAEVENT event)
 {
-  int i;
+  struct overlapped *ov, *next;
+
+  if (ov_buckets == 0 || !p_WSAGetOverlappedResult)
+     return;
 
-  for (i = 0; i < smartlist_len(ov_list); i++)
+  for (ov = ov_bucket[OV_BY_EVENT] [ov_hash((uintptr_t)event, 0)]; ov; ov = next)
   {
-    const struct overlapped *ov = smartlist_get (ov_list, i);
     DWORD bytes = 0;
     bool  rc    = false;
 
-    if (p_WSAGetOverlappedResult && ov->event == event)
+    next = ov->next [OV_BY_EVENT];   /* 'ov' could be released below */
+    if (ov->event != event)
+       continue;
+
+    if (HasOverlappedIoCompleted(ov->ov))
     {
       ENTER_CRIT();
       rc = (*p_WSAGetOverlappedResult) (ov->sock, ov->ov, &bytes, 0, NULL);
       LEAVE_CRIT (0);
-
-      if (rc)
-      {
-        /* This could reduce 'smartlist_len(ov_list)' by 1.
-         */
-        overlap_recall (ov->sock, ov->ov, bytes);
-      }
     }
-    if (i < smartlist_len(ov_list))
-       TRACE ("ov_list[%d]: event: 0x%p, is_recv: %d, rc: %d, got %lu bytes.\n",
-              i, ov->event, ov->is_recv, rc, bytes);
-    else
-      TRACE ("ov_list[%d]: is_recv: %d, was recalled.\n", i, ov->is_recv);
+
+    TRACE ("ov: 0x%p, event: 0x%p, is_recv: %d, rc: %d, got %lu bytes.\n",
+           ov->ov, ov->event, ov->is_recv, rc, bytes);
+
+    if (rc)
+       overlap_recall (ov->sock, ov->ov, bytes);
   }
 }
 
@@ -220,60 +452,79 @@ void overlap_recall_all (const WSAEVENT *event)
  */
 void overlap_recall (SOCKET s, const WSAOVERLAPPED *o, DWORD bytes)
 {
-  int i, max = smartlist_len (ov_list);
+  struct overlapped *ov = ov_find (s, o, -1);
 
-  for (i = 0; i < max; i++)
-  {
-    struct overlapped *ov = smartlist_get (ov_list, i);
-
-    overlap_trace (i, ov);
+  if (!ov)
+     return;
 
-    if (ov->ov != o || ov->sock != s)
-       continue;
+  overlap_trace (ov);
 
-    if (ov->is_recv)
-    {
-      g_data.counts.recv_bytes += bytes;
-      TRACE ("ov_list[%d]: room for %lu bytes, got %lu bytes.\n", i, ov->bytes, bytes);
-    }
-    else
-    {
-      g_data.counts.send_bytes += bytes;
-      TRACE ("ov_list[%d]: sent %lu bytes, actual sent %lu bytes.\n", i, ov->bytes, bytes);
-    }
-    free (ov);
-    smartlist_del (ov_list, i);
-    break;
+  if (ov->is_recv)
+  {
+    g_data.counts.recv_bytes += bytes;
+    sock_list_count (s, bytes, 0);
+    TRACE ("ov: 0x%p, room for %lu bytes, got %lu bytes.\n", o, ov->bytes, bytes);
   }
+  else
+  {
+    g_data.counts.send_bytes += bytes;
+    sock_list_count (s, 0, bytes);
+    TRACE ("ov: 0x%p, sent %lu bytes, actual sent %lu bytes.\n", o, ov->bytes, bytes);
+  }
+  ov_hist_add (ov);
+  ov_release (ov);
 }
 
 /**
- * Remove an overlap entry matching socket `s`.
+ * Remove all overlap entries matching socket `s`.
  */
 void overlap_remove (SOCKET s)
 {
-  int i, max;
+  struct overlapped *ov, *next;
 
   /* This if-test should not be needed. It would mean 'closesocket()' was called
    * after 'wsock_trace_exit()'.
    */
-  if (!ov_list)
+  if (ov_buckets == 0)
      return;
 
-  max = smartlist_len (ov_list);
-  for (i = 0; i < max; i++)
+  for (ov = ov_bucket[OV_BY_SOCK] [ov_hash(s, 0)]; ov; ov = next)
   {
-    struct overlapped *ov = smartlist_get (ov_list, i);
+    next = ov->next [OV_BY_SOCK];
+    if (ov->sock == s)
+       ov_release (ov);
+  }
+  overlap_trace (NULL);
+}
+
+/**
+ * Print the histograms of completion latencies.
+ * Called from `trace_report()`.
+ */
+void overlap_report (void)
+{
+  char  label [30];
+  int   bin;
 
-    if (ov->sock != s)
+  if (num_overlaps == 0)
+     return;
+
+  C_printf ("\n  Overlapped completions:      %10s  %10s\n", "recv", "send");
+  for (bin = 0; bin < OV_HIST_BINS; bin++)
+  {
+    if (ov_hist[1][bin] == 0 && ov_hist[0][bin] == 0)
        continue;
 
-    free (ov);
-    smartlist_del (ov_list, i);
-    max--;
-    i--;
+    if (bin == OV_HIST_BINS - 1)
+         snprintf (label, sizeof(label), ">= %s usec:", qword_str(1ULL << (bin-1)));
+    else snprintf (label, sizeof(label), "<  %s usec:", qword_str(1ULL << bin));
+
+    C_printf ("    %-26s", label);
+    C_printf ("%10s", qword_str(ov_hist[1][bin]));
+    C_printf ("  %10s\n", qword_str(ov_hist[0][bin]));
   }
-  overlap_trace (-1, NULL);
+  if (ov_pending > 0)
+     C_printf ("    Not completed: %lu\n", ov_pending);
 }
 
 /**
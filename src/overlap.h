@@ -18,8 +18,9 @@ extern void  overlap_exit (void);
 
 extern void  overlap_store (SOCKET s, WSAOVERLAPPED *ov, DWORD num_bytes, bool is_recv);
 extern void  overlap_recall (SOCKET s, const WSAOVERLAPPED *ov, DWORD bytes);
-extern void  overlap_recall_all (const WSAEVENT *ev);
+extern void  overlap_recall_all (WSAEVENT ev);
 extern void  overlap_remove (SOCKET s);
+extern void  overlap_report (void);
 extern bool  overlap_transferred (SOCKET s, const WSAOVERLAPPED *ov, DWORD *transferred);
 extern char *overlap_trace_buf (void);
 
@@ -0,0 +1,689 @@
+/**\file    path_cache.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A hash-table of file-names and a value for each.
+ *
+ * Used by `shorten_path()` in common.c to cache the true casing of the
+ * file-names in a stack-trace. That is called for every traced caller;
+ * a lookup is O(1) regardless of the number of file-names seen.
+ *
+ * An open-addressing table with linear probing. A slot holds the 64-bit
+ * hash of the key and a pointer to the entry; the key is compared in full
+ * only when the hashes are equal. Entries are never removed until
+ * `path_cache_free()`; hence a returned value stays valid until then.
+ *
+ * The memory used (entries and slots) is bounded by `max_bytes` given to
+ * `path_cache_new()`. When that is reached, `path_cache_add()` returns
+ * `NULL` and the caller must do without the cache.
+ *
+ * This file has no Windows specific code except for the lock.
+ * Build and run the benchmark on e.g. Linux with:
+ * ```
+ *   gcc -O2 -DPATH_CACHE_TEST -pthread -o path_cache_test path_cache.c
+ *   ./path_cache_test [paths] [linear-paths]
+ * ```
+ *
+ * path_cache.c - Part of Wsock-Trace.
+ */
+#if defined(PATH_CACHE_TEST)
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #if defined(_WIN32)
+    #include <windows.h>
+  #else
+    #include <pthread.h>
+    #include <time.h>
+  #endif
+#else
+  #include "common.h"
+#endif
+
+#include "path_cache.h"
+
+#if defined(_WIN32)
+  typedef CRITICAL_SECTION path_lock;
+
+  #define PATH_LOCK_INIT(l)  InitializeCriticalSectionAndSpinCount (l, 1000)
+  #define PATH_LOCK_FREE(l)  DeleteCriticalSection (l)
+  #define PATH_LOCK(l)       EnterCriticalSection (l)
+  #define PATH_UNLOCK(l)     LeaveCriticalSection (l)
+#else
+  typedef pthread_mutex_t path_lock;
+
+  #define PATH_LOCK_INIT(l)  pthread_mutex_init (l, NULL)
+  #define PATH_LOCK_FREE(l)  pthread_mutex_destroy (l)
+  #define PATH_LOCK(l)       pthread_mutex_lock (l)
+  #define PATH_UNLOCK(l)     pthread_mutex_unlock (l)
+#endif
+
+#define PATH_CACHE_MIN_SIZE  64     /* Initial number of slots */
+
+/**\struct path_entry
+ * An entry; followed by the 0-terminated key and value.
+ */
+struct path_entry {
+       size_t      key_len;
+       const char *value;
+     };
+
+/**\struct path_slot
+ * A slot; a free one has `entry == NULL`.
+ */
+struct path_slot {
+       uint64_t           hash;
+       struct path_entry *entry;
+     };
+
+struct path_cache {
+       path_lock         lock;
+       struct path_slot *slot;
+       uint32_t          size;      /**< A power of 2; or 0 until the first add */
+       uint32_t          used;      /**< At most `size / 2` */
+       size_t            bytes;     /**< Memory used by entries and slots */
+       size_t            max_bytes;
+       bool              full;      /**< An add was refused for lack of `max_bytes` */
+     };
+
+/**
+ * Hash `len` bytes of `key`; 8 bytes at a time.
+ */
+static uint64_t path_hash (const char *key, size_t len)
+{
+  uint64_t h = 0x9E3779B97F4A7C15ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+  uint64_t w;
+
+  while (len >= sizeof(w))
+  {
+    memcpy (&w, key, sizeof(w));
+    h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 32;
+    key += sizeof(w);
+    len -= sizeof(w);
+  }
+  if (len > 0)
+  {
+    w = 0;
+    memcpy (&w, key, len);
+    h = (h ^ w) * 0xFF51AFD7ED558CCDULL;
+  }
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return (h);
+}
+
+static const char *entry_key (const struct path_entry *e)
+{
+  return (const char*) (e + 1);
+}
+
+/**
+ * Return the index of `key` in `tab`; or the index of the free
+ * slot where it should be added.
+ */
+static uint32_t path_find (const path_cache *tab, const char *key, size_t len, uint64_t hash)
+{
+  uint32_t mask = tab->size - 1;
+  uint32_t i    = (uint32_t) (hash >> 32) & mask;
+
+  while (tab->slot[i].entry)
+  {
+    const struct path_entry *e = tab->slot[i].entry;
+
+    if (tab->slot[i].hash == hash && e->key_len == len && !memcmp(entry_key(e), key, len))
+       break;
+    i = (i + 1) & mask;
+  }
+  return (i);
+}
+
+/**
+ * Double the size of `tab` (or allocate the first slots) and
+ * re-insert the used slots.
+ */
+static bool path_grow (path_cache *tab)
+{
+  struct path_slot *old = tab->slot;
+  uint32_t          old_size = tab->size;
+  uint32_t          size = old_size ? 2 * old_size : PATH_CACHE_MIN_SIZE;
+  uint32_t          i, j;
+
+  tab->slot = calloc (size, sizeof(*tab->slot));
+  if (!tab->slot)
+  {
+    tab->slot = old;
+    return (false);
+  }
+  tab->size   = size;
+  tab->bytes += (size - old_size) * sizeof(*tab->slot);
+
+  for (i = 0; i < old_size; i++)
+  {
+    if (!old[i].entry)
+       continue;
+    j = (uint32_t) (old[i].hash >> 32) & (size - 1);
+    while (tab->slot[j].entry)
+          j = (j + 1) & (size - 1);
+    tab->slot[j] = old[i];
+  }
+  free (old);
+  return (true);
+}
+
+/**
+ * Create a table using at most `max_bytes` (approximately).
+ */
+path_cache *path_cache_new (size_t max_bytes)
+{
+  path_cache *tab = calloc (1, sizeof(*tab));
+
+  if (!tab)
+     return (NULL);
+  PATH_LOCK_INIT (&tab->lock);
+  tab->max_bytes = max_bytes;
+  return (tab);
+}
+
+void path_cache_free (path_cache *tab)
+{
+  uint32_t i;
+
+  if (!tab)
+     return;
+  for (i = 0; i < tab->size; i++)
+      free (tab->slot[i].entry);
+  free (tab->slot);
+  PATH_LOCK_FREE (&tab->lock);
+  free (tab);
+}
+
+/**
+ * Return the value for `key`; or `NULL` if not found.
+ */
+const char *path_cache_get (path_cache *tab, const char *key)
+{
+  size_t      len  = strlen (key);
+  uint64_t    hash = path_hash (key, len);
+  const char *value = NULL;
+
+  PATH_LOCK (&tab->lock);
+  if (tab->used > 0)
+  {
+    uint32_t i = path_find (tab, key, len, hash);
+
+    if (tab->slot[i].entry)
+       value = tab->slot[i].entry->value;
+  }
+  PATH_UNLOCK (&tab->lock);
+  return (value);
+}
+
+/**
+ * Add `key` with a copy of `value`.
+ * Return the value in the table. If another thread added `key` first,
+ * that value is returned.
+ *
+ * Returns `NULL` if out of memory or `max_bytes` is used.
+ */
+const char *path_cache_add (path_cache *tab, const char *key, const char *value)
+{
+  struct path_entry *e;
+  size_t             len = strlen (key);
+  size_t             v_len = strlen (value);
+  size_t             e_size = sizeof(*e) + len + 1 + v_len + 1;
+  size_t             need;
+  bool               grow;
+  uint64_t           hash = path_hash (key, len);
+  const char        *ret = NULL;
+  uint32_t           i;
+
+  PATH_LOCK (&tab->lock);
+
+  if (tab->used > 0)
+  {
+    i = path_find (tab, key, len, hash);
+    if (tab->slot[i].entry)
+    {
+      ret = tab->slot[i].entry->value;
+      goto quit;
+    }
+  }
+
+  grow = (2 * (tab->used + 1) > tab->size);
+  need = e_size;
+  if (grow)
+     need += (tab->size ? tab->size : PATH_CACHE_MIN_SIZE) * sizeof(*tab->slot);
+
+  if (tab->bytes + need > tab->max_bytes)
+  {
+    tab->full = true;
+    goto quit;
+  }
+  if (grow && !path_grow(tab))
+     goto quit;
+
+  e = malloc (e_size);
+  if (!e)
+     goto quit;
+
+  e->key_len = len;
+  memcpy ((char*)(e + 1), key, len + 1);
+  e->value = memcpy ((char*)(e + 1) + len + 1, value, v_len + 1);
+
+  i = path_find (tab, key, len, hash);
+  tab->slot[i].hash  = hash;
+  tab->slot[i].entry = e;
+  tab->used++;
+  tab->bytes += e_size;
+  ret = e->value;
+
+quit:
+  PATH_UNLOCK (&tab->lock);
+  return (ret);
+}
+
+/**
+ * Return `true` if an add was refused since `max_bytes` is used.
+ * A caller can then skip computing a value that will not be added.
+ */
+bool path_cache_full (path_cache *tab)
+{
+  bool full;
+
+  PATH_LOCK (&tab->lock);
+  full = tab->full;
+  PATH_UNLOCK (&tab->lock);
+  return (full);
+}
+
+size_t path_cache_len (path_cache *tab)
+{
+  size_t len;
+
+  PATH_LOCK (&tab->lock);
+  len = tab->used;
+  PATH_UNLOCK (&tab->lock);
+  return (len);
+}
+
+size_t path_cache_bytes (path_cache *tab)
+{
+  size_t bytes;
+
+  PATH_LOCK (&tab->lock);
+  bytes = tab->bytes;
+  PATH_UNLOCK (&tab->lock);
+  return (bytes);
+}
+
+/**
+ * Call `func` for each entry in slot-order; with the lock held.
+ */
+void path_cache_foreach (path_cache *tab, path_cache_func func, void *arg)
+{
+  uint32_t i;
+
+  PATH_LOCK (&tab->lock);
+  for (i = 0; i < tab->size; i++)
+  {
+    const struct path_entry *e = tab->slot[i].entry;
+
+    if (e)
+       (*func) (entry_key(e), e->value, tab->slot[i].hash, arg);
+  }
+  PATH_UNLOCK (&tab->lock);
+}
+
+#if defined(PATH_CACHE_TEST)
+/*
+ * A benchmark and a check of the above.
+ *
+ * 1) Add `test_paths` distinct file-names, look them all up in a random
+ *    order and check the values. The same with a linear list of CRC32
+ *    values (like the old `fname_list` in common.c) of `test_linear` names.
+ *
+ * 2) Check that a table with a small `max_bytes` stops adding, but still
+ *    finds what was added.
+ */
+#define TEST_LOOKUPS  10   /* number of lookups of each name */
+
+static uint32_t      test_paths  = 10000;
+static uint32_t      test_linear = 10000;
+static volatile long test_errors;
+
+static void test_error (const char *what, const char *key)
+{
+  if (++test_errors <= 10)
+     printf ("Error: %s for '%s'.\n", what, key);
+}
+
+static uint32_t test_rand (uint32_t *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 8);
+}
+
+/*
+ * Like the lower-cased `Line.FileName` from `SymGetLineFromAddr64()`.
+ */
+static void test_path (char *buf, size_t size, uint32_t num)
+{
+  snprintf (buf, size, "c:\\program files (x86)\\windows kits\\10\\source\\dir%03u\\file%05u.c",
+            num % 97, num);
+}
+
+static void test_value (char *buf, size_t size, uint32_t num)
+{
+  snprintf (buf, size, "c:/Program Files (x86)/Windows Kits/10/Source/Dir%03u/File%05u.c",
+            num % 97, num);
+}
+
+/*
+ * Make all the keys and values up-front; not to time the `snprintf()` calls.
+ */
+static char **test_keys, **test_values;
+
+static bool test_make (uint32_t num)
+{
+  char     buf [200];
+  uint32_t i;
+
+  test_keys   = calloc (num, sizeof(char*));
+  test_values = calloc (num, sizeof(char*));
+  if (!test_keys || !test_values)
+     return (false);
+
+  for (i = 0; i < num; i++)
+  {
+    test_path (buf, sizeof(buf), i);
+    test_keys[i] = strdup (buf);
+    test_value (buf, sizeof(buf), i);
+    test_values[i] = strdup (buf);
+    if (!test_keys[i] || !test_values[i])
+       return (false);
+  }
+  return (true);
+}
+
+static uint32_t *test_shuffle (uint32_t num, uint32_t seed)
+{
+  uint32_t *order = malloc (num * sizeof(*order));
+  uint32_t  i, j, tmp;
+
+  if (!order)
+     return (NULL);
+  for (i = 0; i < num; i++)
+      order[i] = i;
+  for (i = num; i > 1; i--)
+  {
+    j = test_rand (&seed) % i;
+    tmp = order[i-1];
+    order[i-1] = order[j];
+    order[j] = tmp;
+  }
+  return (order);
+}
+
+#if defined(_WIN32)
+  static double test_now (void)
+  {
+    LARGE_INTEGER now, freq;
+
+    QueryPerformanceCounter (&now);
+    QueryPerformanceFrequency (&freq);
+    return (double) now.QuadPart / (double) freq.QuadPart;
+  }
+#else
+  static double test_now (void)
+  {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1E9;
+  }
+#endif
+
+static void test_report (const char *what, uint32_t num, double start)
+{
+  double sec = test_now() - start;
+
+  printf ("  %-22s %8u ops, %8.3f msec, %7.1f nsec/op\n",
+          what, num, 1E3 * sec, num ? 1E9 * sec / num : 0.0);
+}
+
+/*
+ * Part 1 with the hash-table.
+ */
+static void test_single (void)
+{
+  path_cache *tab = path_cache_new ((size_t)-1);
+  uint32_t   *order = test_shuffle (test_paths, 1);
+  char        key [200];
+  const char *found;
+  uint32_t    i, j;
+  double      start;
+
+  if (!tab || !order)
+  {
+    test_error ("alloc", "");
+    goto quit;
+  }
+
+  printf ("Hash-table, %u paths:\n", test_paths);
+
+  start = test_now();
+  for (i = 0; i < test_paths; i++)
+      if (!path_cache_add(tab, test_keys[i], test_values[i]))
+         test_error ("add", test_keys[i]);
+  test_report ("path_cache_add():", test_paths, start);
+
+  if (path_cache_len(tab) != test_paths)
+     test_error ("len", "");
+
+  start = test_now();
+  for (j = 0; j < TEST_LOOKUPS; j++)
+  {
+    for (i = 0; i < test_paths; i++)
+    {
+      found = path_cache_get (tab, test_keys[order[i]]);
+      if (!found || (j == 0 && strcmp(found, test_values[order[i]])))
+         test_error ("get", test_keys[order[i]]);
+    }
+  }
+  test_report ("path_cache_get():", TEST_LOOKUPS * test_paths, start);
+
+  /* A key not added; a prefix and an extension of an added one.
+   */
+  strcpy (key, test_keys[0]);
+  key [strlen(key)-1] = '\0';
+  if (path_cache_get(tab, key))
+     test_error ("get of prefix", key);
+  strcat (key, "cc");
+  if (path_cache_get(tab, key))
+     test_error ("get of extension", key);
+
+  /* A 2nd add of the same key keeps the 1st value.
+   */
+  found = path_cache_add (tab, test_keys[1], "other");
+  if (!found || strcmp(found, test_values[1]))
+     test_error ("re-add", test_keys[1]);
+
+  printf ("  %u entries, %u kB.\n", (unsigned)path_cache_len(tab), (unsigned)(path_cache_bytes(tab) / 1024));
+
+quit:
+  free (order);
+  path_cache_free (tab);
+}
+
+/*
+ * Part 1 with a linear list of CRC32 values.
+ */
+#define CRC_BITS    32
+#define CRC_HIBIT   ((uint32_t) (1L << (CRC_BITS-1)))
+#define CRC_SHIFTS  (CRC_BITS-8)
+#define CRC_PRZ     0x864CFBL
+
+struct test_linear_entry {
+       const char *value;
+       uint32_t    crc32;
+     };
+
+static uint32_t crc_table [256];
+
+static void mk_crctbl (uint32_t poly, uint32_t *tab)
+{
+  uint32_t *p = tab;
+  uint32_t *q = tab;
+  int       i;
+
+  *q++ = 0;
+  *q++ = poly;
+  for (i = 1; i < 128; i++)
+  {
+    uint32_t t = *(++p);
+
+    if (t & CRC_HIBIT)
+    {
+      t <<= 1;
+      *q++ = t ^ poly;
+      *q++ = t;
+    }
+    else
+    {
+      t <<= 1;
+      *q++ = t;
+      *q++ = t ^ poly;
+    }
+  }
+}
+
+static uint32_t crc_bytes (const char *buf, size_t len)
+{
+  uint32_t accum;
+
+  for (accum = 0; len > 0; len--)
+      accum = (accum << 8) ^ crc_table[(uint8_t)(accum >> CRC_SHIFTS) ^ (uint8_t)*buf++];
+  return (accum);
+}
+
+static void test_single_linear (void)
+{
+  struct test_linear_entry *list = calloc (test_linear, sizeof(*list));
+  uint32_t *order = test_shuffle (test_linear, 1);
+  uint32_t  i, j, crc32;
+  double    start;
+
+  if (!list || !order)
+  {
+    test_error ("alloc", "");
+    goto quit;
+  }
+
+  mk_crctbl (CRC_PRZ, crc_table);
+  printf ("Linear CRC32-list, %u paths:\n", test_linear);
+
+  start = test_now();
+  for (i = 0; i < test_linear; i++)
+  {
+    list[i].crc32 = crc_bytes (test_keys[i], strlen(test_keys[i]));
+    list[i].value = test_values[i];
+  }
+  test_report ("add:", test_linear, start);
+
+  start = test_now();
+  for (i = 0; i < test_linear; i++)
+  {
+    const char *key = test_keys [order[i]];
+
+    crc32 = crc_bytes (key, strlen(key));
+    for (j = 0; j < test_linear; j++)
+        if (list[j].crc32 == crc32)
+           break;
+    if (j == test_linear)
+       test_error ("linear get", key);
+  }
+  test_report ("get:", test_linear, start);
+
+quit:
+  free (list);
+  free (order);
+}
+
+/*
+ * Part 2.
+ */
+static void test_bounded (void)
+{
+  size_t      max_bytes = 64 * 1024;
+  path_cache *tab = path_cache_new (max_bytes);
+  uint32_t    i, added = 0;
+
+  if (!tab)
+  {
+    test_error ("alloc", "");
+    return;
+  }
+
+  printf ("Hash-table, max %u kB:\n", (unsigned)(max_bytes / 1024));
+
+  for (i = 0; i < test_paths; i++)
+  {
+    if (!path_cache_add(tab, test_keys[i], test_values[i]))
+       break;
+    added++;
+  }
+  if (added == 0 || added == test_paths)
+     test_error ("bounded add", "");
+  if (!path_cache_full(tab))
+     test_error ("not full", "");
+  if (path_cache_bytes(tab) > max_bytes)
+     test_error ("too many bytes", "");
+
+  for (i = 0; i < added; i++)
+      if (!path_cache_get(tab, test_keys[i]))
+         test_error ("bounded get", test_keys[i]);
+
+  printf ("  %u entries, %u bytes.\n", added, (unsigned)path_cache_bytes(tab));
+  path_cache_free (tab);
+}
+
+int main (int argc, char **argv)
+{
+  uint32_t i, num;
+
+  if (argc > 1)
+     test_paths = (uint32_t) atol (argv[1]);
+  if (argc > 2)
+     test_linear = (uint32_t) atol (argv[2]);
+
+  if (test_paths < 2 || test_linear < 1)
+  {
+    printf ("Use at least 2 paths.\n");
+    return (1);
+  }
+
+  num = (test_paths > test_linear) ? test_paths : test_linear;
+  if (!test_make(num))
+  {
+    printf ("Out of memory.\n");
+    return (1);
+  }
+
+  test_single();
+  test_single_linear();
+  test_bounded();
+
+  for (i = 0; i < num; i++)
+  {
+    free (test_keys[i]);
+    free (test_values[i]);
+  }
+  free (test_keys);
+  free (test_values);
+
+  printf ("%s: %ld errors.\n", test_errors ? "FAILED" : "OKAY", test_errors);
+  return (test_errors ? 1 : 0);
+}
+#endif  /* PATH_CACHE_TEST */
@@ -0,0 +1,33 @@
+/**\file    path_cache.h
+ * \ingroup Main
+ *
+ * \brief
+ *   A hash-table mapping a file-name to another (e.g. the true casing of it).
+ */
+#ifndef _PATH_CACHE_H
+#define _PATH_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Opaque struct; defined in path_cache.c
+ */
+typedef struct path_cache path_cache;
+
+/**
+ * The callback for `path_cache_foreach()`.
+ */
+typedef void (*path_cache_func) (const char *key, const char *value, uint64_t hash, void *arg);
+
+extern path_cache *path_cache_new     (size_t max_bytes);
+extern void        path_cache_free    (path_cache *tab);
+extern const char *path_cache_get     (path_cache *tab, const char *key);
+extern const char *path_cache_add     (path_cache *tab, const char *key, const char *value);
+extern bool        path_cache_full    (path_cache *tab);
+extern size_t      path_cache_len     (path_cache *tab);
+extern size_t      path_cache_bytes   (path_cache *tab);
+extern void        path_cache_foreach (path_cache *tab, path_cache_func func, void *arg);
+
+#endif  /* _PATH_CACHE_H */
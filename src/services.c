@@ -84,11 +84,48 @@ struct service_entry {
        uint16_t  file_bits;            /**< which `g_cfg.services_file[]` is this entry from? */
      };
 
+/**
+ * \struct service_port
+ * A slot in `services_ports[]` for one port. Compiled from `services_list`
+ * by `services_compile()`.
+ */
+struct service_port {
+       uint8_t  protos;   /**< A bitset of all `PROTO_x` on this port. 0 if no entry */
+       uint8_t  multi;    /**< The protocols have different names; see `services_multi[]` */
+       uint16_t index;    /**< The index into `services_multi[]` if `multi` */
+       uint32_t name;     /**< The offset in `services_names` of the name */
+     };
+
+/**
+ * \struct service_multi
+ * The name-offsets for each protocol on a port where the protocols
+ * have different names. Like `512/tcp` = `exec` and `512/udp` = `biff`.
+ */
+struct service_multi {
+       uint32_t name [5];  /**< Indexed by `proto_index()` */
+     };
+
 /**
  * The smartlist of services entries.
  */
 static smartlist_t *services_list;
 
+/**
+ * The port-indexed table of `65536` slots; compiled from `services_list`.
+ */
+static struct service_port *services_ports;
+
+/**
+ * The names of all services separated by a `'\0'`.
+ */
+static char *services_names;
+
+/**
+ * The ports with different names for different protocols.
+ */
+static struct service_multi *services_multi;
+static int                   services_num_multi;
+
 /**
  * The current services file we are parsing. <br>
  * In range `[0 ... DIM(g_cfg.services_file)-1]` == [0 ... 2].
@@ -105,11 +142,6 @@ static bool copy_file_bits = false;
  */
 static int services_duplicates;
 
-/**
- * The filled structure from `fill_servent()`.
- */
-static struct servent ret_fill_servent;
-
 /**
  * Add an entry to the given `smartlist_t` that becomes `services_list`.
  */
@@ -210,21 +242,6 @@ static int services_compare_port_proto (const void **_a, const void **_b)
   return (rc);
 }
 
-/**
- * `smartlist_bsearch()` helper.
- * Compare on port. Then on protocol if it's given.
- */
-static int services_bsearch_port_proto (const void *key, const void **member)
-{
-  const struct service_entry *se     = *member;
-  const struct service_entry *lookup = key;
-  int   rc = (int)lookup->port - (int)se->port;
-
-  if (rc == 0 && (lookup->proto & PROTO_UNKNOWN) == 0)
-     rc = compare_proto (lookup->proto, se->proto);
-  return (rc);
-}
-
 #define _STR2(x) #x
 #define _STR(x)  _STR2(x)
 
@@ -309,13 +326,151 @@ static void services_file_dump (void)
   }
 }
 
+/**
+ * Return the index for a single `PROTO_x` bit; 1 - 4.
+ * Or 0 for `PROTO_UNKNOWN`.
+ */
+static int proto_index (int proto)
+{
+  switch (proto)
+  {
+    case PROTO_UDP:
+         return (1);
+    case PROTO_TCP:
+         return (2);
+    case PROTO_DCCP:
+         return (3);
+    case PROTO_SCTP:
+         return (4);
+  }
+  return (0);
+}
+
+/**
+ * Free the tables made by `services_compile()`.
+ */
+static void services_compile_free (void)
+{
+  free (services_ports);
+  free (services_names);
+  free (services_multi);
+  services_ports = NULL;
+  services_names = NULL;
+  services_multi = NULL;
+  services_num_multi = 0;
+}
+
+/**
+ * Compile the sorted and unique `services_list` into `services_ports[]`,
+ * `services_names` and `services_multi[]`.
+ *
+ * Looking up a port is then just a few loads in `services_lookup()`
+ * instead of a `smartlist_bsearch()`.
+ */
+static void services_compile (void)
+{
+  int    i, j, max = smartlist_len (services_list);
+  size_t names_len = 0;
+
+  for (i = 0; i < max; i++)
+  {
+    const struct service_entry *se = smartlist_get (services_list, i);
+
+    names_len += strlen (se->name) + 1;
+  }
+
+  services_ports = calloc (65536, sizeof(*services_ports));
+  services_names = malloc (names_len + 1);
+  services_multi = calloc (max + 1, sizeof(*services_multi));
+  if (!services_ports || !services_names || !services_multi)
+  {
+    services_compile_free();
+    return;
+  }
+
+  names_len = 0;
+  for (i = 0; i < max; i++)
+  {
+    const struct service_entry *se = smartlist_get (services_list, i);
+    struct service_port        *sp = services_ports + se->port;
+    uint32_t                    name = (uint32_t) names_len;
+
+    strcpy (services_names + names_len, se->name);
+    names_len += strlen (se->name) + 1;
+
+    if (sp->protos == 0)
+    {
+      sp->protos = (uint8_t) se->proto;
+      sp->name   = name;
+      continue;
+    }
+
+    /* Another entry with other protocols on this port.
+     * If the names are the same, just add the protocols.
+     */
+    if (!sp->multi && !strcmp(services_names + sp->name, se->name))
+    {
+      sp->protos |= se->proto;
+      continue;
+    }
+
+    if (!sp->multi)
+    {
+      struct service_multi *sm = services_multi + services_num_multi;
+
+      for (j = 0; j < DIM(sm->name); j++)
+          sm->name[j] = sp->name;
+      sp->multi = 1;
+      sp->index = (uint16_t) services_num_multi++;
+    }
+
+    for (j = 1; j < DIM(services_multi->name); j++)
+        if (se->proto & (1 << j))
+           services_multi [sp->index].name[j] = name;
+
+    /* For an ANY protocol lookup, TCP ranks highest.
+     */
+    if (se->proto & PROTO_TCP)
+       sp->name = name;
+    sp->protos |= se->proto;
+  }
+
+  TRACE (2, "Compiled %d services entries; %d ports with names per protocol. Names: %s bytes.\n",
+         max, services_num_multi, dword_str((DWORD)names_len));
+}
+
+/**
+ * Return the name of the service on `port` (on host order) for `proto`.
+ * Or any protocol if `proto == PROTO_UNKNOWN`.
+ */
+static const char *services_lookup (uint16_t port, int proto)
+{
+  const struct service_port *sp;
+
+  if (!services_ports)
+     return (NULL);
+
+  sp = services_ports + port;
+  if (proto == PROTO_UNKNOWN)
+     return (sp->protos ? services_names + sp->name : NULL);
+
+  if (!(sp->protos & proto))
+     return (NULL);
+
+  if (!sp->multi)
+     return (services_names + sp->name);
+  return (services_names + services_multi[sp->index].name [proto_index(proto)]);
+}
+
 /**
  * Free the memory in `services_list` and free the list itself.
+ * And free the compiled tables.
  */
 void services_file_exit (void)
 {
   smartlist_wipe (services_list, free);
   services_list = NULL;
+  services_compile_free();
 }
 
 /**
@@ -359,69 +514,69 @@ void services_file_init (void)
   copy_file_bits = true;
   services_duplicates = smartlist_make_uniq (services_list, services_compare_port_proto, free);
   copy_file_bits = false;
+  services_compile();
 }
 
 /**
- * Convert a `struct service_entry*` to a `struct servent*`.
- * Does not support aliases.
+ * Fill the caller's `struct servent`.
+ * The `s_name` points into `services_names` and `s_proto` into `protocol_list[]`.
+ * Hence nothing is copied. Does not support aliases.
  */
-static __inline const struct servent *fill_servent (const struct service_entry *se, int protocol)
+static __inline const struct servent *fill_servent (struct servent *se, const char *name, uint16_t port, int protocol)
 {
-  static char  name [MAX_SERV_LEN];
-  static char  proto [MAX_PROTO_LEN];
   static char *null_aliases [1] = { NULL };
-  const char  *proto_ret;
 
   if (protocol == PROTO_UNKNOWN)
-       proto_ret = NULL;
-  else proto_ret = str_ncpy (proto, list_lookup_name(protocol, protocol_list, DIM(protocol_list)), sizeof(proto));
-
-  ret_fill_servent.s_name    = str_ncpy (name, se->name, sizeof(name));
-  ret_fill_servent.s_proto   = (char*) proto_ret;
-  ret_fill_servent.s_aliases = null_aliases;
-  ret_fill_servent.s_port    = swap16 (se->port);
-  return (&ret_fill_servent);
+       se->s_proto = NULL;
+  else se->s_proto = (char*) list_lookup_name (protocol, protocol_list, DIM(protocol_list));
+
+  se->s_name    = (char*) name;
+  se->s_aliases = null_aliases;
+  se->s_port    = swap16 (port);
+  return (se);
 }
 
 /**
- * The internal `getservbyport()` function that does a
- * binary search in the `services_list`.
+ * The internal `getservbyport()` function that looks up the
+ * compiled `services_ports[]` table.
  *
- * \param[in] port        the port on network that we'll search the name for.
- * \param[in] protocol    the optional protocol name to look for.
- * \param[in] fallback    call the Winsock function `getservbyport()` if this
- *                        function fails to find a match.
- * \param[in] do_wstrace  true when this function is called from services_run_tests().
+ * \param[in]  port        the port on network that we'll search the name for.
+ * \param[in]  protocol    the optional protocol name to look for.
+ * \param[in]  fallback    call the Winsock function `getservbyport()` if this
+ *                         function fails to find a match.
+ * \param[in]  do_wstrace  true when this function is called from services_run_tests().
+ * \param[out] buf         the caller's storage for the result. Since this
+ *                         function can be called from several threads at once.
+ *
+ * \retval `buf`, the result of Winsock's `getservbyport()` or NULL.
  */
-const struct servent *ws_getservbyport (uint16_t port, const char *protocol, bool fallback, bool do_wstrace)
+const struct servent *ws_getservbyport (uint16_t port, const char *protocol, bool fallback, bool do_wstrace,
+                                        struct servent *buf)
 {
   const struct servent *ret = NULL;
-  const struct service_entry *se = NULL;
-  struct service_entry lookup;
-
-  lookup.port  = swap16 (port);
-  lookup.proto = protocol ? encode_proto_str(protocol, false) : PROTO_UNKNOWN;
+  const char *name = NULL;
+  int   proto = protocol ? encode_proto_str(protocol, false) : PROTO_UNKNOWN;
 
   /**
    * Give up if:
    *  \li We're asked to lookup a service-name for a protocol we do not support.
-   *  \li Or `services_list == NULL` (malloc failed) or no services file.
+   *  \li Or `services_ports == NULL` (malloc failed) or no services file.
    *
    *  but possibly ask Winsock about it.
    */
-  if (protocol && lookup.proto == PROTO_UNKNOWN)
+  if (protocol && proto == PROTO_UNKNOWN)
        TRACE (3, "Unknown protocol: '%s'.\n", protocol);
-  else if (!services_list || g_cfg.num_services_files == 0)
+  else if (!services_ports || g_cfg.num_services_files == 0)
        TRACE (3, "No services file(s).\n");
-  else se = smartlist_bsearch (services_list, &lookup, services_bsearch_port_proto);
+  else name = services_lookup (swap16(port), proto);
 
-  if (se)
-     ret = fill_servent (se, lookup.proto);
+  if (name)
+     ret = fill_servent (buf, name, swap16(port), proto);
 
   /* if not found, do the fallback to `getservbyport()`?
    * But we cannot call it after a `WSACleanup()` has been done.
    */
-  if (!se && fallback && !cleaned_up)
+  if (!name && fallback && !cleaned_up)
   {
     if (!do_wstrace)
        C_level_save_restore (0);
@@ -432,12 +587,11 @@ const struct servent *ws_getservbyport (uint16_t port, const char *protocol, boo
   return (ret);
 }
 
-
 struct test_table {
        const char *service;
        uint16_t    port;
        const char *protocol;
-       void       *expect;
+       bool        expect;   /**< expect it in our services file(s) */
      };
 
 /**
@@ -448,19 +602,53 @@ struct test_table {
  * ```
  */
 static const struct test_table services_tests[] = {
-                 { "bgp",   179,  "tcp",  &ret_fill_servent },
-                 { "bgp",   179,  "udp",  &ret_fill_servent },
-                 { "bgp",   179,  "sctp", &ret_fill_servent },
-                 { "bgp",   179,  "dccp", NULL              },
-                 { "bgp",   179,  NULL,   &ret_fill_servent },   /* the ANY protocol case */
-                 { "bgp",   179,  "geek", NULL              },   /* the unknown protocol case */
-                 { "exp2", 1022,  "udp",  &ret_fill_servent },
-                 { "exp2", 1022,  "tcp",  &ret_fill_servent },
-                 { "exp2", 1022,  "dccp", &ret_fill_servent },
-                 { "exp2", 1022,  "sctp", &ret_fill_servent },
-                 { "exp2", 1022,  NULL,   &ret_fill_servent }
+                 { "bgp",   179,  "tcp",  true  },
+                 { "bgp",   179,  "udp",  true  },
+                 { "bgp",   179,  "sctp", true  },
+                 { "bgp",   179,  "dccp", false },
+                 { "bgp",   179,  NULL,   true  },   /* the ANY protocol case */
+                 { "bgp",   179,  "geek", false },   /* the unknown protocol case */
+                 { "exp2", 1022,  "udp",  true  },
+                 { "exp2", 1022,  "tcp",  true  },
+                 { "exp2", 1022,  "dccp", true  },
+                 { "exp2", 1022,  "sctp", true  },
+                 { "exp2", 1022,  NULL,   true  }
                };
 
+/**
+ * Check that every entry in `services_list` is found in the
+ * compiled `services_ports[]` with the same name for each of it's protocols.
+ */
+static void services_check_compiled (void)
+{
+  int i, j, max = services_list ? smartlist_len (services_list) : 0;
+  int checked = 0, errors = 0;
+
+  for (i = 0; i < max; i++)
+  {
+    const struct service_entry *se = smartlist_get (services_list, i);
+
+    for (j = 1; j < DIM(services_multi->name); j++)
+    {
+      const char *name;
+
+      if (!(se->proto & (1 << j)))
+         continue;
+
+      name = services_lookup (se->port, 1 << j);
+      if (!name || strcmp(name, se->name))
+      {
+        C_printf ("  %u/%s: expected '%s', got '%s'.\n",
+                  se->port, decode_proto_str(1 << j), se->name, name ? name : "NULL");
+        errors++;
+      }
+      checked++;
+    }
+  }
+  C_printf ("Checked %d port/protocol entries in the compiled table: %s%d~0 errors.\n",
+            checked, errors ? "~5" : "~4", errors);
+}
+
 static void services_run_tests (void)
 {
   bool fallback;
@@ -482,9 +670,13 @@ static void services_run_tests (void)
 
   for (i = 0; i < DIM(services_tests); i++)
   {
+    struct servent        buf;
     const struct servent *se = ws_getservbyport (swap16(services_tests[i].port),
-                                                 services_tests[i].protocol, fallback, true);
-    bool match = (se == services_tests[i].expect);
+                                                 services_tests[i].protocol, fallback, true, &buf);
+    bool match = ((se == &buf) == services_tests[i].expect);
+
+    if (se == &buf && strcmp(se->s_name, services_tests[i].service))
+       match = false;
 
     C_printf ("~2%2d~0: %-4s/%5s: %s~0\n", i,
               services_tests[i].service,
@@ -495,6 +687,8 @@ static void services_run_tests (void)
     else C_puts   ("    NULL\n");
   }
 
+  services_check_compiled();
+
   g_cfg.color_data = save4;
   g_cfg.color_func = save5;
   C_putc ('\n');
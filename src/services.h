@@ -7,9 +7,10 @@
 extern void services_file_init (void);
 extern void services_file_exit (void);
 
-extern const struct servent *ws_getservbyport (uint16_t    port,
-                                               const char *proto,
-                                               bool        fallback,
-                                               bool        do_wstrace);
+extern const struct servent *ws_getservbyport (uint16_t        port,
+                                               const char     *proto,
+                                               bool            fallback,
+                                               bool            do_wstrace,
+                                               struct servent *buf);
 
 #endif
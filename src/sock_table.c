@@ -0,0 +1,693 @@
+/**\file    sock_table.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A hash-table of sockets and their `sock_info`.
+ *
+ * Used by the `sock_list_*()` functions in common.c; a `closesocket()`
+ * or a lookup of the socket-type is O(1) regardless of the number of
+ * open sockets.
+ *
+ * The table is split into `SOCK_TABLE_SHARDS` shards on the hash of
+ * the socket-value. Each shard is an open-addressing table with linear
+ * probing and its own lock. So threads using different sockets rarely
+ * wait for each other. A removed entry is filled by moving back the
+ * entries after it (no tomb-stones); hence a shard never needs a rehash
+ * except when it grows.
+ *
+ * The functions copy a `sock_info` in or out while holding the lock;
+ * a caller never has a pointer into a shard that could be moved.
+ *
+ * This file has no Windows specific code except for the locks.
+ * Build and run the benchmark on e.g. Linux with:
+ * ```
+ *   gcc -O2 -DSOCK_TABLE_TEST -pthread -o sock_table_test sock_table.c
+ *   ./sock_table_test [threads] [sockets] [linear-sockets]
+ * ```
+ *
+ * sock_table.c - Part of Wsock-Trace.
+ */
+#if defined(SOCK_TABLE_TEST)
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #if defined(_WIN32)
+    #include <windows.h>
+  #else
+    #include <pthread.h>
+    #include <time.h>
+  #endif
+#else
+  #include "common.h"
+#endif
+
+#include "sock_table.h"
+
+#if defined(_WIN32)
+  typedef CRITICAL_SECTION sock_lock;
+
+  #define SOCK_LOCK_INIT(l)  InitializeCriticalSectionAndSpinCount (l, 1000)
+  #define SOCK_LOCK_FREE(l)  DeleteCriticalSection (l)
+  #define SOCK_LOCK(l)       EnterCriticalSection (l)
+  #define SOCK_UNLOCK(l)     LeaveCriticalSection (l)
+#else
+  typedef pthread_mutex_t sock_lock;
+
+  #define SOCK_LOCK_INIT(l)  pthread_mutex_init (l, NULL)
+  #define SOCK_LOCK_FREE(l)  pthread_mutex_destroy (l)
+  #define SOCK_LOCK(l)       pthread_mutex_lock (l)
+  #define SOCK_UNLOCK(l)     pthread_mutex_unlock (l)
+#endif
+
+#define SOCK_TABLE_SHARD_BITS  6
+#define SOCK_TABLE_SHARDS      (1 << SOCK_TABLE_SHARD_BITS)
+#define SOCK_TABLE_MIN_SIZE    16         /* Initial number of slots in a shard */
+#define SOCK_TABLE_CACHE_LINE  64
+
+/**\struct sock_shard
+ * One shard of the table. Padded to a cache-line to not share one with
+ * the lock of another shard.
+ */
+struct sock_shard {
+       sock_lock  lock;
+       sock_info *slot;        /**< `size` slots; a free one has `sock == SOCK_TABLE_FREE` */
+       uint32_t   size;        /**< A power of 2; or 0 until the first add */
+       uint32_t   used;        /**< At most `size / 2` */
+       char       pad [SOCK_TABLE_CACHE_LINE - (sizeof(sock_lock) + sizeof(sock_info*) + 2*sizeof(uint32_t)) % SOCK_TABLE_CACHE_LINE];
+     };
+
+struct sock_table {
+       struct sock_shard shard [SOCK_TABLE_SHARDS];
+     };
+
+/**
+ * Fibonacci hashing of a socket-value. The low 2 bits of a Winsock socket
+ * are always 0; the multiply spreads the other bits into the upper ones.
+ * The low `SOCK_TABLE_SHARD_BITS` bits of the result selects the shard and
+ * the rest the home-slot in it.
+ */
+static uint64_t sock_hash (uint64_t sock)
+{
+  uint64_t h = sock * 0x9E3779B97F4A7C15ULL;
+
+  return (h ^ (h >> 29));
+}
+
+static uint32_t sock_home (const struct sock_shard *sh, uint64_t hash)
+{
+  return (uint32_t) (hash >> SOCK_TABLE_SHARD_BITS) & (sh->size - 1);
+}
+
+/**
+ * Return the index of `sock` in `sh`; or the index of the free
+ * slot where it should be added.
+ */
+static uint32_t shard_find (const struct sock_shard *sh, uint64_t sock, uint64_t hash)
+{
+  uint32_t mask = sh->size - 1;
+  uint32_t i    = sock_home (sh, hash);
+
+  while (sh->slot[i].sock != SOCK_TABLE_FREE && sh->slot[i].sock != sock)
+        i = (i + 1) & mask;
+  return (i);
+}
+
+/**
+ * Double the size of `sh` (or allocate the first slots) and
+ * re-insert the used slots.
+ */
+static bool shard_grow (struct sock_shard *sh)
+{
+  sock_info *old = sh->slot;
+  uint32_t   old_size = sh->size;
+  uint32_t   size = old_size ? 2 * old_size : SOCK_TABLE_MIN_SIZE;
+  uint32_t   i;
+
+  sh->slot = malloc (size * sizeof(*sh->slot));
+  if (!sh->slot)
+  {
+    sh->slot = old;
+    return (false);
+  }
+  for (i = 0; i < size; i++)
+      sh->slot[i].sock = SOCK_TABLE_FREE;
+
+  sh->size = size;
+  for (i = 0; i < old_size; i++)
+  {
+    if (old[i].sock != SOCK_TABLE_FREE)
+       sh->slot [shard_find(sh, old[i].sock, sock_hash(old[i].sock))] = old[i];
+  }
+  free (old);
+  return (true);
+}
+
+/**
+ * Free slot `i` and move back the entries after it that are not at
+ * their home-slot. Until one is found that would then be before its
+ * home-slot; or a free slot.
+ */
+static void shard_delete (struct sock_shard *sh, uint32_t i)
+{
+  uint32_t mask = sh->size - 1;
+  uint32_t j = i;
+  uint32_t home;
+
+  while (1)
+  {
+    j = (j + 1) & mask;
+    if (sh->slot[j].sock == SOCK_TABLE_FREE)
+       break;
+
+    /* Can `slot[j]` move to `i`? Not if its home is cyclically in `(i, j]`.
+     */
+    home = sock_home (sh, sock_hash(sh->slot[j].sock));
+    if (((j - home) & mask) >= ((j - i) & mask))
+    {
+      sh->slot[i] = sh->slot[j];
+      i = j;
+    }
+  }
+  sh->slot[i].sock = SOCK_TABLE_FREE;
+  sh->used--;
+}
+
+static struct sock_shard *shard_of (sock_table *tab, uint64_t hash)
+{
+  return (tab->shard + (hash & (SOCK_TABLE_SHARDS - 1)));
+}
+
+sock_table *sock_table_new (void)
+{
+  sock_table *tab = calloc (1, sizeof(*tab));
+  int         i;
+
+  if (!tab)
+     return (NULL);
+
+  for (i = 0; i < SOCK_TABLE_SHARDS; i++)
+      SOCK_LOCK_INIT (&tab->shard[i].lock);
+  return (tab);
+}
+
+void sock_table_free (sock_table *tab)
+{
+  int i;
+
+  if (!tab)
+     return;
+
+  for (i = 0; i < SOCK_TABLE_SHARDS; i++)
+  {
+    SOCK_LOCK_FREE (&tab->shard[i].lock);
+    free (tab->shard[i].slot);
+  }
+  free (tab);
+}
+
+/**
+ * Add or replace the `sock_info` for `info->sock`.
+ * A socket-value can be reused after a `closesocket()` we did not see.
+ */
+bool sock_table_add (sock_table *tab, const sock_info *info)
+{
+  uint64_t           hash = sock_hash (info->sock);
+  struct sock_shard *sh   = shard_of (tab, hash);
+  uint32_t           i;
+  bool               rc = true;
+
+  if (info->sock == SOCK_TABLE_FREE)
+     return (false);
+
+  SOCK_LOCK (&sh->lock);
+
+  if (2 * (sh->used + 1) > sh->size && !shard_grow(sh))
+     rc = false;
+  else
+  {
+    i = shard_find (sh, info->sock, hash);
+    if (sh->slot[i].sock == SOCK_TABLE_FREE)
+       sh->used++;
+    sh->slot[i] = *info;
+  }
+  SOCK_UNLOCK (&sh->lock);
+  return (rc);
+}
+
+/**
+ * Remove `sock` from the table. Copy what it had to `info` if not NULL.
+ */
+bool sock_table_remove (sock_table *tab, uint64_t sock, sock_info *info)
+{
+  uint64_t           hash = sock_hash (sock);
+  struct sock_shard *sh   = shard_of (tab, hash);
+  uint32_t           i;
+  bool               found = false;
+
+  SOCK_LOCK (&sh->lock);
+  if (sh->used > 0)
+  {
+    i = shard_find (sh, sock, hash);
+    if (sh->slot[i].sock == sock)
+    {
+      if (info)
+         *info = sh->slot[i];
+      shard_delete (sh, i);
+      found = true;
+    }
+  }
+  SOCK_UNLOCK (&sh->lock);
+  return (found);
+}
+
+/**
+ * Copy the `sock_info` of `sock` to `info`.
+ */
+bool sock_table_get (sock_table *tab, uint64_t sock, sock_info *info)
+{
+  uint64_t           hash = sock_hash (sock);
+  struct sock_shard *sh   = shard_of (tab, hash);
+  uint32_t           i;
+  bool               found = false;
+
+  SOCK_LOCK (&sh->lock);
+  if (sh->used > 0)
+  {
+    i = shard_find (sh, sock, hash);
+    if (sh->slot[i].sock == sock)
+    {
+      *info = sh->slot[i];
+      found = true;
+    }
+  }
+  SOCK_UNLOCK (&sh->lock);
+  return (found);
+}
+
+/**
+ * Add to the byte-counters of `sock`.
+ */
+bool sock_table_count (sock_table *tab, uint64_t sock, uint64_t recv, uint64_t sent)
+{
+  uint64_t           hash = sock_hash (sock);
+  struct sock_shard *sh   = shard_of (tab, hash);
+  uint32_t           i;
+  bool               found = false;
+
+  SOCK_LOCK (&sh->lock);
+  if (sh->used > 0)
+  {
+    i = shard_find (sh, sock, hash);
+    if (sh->slot[i].sock == sock)
+    {
+      sh->slot[i].bytes_recv += recv;
+      sh->slot[i].bytes_sent += sent;
+      found = true;
+    }
+  }
+  SOCK_UNLOCK (&sh->lock);
+  return (found);
+}
+
+/**
+ * Return the number of sockets in the table.
+ */
+size_t sock_table_len (sock_table *tab)
+{
+  size_t len = 0;
+  int    i;
+
+  for (i = 0; i < SOCK_TABLE_SHARDS; i++)
+  {
+    SOCK_LOCK (&tab->shard[i].lock);
+    len += tab->shard[i].used;
+    SOCK_UNLOCK (&tab->shard[i].lock);
+  }
+  return (len);
+}
+
+#if defined(SOCK_TABLE_TEST)
+/*
+ * A benchmark and a check of the above.
+ *
+ * 1) One thread adds `test_sockets` sockets, looks them all up, counts bytes
+ *    on them and removes them in a random order. The same for a linear list
+ *    (like the old `sock_list` in common.c) of `test_linear` sockets.
+ *
+ * 2) `test_threads` threads does a churn of `test_sockets` sockets in total;
+ *    each keeps up to 1000 of its sockets open in the shared table and
+ *    checks what it gets back.
+ *
+ * Socket-values are like Winsock's; multiples of 4.
+ */
+#define TEST_MAX_THREADS  64
+#define TEST_OPEN         1000
+
+static sock_table *test_tab;
+static int         test_threads = 8;
+static uint32_t    test_sockets = 100000;
+static uint32_t    test_linear  = 10000;
+static volatile long test_errors;
+
+static void test_error (const char *what, uint64_t sock)
+{
+#if defined(_WIN32)
+  if (InterlockedIncrement(&test_errors) <= 10)
+#else
+  if (__atomic_add_fetch(&test_errors, 1, __ATOMIC_SEQ_CST) <= 10)
+#endif
+     printf ("Error: %s for socket %llu.\n", what, (unsigned long long)sock);
+}
+
+static uint32_t test_rand (uint32_t *state)
+{
+  *state = *state * 1103515245 + 12345;
+  return (*state >> 8);
+}
+
+static uint64_t test_sock (uint32_t num)
+{
+  return (0x100 + 4 * (uint64_t)num);
+}
+
+static void test_info (sock_info *info, uint64_t sock)
+{
+  memset (info, '\0', sizeof(*info));
+  info->sock     = sock;
+  info->family   = (int) (sock & 0xFF);
+  info->type     = (int) ((sock >> 8) & 0xFF);
+  info->protocol = 6;
+  info->created  = (int64_t) sock * 10;
+}
+
+static bool test_check (const sock_info *info, uint64_t sock, uint64_t recv, uint64_t sent)
+{
+  return (info->sock == sock && info->family == (int)(sock & 0xFF) &&
+          info->type == (int)((sock >> 8) & 0xFF) && info->protocol == 6 &&
+          info->created == (int64_t)sock * 10 &&
+          info->bytes_recv == recv && info->bytes_sent == sent);
+}
+
+/*
+ * Return a random permutation of `0 .. num-1`.
+ */
+static uint32_t *test_shuffle (uint32_t num, uint32_t seed)
+{
+  uint32_t *order = malloc (num * sizeof(*order));
+  uint32_t  i, j, tmp;
+
+  if (!order)
+     return (NULL);
+  for (i = 0; i < num; i++)
+      order[i] = i;
+  for (i = num; i > 1; i--)
+  {
+    j = test_rand (&seed) % i;
+    tmp = order[i-1];
+    order[i-1] = order[j];
+    order[j] = tmp;
+  }
+  return (order);
+}
+
+#if defined(_WIN32)
+  static double test_now (void)
+  {
+    LARGE_INTEGER now, freq;
+
+    QueryPerformanceCounter (&now);
+    QueryPerformanceFrequency (&freq);
+    return (double) now.QuadPart / (double) freq.QuadPart;
+  }
+#else
+  static double test_now (void)
+  {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1E9;
+  }
+#endif
+
+static void test_report (const char *what, uint32_t num, double start)
+{
+  double sec = test_now() - start;
+
+  printf ("  %-22s %8u ops, %8.3f msec, %7.1f nsec/op\n",
+          what, num, 1E3 * sec, num ? 1E9 * sec / num : 0.0);
+}
+
+/*
+ * Part 1 with the hash-table.
+ */
+static void test_single (void)
+{
+  uint32_t *order = test_shuffle (test_sockets, 1);
+  sock_info info;
+  uint32_t  i;
+  double    start;
+
+  if (!order)
+     return;
+
+  printf ("Hash-table, %u sockets:\n", test_sockets);
+
+  start = test_now();
+  for (i = 0; i < test_sockets; i++)
+  {
+    test_info (&info, test_sock(i));
+    if (!sock_table_add(test_tab, &info))
+       test_error ("add", info.sock);
+  }
+  test_report ("sock_table_add():", test_sockets, start);
+
+  if (sock_table_len(test_tab) != test_sockets)
+     test_error ("len", sock_table_len(test_tab));
+
+  start = test_now();
+  for (i = 0; i < test_sockets; i++)
+  {
+    uint64_t sock = test_sock (order[i]);
+
+    if (!sock_table_get(test_tab, sock, &info) || !test_check(&info, sock, 0, 0))
+       test_error ("get", sock);
+  }
+  test_report ("sock_table_get():", test_sockets, start);
+
+  if (sock_table_get(test_tab, test_sock(test_sockets), &info))
+     test_error ("get of unknown", test_sock(test_sockets));
+
+  start = test_now();
+  for (i = 0; i < test_sockets; i++)
+      sock_table_count (test_tab, test_sock(order[i]), order[i], 1);
+  test_report ("sock_table_count():", test_sockets, start);
+
+  start = test_now();
+  for (i = 0; i < test_sockets; i++)
+  {
+    uint64_t sock = test_sock (order[i]);
+
+    if (!sock_table_remove(test_tab, sock, &info) || !test_check(&info, sock, order[i], 1))
+       test_error ("remove", sock);
+
+    /* Check the entries moved back by `shard_delete()` now and then.
+     */
+    if (i % 1000 == 0 && i + 1 < test_sockets)
+    {
+      uint64_t next = test_sock (order[i+1]);
+
+      if (!sock_table_get(test_tab, next, &info) || !test_check(&info, next, order[i+1], 1))
+         test_error ("get after remove", next);
+    }
+  }
+  test_report ("sock_table_remove():", test_sockets, start);
+
+  if (sock_table_len(test_tab) != 0)
+     test_error ("len after remove", sock_table_len(test_tab));
+  free (order);
+}
+
+/*
+ * Part 1 with a linear list; the same as the old `sock_list`.
+ */
+static void test_single_linear (void)
+{
+  uint32_t  *order = test_shuffle (test_linear, 1);
+  sock_info *list  = malloc (test_linear * sizeof(*list));
+  uint32_t   i, j, len = 0;
+  uint64_t   found = 0;
+  double     start;
+
+  if (!order || !list)
+     goto quit;
+
+  printf ("Linear list, %u sockets:\n", test_linear);
+
+  start = test_now();
+  for (i = 0; i < test_linear; i++)
+      test_info (list + len++, test_sock(i));
+  test_report ("add:", test_linear, start);
+
+  start = test_now();
+  for (i = 0; i < test_linear; i++)
+  {
+    uint64_t sock = test_sock (order[i]);
+
+    for (j = 0; j < len; j++)
+        if (list[j].sock == sock)
+        {
+          found++;
+          break;
+        }
+  }
+  test_report ("lookup:", test_linear, start);
+
+  start = test_now();
+  for (i = 0; i < test_linear; i++)
+  {
+    uint64_t sock = test_sock (order[i]);
+
+    for (j = 0; j < len; j++)
+        if (list[j].sock == sock)
+        {
+          memmove (list + j, list + j + 1, (len - j - 1) * sizeof(*list));
+          len--;
+          found++;
+          break;
+        }
+  }
+  test_report ("remove (keep-order):", test_linear, start);
+
+  if (found != 2 * (uint64_t)test_linear)
+     test_error ("linear list", found);
+
+quit:
+  free (order);
+  free (list);
+}
+
+/*
+ * Part 2; the churn of one thread.
+ * Thread `id` owns the sockets `id, id + test_threads, ...`.
+ */
+static void test_churn (int id)
+{
+  uint64_t  open [TEST_OPEN];
+  uint32_t  num_open = 0;
+  uint32_t  seed = id + 1;
+  uint32_t  next = id;
+  sock_info info;
+
+  while (next < test_sockets || num_open > 0)
+  {
+    uint32_t rnd = test_rand (&seed);
+
+    if (next < test_sockets && (num_open < TEST_OPEN / 2 || (num_open < TEST_OPEN && rnd % 3)))
+    {
+      test_info (&info, test_sock(next));
+      if (!sock_table_add(test_tab, &info))
+         test_error ("add", info.sock);
+      open [num_open++] = info.sock;
+      next += test_threads;
+    }
+    else
+    {
+      uint32_t i    = rnd % num_open;
+      uint64_t sock = open [i];
+
+      if (!sock_table_count(test_tab, sock, 10, 20) ||
+          !sock_table_get(test_tab, sock, &info) || !test_check(&info, sock, 10, 20))
+         test_error ("get", sock);
+
+      if (!sock_table_remove(test_tab, sock, &info) || !test_check(&info, sock, 10, 20))
+         test_error ("remove", sock);
+
+      if (sock_table_get(test_tab, sock, &info))
+         test_error ("get after remove", sock);
+      open [i] = open [--num_open];
+    }
+  }
+}
+
+#if defined(_WIN32)
+  static DWORD WINAPI test_thread (void *arg)
+  {
+    test_churn ((int)(intptr_t)arg);
+    return (0);
+  }
+#else
+  static void *test_thread (void *arg)
+  {
+    test_churn ((int)(intptr_t)arg);
+    return (NULL);
+  }
+#endif
+
+static void test_threaded (void)
+{
+  double start;
+  int    i;
+
+  printf ("Hash-table, %d threads, churn of %u sockets:\n", test_threads, test_sockets);
+
+  start = test_now();
+  {
+#if defined(_WIN32)
+    HANDLE thr [TEST_MAX_THREADS];
+
+    for (i = 0; i < test_threads; i++)
+        thr[i] = CreateThread (NULL, 0, test_thread, (void*)(intptr_t)i, 0, NULL);
+    for (i = 0; i < test_threads; i++)
+    {
+      WaitForSingleObject (thr[i], INFINITE);
+      CloseHandle (thr[i]);
+    }
+#else
+    pthread_t thr [TEST_MAX_THREADS];
+
+    for (i = 0; i < test_threads; i++)
+        pthread_create (&thr[i], NULL, test_thread, (void*)(intptr_t)i);
+    for (i = 0; i < test_threads; i++)
+        pthread_join (thr[i], NULL);
+#endif
+  }
+
+  /* Each socket was added, counted, looked up twice and removed.
+   */
+  test_report ("add+count+get+remove:", 5 * test_sockets, start);
+
+  if (sock_table_len(test_tab) != 0)
+     test_error ("len after churn", sock_table_len(test_tab));
+}
+
+int main (int argc, char **argv)
+{
+  if (argc > 1)
+     test_threads = atoi (argv[1]);
+  if (argc > 2)
+     test_sockets = (uint32_t) atol (argv[2]);
+  if (argc > 3)
+     test_linear = (uint32_t) atol (argv[3]);
+
+  if (test_threads < 1 || test_threads > TEST_MAX_THREADS)
+  {
+    printf ("Use 1 - %d threads.\n", TEST_MAX_THREADS);
+    return (1);
+  }
+
+  test_tab = sock_table_new();
+  if (!test_tab)
+  {
+    printf ("sock_table_new() failed.\n");
+    return (1);
+  }
+
+  test_single();
+  test_single_linear();
+  test_threaded();
+  sock_table_free (test_tab);
+
+  printf ("%s: %ld errors.\n", test_errors ? "FAILED" : "OKAY", test_errors);
+  return (test_errors ? 1 : 0);
+}
+#endif  /* SOCK_TABLE_TEST */
@@ -0,0 +1,48 @@
+/**\file    sock_table.h
+ * \ingroup Main
+ *
+ * \brief
+ *   A hash-table of the sockets seen by `socket()`, `accept()` etc.
+ *   and their associated data.
+ */
+#ifndef _SOCK_TABLE_H
+#define _SOCK_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * A `sock_info::sock` value that is never added; `INVALID_SOCKET`.
+ */
+#define SOCK_TABLE_FREE  ((uint64_t)-1)
+
+/**\struct sock_info
+ * The data kept for a socket through its lifetime.
+ *
+ * \todo: options from `setsockopt()` should be added here.
+ */
+typedef struct sock_info {
+        uint64_t sock;        /**< the socket-value */
+        int      family;      /**< the address family; AF_INET, AF_INET6, AF_UNIX */
+        int      type;        /**< the procotol type; SOCK_STREAM, SOCK_DGRAM, SOCK_RAW, SOCK_RDM, SOCK_SEQPACKET */
+        int      protocol;    /**< the protocol number; IPPROTO_IP, etc. */
+        int64_t  created;     /**< when it was created; in units of the caller */
+        uint64_t bytes_recv;  /**< bytes received on it */
+        uint64_t bytes_sent;  /**< bytes sent on it */
+      } sock_info;
+
+/**
+ * Opaque struct; defined in sock_table.c
+ */
+typedef struct sock_table sock_table;
+
+extern sock_table *sock_table_new    (void);
+extern void        sock_table_free   (sock_table *tab);
+extern bool        sock_table_add    (sock_table *tab, const sock_info *info);
+extern bool        sock_table_remove (sock_table *tab, uint64_t sock, sock_info *info);
+extern bool        sock_table_get    (sock_table *tab, uint64_t sock, sock_info *info);
+extern bool        sock_table_count  (sock_table *tab, uint64_t sock, uint64_t recv, uint64_t sent);
+extern size_t      sock_table_len    (sock_table *tab);
+
+#endif  /* _SOCK_TABLE_H */
@@ -0,0 +1,338 @@
+/**\file    trace_bin.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A binary trace-file format and the `ws_tool decode` sub-command.
+ *
+ * With `trace_binary = 1` (and a `trace_file`), the hooks for `recv()`,
+ * `recvfrom()`, `send()` and `sendto()` writes a `TRACE_BIN_CALL` record
+ * with the raw arguments instead of formatting a trace-line and a hex-dump.
+ * All other trace-output is written as `TRACE_BIN_TEXT` records.
+ *
+ * `ws_tool decode <file>` renders such a file into the same text as a
+ * normal trace-file would have had. The file can also be compressed
+ * (`trace_compress = 1..9`).
+ *
+ * trace_bin.c - Part of Wsock-Trace.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include "common.h"
+#include "getopt.h"
+#include "init.h"
+#include "trace_bin.h"
+#include "trace_gz.h"
+
+/** Largest record `ws_tool decode` accepts.
+ */
+#define TRACE_BIN_MAX_REC  (16*1024*1024)
+
+/** Size of the text-records; the same as `TRACE_BUF_SIZE` in common.c.
+ */
+#define TRACE_BIN_TEXT_SIZE  (2*1024)
+
+/**
+ * Fill in the `TRACE_BIN_HEAD` record.
+ * Also used by common.c to start a rotated trace-file.
+ */
+void trace_bin_head_record (trace_bin_hdr *hdr)
+{
+  LARGE_INTEGER freq;
+
+  QueryPerformanceFrequency (&freq);
+
+  memset (hdr, '\0', sizeof(*hdr));
+  hdr->rec.kind = TRACE_BIN_HEAD;
+  hdr->rec.len  = sizeof(hdr->head);
+
+  memcpy (&hdr->head.magic, TRACE_BIN_MAGIC, sizeof(hdr->head.magic));
+  hdr->head.version         = TRACE_BIN_VERSION;
+  hdr->head.ptr_size        = sizeof(void*);
+  hdr->head.time_format     = g_cfg.trace_time_format;
+  hdr->head.indent          = g_cfg.trace_indent;
+  hdr->head.max_data        = g_cfg.max_data;
+  hdr->head.clocks_per_usec = freq.QuadPart / 1000000ULL;
+
+  if (g_cfg.show_tid)
+     hdr->head.flags |= TRACE_BIN_SHOW_TID;
+  if (g_cfg.compact)
+     hdr->head.flags |= TRACE_BIN_COMPACT;
+  if (g_cfg.extra_new_line)
+     hdr->head.flags |= TRACE_BIN_EXTRA_NEW_LINE;
+  if (g_cfg.trace_time_usec)
+     hdr->head.flags |= TRACE_BIN_TIME_USEC;
+}
+
+/**
+ * Write the `TRACE_BIN_HEAD` record.
+ * Called from `wsock_trace_init()` after the trace-file is opened.
+ */
+bool trace_bin_init (void)
+{
+  trace_bin_hdr hdr;
+
+  trace_bin_head_record (&hdr);
+  C_flush();
+  if (C_write_record(&hdr, sizeof(hdr)) != sizeof(hdr))
+  {
+    TRACE (1, "Failed to write the binary trace-header.\n");
+    return (false);
+  }
+  TRACE (2, "Writing a binary trace to '%s'.\n", g_cfg.trace_file);
+  return (true);
+}
+
+/**
+ * Called from `C_flush()` to write the trace-buffer as `TRACE_BIN_TEXT` records.
+ */
+size_t trace_bin_text (const char *text, size_t len)
+{
+  char   buf [sizeof(trace_bin_rec) + TRACE_BIN_TEXT_SIZE];
+  size_t written = 0;
+
+  while (len > 0)
+  {
+    trace_bin_rec *rec = (trace_bin_rec*) buf;
+    size_t         chunk = min (len, TRACE_BIN_TEXT_SIZE);
+
+    rec->kind = TRACE_BIN_TEXT;
+    rec->func = 0;
+    rec->len  = (uint32_t) chunk;
+    memcpy (rec + 1, text, chunk);
+
+    if (C_write_record(buf, sizeof(*rec) + chunk) != sizeof(*rec) + chunk)
+       break;
+    written += chunk;
+    text    += chunk;
+    len     -= chunk;
+  }
+  return (written);
+}
+
+/**
+ * Write a `TRACE_BIN_CALL` record.
+ * `call->addr_len`, `call->data_len` and `call->caller_len` gives the
+ * number of bytes to copy from `addr`, `data` and `caller`.
+ */
+size_t trace_bin_write (trace_bin_func func, const trace_bin_call *call,
+                        const char *caller, const void *addr, const void *data)
+{
+  char           stack_buf [1024];
+  char          *buf = stack_buf;
+  char          *p;
+  trace_bin_rec *rec;
+  size_t         len = sizeof(*rec) + sizeof(*call) + call->addr_len + call->data_len + call->caller_len;
+  size_t         written;
+
+  if (len > sizeof(stack_buf))
+  {
+    buf = malloc (len);
+    if (!buf)
+       return (0);
+  }
+
+  rec = (trace_bin_rec*) buf;
+  rec->kind = TRACE_BIN_CALL;
+  rec->func = (uint16_t) func;
+  rec->len  = (uint32_t) (len - sizeof(*rec));
+
+  p = (char*) (rec + 1);
+  memcpy (p, call, sizeof(*call));
+  p += sizeof(*call);
+  memcpy (p, addr, call->addr_len);
+  p += call->addr_len;
+  memcpy (p, data, call->data_len);
+  p += call->data_len;
+  memcpy (p, caller, call->caller_len);
+
+  C_flush();   /* keep the text written so far before this record */
+  written = C_write_record (buf, len);
+
+  if (buf != stack_buf)
+     free (buf);
+  return (written);
+}
+
+/**
+ * Apply the `TRACE_BIN_HEAD` record to `g_cfg`.
+ */
+static bool decode_head (const trace_bin_head *head, size_t len, int *ptr_size)
+{
+  if (len < sizeof(*head) || memcmp(head->magic, TRACE_BIN_MAGIC, sizeof(head->magic)))
+  {
+    printf ("Not a binary trace-file.\n");
+    return (false);
+  }
+  if (head->version != TRACE_BIN_VERSION)
+  {
+    printf ("Unsupported version %u of binary trace-file.\n", head->version);
+    return (false);
+  }
+
+  *ptr_size                = head->ptr_size;
+  g_cfg.trace_time_format  = (TS_TYPE) head->time_format;
+  g_cfg.trace_indent       = head->indent;
+  g_cfg.max_data           = head->max_data;
+  g_cfg.show_tid           = (head->flags & TRACE_BIN_SHOW_TID) ? true : false;
+  g_cfg.compact            = (head->flags & TRACE_BIN_COMPACT) ? true : false;
+  g_cfg.extra_new_line     = (head->flags & TRACE_BIN_EXTRA_NEW_LINE) ? true : false;
+  g_cfg.trace_time_usec    = (head->flags & TRACE_BIN_TIME_USEC) ? true : false;
+  g_data.clocks_per_usec   = head->clocks_per_usec ? head->clocks_per_usec : 1;
+
+  /* As the traced program saw it while writing to a trace-file.
+   */
+  g_cfg.trace_file_okay = true;
+  g_cfg.start_new_line  = false;
+  return (true);
+}
+
+/**
+ * Render a `TRACE_BIN_CALL` record.
+ * `rec` is 0-terminated; hence the caller-string at the end is too.
+ */
+static bool decode_call (trace_bin_func func, const char *rec, size_t len, int ptr_size)
+{
+  const trace_bin_call   *call = (const trace_bin_call*) rec;
+  struct sockaddr_storage addr;
+  const char             *data;
+
+  if (len < sizeof(*call) ||
+      len != sizeof(*call) + call->addr_len + call->data_len + call->caller_len ||
+      call->addr_len > sizeof(addr) || call->data_len < min(call->data_total, (unsigned)g_cfg.max_data) ||
+      func < TRACE_BIN_RECV || func > TRACE_BIN_SENDTO)
+     return (false);
+
+  memset (&addr, '\0', sizeof(addr));
+  memcpy (&addr, rec + sizeof(*call), call->addr_len);
+  data = rec + sizeof(*call) + call->addr_len;
+
+  wstrace_bin_render (func, call, data + call->data_len,
+                      call->addr_len ? (const struct sockaddr*)&addr : NULL,
+                      data, ptr_size);
+  return (true);
+}
+
+static int decode_file (trace_gz_reader *rd, const char *fname)
+{
+  trace_bin_rec rec;
+  char         *buf = NULL;
+  size_t        size = 0;
+  DWORD         num = 0;
+  int           ptr_size = 0;
+  int           rc = 0;
+
+  while (trace_gz_read(rd, &rec, sizeof(rec)) == sizeof(rec))
+  {
+    if (rec.len > TRACE_BIN_MAX_REC)
+    {
+      printf ("%s: record %lu is too large (%u bytes).\n", fname, num, rec.len);
+      rc = 1;
+      break;
+    }
+    if (rec.len + 1 > size)
+    {
+      char *more = realloc (buf, rec.len + 1);
+
+      if (!more)
+      {
+        rc = 1;
+        break;
+      }
+      buf  = more;
+      size = rec.len + 1;
+    }
+    if (trace_gz_read(rd, buf, rec.len) != rec.len)
+    {
+      printf ("%s: record %lu is truncated.\n", fname, num);
+      rc = 1;
+      break;
+    }
+    buf [rec.len] = '\0';
+
+    if (num++ == 0 && rec.kind != TRACE_BIN_HEAD)
+    {
+      printf ("%s: not a binary trace-file.\n", fname);
+      rc = 1;
+      break;
+    }
+
+    if (rec.kind == TRACE_BIN_HEAD)
+    {
+      if (!decode_head((const trace_bin_head*)buf, rec.len, &ptr_size))
+      {
+        rc = 1;
+        break;
+      }
+    }
+    else if (rec.kind == TRACE_BIN_TEXT)
+    {
+      C_flush();
+      fwrite (buf, 1, rec.len, g_cfg.trace_stream);
+    }
+    else if (rec.kind != TRACE_BIN_CALL || !decode_call(rec.func, buf, rec.len, ptr_size))
+    {
+      C_flush();
+      printf ("%s: bad record %lu (kind: %u, func: %u, len: %u).\n",
+              fname, num, rec.kind, rec.func, rec.len);
+      rc = 1;
+      break;
+    }
+  }
+  C_flush();
+  fflush (g_cfg.trace_stream);
+  free (buf);
+  return (rc);
+}
+
+/*
+ * The `ws_tool decode` sub-command.
+ */
+static int show_help (void)
+{
+  printf ("Usage: %s [-h] <trace-file>\n"
+          "  Render a trace-file written with 'trace_binary = 1' as text. It can be compressed.\n",
+          g_data.program_name);
+  return (0);
+}
+
+int decode_main (int argc, char **argv)
+{
+  trace_gz_reader *rd;
+  int              ch, rc;
+
+  set_program_name (argv[0]);
+
+  while ((ch = getopt(argc, argv, "h?")) != EOF)
+     switch (ch)
+     {
+       case '?':
+       case 'h':
+       default:
+            return show_help();
+  }
+  argv += optind;
+  if (!*argv)
+     return show_help();
+
+  rd = trace_gz_ropen (*argv);
+  if (!rd)
+  {
+    printf ("Failed to open '%s': %s\n", *argv, strerror(errno));
+    return (1);
+  }
+
+  /* The text-records already have "\r\n" line-endings.
+   */
+  if (g_cfg.trace_use_ods || !g_cfg.trace_stream)
+     g_cfg.trace_stream = stdout;
+  g_cfg.trace_use_ods = false;
+  g_cfg.trace_binary  = false;
+  g_cfg.trace_binmode = true;
+  fflush (g_cfg.trace_stream);
+  _setmode (_fileno(g_cfg.trace_stream), O_BINARY);
+
+  rc = decode_file (rd, *argv);
+  trace_gz_rclose (rd);
+  return (rc);
+}
@@ -0,0 +1,110 @@
+/**\file    trace_bin.h
+ * \ingroup Main
+ *
+ * \brief
+ *   The record-format of a binary trace-file (`trace_binary = 1`).
+ *   Such a file is rendered into normal text by `ws_tool decode`.
+ */
+#ifndef _TRACE_BIN_H
+#define _TRACE_BIN_H
+
+#include <stdint.h>
+
+#define TRACE_BIN_MAGIC    "WSTRACE\x1A"
+#define TRACE_BIN_VERSION  1
+
+/**
+ * \enum trace_bin_kind
+ * The record kinds.
+ */
+typedef enum trace_bin_kind {
+        TRACE_BIN_HEAD = 1,    /**< A `trace_bin_head`; written when a program starts tracing */
+        TRACE_BIN_TEXT,        /**< Trace-output that is already formatted */
+        TRACE_BIN_CALL         /**< A `trace_bin_call` for one of the `trace_bin_func` functions */
+      } trace_bin_kind;
+
+/**
+ * \enum trace_bin_func
+ * The traced functions written as a `TRACE_BIN_CALL` record.
+ */
+typedef enum trace_bin_func {
+        TRACE_BIN_RECV = 1,
+        TRACE_BIN_RECVFROM,
+        TRACE_BIN_SEND,
+        TRACE_BIN_SENDTO,
+      } trace_bin_func;
+
+/**
+ * Flags for `trace_bin_head::flags`.
+ */
+#define TRACE_BIN_SHOW_TID        0x0001
+#define TRACE_BIN_COMPACT         0x0002
+#define TRACE_BIN_EXTRA_NEW_LINE  0x0004
+#define TRACE_BIN_TIME_USEC       0x0008
+
+#pragma pack(push,1)
+
+/**\struct trace_bin_rec
+ * Every record starts with this.
+ */
+typedef struct trace_bin_rec {
+        uint16_t kind;     /**< A `trace_bin_kind` */
+        uint16_t func;     /**< A `trace_bin_func` for a `TRACE_BIN_CALL` record. Otherwise 0 */
+        uint32_t len;      /**< Length of the data following this header */
+      } trace_bin_rec;
+
+/**\struct trace_bin_head
+ * The configuration needed to render the records that follows.
+ */
+typedef struct trace_bin_head {
+        char     magic [8];        /**< `TRACE_BIN_MAGIC` */
+        uint16_t version;          /**< `TRACE_BIN_VERSION` */
+        uint16_t ptr_size;         /**< `sizeof(void*)` of the traced program */
+        uint32_t flags;            /**< `TRACE_BIN_x` flags */
+        int32_t  time_format;      /**< `g_cfg.trace_time_format` */
+        int32_t  indent;           /**< `g_cfg.trace_indent` */
+        int32_t  max_data;         /**< `g_cfg.max_data` */
+        uint64_t clocks_per_usec;  /**< `g_data.clocks_per_usec` */
+      } trace_bin_head;
+
+/**\struct trace_bin_call
+ * The raw arguments of a traced `recv()`, `recvfrom()`, `send()` or `sendto()`.
+ * Followed by `addr_len` bytes of the `sockaddr`, `data_len` bytes of
+ * the data to dump and `caller_len` bytes of the caller-string.
+ */
+typedef struct trace_bin_call {
+        int64_t  time;          /**< The raw time-stamp from `get_timestamp_raw()` */
+        uint64_t sock;          /**< The socket */
+        uint64_t buf;           /**< Address of the program's buffer */
+        uint32_t tid;           /**< The thread-id */
+        int32_t  buf_len;       /**< The buffer length argument */
+        int32_t  flags;         /**< The `MSG_x` flags */
+        int32_t  rc;            /**< The return value */
+        int32_t  error;         /**< `WSAGetLastError()` if `rc < 0` */
+        uint32_t data_total;    /**< The length given to `dump_data()`. 0 if nothing to dump */
+        uint16_t caller_len;
+        uint16_t addr_len;      /**< 0 for a NULL `sockaddr` */
+        uint32_t data_len;      /**< At most `trace_bin_head::max_data` */
+      } trace_bin_call;
+
+/**\struct trace_bin_hdr
+ * The `TRACE_BIN_HEAD` record written first in every trace-file.
+ */
+typedef struct trace_bin_hdr {
+        trace_bin_rec  rec;
+        trace_bin_head head;
+      } trace_bin_hdr;
+
+#pragma pack(pop)
+
+extern void   trace_bin_head_record (trace_bin_hdr *hdr);
+extern bool   trace_bin_init  (void);
+extern size_t trace_bin_text  (const char *text, size_t len);
+extern size_t trace_bin_write (trace_bin_func func, const trace_bin_call *call,
+                               const char *caller, const void *addr, const void *data);
+
+extern void wstrace_bin_render (trace_bin_func func, const trace_bin_call *call,
+                                const char *caller, const struct sockaddr *addr,
+                                const void *data, int ptr_size);
+
+#endif  /* _TRACE_BIN_H */
@@ -0,0 +1,615 @@
+/**\file    trace_gz.c
+ * \ingroup Main
+ *
+ * \brief
+ *   A gzip compressed `trace_file` using the bundled miniz.
+ *
+ * With `trace_compress = 1..9`, all output to the trace-file is deflated
+ * in `C_write()`. Normally that is on the writer-thread of `trace_async`
+ * in blocks of up to 64 kB. The compressed data is written out when the
+ * output-buffer is full and at the sync-flush points done every
+ * `trace_compress_sync` msec. Hence if the program crashes, all trace
+ * up to the last sync-point can be read back.
+ *
+ * Each run of a program appends a new gzip member to the file.
+ * A member without a trailer (the program crashed) is handled by the
+ * reader below; it continues with the next member.
+ *
+ * \note
+ *   The inflater in miniz can read a few bytes past the end of the deflate
+ *   data. So the reader does not check the gzip trailer; it just looks
+ *   for the header of the next member.
+ *
+ * The reader is used by `ws_tool cat`, `ws_tool grep` and `ws_tool decode`.
+ * Plain (not compressed) files are read as-is.
+ *
+ * trace_gz.c - Part of Wsock-Trace.
+ */
+#include <errno.h>
+#include <fcntl.h>
+
+#include "common.h"
+#include "getopt.h"
+#include "init.h"
+#include "miniz.h"
+#include "trace_gz.h"
+
+#define TRACE_GZ_BUF_SIZE  (64*1024)
+#define TRACE_GZ_LOOKBACK  8    /* Input bytes kept for `rd_backup()` */
+
+#define GZ_MAGIC1     0x1F
+#define GZ_MAGIC2     0x8B
+#define GZ_DEFLATED   8
+#define GZ_OS_NTFS    11
+
+#define GZ_FHCRC      0x02
+#define GZ_FEXTRA     0x04
+#define GZ_FNAME      0x08
+#define GZ_FCOMMENT   0x10
+
+/**\struct trace_gz
+ * The state of the compressor.
+ */
+struct trace_gz {
+       FILE          *file;
+       mz_stream      zs;
+       mz_ulong       crc;                        /**< CRC-32 of the uncompressed data */
+       DWORD          isize;                      /**< Uncompressed size modulo 2^32 */
+       bool           dirty;                      /**< Data was deflated since the last sync-flush */
+       unsigned char  out [TRACE_GZ_BUF_SIZE];
+     };
+
+/**\struct trace_gz_reader
+ * The state of the reader.
+ */
+struct trace_gz_reader {
+       FILE          *file;
+       bool           gzip;                       /**< false for a plain file */
+       bool           in_member;                  /**< Inside a gzip member; `zs` is initialised */
+       bool           eof;
+       mz_stream      zs;
+       const unsigned char *in_start;             /**< Oldest byte we can back up to */
+       unsigned char  in [TRACE_GZ_LOOKBACK + TRACE_GZ_BUF_SIZE];
+     };
+
+static void put_le32 (unsigned char *p, DWORD val)
+{
+  p[0] = (unsigned char) val;
+  p[1] = (unsigned char) (val >> 8);
+  p[2] = (unsigned char) (val >> 16);
+  p[3] = (unsigned char) (val >> 24);
+}
+
+/**
+ * Write out what is in the output-buffer.
+ */
+static bool gz_write_out (trace_gz *gz)
+{
+  size_t len = sizeof(gz->out) - gz->zs.avail_out;
+
+  gz->zs.next_out  = gz->out;
+  gz->zs.avail_out = sizeof(gz->out);
+  return (len == 0 || fwrite(gz->out, 1, len, gz->file) == len);
+}
+
+/**
+ * Deflate all pending input.
+ * With `MZ_NO_FLUSH`, the output is only written when the output-buffer is full.
+ */
+static bool gz_deflate (trace_gz *gz, int flush)
+{
+  for (;;)
+  {
+    int  rc   = mz_deflate (&gz->zs, flush);
+    bool full = (gz->zs.avail_out == 0);
+
+    if (rc != MZ_OK && rc != MZ_STREAM_END && rc != MZ_BUF_ERROR)
+       return (false);
+
+    if ((full || flush != MZ_NO_FLUSH) && !gz_write_out(gz))
+       return (false);
+
+    if (!full)
+       return (true);
+  }
+}
+
+/**
+ * Start a new gzip member at the end of `file`.
+ * `file` must be opened in binary mode.
+ */
+trace_gz *trace_gz_open (FILE *file, int level)
+{
+  trace_gz      *gz = calloc (1, sizeof(*gz));
+  unsigned char  hdr [10];
+
+  if (!gz)
+     return (NULL);
+
+  if (mz_deflateInit2(&gz->zs, level, MZ_DEFLATED, -MZ_DEFAULT_WINDOW_BITS, 9, MZ_DEFAULT_STRATEGY) != MZ_OK)
+  {
+    free (gz);
+    return (NULL);
+  }
+
+  hdr[0] = GZ_MAGIC1;
+  hdr[1] = GZ_MAGIC2;
+  hdr[2] = GZ_DEFLATED;
+  hdr[3] = 0;
+  put_le32 (hdr+4, (DWORD)time(NULL));
+  hdr[8] = (level >= 9) ? 2 : (level == 1) ? 4 : 0;
+  hdr[9] = GZ_OS_NTFS;
+
+  if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr))
+  {
+    mz_deflateEnd (&gz->zs);
+    free (gz);
+    return (NULL);
+  }
+  gz->file         = file;
+  gz->crc          = MZ_CRC32_INIT;
+  gz->zs.next_out  = gz->out;
+  gz->zs.avail_out = sizeof(gz->out);
+  return (gz);
+}
+
+/**
+ * Compress `len` bytes of `data`.
+ */
+size_t trace_gz_write (trace_gz *gz, const void *data, size_t len)
+{
+  gz->crc   = mz_crc32 (gz->crc, (const unsigned char*)data, len);
+  gz->isize += (DWORD) len;
+
+  gz->zs.next_in  = (const unsigned char*) data;
+  gz->zs.avail_in = (unsigned) len;
+  gz->dirty = true;
+  return (gz_deflate(gz, MZ_NO_FLUSH) ? len : 0);
+}
+
+/**
+ * Do a sync-flush; all data so far can then be read back
+ * even if the gzip trailer is never written.
+ */
+bool trace_gz_sync (trace_gz *gz)
+{
+  bool rc;
+
+  if (!gz->dirty)
+     return (true);
+
+  gz->dirty = false;
+  rc = gz_deflate (gz, MZ_SYNC_FLUSH);
+  fflush (gz->file);
+  return (rc);
+}
+
+/**
+ * Finish the gzip member and free `gz`.
+ * The caller closes the file.
+ */
+void trace_gz_close (trace_gz *gz)
+{
+  unsigned char trailer [8];
+
+  if (gz_deflate(gz, MZ_FINISH))
+  {
+    put_le32 (trailer, (DWORD)gz->crc);
+    put_le32 (trailer+4, gz->isize);
+    fwrite (trailer, 1, sizeof(trailer), gz->file);
+  }
+  fflush (gz->file);
+  mz_deflateEnd (&gz->zs);
+  free (gz);
+}
+
+/**
+ * Read more input when all is used.
+ * Keep the last `TRACE_GZ_LOOKBACK` bytes in front of it.
+ */
+static size_t rd_fill (trace_gz_reader *rd)
+{
+  unsigned char *start = rd->in + TRACE_GZ_LOOKBACK;
+  size_t         keep  = 0;
+  size_t         len;
+
+  if (rd->zs.next_in)
+  {
+    keep = min (TRACE_GZ_LOOKBACK, rd->zs.next_in - rd->in_start);
+    memmove (start - keep, rd->zs.next_in - keep, keep);
+  }
+  len = fread (start, 1, TRACE_GZ_BUF_SIZE, rd->file);
+  rd->in_start    = start - keep;
+  rd->zs.next_in  = start;
+  rd->zs.avail_in = (unsigned) len;
+  return (len);
+}
+
+/**
+ * After an inflate error, go back the few bytes the inflater could
+ * have read from the header of the next member.
+ */
+static void rd_backup (trace_gz_reader *rd)
+{
+  size_t back = min (TRACE_GZ_LOOKBACK, rd->zs.next_in - rd->in_start);
+
+  rd->zs.next_in  -= back;
+  rd->zs.avail_in += (unsigned) back;
+}
+
+/**
+ * Return the next input byte or -1 on EOF.
+ */
+static int rd_byte (trace_gz_reader *rd)
+{
+  if (rd->zs.avail_in == 0 && rd_fill(rd) == 0)
+     return (-1);
+  rd->zs.avail_in--;
+  return (*rd->zs.next_in++);
+}
+
+/**
+ * Parse a gzip header and start inflating the member.
+ * With `resync`, skip any garbage (or the trailer of the previous member)
+ * before the header.
+ */
+static bool rd_member_start (trace_gz_reader *rd, bool resync)
+{
+  int c = rd_byte (rd);
+  int i, flags, len;
+
+  while (c >= 0)
+  {
+    if (c == GZ_MAGIC1 && (c = rd_byte(rd)) == GZ_MAGIC2 && (c = rd_byte(rd)) == GZ_DEFLATED)
+       break;
+    if (!resync)
+       return (false);
+    if (c != GZ_MAGIC1)
+       c = rd_byte (rd);
+  }
+  if (c < 0)
+     return (false);
+
+  flags = rd_byte (rd);
+  for (i = 0; i < 6; i++)    /* mtime, xfl, os */
+      rd_byte (rd);
+
+  if (flags > 0 && (flags & GZ_FEXTRA))
+  {
+    len = rd_byte (rd);
+    len += 256 * rd_byte (rd);
+    while (len-- > 0)
+       rd_byte (rd);
+  }
+  if (flags > 0 && (flags & GZ_FNAME))
+     while (rd_byte(rd) > 0)
+        ;
+  if (flags > 0 && (flags & GZ_FCOMMENT))
+     while (rd_byte(rd) > 0)
+        ;
+  if (flags > 0 && (flags & GZ_FHCRC))
+  {
+    rd_byte (rd);
+    rd_byte (rd);
+  }
+  if (flags < 0 || mz_inflateInit2(&rd->zs, -MZ_DEFAULT_WINDOW_BITS) != MZ_OK)
+     return (false);
+
+  rd->in_member = true;
+  return (true);
+}
+
+/**
+ * Open a compressed or plain trace-file for reading.
+ */
+trace_gz_reader *trace_gz_ropen (const char *fname)
+{
+  trace_gz_reader *rd;
+  FILE            *file = fopen (fname, "rb");
+  int              c1, c2;
+
+  if (!file)
+     return (NULL);
+
+  rd = calloc (1, sizeof(*rd));
+  if (!rd)
+  {
+    fclose (file);
+    return (NULL);
+  }
+  c1 = fgetc (file);
+  c2 = fgetc (file);
+  rewind (file);
+
+  rd->file = file;
+  rd->gzip = (c1 == GZ_MAGIC1 && c2 == GZ_MAGIC2);
+  return (rd);
+}
+
+/**
+ * Read up to `len` bytes of uncompressed data.
+ * Returns less than `len` only at the end of the file.
+ */
+size_t trace_gz_read (trace_gz_reader *rd, void *buf, size_t len)
+{
+  size_t got = 0;
+
+  if (!rd->gzip)
+     return fread (buf, 1, len, rd->file);
+
+  while (got < len && !rd->eof)
+  {
+    int rc;
+
+    if (!rd->in_member)
+    {
+      if (!rd_member_start(rd, true))
+         rd->eof = true;
+      continue;
+    }
+
+    rd->zs.next_out  = (unsigned char*)buf + got;
+    rd->zs.avail_out = (unsigned) (len - got);
+    rc   = mz_inflate (&rd->zs, MZ_SYNC_FLUSH);
+    got  = len - rd->zs.avail_out;
+
+    if (rc == MZ_STREAM_END)
+    {
+      mz_inflateEnd (&rd->zs);
+      rd->in_member = false;
+    }
+    else if (rc == MZ_BUF_ERROR)
+    {
+      /* Needs more input. At EOF, the member has no trailer; the program
+       * was killed or it is still running.
+       */
+      if (rd_fill(rd) == 0)
+         rd->eof = true;
+    }
+    else if (rc != MZ_OK)
+    {
+      /* A member without a trailer followed by the next member.
+       */
+      TRACE (2, "Inflate error %d; looking for the next member.\n", rc);
+      mz_inflateEnd (&rd->zs);
+      rd->in_member = false;
+      rd_backup (rd);
+    }
+  }
+  return (got);
+}
+
+void trace_gz_rclose (trace_gz_reader *rd)
+{
+  if (rd->in_member)
+     mz_inflateEnd (&rd->zs);
+  fclose (rd->file);
+  free (rd);
+}
+
+/*
+ * The `ws_tool cat` and `ws_tool grep` sub-commands.
+ */
+static int cat_help (void)
+{
+  printf ("Usage: %s [-h] <trace-file..>\n"
+          "  Print a compressed ('trace_compress = 1..9') or plain trace-file.\n",
+          g_data.program_name);
+  return (0);
+}
+
+int cat_main (int argc, char **argv)
+{
+  trace_gz_reader *rd;
+  char            *buf;
+  size_t           len;
+  int              ch, rc = 0;
+
+  set_program_name (argv[0]);
+
+  while ((ch = getopt(argc, argv, "h?")) != EOF)
+     switch (ch)
+     {
+       case '?':
+       case 'h':
+       default:
+            return cat_help();
+  }
+  argv += optind;
+  if (!*argv)
+     return cat_help();
+
+  buf = malloc (TRACE_GZ_BUF_SIZE);
+  if (!buf)
+     return (1);
+
+  /* The trace-files already have "\r\n" line-endings.
+   */
+  fflush (stdout);
+  _setmode (_fileno(stdout), O_BINARY);
+
+  for ( ; *argv; argv++)
+  {
+    rd = trace_gz_ropen (*argv);
+    if (!rd)
+    {
+      fprintf (stderr, "Failed to open '%s': %s\n", *argv, strerror(errno));
+      rc = 1;
+      continue;
+    }
+    while ((len = trace_gz_read(rd, buf, TRACE_GZ_BUF_SIZE)) > 0)
+       fwrite (buf, 1, len, stdout);
+    trace_gz_rclose (rd);
+  }
+  fflush (stdout);
+  free (buf);
+  return (rc);
+}
+
+/**
+ * The state for `ws_tool grep`.
+ */
+struct grep_state {
+       const char *str;
+       size_t      str_len;
+       bool        ignore_case;
+       bool        invert;
+       bool        count_only;
+       const char *fname;            /**< Print this before each line. Or NULL */
+       char       *line;
+       size_t      line_len;
+       size_t      line_size;
+       DWORD       matches;
+     };
+
+static void grep_line (struct grep_state *gs)
+{
+  const char *p   = gs->line;
+  const char *end = gs->line + gs->line_len;
+  bool        found = false;
+
+  for ( ; p + gs->str_len <= end; p++)
+  {
+    if (gs->ignore_case ? !strnicmp(p, gs->str, gs->str_len) : !memcmp(p, gs->str, gs->str_len))
+    {
+      found = true;
+      break;
+    }
+  }
+  if (found == gs->invert)
+     return;
+
+  gs->matches++;
+  if (gs->count_only)
+     return;
+
+  if (gs->fname)
+     printf ("%s:", gs->fname);
+  fwrite (gs->line, 1, gs->line_len, stdout);
+  if (gs->line_len == 0 || gs->line [gs->line_len-1] != '\n')
+     fputs ("\r\n", stdout);
+}
+
+static int grep_file (struct grep_state *gs, const char *fname, char *buf)
+{
+  trace_gz_reader *rd = trace_gz_ropen (fname);
+  size_t           len;
+
+  if (!rd)
+  {
+    fprintf (stderr, "Failed to open '%s': %s\n", fname, strerror(errno));
+    return (1);
+  }
+
+  gs->line_len = 0;
+  gs->matches  = 0;
+
+  while ((len = trace_gz_read(rd, buf, TRACE_GZ_BUF_SIZE)) > 0)
+  {
+    const char *p   = buf;
+    const char *end = buf + len;
+
+    while (p < end)
+    {
+      const char *nl = memchr (p, '\n', end - p);
+      size_t      n  = (nl ? nl + 1 : end) - p;
+
+      if (gs->line_len + n > gs->line_size)
+      {
+        char *more = realloc (gs->line, gs->line_len + n);
+
+        if (!more)
+        {
+          trace_gz_rclose (rd);
+          return (1);
+        }
+        gs->line      = more;
+        gs->line_size = gs->line_len + n;
+      }
+      memcpy (gs->line + gs->line_len, p, n);
+      gs->line_len += n;
+      p += n;
+
+      if (nl)
+      {
+        grep_line (gs);
+        gs->line_len = 0;
+      }
+    }
+  }
+  if (gs->line_len > 0)
+     grep_line (gs);
+
+  if (gs->count_only)
+  {
+    if (gs->fname)
+       printf ("%s:", gs->fname);
+    printf ("%lu\r\n", gs->matches);
+  }
+  trace_gz_rclose (rd);
+  return (0);
+}
+
+static int grep_help (void)
+{
+  printf ("Usage: %s [-chiv] <string> <trace-file..>\n"
+          "  Print the lines containing <string> in a compressed ('trace_compress = 1..9') or plain trace-file.\n"
+          "    -c: only print the number of matching lines.\n"
+          "    -i: ignore case.\n"
+          "    -v: print the lines not matching.\n",
+          g_data.program_name);
+  return (0);
+}
+
+int grep_main (int argc, char **argv)
+{
+  struct grep_state gs;
+  char  *buf;
+  int    ch, rc = 0;
+  bool   many;
+
+  set_program_name (argv[0]);
+  memset (&gs, '\0', sizeof(gs));
+
+  while ((ch = getopt(argc, argv, "chiv?")) != EOF)
+     switch (ch)
+     {
+       case 'c':
+            gs.count_only = true;
+            break;
+       case 'i':
+            gs.ignore_case = true;
+            break;
+       case 'v':
+            gs.invert = true;
+            break;
+       case '?':
+       case 'h':
+       default:
+            return grep_help();
+  }
+  argv += optind;
+  if (!argv[0] || !argv[1])
+     return grep_help();
+
+  gs.str     = *argv++;
+  gs.str_len = strlen (gs.str);
+  many       = (argv[1] != NULL);
+
+  buf = malloc (TRACE_GZ_BUF_SIZE);
+  if (!buf)
+     return (1);
+
+  fflush (stdout);
+  _setmode (_fileno(stdout), O_BINARY);
+
+  for ( ; *argv; argv++)
+  {
+    gs.fname = many ? *argv : NULL;
+    rc |= grep_file (&gs, *argv, buf);
+  }
+  fflush (stdout);
+  free (gs.line);
+  free (buf);
+  return (rc);
+}
@@ -0,0 +1,26 @@
+/**\file    trace_gz.h
+ * \ingroup Main
+ *
+ * \brief
+ *   A gzip compressed `trace_file` (`trace_compress = 1..9`) and
+ *   a reader for it used by `ws_tool cat`, `ws_tool grep` and `ws_tool decode`.
+ */
+#ifndef _TRACE_GZ_H
+#define _TRACE_GZ_H
+
+/**
+ * Opaque structs; defined in trace_gz.c
+ */
+typedef struct trace_gz        trace_gz;
+typedef struct trace_gz_reader trace_gz_reader;
+
+extern trace_gz *trace_gz_open  (FILE *file, int level);
+extern size_t    trace_gz_write (trace_gz *gz, const void *data, size_t len);
+extern bool      trace_gz_sync  (trace_gz *gz);
+extern void      trace_gz_close (trace_gz *gz);
+
+extern trace_gz_reader *trace_gz_ropen  (const char *fname);
+extern size_t           trace_gz_read   (trace_gz_reader *rd, void *buf, size_t len);
+extern void             trace_gz_rclose (trace_gz_reader *rd);
+
+#endif  /* _TRACE_GZ_H */
@@ -0,0 +1,617 @@
+/**\file    trace_ring.c
+ * \ingroup Main
+ *
+ * \brief
+ *   Per-thread single-producer ring-buffers for the trace-output.
+ *
+ * Each thread writing trace-output puts its records into its own
+ * `trace_ring` without any lock or I/O. One consumer (the writer-thread in
+ * common.c) drains all rings of a `trace_rings` set in commit-order.
+ *
+ * A record gets its sequence-number from a global counter when it is
+ * committed. This gives one total order that agrees with the order of
+ * each thread and with the order of the global critical-section.
+ * Timestamps from `QueryPerformanceCounter()` on different cores could
+ * tie or go backwards.
+ *
+ * To never print a record before one with a lower sequence-number still
+ * being committed, a producer sets `ring->pending` around the commit.
+ * The consumer reads the counter first, then waits a while for `pending == 0`
+ * in each ring before taking a snapshot of it. If a ring is still busy, the
+ * limit is lowered to below the sequence-number being committed in it.
+ * Only records with a sequence-number <= the limit are then printed; the
+ * rest are printed by the next drain.
+ * The producer never waits for the consumer; if its ring is full, the
+ * record is dropped and counted.
+ *
+ * This file has no Windows specific code except for the atomic
+ * functions. Build and run the stress-test on e.g. Linux with:
+ * ```
+ *   gcc -O2 -DRING_TEST -pthread -o ring_test trace_ring.c
+ *   ./ring_test [threads] [records] [ring-size]
+ * ```
+ *
+ * trace_ring.c - Part of Wsock-Trace.
+ */
+#if defined(RING_TEST)
+  #include <stdio.h>
+  #include <stdlib.h>
+  #include <string.h>
+  #include <stdbool.h>
+  #if defined(_WIN32)
+    #include <windows.h>
+  #else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <time.h>
+  #endif
+#else
+  #include "common.h"
+#endif
+
+#include "trace_ring.h"
+
+#if defined(_WIN32)
+  #define RING_LOAD(p)             InterlockedCompareExchange ((p), 0, 0)
+  #define RING_STORE(p, v)         InterlockedExchange ((p), (long)(v))
+  #define RING_INC(p)              InterlockedIncrement (p)
+  #define RING_DEC(p)              InterlockedDecrement (p)
+  #define RING_LOAD_PTR(p)         InterlockedCompareExchangePointer ((void *volatile*)(p), NULL, NULL)
+  #define RING_STORE_PTR(p, v)     InterlockedExchangePointer ((void *volatile*)(p), (v))
+  #define RING_CAS_PTR(p, old, v)  (InterlockedCompareExchangePointer ((void *volatile*)(p), (v), (old)) == (old))
+  #define RING_YIELD()             SwitchToThread()
+#else
+  #define RING_LOAD(p)             __atomic_load_n ((p), __ATOMIC_SEQ_CST)
+  #define RING_STORE(p, v)         __atomic_store_n ((p), (int32_t)(v), __ATOMIC_SEQ_CST)
+  #define RING_INC(p)              __atomic_add_fetch ((p), 1, __ATOMIC_SEQ_CST)
+  #define RING_DEC(p)              __atomic_sub_fetch ((p), 1, __ATOMIC_SEQ_CST)
+  #define RING_LOAD_PTR(p)         __atomic_load_n ((p), __ATOMIC_SEQ_CST)
+  #define RING_STORE_PTR(p, v)     __atomic_store_n ((p), (v), __ATOMIC_SEQ_CST)
+  #define RING_YIELD()             sched_yield()
+
+  static bool RING_CAS_PTR (trace_ring *volatile *p, trace_ring *old, trace_ring *v)
+  {
+    return __atomic_compare_exchange_n (p, &old, v, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  }
+#endif
+
+#define RING_CACHE_LINE  64
+#define RING_WRAP        0xFFFFFFFF   /* A `ring_hdr::len` telling the rest of the buffer is unused */
+#define RING_MAX_SPINS   1000
+
+/* The values of `trace_ring::pending`.
+ */
+#define RING_IDLE        0
+#define RING_GET_SEQ     1   /* Getting the sequence-number; not yet known */
+#define RING_COMMIT      2   /* Committing the record with `pending_seq` */
+#define RING_ALIGN(x)    (((x) + 7) & ~7)
+
+/**\struct ring_hdr
+ * The header before each record in a ring.
+ */
+struct ring_hdr {
+       uint32_t seq;       /**< The commit sequence-number */
+       uint32_t len;       /**< The length of the data following; or `RING_WRAP` */
+     };
+
+/**\struct trace_ring
+ * A single-producer, single-consumer ring of variable sized records.
+ *
+ * `head` and `tail` are free-running byte-counters; the position in
+ * `buf` is `head & (size-1)`. They are in separate cache-lines since
+ * the producer writes `head` and the consumer writes `tail`.
+ */
+struct trace_ring {
+       trace_rings       *set;                       /**< The set we belong to */
+       char              *buf;                       /**< The buffer of `size` bytes */
+       uint32_t           size;                      /**< A power of 2 */
+       trace_ring_atomic  pending;                   /**< The producer is committing a record; `RING_x` */
+       trace_ring_atomic  pending_seq;               /**< The sequence-number of it when `RING_COMMIT` */
+       trace_ring_atomic  closed;                    /**< The producer is gone; free it when empty */
+       char               pad1 [RING_CACHE_LINE];
+       trace_ring_atomic  head;                      /**< Written by the producer only */
+       char               pad2 [RING_CACHE_LINE];
+       trace_ring_atomic  tail;                      /**< Written by the consumer only */
+     };
+
+/**
+ * Allocate a new ring of at least `size` bytes (rounded up to a power of 2)
+ * and add it to `set`.
+ *
+ * \retval NULL if `set` already has `TRACE_RING_MAX` rings or no memory.
+ */
+trace_ring *trace_ring_new (trace_rings *set, size_t size)
+{
+  trace_ring *ring;
+  size_t      sz = 1024;
+  int         i;
+
+  while (sz < size && sz < (1U << 30))
+        sz <<= 1;
+
+  ring = calloc (1, sizeof(*ring));
+  if (!ring)
+     return (NULL);
+
+  ring->buf = malloc (sz);
+  if (!ring->buf)
+  {
+    free (ring);
+    return (NULL);
+  }
+  ring->set  = set;
+  ring->size = (uint32_t) sz;
+
+  for (i = 0; i < TRACE_RING_MAX; i++)
+  {
+    if (RING_CAS_PTR(&set->ring[i], NULL, ring))
+       return (ring);
+  }
+  free (ring->buf);
+  free (ring);
+  return (NULL);
+}
+
+/**
+ * Called by the producer when it will not put any more records into
+ * `ring`. The consumer frees it when all records are drained.
+ */
+void trace_ring_close (trace_ring *ring)
+{
+  RING_STORE (&ring->closed, 1);
+}
+
+/**
+ * Put a record into `ring`. Called by the producer only.
+ *
+ * \retval -1  if it did not fit; it is dropped and counted in `set->dropped`.
+ * \retval >=0 the percentage of the ring in use.
+ */
+int trace_ring_put (trace_ring *ring, const void *data, size_t len)
+{
+  struct ring_hdr *hdr;
+  uint32_t head = (uint32_t) ring->head;   /* Only we write it */
+  uint32_t tail = (uint32_t) RING_LOAD (&ring->tail);
+  uint32_t pos  = head & (ring->size - 1);
+  uint32_t need, skip = 0;
+
+  if (len > ring->size / 2)
+  {
+    RING_INC (&ring->set->dropped);
+    return (-1);
+  }
+
+  need = RING_ALIGN (sizeof(*hdr) + (uint32_t)len);
+
+  /* A record is never split; skip to the start if it does not fit at the end.
+   */
+  if (ring->size - pos < need)
+     skip = ring->size - pos;
+
+  if (head - tail + skip + need > ring->size)
+  {
+    RING_INC (&ring->set->dropped);
+    return (-1);
+  }
+
+  RING_STORE (&ring->pending, RING_GET_SEQ);
+
+  if (skip)
+  {
+    hdr = (struct ring_hdr*) (ring->buf + pos);
+    hdr->seq = 0;
+    hdr->len = RING_WRAP;
+    head += skip;
+    pos = 0;
+  }
+
+  hdr = (struct ring_hdr*) (ring->buf + pos);
+  hdr->seq = (uint32_t) RING_INC (&ring->set->seq);
+  RING_STORE (&ring->pending_seq, hdr->seq);
+  RING_STORE (&ring->pending, RING_COMMIT);
+  hdr->len = (uint32_t) len;
+  memcpy (hdr + 1, data, len);
+  head += need;
+
+  RING_STORE (&ring->head, head);
+  RING_STORE (&ring->pending, RING_IDLE);
+  return (int) ((uint64_t)(head - tail) * 100 / ring->size);
+}
+
+/**
+ * Return the header of the first record in the range `[*tail .. head)`
+ * of `ring`. Skips a `RING_WRAP` marker.
+ *
+ * \retval NULL if the range is empty.
+ */
+static const struct ring_hdr *ring_peek (const trace_ring *ring, uint32_t *tail, uint32_t head)
+{
+  const struct ring_hdr *hdr;
+  uint32_t   pos;
+
+  if (*tail == head)
+     return (NULL);
+
+  pos = *tail & (ring->size - 1);
+  hdr = (const struct ring_hdr*) (ring->buf + pos);
+  if (hdr->len != RING_WRAP)
+     return (hdr);
+
+  *tail += ring->size - pos;
+  if (*tail == head)
+     return (NULL);
+  return (const struct ring_hdr*) ring->buf;
+}
+
+/**
+ * Drain all rings in `set` and call `func` for each record in
+ * sequence-order. Called by the consumer only.
+ *
+ * This is a k-way merge of the rings; the number of rings with
+ * data at the same time is normally small.
+ * A closed ring is freed when it becomes empty.
+ *
+ * \retval the number of records drained.
+ */
+size_t trace_ring_drain (trace_rings *set, trace_ring_func func, void *arg)
+{
+  trace_ring            *rings  [TRACE_RING_MAX];
+  const struct ring_hdr *next   [TRACE_RING_MAX];
+  uint32_t               head   [TRACE_RING_MAX];
+  uint32_t               tail   [TRACE_RING_MAX];
+  int                    slot   [TRACE_RING_MAX];
+  bool                   closed [TRACE_RING_MAX];
+  uint32_t               limit;
+  size_t                 count = 0;
+  int                    i, num = 0;
+
+  /* Any record with a sequence-number <= `limit` is committed when
+   * its `ring->pending` is `RING_IDLE`. Lowered below a record still
+   * being committed.
+   */
+  limit = (uint32_t) RING_LOAD (&set->seq);
+
+  for (i = 0; i < TRACE_RING_MAX; i++)
+  {
+    trace_ring *ring = RING_LOAD_PTR (&set->ring[i]);
+    int         spins;
+
+    if (!ring)
+       continue;
+
+    closed[num] = (RING_LOAD(&ring->closed) != 0);
+    for (spins = 0; RING_LOAD(&ring->pending) != RING_IDLE && spins < RING_MAX_SPINS; spins++)
+        RING_YIELD();
+
+    /* Still busy. Its sequence-number could be <= `limit`; wait until it is known.
+     * Then print nothing from that number on. Reading `pending_seq` of a later
+     * commit is harmless; it only lowers `limit` less.
+     */
+    while (1)
+    {
+      int32_t state = RING_LOAD (&ring->pending);
+
+      if (state == RING_IDLE)
+         break;
+      if (state == RING_COMMIT)
+      {
+        uint32_t seq = (uint32_t) RING_LOAD (&ring->pending_seq);
+
+        if (RING_LOAD(&ring->pending) == RING_COMMIT && (int32_t)(seq - limit) <= 0)
+           limit = seq - 1;
+        break;
+      }
+      RING_YIELD();
+    }
+
+    rings[num] = ring;
+    slot[num]  = i;
+    head[num]  = (uint32_t) RING_LOAD (&ring->head);
+    tail[num]  = (uint32_t) ring->tail;
+    next[num]  = ring_peek (ring, &tail[num], head[num]);
+    num++;
+  }
+
+  while (1)
+  {
+    const struct ring_hdr *hdr = NULL;
+    int   best = -1;
+
+    for (i = 0; i < num; i++)
+    {
+      if (!next[i] || (int32_t)(next[i]->seq - limit) > 0)
+         continue;
+      if (!hdr || (int32_t)(next[i]->seq - hdr->seq) < 0)
+      {
+        hdr  = next[i];
+        best = i;
+      }
+    }
+    if (!hdr)
+       break;
+
+    (*func) (arg, hdr->seq, (const char*)(hdr + 1), hdr->len);
+    count++;
+
+    tail[best] += RING_ALIGN (sizeof(*hdr) + hdr->len);
+    RING_STORE (&rings[best]->tail, tail[best]);
+    next[best] = ring_peek (rings[best], &tail[best], head[best]);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    RING_STORE (&rings[i]->tail, tail[i]);
+    if (closed[i] && tail[i] == head[i])
+    {
+      RING_STORE_PTR (&set->ring[slot[i]], NULL);
+      free (rings[i]->buf);
+      free (rings[i]);
+    }
+  }
+  return (count);
+}
+
+/**
+ * Return the number of records dropped in all rings of `set`.
+ */
+uint32_t trace_ring_dropped (trace_rings *set)
+{
+  return (uint32_t) RING_LOAD (&set->dropped);
+}
+
+/**
+ * Free all rings in `set`. No producer or consumer may use it after this.
+ */
+void trace_rings_free (trace_rings *set)
+{
+  int i;
+
+  for (i = 0; i < TRACE_RING_MAX; i++)
+  {
+    trace_ring *ring = RING_LOAD_PTR (&set->ring[i]);
+
+    if (ring)
+    {
+      free (ring->buf);
+      free (ring);
+      RING_STORE_PTR (&set->ring[i], NULL);
+    }
+  }
+}
+
+#if defined(RING_TEST)
+/*
+ * A stress-test of the above.
+ *
+ * `test_threads` producers each put `test_records` records of random length
+ * into rings of `test_ring_size` bytes while the main thread drains them.
+ * A small ring gives many wraps and drops. The drained records are checked for:
+ *  - sequence-numbers strictly increasing without gaps (a dropped record has none).
+ *  - the records of each producer coming in the order they were put.
+ *  - no corrupted data.
+ *  - put + dropped == records attempted; all closed rings are freed.
+ */
+#define TEST_MAX_THREADS  64
+
+struct test_producer {
+       int          id;
+       trace_ring  *ring;
+       uint32_t     sent;
+       uint32_t     dropped;
+     };
+
+static trace_rings          test_set;
+static trace_ring_atomic    test_running;
+static struct test_producer test_prod [TEST_MAX_THREADS];
+static uint32_t             test_next [TEST_MAX_THREADS];   /* next record-number expected (or higher) */
+static uint32_t             test_received [TEST_MAX_THREADS];
+static uint32_t             test_last_seq;
+static int                  test_threads   = 8;
+static uint32_t             test_records   = 200000;
+static size_t               test_ring_size = 4096;
+static int                  test_errors;
+
+static void test_error (const char *what, uint32_t seq, const char *data, size_t len)
+{
+  if (test_errors++ < 10)
+     printf ("Error: %s at seq %u: '%.*s'\n", what, seq, (int)len, data);
+}
+
+static void test_callback (void *arg, uint32_t seq, const char *data, size_t len)
+{
+  char     buf [300];
+  int      id, ofs = 0;
+  unsigned num, pad;
+  size_t   i;
+
+  (void) arg;
+
+  if (seq != test_last_seq + 1)
+     test_error ("sequence gap", seq, data, len);
+  test_last_seq = seq;
+
+  if (len >= sizeof(buf))
+  {
+    test_error ("too long", seq, data, 40);
+    return;
+  }
+  memcpy (buf, data, len);
+  buf [len] = '\0';
+
+  if (sscanf(buf, "%d:%u:%u:%n", &id, &num, &pad, &ofs) != 3 || ofs == 0 ||
+      id < 0 || id >= test_threads || ofs + pad + 1 != len || buf[len-1] != '\n')
+  {
+    test_error ("bad record", seq, data, len);
+    return;
+  }
+  for (i = 0; i < pad; i++)
+     if (buf[ofs+i] != (char)('a' + (num + i) % 26))
+     {
+       test_error ("bad payload", seq, data, len);
+       return;
+     }
+
+  if (num < test_next[id])
+     test_error ("record order", seq, data, len);
+  test_next [id] = num + 1;
+  test_received [id]++;
+}
+
+static void test_produce (struct test_producer *prod)
+{
+  char     buf [300];
+  uint32_t num, rnd = 2463534242U + prod->id;
+
+  for (num = 0; num < test_records; num++)
+  {
+    unsigned i, pad;
+    int      len;
+
+    rnd ^= rnd << 13;   /* xorshift32 */
+    rnd ^= rnd >> 17;
+    rnd ^= rnd << 5;
+    pad = rnd % 200;
+
+    len = snprintf (buf, sizeof(buf), "%d:%u:%u:", prod->id, num, pad);
+    for (i = 0; i < pad; i++)
+        buf [len++] = 'a' + (num + i) % 26;
+    buf [len++] = '\n';
+
+    if (trace_ring_put(prod->ring, buf, len) < 0)
+         prod->dropped++;
+    else prod->sent++;
+
+    if ((rnd & 0xFF) == 0)
+       RING_YIELD();
+  }
+  trace_ring_close (prod->ring);
+  RING_DEC (&test_running);
+}
+
+#if defined(_WIN32)
+  static DWORD WINAPI test_thread (void *arg)
+  {
+    test_produce (arg);
+    return (0);
+  }
+
+  static double test_now (void)
+  {
+    return (double) GetTickCount() / 1E3;
+  }
+#else
+  static void *test_thread (void *arg)
+  {
+    test_produce (arg);
+    return (NULL);
+  }
+
+  static double test_now (void)
+  {
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1E9;
+  }
+#endif
+
+int main (int argc, char **argv)
+{
+  uint32_t sent = 0, dropped = 0, received = 0;
+  size_t   rounds = 0;
+  double   start;
+  int      i;
+
+  if (argc > 1)
+     test_threads = atoi (argv[1]);
+  if (argc > 2)
+     test_records = (uint32_t) atol (argv[2]);
+  if (argc > 3)
+     test_ring_size = (size_t) atol (argv[3]);
+
+  if (test_threads < 1 || test_threads > TEST_MAX_THREADS)
+  {
+    printf ("Use 1 - %d threads.\n", TEST_MAX_THREADS);
+    return (1);
+  }
+
+  printf ("%d threads putting %u records each into rings of %u bytes.\n",
+          test_threads, test_records, (unsigned)test_ring_size);
+
+  test_running = test_threads;
+  for (i = 0; i < test_threads; i++)
+  {
+    test_prod[i].id   = i;
+    test_prod[i].ring = trace_ring_new (&test_set, test_ring_size);
+    if (!test_prod[i].ring)
+    {
+      printf ("trace_ring_new() failed.\n");
+      return (1);
+    }
+  }
+
+  start = test_now();
+  for (i = 0; i < test_threads; i++)
+  {
+#if defined(_WIN32)
+    HANDLE thr = CreateThread (NULL, 0, test_thread, test_prod + i, 0, NULL);
+
+    if (thr)
+       CloseHandle (thr);
+#else
+    pthread_t thr;
+
+    if (pthread_create(&thr, NULL, test_thread, test_prod + i) == 0)
+       pthread_detach (thr);
+#endif
+  }
+
+  while (RING_LOAD(&test_running) > 0)
+  {
+    if (trace_ring_drain(&test_set, test_callback, NULL) == 0)
+       RING_YIELD();
+    rounds++;
+  }
+
+  /* All producers are done; drain the rest.
+   */
+  while (trace_ring_drain(&test_set, test_callback, NULL) > 0)
+        rounds++;
+
+  for (i = 0; i < test_threads; i++)
+  {
+    sent     += test_prod[i].sent;
+    dropped  += test_prod[i].dropped;
+    received += test_received[i];
+    if (test_prod[i].sent != test_received[i])
+    {
+      printf ("Error: producer %d sent %u records, received %u.\n", i, test_prod[i].sent, test_received[i]);
+      test_errors++;
+    }
+  }
+  if (dropped != trace_ring_dropped(&test_set))
+  {
+    printf ("Error: dropped %u records, counted %u.\n", dropped, trace_ring_dropped(&test_set));
+    test_errors++;
+  }
+  if (test_last_seq != received)
+  {
+    printf ("Error: last seq %u, received %u.\n", test_last_seq, received);
+    test_errors++;
+  }
+  for (i = 0; i < TRACE_RING_MAX; i++)
+  {
+    if (test_set.ring[i])
+    {
+      printf ("Error: ring %d not freed.\n", i);
+      test_errors++;
+    }
+  }
+
+  printf ("received: %u, dropped: %u, drain rounds: %u, %.3f sec.\n",
+          received, dropped, (unsigned)rounds, test_now() - start);
+  printf ("%s: %d errors.\n", test_errors ? "FAILED" : "OKAY", test_errors);
+  trace_rings_free (&test_set);
+  return (test_errors ? 1 : 0);
+}
+#endif  /* RING_TEST */
@@ -0,0 +1,55 @@
+/**\file    trace_ring.h
+ * \ingroup Main
+ *
+ * \brief
+ *   Per-thread single-producer ring-buffers for the trace-output
+ *   and a merge of these in commit-order.
+ */
+#ifndef _TRACE_RING_H
+#define _TRACE_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * The max number of rings (i.e. threads) in a `trace_rings` set.
+ */
+#define TRACE_RING_MAX  256
+
+/**
+ * A 32-bit value accessed with the `RING_*()` atomic macros in trace_ring.c.
+ */
+#if defined(_WIN32)
+  typedef volatile long    trace_ring_atomic;
+#else
+  typedef volatile int32_t trace_ring_atomic;
+#endif
+
+/**
+ * Opaque struct; defined in trace_ring.c
+ */
+typedef struct trace_ring trace_ring;
+
+/**\struct trace_rings
+ * A set of rings drained by one consumer.
+ * Must be zeroed before use.
+ */
+typedef struct trace_rings {
+        trace_ring *volatile ring [TRACE_RING_MAX];  /**< The registered rings; NULL if a free slot */
+        trace_ring_atomic    seq;                    /**< The global commit-counter */
+        trace_ring_atomic    dropped;                /**< Number of records not fitting in a ring */
+      } trace_rings;
+
+/**\typedef trace_ring_func
+ * The function called by `trace_ring_drain()` for each record.
+ */
+typedef void (*trace_ring_func) (void *arg, uint32_t seq, const char *data, size_t len);
+
+extern trace_ring *trace_ring_new     (trace_rings *set, size_t size);
+extern void        trace_ring_close   (trace_ring *ring);
+extern int         trace_ring_put     (trace_ring *ring, const void *data, size_t len);
+extern size_t      trace_ring_drain   (trace_rings *set, trace_ring_func func, void *arg);
+extern uint32_t    trace_ring_dropped (trace_rings *set);
+extern void        trace_rings_free   (trace_rings *set);
+
+#endif  /* _TRACE_RING_H */
@@ -376,13 +376,7 @@ void vm_bug_list (int skip_frames, void *list)
   {
     WaitForSingleObject (th, INFINITE);
     if (vm_bug_debug >= 2)
-    {
-      FILE *save = g_cfg.trace_stream;
-
-      g_cfg.trace_stream = vm_bug_stream;
-      print_thread_times (th);
-      g_cfg.trace_stream = save;
-    }
+       print_thread_times (th);
     CloseHandle (th);
   }
   else
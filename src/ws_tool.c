@@ -25,10 +25,14 @@
 
 extern int asn_main           (int argc, char **argv);
 extern int backtrace_main     (int argc, char **argv);
+extern int cat_main           (int argc, char **argv);
 extern int csv_main           (int argc, char **argv);
+extern int decode_main        (int argc, char **argv);
 extern int dnsbl_main         (int argc, char **argv);
 extern int firewall_main      (int argc, char **argv);
 extern int geoip_main         (int argc, char **argv);
+extern int grep_main          (int argc, char **argv);
+extern int hosts_file_main    (int argc, char **argv);
 extern int iana_main          (int argc, char **argv);
 extern int idna_main          (int argc, char **argv);
 extern int services_file_main (int argc, char **argv);
@@ -40,10 +44,14 @@ static const struct {
      } sub_commands[] = {
        { asn_main,           "asn"       },
        { backtrace_main,     "backtrace" },
+       { cat_main,           "cat"       },
        { csv_main,           "csv"       },
+       { decode_main,        "decode"    },
        { dnsbl_main,         "dnsbl"     },
        { firewall_main,      "firewall"  },
        { geoip_main,         "geoip"     },
+       { grep_main,          "grep"      },
+       { hosts_file_main,    "hosts"     },
        { iana_main,          "iana"      },
        { idna_main,          "idna"      },
        { services_file_main, "services"  },
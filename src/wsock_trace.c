@@ -24,6 +24,9 @@
 #include "firewall.h"
 #include "wsock_trace_lua.h"
 #include "wsock_trace.h"
+#include "trace_bin.h"
+#include "sock_table.h"
+#include "caller_cache.h"
 
 #ifndef WSA_IO_PENDING
 #define WSA_IO_PENDING  ERROR_IO_PENDING
@@ -60,6 +63,9 @@ static void        get_tcp_info_v1 (SOCKET s, TCP_INFO_v1 *info, int *err);
 static void        wstrace_printf (bool first_line,
                                    _Printf_format_string_ const char *fmt, ...)
                                    ATTR_PRINTF (2, 3);
+static void        wstrace_bin (trace_bin_func func, const char *caller, SOCKET s,
+                                const char *buf, int buf_len, int flags, int rc,
+                                const struct sockaddr *addr, int addr_len, unsigned dump_len);
 
 #if defined(__clang__)
   static void test_get_caller (const void *from);
@@ -85,14 +91,16 @@ static void        wstrace_printf (bool first_line,
  *     Do NOT add a trailing `".~0\n"`; it's done in this macro.
  *
  *   If `"g_cfg.trace_caller == 0"` or `"WSAStartup"` is in the
- *   `exclude_list` smartlist, the `!exclude_list_get("WSAStartup...", EXCL_FUNCTION)`
- *   returns `true`.
+ *   `exclude_list` smartlist, the `!exclude_list_get_cached(.., "WSAStartup...", EXCL_FUNCTION)`
+ *   returns `true`. The lookup is done once for each use of this macro.
  */
 #define WSTRACE(fmt, ...)                                        \
         do {                                                     \
+          static exclude_cache _ex_cache;                        \
           exclude_this = true;                                   \
           if (g_cfg.trace_level > 0 &&                           \
-              !exclude_list_get (fmt, EXCL_FUNCTION))            \
+              !exclude_list_get_cached (&_ex_cache, fmt,         \
+                                        EXCL_FUNCTION))          \
           {                                                      \
             exclude_this = false;                                \
             wstrace_printf (true, "~1* ~3%s%s~5%s ~1",           \
@@ -105,6 +113,20 @@ static void        wstrace_printf (bool first_line,
           ts_now = NULL;                                         \
         } while (0)
 
+/**
+ * \def EXCLUDE_THIS()
+ *   Set `exclude_this` for a hook that does the tracing itself.
+ *   Like in `WSTRACE()`, the `exclude_list` lookup of `func` is
+ *   done once for each use of this macro.
+ */
+#define EXCLUDE_THIS(func)                                       \
+        do {                                                     \
+          static exclude_cache _ex_cache;                        \
+          exclude_this = (g_cfg.trace_level == 0 ||              \
+                          exclude_list_get_cached (&_ex_cache,   \
+                                       func, EXCL_FUNCTION));    \
+        } while (0)
+
 #if defined(__clang__)
   #define GET_RET_ADDR()  (ULONG_PTR)__builtin_return_address (0)
 #else
@@ -610,6 +632,101 @@ static void wstrace_printf (bool first_line, const char *fmt, ...)
   SetLastError (err);  /* restore error status */
 }
 
+/**
+ * With `g_cfg.trace_binary`, write a `TRACE_BIN_CALL` record instead of the
+ * `WSTRACE()` and `dump_data()` in `recv()`, `recvfrom()`, `send()` and `sendto()`.
+ * The `caller` must be found in the hook itself.
+ */
+static void wstrace_bin (trace_bin_func func, const char *caller, SOCKET s,
+                         const char *buf, int buf_len, int flags, int rc,
+                         const struct sockaddr *addr, int addr_len, unsigned dump_len)
+{
+  trace_bin_call call;
+
+  memset (&call, '\0', sizeof(call));
+  call.time    = get_timestamp_raw();
+  call.sock    = (uint64_t) s;
+  call.buf     = (uint64_t) (UINT_PTR) buf;
+  call.tid     = GetCurrentThreadId();
+  call.buf_len = buf_len;
+  call.flags   = flags;
+  call.rc      = rc;
+  call.error   = (rc < 0) ? (*g_data.WSAGetLastError)() : 0;
+
+  if (g_cfg.max_data > 0)
+  {
+    call.data_total = dump_len;
+    call.data_len   = min (dump_len, (unsigned)g_cfg.max_data);
+  }
+
+  /* Copy only what `INET_addr_sockaddr()` would look at.
+   */
+  if (addr && addr->sa_family == AF_INET)
+       call.addr_len = sizeof(struct sockaddr_in);
+  else if (addr && addr->sa_family == AF_INET6)
+       call.addr_len = sizeof(struct sockaddr_in6);
+  else if (addr)
+       call.addr_len = (addr_len > 0) ? (uint16_t) min (addr_len, (int)sizeof(struct sockaddr_storage)) :
+                                        sizeof(struct sockaddr);
+
+  call.caller_len = (uint16_t) min (strlen(caller), USHRT_MAX);
+  trace_bin_write (func, &call, caller, addr, buf);
+  ts_now = NULL;
+}
+
+/**
+ * Render a `TRACE_BIN_CALL` record in `ws_tool decode`.
+ * This must print exactly what the `WSTRACE()` and `dump_data()` in
+ * `recv()`, `recvfrom()`, `send()` and `sendto()` does.
+ */
+void wstrace_bin_render (trace_bin_func func, const trace_bin_call *call,
+                         const char *caller, const struct sockaddr *addr,
+                         const void *data, int ptr_size)
+{
+  const char *sock  = socket_number ((SOCKET)call->sock);
+  const char *flags = socket_flags (call->flags);
+  char        tid [30] = "";
+  char        ptr [30];
+  char        res [150];
+
+  if (g_cfg.show_tid)
+     snprintf (tid, sizeof(tid), "tid: %lu%c ", (unsigned long)call->tid,
+               (g_cfg.trace_time_format == TS_NONE) ? ':' : ',');
+
+  /* Print the buffer-address as `"0x%p"` does in the traced program.
+   */
+  snprintf (ptr, sizeof(ptr), "0x%0*I64X", 2*ptr_size, call->buf);
+
+  if (call->rc >= 0)
+       snprintf (res, sizeof(res), "%d bytes", call->rc);
+  else ws_strerror (call->error, res, sizeof(res));
+
+  wstrace_printf (true, "~1* ~3%s%s~5%s ~1", tid, get_timestamp_str(call->time), caller);
+
+  switch (func)
+  {
+    case TRACE_BIN_RECV:
+         wstrace_printf (false, "recv (%s, %s, %d, %s) --> %s.~0\n",
+                         sock, ptr, call->buf_len, flags, res);
+         break;
+    case TRACE_BIN_RECVFROM:
+         wstrace_printf (false, "recvfrom (%s, %s, %d, %s, %s) --> %s.~0\n",
+                         sock, ptr, call->buf_len, flags, INET_addr_sockaddr(addr), res);
+         break;
+    case TRACE_BIN_SEND:
+         wstrace_printf (false, "send (%s, %s, %d, %s) --> %s.~0\n",
+                         sock, ptr, call->buf_len, flags, res);
+         break;
+    case TRACE_BIN_SENDTO:
+         wstrace_printf (false, "sendto (%s, %s, %d, %s, %s) --> %s.~0\n",
+                         sock, ptr, call->buf_len, flags, INET_addr_sockaddr(addr), res);
+         break;
+  }
+
+  if (call->data_total > 0)
+     dump_data (data, call->data_total);
+}
+
 /**
  * Save and restore WSA error-state:
  * \param[in]  pop  if = 0: return value from `WSAGetLastError()`.
@@ -1099,7 +1216,7 @@ BOOL WINAPI WSAConnectByNameA (SOCKET                s,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSAConnectByNameA", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSAConnectByNameA");
   if (!exclude_this)
   {
     if (!tv)
@@ -1144,7 +1261,7 @@ BOOL WINAPI WSAConnectByNameW (SOCKET               s,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSAConnectByNameW", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSAConnectByNameW");
   if (!exclude_this)
   {
     if (!tv)
@@ -1188,7 +1305,7 @@ BOOL WINAPI WSAConnectByList (SOCKET                s,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSAConnectByList", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSAConnectByList");
   if (!exclude_this)
   {
     if (!tv)
@@ -1335,19 +1452,7 @@ SOCKET WINAPI WSAAccept (SOCKET s, struct sockaddr *addr, int *addr_len,
            condition, (const void*)callback_data, socket_or_error(rc));
 
   if (!exclude_this)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (addr);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (addr);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (addr);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (addr);
-  }
+     dump_annotations_sockaddr (addr);
 
   LEAVE_CRIT (!exclude_this);
   return (rc);
@@ -1401,19 +1506,7 @@ SOCKET WINAPI accept (SOCKET s, struct sockaddr *addr, int *addr_len)
            socket_or_error(rc));
 
   if (!exclude_this)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (addr);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (addr);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (addr);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (addr);
-  }
+     dump_annotations_sockaddr (addr);
 
   LEAVE_CRIT (!exclude_this);
   return (rc);
@@ -1440,19 +1533,7 @@ int WINAPI bind (SOCKET s, const struct sockaddr *addr, int addr_len)
   }
 
   if (!exclude_this)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (addr);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (addr);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (addr);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (addr);
-  }
+     dump_annotations_sockaddr (addr);
 
   LEAVE_CRIT (!exclude_this);
   return (rc);
@@ -1461,6 +1542,7 @@ int WINAPI bind (SOCKET s, const struct sockaddr *addr, int addr_len)
 int WINAPI closesocket (SOCKET s)
 {
   TCP_INFO_v0 info;
+  sock_info   si;
   int  rc, rc2 = -1;
   int  protocol = -1;
 
@@ -1486,7 +1568,8 @@ int WINAPI closesocket (SOCKET s)
   WSTRACE ("closesocket (%s) --> %s", socket_number(s), get_error(rc, 0));
 
   overlap_remove (s);
-  sock_list_remove (s);
+  if (sock_list_remove(s, &si) && !exclude_this && g_cfg.trace_level >= 3)
+     dump_sock_info (&si);
 
   if (g_cfg.dump_tcpinfo && rc2 != -1)
      dump_tcp_info_v0 (&info, rc2);
@@ -1534,17 +1617,7 @@ int WINAPI connect (SOCKET s, const struct sockaddr *addr, int addr_len)
   {
     WSAERROR_PUSH();
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (addr);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (addr);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (addr);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (addr);
+    dump_annotations_sockaddr (addr);
 
 #if 0
     /**\todo store the address in a connect cache-file with above 'geo-ip', IANA and ASN information.
@@ -1600,7 +1673,7 @@ int WINAPI select (int nfds, fd_set *rd_fd, fd_set *wr_fd, fd_set *ex_fd, const
 
   /* Set the global and local 'exclude_this' values
    */
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("select", EXCL_FUNCTION));
+  EXCLUDE_THIS ("select");
   _exclude_this = exclude_this;
 
   if (!_exclude_this)
@@ -1751,13 +1824,17 @@ int WINAPI recv (SOCKET s, char *buf, int buf_len, int flags)
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("recv", EXCL_FUNCTION));
+  EXCLUDE_THIS ("recv");
 
   if (rc >= 0)
   {
     if (flags & MSG_PEEK)
-         g_data.counts.recv_peeked += rc;
-    else g_data.counts.recv_bytes  += rc;
+       g_data.counts.recv_peeked += rc;
+    else
+    {
+      g_data.counts.recv_bytes += rc;
+      sock_list_count (s, rc, 0);
+    }
   }
   else
     g_data.counts.recv_errors++;
@@ -1766,15 +1843,22 @@ int WINAPI recv (SOCKET s, char *buf, int buf_len, int flags)
   {
     char res[100];
 
-    if (rc >= 0)
-        sprintf (res, "%d bytes", rc);
-    else strcpy (res, get_error(rc, 0));
+    if (g_cfg.trace_binary)
+       wstrace_bin (TRACE_BIN_RECV, get_caller(GET_RET_ADDR(), get_EBP()),
+                    s, buf, buf_len, flags, rc, NULL, 0,
+                    (rc > 0 && g_cfg.dump_data) ? rc : 0);
+    else
+    {
+      if (rc >= 0)
+           sprintf (res, "%d bytes", rc);
+      else strcpy (res, get_error(rc, 0));
 
-    WSTRACE ("recv (%s, 0x%p, %d, %s) --> %s",
-             socket_number(s), buf, buf_len, socket_flags(flags), res);
+      WSTRACE ("recv (%s, 0x%p, %d, %s) --> %s",
+               socket_number(s), buf, buf_len, socket_flags(flags), res);
 
-    if (rc > 0 && g_cfg.dump_data)
-       dump_data (buf, rc);
+      if (rc > 0 && g_cfg.dump_data)
+         dump_data (buf, rc);
+    }
   }
 
   if (g_cfg.PCAP.enable && rc > 0 && !(flags & MSG_PEEK))
@@ -1797,13 +1881,17 @@ int WINAPI recvfrom (SOCKET s, char *buf, int buf_len, int flags, struct sockadd
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("recvfrom", EXCL_FUNCTION));
+  EXCLUDE_THIS ("recvfrom");
 
   if (rc >= 0)
   {
     if (flags & MSG_PEEK)
-         g_data.counts.recv_peeked += rc;
-    else g_data.counts.recv_bytes  += rc;
+       g_data.counts.recv_peeked += rc;
+    else
+    {
+      g_data.counts.recv_bytes += rc;
+      sock_list_count (s, rc, 0);
+    }
   }
   else
     g_data.counts.recv_errors++;
@@ -1812,33 +1900,28 @@ int WINAPI recvfrom (SOCKET s, char *buf, int buf_len, int flags, struct sockadd
   {
     char res[100];
 
-    if (rc >= 0)
-       sprintf (res, "%d bytes", rc);
+    if (rc < 0 && (*g_data.WSAGetLastError)() == WSAEWOULDBLOCK)
+       g_data.counts.recv_EWOULDBLOCK++;
+
+    if (g_cfg.trace_binary)
+       wstrace_bin (TRACE_BIN_RECVFROM, get_caller(GET_RET_ADDR(), get_EBP()),
+                    s, buf, buf_len, flags, rc, from, from_len ? *from_len : 0,
+                    (rc > 0 && g_cfg.dump_data) ? rc : 0);
     else
     {
-      strcpy (res, get_error(rc, 0));
-      if ((*g_data.WSAGetLastError)() == WSAEWOULDBLOCK)
-         g_data.counts.recv_EWOULDBLOCK++;
-    }
-
-    WSTRACE ("recvfrom (%s, 0x%p, %d, %s, %s) --> %s",
-             socket_number(s), buf, buf_len, socket_flags(flags),
-             INET_addr_sockaddr(from), res);
-
-    if (rc > 0 && g_cfg.dump_data)
-       dump_data (buf, rc);
+      if (rc >= 0)
+           sprintf (res, "%d bytes", rc);
+      else strcpy (res, get_error(rc, 0));
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (from);
+      WSTRACE ("recvfrom (%s, 0x%p, %d, %s, %s) --> %s",
+               socket_number(s), buf, buf_len, socket_flags(flags),
+               INET_addr_sockaddr(from), res);
 
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (from);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (from);
+      if (rc > 0 && g_cfg.dump_data)
+         dump_data (buf, rc);
+    }
 
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (from);
+    dump_annotations_sockaddr (from);
   }
 
   if (g_cfg.PCAP.enable && rc > 0 && !(flags & MSG_PEEK))
@@ -1861,25 +1944,36 @@ int WINAPI send (SOCKET s, const char *buf, int buf_len, int flags)
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("send", EXCL_FUNCTION));
+  EXCLUDE_THIS ("send");
 
   if (rc >= 0)
-       g_data.counts.send_bytes += rc;
-  else g_data.counts.send_errors++;
+  {
+    g_data.counts.send_bytes += rc;
+    sock_list_count (s, 0, rc);
+  }
+  else
+    g_data.counts.send_errors++;
 
   if (!exclude_this)
   {
     char res[100];
 
-    if (rc >= 0)
-         sprintf (res, "%d bytes", rc);
-    else strcpy (res, get_error(rc, 0));
+    if (g_cfg.trace_binary)
+       wstrace_bin (TRACE_BIN_SEND, get_caller(GET_RET_ADDR(), get_EBP()),
+                    s, buf, buf_len, flags, rc, NULL, 0,
+                    g_cfg.dump_data ? buf_len : 0);
+    else
+    {
+      if (rc >= 0)
+           sprintf (res, "%d bytes", rc);
+      else strcpy (res, get_error(rc, 0));
 
-    WSTRACE ("send (%s, 0x%p, %d, %s) --> %s",
-             socket_number(s), buf, buf_len, socket_flags(flags), res);
+      WSTRACE ("send (%s, 0x%p, %d, %s) --> %s",
+               socket_number(s), buf, buf_len, socket_flags(flags), res);
 
-    if (g_cfg.dump_data)
-       dump_data (buf, buf_len);
+      if (g_cfg.dump_data)
+         dump_data (buf, buf_len);
+    }
   }
 
   if (g_cfg.PCAP.enable && rc > 0)
@@ -1902,32 +1996,39 @@ int WINAPI sendto (SOCKET s, const char *buf, int buf_len, int flags, const stru
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("sendto", EXCL_FUNCTION));
+  EXCLUDE_THIS ("sendto");
 
   if (rc >= 0)
-       g_data.counts.send_bytes += rc;
-  else g_data.counts.send_errors++;
+  {
+    g_data.counts.send_bytes += rc;
+    sock_list_count (s, 0, rc);
+  }
+  else
+    g_data.counts.send_errors++;
 
   if (!exclude_this)
   {
     char res[100];
 
-    if (rc >= 0)
-         sprintf (res, "%d bytes", rc);
-    else strcpy (res, get_error(rc, 0));
-
-    WSTRACE ("sendto (%s, 0x%p, %d, %s, %s) --> %s",
-             socket_number(s), buf, buf_len, socket_flags(flags),
-             INET_addr_sockaddr(to), res);
+    if (g_cfg.trace_binary)
+       wstrace_bin (TRACE_BIN_SENDTO, get_caller(GET_RET_ADDR(), get_EBP()),
+                    s, buf, buf_len, flags, rc, to, to_len,
+                    g_cfg.dump_data ? buf_len : 0);
+    else
+    {
+      if (rc >= 0)
+           sprintf (res, "%d bytes", rc);
+      else strcpy (res, get_error(rc, 0));
 
-    if (g_cfg.dump_data)
-       dump_data (buf, buf_len);
+      WSTRACE ("sendto (%s, 0x%p, %d, %s, %s) --> %s",
+               socket_number(s), buf, buf_len, socket_flags(flags),
+               INET_addr_sockaddr(to), res);
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (to);
+      if (g_cfg.dump_data)
+         dump_data (buf, buf_len);
+    }
 
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (to);
+    dump_annotations_sockaddr (to);
   }
 
   if (g_cfg.PCAP.enable && rc > 0)
@@ -1968,16 +2069,16 @@ static void handle_recv_overlapped (SOCKET s, const WSAOVERLAPPED *ov, DWORD *si
 {
   DWORD transferred;
 
-  if (!ov)
-     g_data.counts.recv_bytes += *size;
-
-  else if (overlap_transferred(s, ov, &transferred))
+  if (ov && !overlap_transferred(s, ov, &transferred))
   {
-    *size = transferred;
-    g_data.counts.recv_bytes += *size;
-  }
-  else
     *size = 0;  /* Unknown due to  WSA_IO_PENDING */
+    return;
+  }
+  if (ov)
+     *size = transferred;
+
+  g_data.counts.recv_bytes += *size;
+  sock_list_count (s, *size, 0);
 }
 
 /**
@@ -1991,13 +2092,7 @@ static void handle_recv_data (int rc, const WSABUF *bufs, DWORD num_bufs, const
      dump_wsabuf (bufs, num_bufs);
 
   if (from && (*g_data.WSAGetLastError)() != WSA_IO_PENDING)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (from);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (from);
-  }
+     dump_annotations_sockaddr (from);
 
   if (*ov_trace)
   {
@@ -2018,7 +2113,7 @@ int WINAPI WSARecv (SOCKET s, WSABUF *bufs, DWORD num_bufs, DWORD *num_bytes,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSARecv", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSARecv");
   size = bufs->len * num_bufs;
 
   if (rc == NO_ERROR)
@@ -2068,7 +2163,7 @@ int WINAPI WSARecvFrom (SOCKET s, WSABUF *bufs, DWORD num_bufs, DWORD *num_bytes
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSARecvFrom", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSARecvFrom");
   size = bufs->len * num_bufs;
 
   if (rc == NO_ERROR)
@@ -2116,11 +2211,15 @@ int WINAPI WSARecvEx (SOCKET s, char *buf, int buf_len, int *flags)
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSARecvEx", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSARecvEx");
 
   if (rc >= 0)
-       g_data.counts.recv_bytes += rc;
-  else g_data.counts.recv_errors++;
+  {
+    g_data.counts.recv_bytes += rc;
+    sock_list_count (s, rc, 0);
+  }
+  else
+    g_data.counts.recv_errors++;
 
   if (!exclude_this)
   {
@@ -2184,13 +2283,16 @@ int WINAPI WSASend (SOCKET s, WSABUF *bufs, DWORD num_bufs, DWORD *num_bytes,
 
   if (rc == NO_ERROR)
   {
-    /* If the transfer is overlapped this counter should be
+    /* If the transfer is overlapped these counters should be
      * updated in 'WSAGetOverlappedResult()'
      */
-    g_data.counts.send_bytes += count_wsabuf (bufs, num_bufs);
+    DWORD bytes = count_wsabuf (bufs, num_bufs);
+
+    g_data.counts.send_bytes += bytes;
+    sock_list_count (s, 0, bytes);
   }
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSASend", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSASend");
 
   if (!exclude_this)
   {
@@ -2238,13 +2340,16 @@ int WINAPI WSASendTo (SOCKET s, WSABUF *bufs, DWORD num_bufs, DWORD *num_bytes,
 
   if (rc == NO_ERROR)
   {
-    /* If the transfer is overlapped this counter should be
+    /* If the transfer is overlapped these counters should be
      * updated in 'WSAGetOverlappedResult()'
      */
-    g_data.counts.send_bytes += count_wsabuf (bufs, num_bufs);
+    DWORD bytes = count_wsabuf (bufs, num_bufs);
+
+    g_data.counts.send_bytes += bytes;
+    sock_list_count (s, 0, bytes);
   }
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSASendTo", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSASendTo");
 
   if (!exclude_this)
   {
@@ -2264,17 +2369,7 @@ int WINAPI WSASendTo (SOCKET s, WSABUF *bufs, DWORD num_bufs, DWORD *num_bytes,
     if (g_cfg.dump_data)
        dump_wsabuf (bufs, num_bufs);
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (to);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (to);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (to);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (to);
+    dump_annotations_sockaddr (to);
 
     if (ov)
        overlap_store (s, ov, count_wsabuf(bufs, num_bufs), false);
@@ -2301,7 +2396,7 @@ int WINAPI WSASendMsg (SOCKET s, WSAMSG *msg, DWORD flags, DWORD *num_bytes,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSASendMsg", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSASendMsg");
 
   if (!exclude_this)
   {
@@ -2597,7 +2692,7 @@ int WINAPI WSAPoll (LPWSAPOLLFD fd_array, ULONG fds, int timeout_ms)
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSAPoll", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSAPoll");
 
   if (!exclude_this)
   {
@@ -2689,7 +2784,7 @@ DWORD WINAPI WSAWaitForMultipleEvents (DWORD           num_ev,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("WSAWaitForMultipleEvents", EXCL_FUNCTION));
+  EXCLUDE_THIS ("WSAWaitForMultipleEvents");
 
   if (!exclude_this)
   {
@@ -2718,10 +2813,21 @@ DWORD WINAPI WSAWaitForMultipleEvents (DWORD           num_ev,
              num_ev, ev, wait_all ? "TRUE" : "FALSE",
              time, alertable ? "" : "not ", err);
 
-    /* Update all sockets with overlapped operations that matches this event.
+    /* Update all sockets with overlapped operations that matches the
+     * signalled event. Or all the events if 'wait_all'.
      */
     if (rc < (WSA_WAIT_EVENT_0 + num_ev))
-       overlap_recall_all (ev);
+    {
+      if (wait_all)
+      {
+        DWORD i;
+
+        for (i = 0; i < num_ev; i++)
+            overlap_recall_all (ev[i]);
+      }
+      else
+        overlap_recall_all (ev [rc - WSA_WAIT_EVENT_0]);
+    }
   }
 
   LEAVE_CRIT (!exclude_this);
@@ -3093,19 +3199,7 @@ int WINAPI getpeername (SOCKET s, struct sockaddr *name, int *name_len)
            socket_number(s), INET_addr_sockaddr(name), get_error(rc, 0));
 
   if (!exclude_this)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (name);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (name);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (name);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (name);
-  }
+     dump_annotations_sockaddr (name);
 
   LEAVE_CRIT (!exclude_this);
   return (rc);
@@ -3129,19 +3223,7 @@ int WINAPI getsockname (SOCKET s, struct sockaddr *name, int *name_len)
            socket_number(s), sa, get_error(rc, 0));
 
   if (!exclude_this)
-  {
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (name);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (name);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (name);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (name);
-  }
+     dump_annotations_sockaddr (name);
 
   LEAVE_CRIT (!exclude_this);
   return (rc);
@@ -3206,17 +3288,7 @@ int WINAPI getnameinfo (const struct sockaddr *sa, socklen_t sa_len,
     if (rc == 0 && g_cfg.dump_nameinfo)
        dump_nameinfo (host, serv_buf, flags);
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (sa);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (sa);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (sa);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (sa);
+    dump_annotations_sockaddr (sa);
   }
 
   LEAVE_CRIT (!exclude_this);
@@ -3237,7 +3309,7 @@ int WINAPI getaddrinfo (const char *host_name, const char *serv_name,
 
   ENTER_CRIT();
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("getaddrinfo", EXCL_FUNCTION));
+  EXCLUDE_THIS ("getaddrinfo");
   if (!host_name || !(g_cfg.IDNA.enable && g_cfg.IDNA.fix_getaddrinfo))
      exclude_this = true;
 
@@ -3329,7 +3401,7 @@ INT WINAPI GetAddrInfoW (const wchar_t *host_name, const wchar_t *serv_name,
 
   rc = (*p_GetAddrInfoW) (host_name, serv_name, hints, res);
 
-  exclude_this = (g_cfg.trace_level == 0 || exclude_list_get("GetAddrInfoW", EXCL_FUNCTION));
+  EXCLUDE_THIS ("GetAddrInfoW");
 
   /* 'exclude_this' set once more inside the 'WSTRACE()' macro.
    */
@@ -3390,17 +3462,7 @@ INT WINAPI GetNameInfoW (const SOCKADDR *sa,
     if (rc == 0 && g_cfg.dump_nameinfo)
        dump_nameinfow (host, serv_buf, flags);
 
-    if (g_cfg.GEOIP.enable)
-       dump_countries_sockaddr (sa);
-
-    if (g_cfg.IANA.enable)
-       dump_IANA_sockaddr (sa);
-
-    if (g_cfg.ASN.enable)
-       dump_ASN_sockaddr (sa);
-
-    if (g_cfg.DNSBL.enable)
-       dump_DNSBL_sockaddr (sa);
+    dump_annotations_sockaddr (sa);
   }
 
   LEAVE_CRIT (!exclude_this);
@@ -3573,10 +3635,29 @@ static const char *get_threadid (bool add_space)
   return (buf);
 }
 
+/**
+ * Return the formatted caller of the traced function.
+ * The string for an address is looked up in the `caller_cache` first.
+ * If not found, it is resolved by `StackWalkShow()` and added.
+ */
+static const char *get_caller_frame (HANDLE thr, CONTEXT *ctx, ULONG_PTR addr)
+{
+  const char *ret = caller_cache_get (addr);
+  const char *cached;
+
+  if (ret)
+     return (ret);
+
+  REG_EIP (ctx) = addr;
+  ret = StackWalkShow (thr, ctx);
+  cached = caller_cache_add (addr, ret);
+  return (cached ? cached : ret);
+}
+
 static const char *get_caller (ULONG_PTR ret_addr, ULONG_PTR ebp)
 {
-  static int reentry = 0;
-  char  *ret = NULL;
+  static int  reentry = 0;
+  const char *ret = NULL;
 
   WSAERROR_PUSH();
 
@@ -3629,26 +3710,26 @@ static const char *get_caller (ULONG_PTR ret_addr, ULONG_PTR ebp)
      * (for MSVC/PDB files) should be at frames[2]. For gcc, the RtlCaptureStackBackTrace()
      * doesn't work. I've had to use __builtin_return_addres(0) (='ret_addr').
      */
-    REG_EIP (&ctx) = ret_addr;
     REG_EBP (&ctx) = ebp;
-    ret = StackWalkShow (thr, &ctx);
+    ret = get_caller_frame (thr, &ctx, ret_addr);
 
     if (g_cfg.callee_level > 1 && num_frames > 2 && frames[3])
     {
-      char *a, *b;
-      int   indent = 16;
-
-      REG_EIP (&ctx) = (ULONG_PTR) frames [3];
-      a = strdup (ret);
-      b = strdup (StackWalkShow (thr, &ctx));
+      static char buf [2500];
+      int    indent = 16;
+      size_t len;
 
       if (g_cfg.trace_time_usec)
          indent += 3;
       if (g_cfg.show_tid)
          indent += (int) strlen (get_threadid(true)) - 1;  /* just need it's length */
 
-      ret = malloc (strlen(a) + strlen(b) + indent + 3);
-      sprintf (ret, "%s\n%*s%s", a, indent, "", b);
+      /* Copy the 1st frame before the next 'StackWalkShow()' could overwrite it.
+       */
+      snprintf (buf, sizeof(buf), "%s\n%*s", ret, indent, "");
+      len = strlen (buf);
+      str_ncpy (buf + len, get_caller_frame(thr, &ctx, (ULONG_PTR)frames[3]), sizeof(buf) - len);
+      ret = buf;
     }
   }
 
@@ -3795,6 +3876,12 @@ BOOL WINAPI DllMain (HINSTANCE instDLL, DWORD reason, LPVOID reserved)
     else TRACE (2, "rc: %d, %s. instDLL: 0x%" ADDR_FMT ", tid: %lu, g_data.ws_sema_inherited: %d.\n",
                 rc, reason_str, ADDR_CAST(instDLL), tid, g_data.ws_sema_inherited);
   }
+
+  /* This thread will not trace anything more.
+   */
+  if (reason == DLL_THREAD_DETACH)
+     C_async_thread_exit();
+
   ARGSUSED (reserved);
   return (rc);
 }